@@ -70,6 +70,10 @@ void ::Murmur::${class}I::${func}_async('. join(", ", @{$wrapargs}).qq') {
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_${class}_${func}
+	if (snapshot_${class}_${func}(' . join(", ", @${callargs}).qq'))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_${class}_$func, ' . join(", ", @${callargs}).qq'));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -90,6 +90,7 @@ void Channel::link(Channel *l) {
 	qhLinks[l]++;
 	l->qsPermLinks.insert(this);
 	l->qhLinks[this]++;
+	updateLinkComponent();
 }
 
 void Channel::unlink(Channel *l) {
@@ -98,6 +99,9 @@ void Channel::unlink(Channel *l) {
 		qhLinks.remove(l);
 		l->qsPermLinks.remove(this);
 		l->qhLinks.remove(this);
+		// The component may have split in two.
+		updateLinkComponent();
+		l->updateLinkComponent();
 	} else {
 		foreach(Channel *c, qhLinks.keys())
 			unlink(c);
@@ -125,6 +129,22 @@ QSet<Channel *> Channel::allLinks() {
 	return seen;
 }
 
+QSet<Channel *> Channel::linkComponent() const {
+	QSet<Channel *> component = qlLinkComponent.toSet();
+	component.insert(const_cast<Channel *>(this));
+	return component;
+}
+
+void Channel::updateLinkComponent() {
+	const QSet<Channel *> component = allLinks();
+
+	QList<Channel *> list;
+	if (component.count() > 1)
+		list = component.toList();
+	foreach(Channel *c, component)
+		c->qlLinkComponent = list;
+}
+
 QSet<Channel *> Channel::allChildren() {
 	QSet<Channel *> seen;
 	if (! qlChannels.isEmpty()) {
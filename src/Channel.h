@@ -40,6 +40,11 @@ class Channel : public QObject {
 
 		QSet<Channel *> qsPermLinks;
 		QHash<Channel *, int> qhLinks;
+		/// All channels linked to this one, directly or through other
+		/// channels, including this one. Maintained by link() and unlink(),
+		/// and shared by all channels of the component. Empty if the
+		/// channel has no links.
+		QList<Channel *> qlLinkComponent;
 
 		bool bInheritACL;
 
@@ -81,6 +86,10 @@ class Channel : public QObject {
 		void unlink(Channel *c = NULL);
 
 		QSet<Channel *> allLinks();
+		/// Like allLinks(), but read from qlLinkComponent instead of
+		/// walking the link graph. Always contains this channel.
+		QSet<Channel *> linkComponent() const;
+		void updateLinkComponent();
 		QSet<Channel *> allChildren();
 
 		operator QString() const;
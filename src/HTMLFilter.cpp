@@ -7,42 +7,410 @@
 
 #include "HTMLFilter.h"
 
-QString HTMLFilter::escapeTags(const QString &in) {
-	QString out;
-	for (int i = 0; i < in.size(); i++) {
-		if (in.at(i) == QLatin1Char('<')) {
-			out += QLatin1String("&lt;");
-		} else if (in.at(i) == QLatin1Char('>')) {
-			out += QLatin1String("&gt;");
-		} else {
-			out += in.at(i);
+/// HTMLScanner tokenizes a HTML document in a single pass.
+///
+/// It accepts the same well-formed XML fragments that a QXmlStreamReader
+/// accepts when the document is wrapped in a <document> element, but it
+/// works on the characters of the input directly. Apart from the names
+/// of the currently open elements it keeps no state, so scanning a message
+/// never copies it, no matter how large its embedded images are.
+class HTMLScanner {
+	private:
+		Q_DISABLE_COPY(HTMLScanner)
+	public:
+		enum Token { Invalid, End, Characters, CData, StartElement, EndElement, Skipped };
+
+		/// Start and length of the raw text of a Characters or CData token,
+		/// or of the element name of a StartElement or EndElement token.
+		int iStart, iLength;
+		/// Combined length of the src attribute values of an <img> StartElement.
+		int iSrcLength;
+
+		HTMLScanner(const QString &in);
+		Token next();
+
+		QStringRef name() const;
+		/// Decodes the entity reference at pos, and advances pos past it.
+		/// Returns false if it is not a valid reference.
+		bool entity(int &pos, uint &ucs4) const;
+	protected:
+		const QString &qsIn;
+		const QChar *d;
+		int iSize;
+		int iPos;
+		/// Set after an empty element tag, to report its EndElement next.
+		bool bPendingEnd;
+		QVector<QPair<int, int> > qvOpen;
+
+		ushort at(int pos) const;
+		bool lookingAt(int pos, const char *str) const;
+		bool skipSpace();
+		bool scanName(int &start, int &length);
+		bool scanAttribute(QVarLengthArray<QPair<int, int>, 8> &names, bool img);
+		bool sameName(const QPair<int, int> &a, const QPair<int, int> &b) const;
+		Token scanStartElement();
+		Token scanEndElement();
+		Token scanMarkup(const char *open, const char *close, Token token);
+		Token scanProcessingInstruction();
+};
+
+static bool isXmlChar(uint u) {
+	return (u == 0x9) || (u == 0xa) || (u == 0xd) || ((u >= 0x20) && (u <= 0xd7ff)) || ((u >= 0xe000) && (u <= 0xfffd)) || ((u >= 0x10000) && (u <= 0x10ffff));
+}
+
+static bool isXmlSpace(ushort u) {
+	return (u == ' ') || (u == '\t') || (u == '\n') || (u == '\r');
+}
+
+static bool isNameStartChar(ushort u) {
+	return ((u >= 'a') && (u <= 'z')) || ((u >= 'A') && (u <= 'Z')) || (u == '_') || (u == ':') || (u >= 0xc0);
+}
+
+static bool isNameChar(ushort u) {
+	return isNameStartChar(u) || ((u >= '0') && (u <= '9')) || (u == '-') || (u == '.') || (u == 0xb7);
+}
+
+HTMLScanner::HTMLScanner(const QString &in) : iStart(0), iLength(0), iSrcLength(0), qsIn(in), d(in.constData()), iSize(in.size()), iPos(0), bPendingEnd(false) {
+}
+
+ushort HTMLScanner::at(int pos) const {
+	return (pos < iSize) ? d[pos].unicode() : 0;
+}
+
+bool HTMLScanner::lookingAt(int pos, const char *str) const {
+	for (; *str; ++str, ++pos)
+		if (at(pos) != static_cast<ushort>(*str))
+			return false;
+	return true;
+}
+
+QStringRef HTMLScanner::name() const {
+	return QStringRef(&qsIn, iStart, iLength);
+}
+
+bool HTMLScanner::skipSpace() {
+	int start = iPos;
+	while (isXmlSpace(at(iPos)))
+		++iPos;
+	return iPos != start;
+}
+
+bool HTMLScanner::scanName(int &start, int &length) {
+	start = iPos;
+	if (! isNameStartChar(at(iPos)))
+		return false;
+	while (isNameChar(at(iPos)))
+		++iPos;
+	length = iPos - start;
+	return true;
+}
+
+bool HTMLScanner::sameName(const QPair<int, int> &a, const QPair<int, int> &b) const {
+	return QStringRef(&qsIn, a.first, a.second) == QStringRef(&qsIn, b.first, b.second);
+}
+
+bool HTMLScanner::entity(int &pos, uint &ucs4) const {
+	int end = pos + 1;
+	while ((end < iSize) && (end - pos <= 32) && (d[end] != QLatin1Char(';')))
+		++end;
+	if (at(end) != ';')
+		return false;
+
+	const QStringRef ref(&qsIn, pos + 1, end - pos - 1);
+	if (ref == QLatin1String("amp")) {
+		ucs4 = '&';
+	} else if (ref == QLatin1String("lt")) {
+		ucs4 = '<';
+	} else if (ref == QLatin1String("gt")) {
+		ucs4 = '>';
+	} else if (ref == QLatin1String("quot")) {
+		ucs4 = '"';
+	} else if (ref == QLatin1String("apos")) {
+		ucs4 = '\'';
+	} else if ((ref.size() >= 2) && (ref.at(0) == QLatin1Char('#'))) {
+		bool hex = (ref.at(1) == QLatin1Char('x'));
+		int i = hex ? 2 : 1;
+		if (i == ref.size())
+			return false;
+
+		ucs4 = 0;
+		for (; i < ref.size(); ++i) {
+			ushort c = ref.at(i).unicode();
+			uint digit;
+			if ((c >= '0') && (c <= '9'))
+				digit = c - '0';
+			else if (hex && (c >= 'a') && (c <= 'f'))
+				digit = c - 'a' + 10;
+			else if (hex && (c >= 'A') && (c <= 'F'))
+				digit = c - 'A' + 10;
+			else
+				return false;
+			ucs4 = ucs4 * (hex ? 16 : 10) + digit;
+			if (ucs4 > 0x10ffff)
+				return false;
+		}
+		if (! isXmlChar(ucs4))
+			return false;
+	} else {
+		return false;
+	}
+
+	pos = end + 1;
+	return true;
+}
+
+HTMLScanner::Token HTMLScanner::next() {
+	iSrcLength = 0;
+
+	if (bPendingEnd) {
+		bPendingEnd = false;
+		return EndElement;
+	}
+
+	if (iPos >= iSize)
+		return qvOpen.isEmpty() ? End : Invalid;
+
+	if (at(iPos) != '<') {
+		iStart = iPos;
+		while ((iPos < iSize) && (at(iPos) != '<')) {
+			ushort u = at(iPos);
+			if (u == '&') {
+				uint ucs4;
+				if (! entity(iPos, ucs4))
+					return Invalid;
+				continue;
+			}
+			if ((u < 0x20) && ! isXmlSpace(u))
+				return Invalid;
+			if ((u == ']') && lookingAt(iPos, "]]>"))
+				return Invalid;
+			++iPos;
+		}
+		iLength = iPos - iStart;
+		return Characters;
+	}
+
+	switch (at(iPos + 1)) {
+		case '/':
+			return scanEndElement();
+		case '?':
+			return scanProcessingInstruction();
+		case '!':
+			if (lookingAt(iPos, "<!--"))
+				return scanMarkup("<!--", "--", Skipped);
+			if (lookingAt(iPos, "<![CDATA["))
+				return scanMarkup("<![CDATA[", "]]>", CData);
+			// No document type declarations inside of an element.
+			return Invalid;
+		default:
+			return scanStartElement();
+	}
+}
+
+HTMLScanner::Token HTMLScanner::scanMarkup(const char *open, const char *close, Token token) {
+	iStart = iPos + static_cast<int>(qstrlen(open));
+	int end = qsIn.indexOf(QLatin1String(close), iStart);
+	if (end < 0)
+		return Invalid;
+
+	iLength = end - iStart;
+	iPos = end + static_cast<int>(qstrlen(close));
+
+	// "--" must not occur within a comment, so it has to be the end of it.
+	if (token == Skipped) {
+		if (at(iPos) != '>')
+			return Invalid;
+		++iPos;
+	}
+	return token;
+}
+
+HTMLScanner::Token HTMLScanner::scanProcessingInstruction() {
+	iPos += 2;
+
+	int start, length;
+	if (! scanName(start, length))
+		return Invalid;
+	// The XML declaration is only allowed at the start of a document.
+	if (QStringRef(&qsIn, start, length).compare(QLatin1String("xml"), Qt::CaseInsensitive) == 0)
+		return Invalid;
+
+	int end = qsIn.indexOf(QLatin1String("?>"), iPos);
+	if (end < 0)
+		return Invalid;
+	iPos = end + 2;
+	return Skipped;
+}
+
+HTMLScanner::Token HTMLScanner::scanEndElement() {
+	iPos += 2;
+	if (! scanName(iStart, iLength))
+		return Invalid;
+	skipSpace();
+	if (at(iPos) != '>')
+		return Invalid;
+	++iPos;
+
+	if (qvOpen.isEmpty() || ! sameName(qvOpen.last(), qMakePair(iStart, iLength)))
+		return Invalid;
+	qvOpen.pop_back();
+	return EndElement;
+}
+
+HTMLScanner::Token HTMLScanner::scanStartElement() {
+	++iPos;
+	if (! scanName(iStart, iLength))
+		return Invalid;
+
+	const bool img = (name() == QLatin1String("img"));
+	QVarLengthArray<QPair<int, int>, 8> names;
+
+	forever {
+		bool space = skipSpace();
+		if (at(iPos) == '>') {
+			++iPos;
+			qvOpen.append(qMakePair(iStart, iLength));
+			return StartElement;
+		}
+		if ((at(iPos) == '/') && (at(iPos + 1) == '>')) {
+			iPos += 2;
+			bPendingEnd = true;
+			return StartElement;
+		}
+		if (! space || ! scanAttribute(names, img))
+			return Invalid;
+	}
+}
+
+bool HTMLScanner::scanAttribute(QVarLengthArray<QPair<int, int>, 8> &names, bool img) {
+	QPair<int, int> attr;
+	if (! scanName(attr.first, attr.second))
+		return false;
+	for (int i = 0; i < names.size(); ++i)
+		if (sameName(names.at(i), attr))
+			return false;
+	names.append(attr);
+
+	skipSpace();
+	if (at(iPos) != '=')
+		return false;
+	++iPos;
+	skipSpace();
+
+	const ushort quote = at(iPos);
+	if ((quote != '"') && (quote != '\''))
+		return false;
+	++iPos;
+
+	const int start = iPos;
+	forever {
+		ushort u = at(iPos);
+		if (u == quote)
+			break;
+		if ((u == '<') || (iPos >= iSize))
+			return false;
+		if (u == '&') {
+			uint ucs4;
+			if (! entity(iPos, ucs4))
+				return false;
+			continue;
 		}
+		if ((u < 0x20) && ! isXmlSpace(u))
+			return false;
+		++iPos;
+	}
+
+	if (img && (QStringRef(&qsIn, attr.first, attr.second) == QLatin1String("src")))
+		iSrcLength += iPos - start;
+
+	++iPos;
+	return true;
+}
+
+/// Appends a single character of text to out, collapsing whitespace the
+/// same way QString::simplified() does and escaping the characters of
+/// tags.
+static void appendSimplified(QString &out, bool &space, uint ucs4) {
+	if ((ucs4 < 0x10000) && QChar(static_cast<ushort>(ucs4)).isSpace()) {
+		space = true;
+		return;
+	}
+
+	if (space && ! out.isEmpty())
+		out += QLatin1Char(' ');
+	space = false;
+
+	if (ucs4 == '<') {
+		out += QLatin1String("&lt;");
+	} else if (ucs4 == '>') {
+		out += QLatin1String("&gt;");
+	} else if (ucs4 >= 0x10000) {
+		out += QChar(QChar::highSurrogate(ucs4));
+		out += QChar(QChar::lowSurrogate(ucs4));
+	} else {
+		out += QChar(static_cast<ushort>(ucs4));
 	}
-	return out;
 }
 
 bool HTMLFilter::filter(const QString &in, QString &out) {
 	if (! in.contains(QLatin1Char('<'))) {
 		out = in.simplified();
-	} else {
-		QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(in));
-		QString qs;
-		while (! qxsr.atEnd()) {
-			switch (qxsr.readNext()) {
-				case QXmlStreamReader::Invalid:
-					return false;
-				case QXmlStreamReader::Characters:
-					qs += qxsr.text();
-					break;
-				case QXmlStreamReader::EndElement:
-					if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
-						qs += QLatin1Char('\n');
-					break;
-				default:
-					break;
-			}
+		return true;
+	}
+
+	QString qs;
+	qs.reserve(in.size());
+	bool space = false;
+
+	HTMLScanner scanner(in);
+	forever {
+		switch (scanner.next()) {
+			case HTMLScanner::Invalid:
+				return false;
+			case HTMLScanner::End:
+				out = qs;
+				return true;
+			case HTMLScanner::Characters: {
+					const int end = scanner.iStart + scanner.iLength;
+					for (int i = scanner.iStart; i < end;) {
+						uint ucs4 = in.at(i).unicode();
+						if (ucs4 == '&')
+							scanner.entity(i, ucs4);
+						else
+							++i;
+						appendSimplified(qs, space, ucs4);
+					}
+				}
+				break;
+			case HTMLScanner::CData:
+				for (int i = scanner.iStart; i < scanner.iStart + scanner.iLength; ++i)
+					appendSimplified(qs, space, in.at(i).unicode());
+				break;
+			case HTMLScanner::EndElement:
+				if ((scanner.name() == QLatin1String("br")) || (scanner.name() == QLatin1String("p")))
+					space = true;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+int HTMLFilter::textLength(const QString &in) {
+	int length = in.size();
+
+	HTMLScanner scanner(in);
+	forever {
+		switch (scanner.next()) {
+			case HTMLScanner::Invalid:
+				return -1;
+			case HTMLScanner::End:
+				return length;
+			case HTMLScanner::StartElement:
+				length -= scanner.iSrcLength;
+				break;
+			default:
+				break;
 		}
-		out = escapeTags(qs.simplified());
 	}
-	return true;
 }
@@ -17,10 +17,6 @@
 /// to plain text when a server is
 /// configured to disallow HTML. 
 class HTMLFilter {
-		/// escapeTags returns the in HTML document
-		/// with all occurrences of > and <
-		/// replaced by &lt; and &gt;.
-		static QString escapeTags(const QString &in);
 	public:
 		/// filter does a best-effort conversion of the
 		/// in HTML document to a plain-text representation.
@@ -32,6 +28,14 @@ class HTMLFilter {
 		/// If the filtering failed, the function returns false
 		/// and out is left unchanged.	
 		static bool filter(const QString &in, QString &out);
+
+		/// textLength returns the length of the in HTML
+		/// document, not counting the values of the src
+		/// attributes of its <img> elements.
+		///
+		/// If the document is not well-formed, the function
+		/// returns -1.
+		static int textLength(const QString &in);
 };
 
 #endif
@@ -0,0 +1,245 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "mumble_pch.hpp"
+
+#include "AudioBenchmark.h"
+
+#include "ClientUser.h"
+#include "Global.h"
+#include "Message.h"
+#include "PacketDataStream.h"
+
+#ifdef USE_OPUS
+#include "opus.h"
+#endif
+
+// Length of the discarded warm-up period, to let the jitter buffers settle.
+#define AUDIOBENCHMARK_WARMUP_USEC 1000000ULL
+// Voice packets carry 20ms of audio, i.e. two 10ms frames of sequence numbers.
+#define AUDIOBENCHMARK_PACKET_USEC 20000ULL
+#define AUDIOBENCHMARK_PACKET_SAMPLES (SAMPLE_RATE / 50)
+
+AudioBenchmark::AudioBenchmark(unsigned int users, unsigned int seconds, QObject *p)
+	: QObject(p)
+	, uiUsers(users)
+	, uiSeconds(seconds)
+	, qtTick(NULL)
+	, tElapsed(false)
+	, uiMeasureStart(0)
+	, uiFramesSent(0)
+	, bMeasuring(false) {
+}
+
+AudioBenchmark::~AudioBenchmark() {
+	foreach(const Speaker &s, qlSpeakers)
+		ClientUser::remove(s.cuUser);
+}
+
+bool AudioBenchmark::parseArgument(const QString &arg, unsigned int &users, unsigned int &seconds) {
+	const QStringList parts = arg.split(QLatin1Char(':'));
+	if (parts.count() > 2)
+		return false;
+
+	bool ok;
+	users = parts.at(0).toUInt(&ok);
+	if (! ok || users == 0)
+		return false;
+
+	if (parts.count() == 2) {
+		seconds = parts.at(1).toUInt(&ok);
+		if (! ok || seconds == 0)
+			return false;
+	}
+	return true;
+}
+
+void AudioBenchmark::configure(Settings &s) {
+	// Talk all the time so the encoder runs on every frame.
+	s.atTransmit = Settings::Continuous;
+	s.lmLoopMode = Settings::None;
+	s.bTxAudioCue = false;
+	s.bUpdateCheck = false;
+	s.bPluginCheck = false;
+}
+
+void AudioBenchmark::start() {
+	// A ServerHandler that never connects. It's only used for its
+	// voice packet entry point.
+	shHandler = ServerHandlerPtr(new ServerHandler());
+
+	for (unsigned int i = 0; i < uiUsers; ++i) {
+		Speaker s;
+		s.cuUser = ClientUser::add(i + 1, this);
+		s.cuUser->qsName = QString::fromLatin1("Speaker %1").arg(i + 1);
+		s.iFrame = 0;
+		s.uiSeq = 0;
+
+#ifdef USE_OPUS
+		int err = 0;
+		OpusEncoder *enc = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &err);
+		if (! enc) {
+			qWarning("AudioBenchmark: Failed to create Opus encoder: %d", err);
+			break;
+		}
+		opus_encoder_ctl(enc, OPUS_SET_BITRATE(40000));
+
+		// Give every speaker its own pitch, so the decoders don't all see identical input.
+		const float step = 2.0f * static_cast<float>(M_PI) * (150.0f + 10.0f * static_cast<float>(i % 50)) / static_cast<float>(SAMPLE_RATE);
+		float phase = 0.0f;
+		opus_int16 pcm[AUDIOBENCHMARK_PACKET_SAMPLES];
+		unsigned char packet[1024];
+
+		for (int f = 0; f < 50; ++f) {
+			for (int j = 0; j < AUDIOBENCHMARK_PACKET_SAMPLES; ++j) {
+				pcm[j] = static_cast<opus_int16>(8000.0f * sinf(phase));
+				phase += step;
+			}
+			const int len = opus_encode(enc, pcm, AUDIOBENCHMARK_PACKET_SAMPLES, packet, static_cast<opus_int32>(sizeof(packet)));
+			if (len > 0)
+				s.qlFrames << QByteArray(reinterpret_cast<const char *>(packet), len);
+		}
+
+		opus_encoder_destroy(enc);
+#endif
+
+		qlSpeakers << s;
+	}
+
+#ifndef USE_OPUS
+	qWarning("AudioBenchmark: Built without Opus support, no remote speakers will be simulated.");
+#endif
+
+	printf("Audio benchmark: %u speakers, %u seconds (plus %llu ms warm-up)\n", uiUsers, uiSeconds, AUDIOBENCHMARK_WARMUP_USEC / 1000ULL);
+	fflush(stdout);
+
+	qtTick = new QTimer(this);
+#if QT_VERSION >= 0x050000
+	qtTick->setTimerType(Qt::PreciseTimer);
+#endif
+	connect(qtTick, SIGNAL(timeout()), this, SLOT(tick()));
+	qtTick->start(5);
+	tElapsed.restart();
+}
+
+void AudioBenchmark::sendFrame(Speaker &s) {
+	if (s.qlFrames.isEmpty())
+		return;
+
+	const QByteArray &frame = s.qlFrames.at(s.iFrame);
+	s.iFrame = (s.iFrame + 1) % s.qlFrames.count();
+
+	// Same layout as a decrypted UDP voice packet, minus the header byte.
+	char buffer[1024];
+	PacketDataStream pds(buffer, sizeof(buffer));
+	pds << s.cuUser->uiSession;
+	pds << s.uiSeq;
+	pds << static_cast<unsigned int>(frame.size());
+	pds.append(frame.constData(), frame.size());
+
+	s.uiSeq += static_cast<unsigned int>(AUDIOBENCHMARK_PACKET_USEC / 10000ULL);
+
+	PacketDataStream in(buffer, pds.size());
+
+	const quint64 cpu = NullAudioTimings::threadCpuUsec();
+	Timer t;
+	shHandler->handleVoicePacket(0, in, MessageHandler::UDPVoiceOpus);
+	natReceive.add(t.elapsed(), NullAudioTimings::threadCpuUsec() - cpu);
+}
+
+void AudioBenchmark::tick() {
+	const quint64 now = tElapsed.elapsed();
+
+	// Send whatever is due, so a late timer doesn't skew the packet rate.
+	while (uiFramesSent * AUDIOBENCHMARK_PACKET_USEC <= now) {
+		for (int i = 0; i < qlSpeakers.count(); ++i)
+			sendFrame(qlSpeakers[i]);
+		++uiFramesSent;
+	}
+
+	if (! bMeasuring) {
+		if (now < AUDIOBENCHMARK_WARMUP_USEC)
+			return;
+
+		quint64 cpu;
+		natReceive.take(cpu);
+
+		AudioInputPtr ai = g.ai;
+		NullInput *ni = qobject_cast<NullInput *>(ai.get());
+		if (ni)
+			ni->natTimings.take(cpu);
+
+		AudioOutputPtr ao = g.ao;
+		NullOutput *no = qobject_cast<NullOutput *>(ao.get());
+		if (no)
+			no->natTimings.take(cpu);
+
+		uiMeasureStart = now;
+		bMeasuring = true;
+		return;
+	}
+
+	if (now - uiMeasureStart >= uiSeconds * 1000000ULL) {
+		qtTick->stop();
+		report(now - uiMeasureStart);
+		qApp->quit();
+	}
+}
+
+void AudioBenchmark::report(quint64 wallUsec) {
+	quint64 cpu;
+	QVector<quint64> times;
+
+	AudioOutputPtr ao = g.ao;
+	NullOutput *no = qobject_cast<NullOutput *>(ao.get());
+	if (no) {
+		times = no->natTimings.take(cpu);
+		printTimings("mix", times, cpu, wallUsec, uiUsers);
+	} else {
+		printf("mix: Null audio output not active\n");
+	}
+
+	times = natReceive.take(cpu);
+	printTimings("receive", times, cpu, wallUsec, uiUsers);
+
+	AudioInputPtr ai = g.ai;
+	NullInput *ni = qobject_cast<NullInput *>(ai.get());
+	if (ni) {
+		times = ni->natTimings.take(cpu);
+		printTimings("capture", times, cpu, wallUsec, 0);
+	} else {
+		printf("capture: Null audio input not active\n");
+	}
+
+	fflush(stdout);
+}
+
+void AudioBenchmark::printTimings(const char *name, QVector<quint64> times, quint64 cpuUsec, quint64 wallUsec, unsigned int users) {
+	if (times.isEmpty()) {
+		printf("%s: no callbacks\n", name);
+		return;
+	}
+
+	qSort(times);
+
+	const int n = times.count();
+	quint64 sum = 0;
+	foreach(quint64 t, times)
+		sum += t;
+
+	printf("%s: %d calls, mean %llu us, p50 %llu us, p90 %llu us, p99 %llu us, max %llu us\n",
+	       name, n,
+	       static_cast<unsigned long long>(sum / static_cast<quint64>(n)),
+	       static_cast<unsigned long long>(times.at((n - 1) * 50 / 100)),
+	       static_cast<unsigned long long>(times.at((n - 1) * 90 / 100)),
+	       static_cast<unsigned long long>(times.at((n - 1) * 99 / 100)),
+	       static_cast<unsigned long long>(times.at(n - 1)));
+
+	const double cpuPercent = 100.0 * static_cast<double>(cpuUsec) / static_cast<double>(wallUsec);
+	if (users > 0)
+		printf("%s: CPU %.2f%% total, %.3f%% per speaker\n", name, cpuPercent, cpuPercent / static_cast<double>(users));
+	else
+		printf("%s: CPU %.2f%% total\n", name, cpuPercent);
+}
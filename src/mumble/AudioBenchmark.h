@@ -0,0 +1,79 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MUMBLE_AUDIOBENCHMARK_H_
+#define MUMBLE_MUMBLE_AUDIOBENCHMARK_H_
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QVector>
+#include <QtCore/QByteArray>
+
+#include "NullAudio.h"
+#include "ServerHandler.h"
+#include "Timer.h"
+
+class ClientUser;
+class QTimer;
+struct Settings;
+
+/// Headless benchmark of the client voice pipeline.
+///
+/// Runs the regular client with the Null audio backend and feeds
+/// synthetic Opus streams from a number of fake users through
+/// ServerHandler::handleVoicePacket(), the jitter buffers, the decoders
+/// and AudioOutput::mix(). The Null input simultaneously drives
+/// AudioInput::addMic() through preprocessing and encoding.
+///
+/// After the requested run time, per-callback latency percentiles and
+/// CPU usage are printed to stdout and the application quits.
+///
+/// Started with "mumble --audio-benchmark <users>[:<seconds>]". On
+/// machines without a display, set QT_QPA_PLATFORM=offscreen.
+class AudioBenchmark : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(AudioBenchmark)
+	protected:
+		struct Speaker {
+			ClientUser *cuUser;
+			/// One second of pre-encoded 20ms Opus packets, played in a loop.
+			QList<QByteArray> qlFrames;
+			int iFrame;
+			unsigned int uiSeq;
+		};
+
+		unsigned int uiUsers;
+		unsigned int uiSeconds;
+		ServerHandlerPtr shHandler;
+		QList<Speaker> qlSpeakers;
+		QTimer *qtTick;
+		Timer tElapsed;
+		/// Start of the measurement, after the warm-up second.
+		quint64 uiMeasureStart;
+		quint64 uiFramesSent;
+		bool bMeasuring;
+		/// Time spent in handleVoicePacket(), i.e. the jitter buffer insert.
+		NullAudioTimings natReceive;
+
+		void sendFrame(Speaker &s);
+		void report(quint64 wallUsec);
+		static void printTimings(const char *name, QVector<quint64> times, quint64 cpuUsec, quint64 wallUsec, unsigned int users);
+	public:
+		AudioBenchmark(unsigned int users, unsigned int seconds, QObject *p = NULL);
+		~AudioBenchmark() Q_DECL_OVERRIDE;
+
+		/// Parses the "<users>[:<seconds>]" argument of --audio-benchmark.
+		static bool parseArgument(const QString &arg, unsigned int &users, unsigned int &seconds);
+		/// Adjusts the loaded settings for an unattended run. The settings
+		/// must not be saved afterwards.
+		static void configure(Settings &s);
+
+		void start();
+	public slots:
+		void tick();
+};
+
+#endif
@@ -975,8 +975,23 @@ static void sendAudioFrame(const char *data, PacketDataStream &pds) {
 	ServerHandlerPtr sh = g.sh;
 	if (sh) {
 		VoiceRecorderPtr recorder(sh->recorder);
-		if (recorder)
-			recorder->getRecordUser().addFrame(QByteArray(data, pds.size() + 1));
+		if (recorder) {
+			if (recorder->isInPacketMode()) {
+				PacketDataStream rpds(data, pds.size() + 1);
+				const unsigned int msgFlags = static_cast<unsigned int>(rpds.next());
+				unsigned int iSeq;
+				rpds >> iSeq;
+
+				QByteArray qba;
+				qba.reserve(rpds.left() + 1);
+				qba.append(static_cast<char>(msgFlags));
+				qba.append(rpds.dataBlock(rpds.left()));
+
+				recorder->addPacket(&recorder->getRecordUser(), iSeq, qba);
+			} else {
+				recorder->getRecordUser().addFrame(QByteArray(data, pds.size() + 1));
+			}
+		}
 	}
 
 	if (g.s.lmLoopMode == Settings::Local)
@@ -365,6 +365,11 @@ bool AudioOutput::mix(void *outbuff, unsigned int nsamp) {
 	VoiceRecorderPtr recorder;
 	if (sh) {
 		recorder = g.sh->recorder;
+
+		// In packet mode the recorder stores the received packets directly
+		// and doesn't need any decoded audio from the mixer.
+		if (recorder && recorder->isInPacketMode())
+			recorder.reset();
 	}
 
 	qrwlOutputs.lockForRead();
@@ -0,0 +1,216 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "mumble_pch.hpp"
+
+#include "NullAudio.h"
+
+#ifndef Q_OS_WIN
+#include <time.h>
+#endif
+
+#include "Timer.h"
+#include "Global.h"
+
+// Never pick the Null backend on our own; it has to be asked for by name.
+#define NULLAUDIO_PRIORITY -100
+
+class NullInputRegistrar : public AudioInputRegistrar {
+	public:
+		NullInputRegistrar();
+		virtual AudioInput *create();
+		virtual const QList<audioDevice> getDeviceChoices();
+		virtual void setDeviceChoice(const QVariant &, Settings &);
+		virtual bool canEcho(const QString &) const;
+};
+
+class NullOutputRegistrar : public AudioOutputRegistrar {
+	public:
+		NullOutputRegistrar();
+		virtual AudioOutput *create();
+		virtual const QList<audioDevice> getDeviceChoices();
+		virtual void setDeviceChoice(const QVariant &, Settings &);
+};
+
+static NullInputRegistrar airNull;
+static NullOutputRegistrar aorNull;
+
+NullInputRegistrar::NullInputRegistrar() : AudioInputRegistrar(QLatin1String("Null"), NULLAUDIO_PRIORITY) {
+}
+
+AudioInput *NullInputRegistrar::create() {
+	return new NullInput();
+}
+
+const QList<audioDevice> NullInputRegistrar::getDeviceChoices() {
+	QList<audioDevice> qlReturn;
+	qlReturn << audioDevice(QLatin1String("Null"), QString());
+	return qlReturn;
+}
+
+void NullInputRegistrar::setDeviceChoice(const QVariant &, Settings &) {
+}
+
+bool NullInputRegistrar::canEcho(const QString &) const {
+	return false;
+}
+
+NullOutputRegistrar::NullOutputRegistrar() : AudioOutputRegistrar(QLatin1String("Null"), NULLAUDIO_PRIORITY) {
+}
+
+AudioOutput *NullOutputRegistrar::create() {
+	return new NullOutput();
+}
+
+const QList<audioDevice> NullOutputRegistrar::getDeviceChoices() {
+	QList<audioDevice> qlReturn;
+	qlReturn << audioDevice(QLatin1String("Null"), QString());
+	return qlReturn;
+}
+
+void NullOutputRegistrar::setDeviceChoice(const QVariant &, Settings &) {
+}
+
+NullAudioTimings::NullAudioTimings() : uiCpuUsec(0) {
+}
+
+void NullAudioTimings::add(quint64 wallUsec, quint64 cpuUsec) {
+	QMutexLocker qml(&qmTimings);
+	qvWallUsec.append(wallUsec);
+	uiCpuUsec += cpuUsec;
+}
+
+QVector<quint64> NullAudioTimings::take(quint64 &cpuUsec) {
+	QMutexLocker qml(&qmTimings);
+	QVector<quint64> qv = qvWallUsec;
+	qvWallUsec.clear();
+	cpuUsec = uiCpuUsec;
+	uiCpuUsec = 0;
+	return qv;
+}
+
+quint64 NullAudioTimings::threadCpuUsec() {
+#if defined(Q_OS_WIN)
+	FILETIME ftCreation, ftExit, ftKernel, ftUser;
+	if (! GetThreadTimes(GetCurrentThread(), &ftCreation, &ftExit, &ftKernel, &ftUser))
+		return 0;
+	const quint64 kernel = (static_cast<quint64>(ftKernel.dwHighDateTime) << 32) | ftKernel.dwLowDateTime;
+	const quint64 user = (static_cast<quint64>(ftUser.dwHighDateTime) << 32) | ftUser.dwLowDateTime;
+	// FILETIME is in 100ns units.
+	return (kernel + user) / 10ULL;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return static_cast<quint64>(ts.tv_sec) * 1000000ULL + static_cast<quint64>(ts.tv_nsec) / 1000ULL;
+#else
+	return 0;
+#endif
+}
+
+NullInput::NullInput() {
+	bRunning = true;
+}
+
+NullInput::~NullInput() {
+	bRunning = false;
+	wait();
+}
+
+void NullInput::run() {
+	iMicChannels = 1;
+	iMicFreq = SAMPLE_RATE;
+	eMicFormat = SampleShort;
+	initializeMixer();
+
+	qWarning("NullInput: Starting synthetic audio capture");
+
+	QVector<short> buffer(static_cast<int>(iMicLength * iMicChannels));
+
+	// A 300Hz tone is well inside the speech band, so the preprocessor
+	// and the encoder have real work to do.
+	const float step = 2.0f * static_cast<float>(M_PI) * 300.0f / static_cast<float>(iMicFreq);
+	float phase = 0.0f;
+
+	const quint64 period = (static_cast<quint64>(iMicLength) * 1000000ULL) / iMicFreq;
+	quint64 deadline = 0;
+	Timer t;
+
+	while (bRunning) {
+		for (int i = 0; i < buffer.size(); ++i) {
+			buffer[i] = static_cast<short>(8000.0f * sinf(phase));
+			phase += step;
+			if (phase > 2.0f * static_cast<float>(M_PI))
+				phase -= 2.0f * static_cast<float>(M_PI);
+		}
+
+		const quint64 cpu = NullAudioTimings::threadCpuUsec();
+		const quint64 start = t.elapsed();
+		addMic(buffer.constData(), iMicLength);
+		natTimings.add(t.elapsed() - start, NullAudioTimings::threadCpuUsec() - cpu);
+
+		deadline += period;
+		const quint64 now = t.elapsed();
+		if (deadline > now)
+			usleep(static_cast<unsigned long>(deadline - now));
+		else if (now - deadline > 20 * period)
+			deadline = now; // Don't try to catch up after a long stall.
+	}
+
+	qWarning("NullInput: Releasing.");
+}
+
+NullOutput::NullOutput() {
+	bRunning = true;
+
+	qWarning("NullOutput: Initialized");
+}
+
+NullOutput::~NullOutput() {
+	bRunning = false;
+	// Call destructor of all children
+	wipe();
+	// Wait for terminate
+	wait();
+	qWarning("NullOutput: Destroyed");
+}
+
+void NullOutput::run() {
+	const unsigned int chanmasks[32] = {
+		SPEAKER_FRONT_LEFT,
+		SPEAKER_FRONT_RIGHT
+	};
+
+	iChannels = g.s.doPositionalAudio() ? 2 : 1;
+	iMixerFreq = SAMPLE_RATE;
+	eSampleFormat = SampleShort;
+
+	initializeMixer(chanmasks);
+
+	qWarning("NullOutput: Starting playback to nowhere");
+
+	const unsigned int iOutputBlock = (iFrameSize * iMixerFreq) / SAMPLE_RATE;
+	QVector<short> mbuffer(static_cast<int>(iOutputBlock * iChannels));
+
+	const quint64 period = (static_cast<quint64>(iOutputBlock) * 1000000ULL) / iMixerFreq;
+	quint64 deadline = 0;
+	Timer t;
+
+	while (bRunning) {
+		const quint64 cpu = NullAudioTimings::threadCpuUsec();
+		const quint64 start = t.elapsed();
+		mix(mbuffer.data(), iOutputBlock);
+		natTimings.add(t.elapsed() - start, NullAudioTimings::threadCpuUsec() - cpu);
+
+		deadline += period;
+		const quint64 now = t.elapsed();
+		if (deadline > now)
+			usleep(static_cast<unsigned long>(deadline - now));
+		else if (now - deadline > 20 * period)
+			deadline = now; // Don't try to catch up after a long stall.
+	}
+
+	qWarning("NullOutput: Releasing");
+}
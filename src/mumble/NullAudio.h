@@ -0,0 +1,64 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MUMBLE_NULLAUDIO_H_
+#define MUMBLE_MUMBLE_NULLAUDIO_H_
+
+#include "AudioInput.h"
+#include "AudioOutput.h"
+
+/// Wall clock and CPU time spent in the audio callbacks of the
+/// Null backend. Filled by the audio thread, drained by whoever
+/// is interested in the numbers (e.g. AudioBenchmark).
+class NullAudioTimings {
+	private:
+		Q_DISABLE_COPY(NullAudioTimings)
+	protected:
+		QMutex qmTimings;
+		QVector<quint64> qvWallUsec;
+		quint64 uiCpuUsec;
+	public:
+		NullAudioTimings();
+		void add(quint64 wallUsec, quint64 cpuUsec);
+		/// Returns the recorded per-callback wall clock durations and the
+		/// accumulated thread CPU time, then starts over.
+		QVector<quint64> take(quint64 &cpuUsec);
+
+		/// CPU time consumed by the calling thread, in microseconds.
+		/// Returns 0 where per-thread CPU accounting is unavailable.
+		static quint64 threadCpuUsec();
+};
+
+/// Audio input that doesn't talk to any hardware. It feeds a synthetic
+/// signal into addMic() at real-time pace, which drives the whole
+/// preprocess and encode chain exactly like a sound card would.
+class NullInput : public AudioInput {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(NullInput)
+	public:
+		NullAudioTimings natTimings;
+
+		NullInput();
+		~NullInput() Q_DECL_OVERRIDE;
+		void run() Q_DECL_OVERRIDE;
+};
+
+/// Audio output that discards everything it mixes. Callbacks happen
+/// at real-time pace so the jitter buffers behave as they would with
+/// a sound card attached.
+class NullOutput : public AudioOutput {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(NullOutput)
+	public:
+		NullAudioTimings natTimings;
+
+		NullOutput();
+		~NullOutput() Q_DECL_OVERRIDE;
+		void run() Q_DECL_OVERRIDE;
+};
+
+#endif
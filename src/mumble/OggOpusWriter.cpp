@@ -0,0 +1,241 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "mumble_pch.hpp"
+
+#include "OggOpusWriter.h"
+
+// Flush a page once it covers this many samples (1 second at 48kHz).
+#define OGGOPUS_PAGE_SAMPLES 48000
+#define OGGOPUS_MAX_SEGMENTS 255
+
+// A mono 20ms CELT frame that decodes to digital silence.
+static const char oggopus_silence_frame[] = { static_cast<char>(0xf8), static_cast<char>(0xff), static_cast<char>(0xfe) };
+
+static void appendLE16(QByteArray &qba, quint16 v) {
+	qba.append(static_cast<char>(v & 0xff));
+	qba.append(static_cast<char>((v >> 8) & 0xff));
+}
+
+static void appendLE32(QByteArray &qba, quint32 v) {
+	for (int i = 0; i < 4; ++i)
+		qba.append(static_cast<char>((v >> (i * 8)) & 0xff));
+}
+
+static void appendLE64(QByteArray &qba, quint64 v) {
+	for (int i = 0; i < 8; ++i)
+		qba.append(static_cast<char>((v >> (i * 8)) & 0xff));
+}
+
+static int laceCount(int len) {
+	return len / 255 + 1;
+}
+
+OggOpusWriter::OggOpusWriter(QIODevice *device, quint32 serial)
+	: qiodDevice(device)
+	, uiSerial(serial)
+	, uiPageSequence(0)
+	, uiGranule(0)
+	, bFinished(false)
+	, iPendingSegments(0)
+	, iPendingSamples(0) {
+}
+
+OggOpusWriter::~OggOpusWriter() {
+	if (! bFinished)
+		finish();
+}
+
+bool OggOpusWriter::writeHeaders(const QStringList &comments) {
+	// RFC 7845, section 5.1
+	QByteArray head("OpusHead");
+	head.append(static_cast<char>(1)); // Version
+	head.append(static_cast<char>(1)); // Channel count
+	appendLE16(head, 0); // Pre-skip. The packets come from unknown encoders, don't guess.
+	appendLE32(head, 48000); // Input sample rate
+	appendLE16(head, 0); // Output gain
+	head.append(static_cast<char>(0)); // Channel mapping family
+
+	if (! writePage(QList<QByteArray>() << head, 0, 0x02))
+		return false;
+
+	// RFC 7845, section 5.2
+	QByteArray tags("OpusTags");
+	const QByteArray vendor("Mumble");
+	appendLE32(tags, static_cast<quint32>(vendor.size()));
+	tags.append(vendor);
+	appendLE32(tags, static_cast<quint32>(comments.count()));
+	foreach(const QString &comment, comments) {
+		const QByteArray utf8 = comment.toUtf8();
+		appendLE32(tags, static_cast<quint32>(utf8.size()));
+		tags.append(utf8);
+	}
+
+	return writePage(QList<QByteArray>() << tags, 0, 0x00);
+}
+
+bool OggOpusWriter::writePacket(const QByteArray &packet, int samples) {
+	if (bFinished || packet.isEmpty() || samples <= 0)
+		return false;
+
+	const int segments = laceCount(packet.size());
+	if (segments > OGGOPUS_MAX_SEGMENTS)
+		return false;
+
+	if (iPendingSegments + segments > OGGOPUS_MAX_SEGMENTS) {
+		if (! flushPage(false))
+			return false;
+	}
+
+	qlPending << packet;
+	iPendingSegments += segments;
+	iPendingSamples += samples;
+	uiGranule += static_cast<quint64>(samples);
+
+	if (iPendingSamples >= OGGOPUS_PAGE_SAMPLES)
+		return flushPage(false);
+
+	return true;
+}
+
+bool OggOpusWriter::writeSilence(int samples) {
+	const QByteArray frame = QByteArray::fromRawData(oggopus_silence_frame, sizeof(oggopus_silence_frame));
+
+	while (samples > 0) {
+		if (! writePacket(frame, 960))
+			return false;
+		samples -= 960;
+	}
+	return true;
+}
+
+bool OggOpusWriter::finish() {
+	if (bFinished)
+		return true;
+
+	bool ok = flushPage(true);
+	bFinished = true;
+	return ok;
+}
+
+quint64 OggOpusWriter::granulePosition() const {
+	return uiGranule;
+}
+
+int OggOpusWriter::packetSamples(const QByteArray &packet) {
+	// RFC 6716, section 3.1
+	if (packet.isEmpty())
+		return -1;
+
+	const unsigned char toc = static_cast<unsigned char>(packet.at(0));
+	const unsigned int config = toc >> 3;
+
+	int frameSamples;
+	if (config < 12) {
+		// SILK-only: 10, 20, 40 or 60ms
+		static const int silk[4] = { 480, 960, 1920, 2880 };
+		frameSamples = silk[config & 0x3];
+	} else if (config < 16) {
+		// Hybrid: 10 or 20ms
+		frameSamples = (config & 0x1) ? 960 : 480;
+	} else {
+		// CELT-only: 2.5, 5, 10 or 20ms
+		static const int celt[4] = { 120, 240, 480, 960 };
+		frameSamples = celt[config & 0x3];
+	}
+
+	int frames;
+	switch (toc & 0x3) {
+		case 0:
+			frames = 1;
+			break;
+		case 1:
+		case 2:
+			frames = 2;
+			break;
+		default:
+			if (packet.size() < 2)
+				return -1;
+			frames = static_cast<unsigned char>(packet.at(1)) & 0x3f;
+			break;
+	}
+
+	const int samples = frames * frameSamples;
+	// An Opus packet may not exceed 120ms.
+	if (samples <= 0 || samples > 5760)
+		return -1;
+	return samples;
+}
+
+bool OggOpusWriter::flushPage(bool eos) {
+	if (qlPending.isEmpty() && ! eos)
+		return true;
+
+	bool ok = writePage(qlPending, uiGranule, eos ? 0x04 : 0x00);
+
+	qlPending.clear();
+	iPendingSegments = 0;
+	iPendingSamples = 0;
+
+	return ok;
+}
+
+bool OggOpusWriter::writePage(const QList<QByteArray> &packets, quint64 granule, unsigned char headerType) {
+	// RFC 3533, section 6
+	QByteArray page("OggS");
+	page.append(static_cast<char>(0)); // Stream structure version
+	page.append(static_cast<char>(headerType));
+	appendLE64(page, granule);
+	appendLE32(page, uiSerial);
+	appendLE32(page, uiPageSequence++);
+	appendLE32(page, 0); // CRC, filled in below
+
+	QByteArray lacing;
+	int bodySize = 0;
+	foreach(const QByteArray &packet, packets) {
+		int len = packet.size();
+		while (len >= 255) {
+			lacing.append(static_cast<char>(255));
+			len -= 255;
+		}
+		lacing.append(static_cast<char>(len));
+		bodySize += packet.size();
+	}
+
+	Q_ASSERT(lacing.size() <= OGGOPUS_MAX_SEGMENTS);
+
+	page.append(static_cast<char>(lacing.size()));
+	page.append(lacing);
+	page.reserve(page.size() + bodySize);
+	foreach(const QByteArray &packet, packets)
+		page.append(packet);
+
+	const quint32 checksum = crc(reinterpret_cast<const unsigned char *>(page.constData()), page.size());
+	for (int i = 0; i < 4; ++i)
+		page[22 + i] = static_cast<char>((checksum >> (i * 8)) & 0xff);
+
+	return qiodDevice->write(page) == page.size();
+}
+
+quint32 OggOpusWriter::crc(const unsigned char *data, int len) {
+	// Ogg uses the unreflected CRC-32 with polynomial 0x04c11db7 and zero initial value.
+	static quint32 table[256];
+	static bool tableInitialized = false;
+
+	if (! tableInitialized) {
+		for (quint32 i = 0; i < 256; ++i) {
+			quint32 r = i << 24;
+			for (int j = 0; j < 8; ++j)
+				r = (r & 0x80000000U) ? ((r << 1) ^ 0x04c11db7U) : (r << 1);
+			table[i] = r;
+		}
+		tableInitialized = true;
+	}
+
+	quint32 c = 0;
+	for (int i = 0; i < len; ++i)
+		c = (c << 8) ^ table[((c >> 24) & 0xff) ^ data[i]];
+	return c;
+}
@@ -0,0 +1,70 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MUMBLE_OGGOPUSWRITER_H_
+#define MUMBLE_MUMBLE_OGGOPUSWRITER_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+class QIODevice;
+
+/// Streaming writer for Ogg encapsulated Opus streams (RFC 7845).
+///
+/// The writer does not encode anything itself. It takes already encoded
+/// Opus packets and wraps them into Ogg pages, which makes it possible to
+/// store received voice packets without decoding and re-encoding them.
+///
+/// Pages are flushed to the device roughly once per second of audio, so
+/// a recording that is interrupted only loses the last partial page.
+class OggOpusWriter {
+	private:
+		Q_DISABLE_COPY(OggOpusWriter)
+	public:
+		/// Creates a writer that writes to |device|, which must already be
+		/// open for writing. The device is not owned by the writer.
+		OggOpusWriter(QIODevice *device, quint32 serial);
+		~OggOpusWriter();
+
+		/// Writes the OpusHead and OpusTags header pages.
+		/// |comments| are written as "KEY=value" user comments.
+		bool writeHeaders(const QStringList &comments);
+
+		/// Appends a single Opus packet which decodes to |samples| samples at 48kHz.
+		bool writePacket(const QByteArray &packet, int samples);
+
+		/// Appends |samples| (rounded up to 20ms frames) of digital silence.
+		bool writeSilence(int samples);
+
+		/// Flushes all pending packets and writes the end-of-stream page.
+		bool finish();
+
+		/// Returns the granule position (48kHz sample count) after the last written packet.
+		quint64 granulePosition() const;
+
+		/// Returns the number of samples in a single Opus packet, or -1 if the packet is invalid.
+		static int packetSamples(const QByteArray &packet);
+	protected:
+		QIODevice *qiodDevice;
+		quint32 uiSerial;
+		quint32 uiPageSequence;
+		quint64 uiGranule;
+		bool bFinished;
+
+		/// Packets that have not yet been written out as part of a page.
+		QList<QByteArray> qlPending;
+		/// Number of lacing values needed for |qlPending|.
+		int iPendingSegments;
+		/// Samples covered by |qlPending|.
+		int iPendingSamples;
+
+		bool flushPage(bool eos);
+		bool writePage(const QList<QByteArray> &packets, quint64 granule, unsigned char headerType);
+		static quint32 crc(const unsigned char *data, int len);
+};
+
+#endif
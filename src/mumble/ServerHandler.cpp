@@ -25,6 +25,7 @@
 #include "HostAddress.h"
 #include "ServerResolver.h"
 #include "ServerResolverRecord.h"
+#include "VoiceRecorder.h"
 
 ServerHandlerMessageEvent::ServerHandlerMessageEvent(const QByteArray &msg, unsigned int mtype, bool flush) : QEvent(static_cast<QEvent::Type>(SERVERSEND_EVENT)) {
 	qbaMsg = msg;
@@ -212,6 +213,11 @@ void ServerHandler::handleVoicePacket(unsigned int msgFlags, PacketDataStream &p
 		qba.reserve(pds.left() + 1);
 		qba.append(static_cast<char>(msgFlags));
 		qba.append(pds.dataBlock(pds.left()));
+
+		VoiceRecorderPtr rec(recorder);
+		if (rec && rec->isInPacketMode())
+			rec->addPacket(p, iSeq, qba);
+
 		ao->addFrameToBuffer(p, qba, iSeq, type);
 	}
 }
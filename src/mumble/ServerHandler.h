@@ -52,6 +52,7 @@ class ServerHandlerMessageEvent : public QEvent {
 typedef boost::shared_ptr<Connection> ConnectionPtr;
 
 class ServerHandler : public QThread {
+		friend class AudioBenchmark;
 	private:
 		Q_OBJECT
 		Q_DISABLE_COPY(ServerHandler)
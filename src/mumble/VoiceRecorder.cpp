@@ -10,6 +10,9 @@
 #include "AudioOutput.h"
 #include "ClientUser.h"
 #include "Global.h"
+#include "Message.h"
+#include "OggOpusWriter.h"
+#include "PacketDataStream.h"
 #include "ServerHandler.h"
 
 #include "../Timer.h"
@@ -28,10 +31,33 @@ VoiceRecorder::RecordBuffer::RecordBuffer(
 	// Nothing
 }
 
+VoiceRecorder::RecordPacket::RecordPacket(
+		int recordInfoIndex_,
+		unsigned int sequence_,
+		quint64 arrivalTime_,
+		const QByteArray &payload_,
+		bool terminator_)
+
+	: recordInfoIndex(recordInfoIndex_)
+	, sequence(sequence_)
+	, arrivalTime(arrivalTime_)
+	, payload(payload_)
+	, terminator(terminator_) {
+
+	// Nothing
+}
+
 VoiceRecorder::RecordInfo::RecordInfo(const QString& userName_)
     : userName(userName_)
     , soundFile(NULL)
-    , lastWrittenAbsoluteSample(0) {
+    , lastWrittenAbsoluteSample(0)
+    , packetFile(NULL)
+    , packetWriter(NULL)
+    , indexFile(NULL)
+    , inTalkSpurt(false)
+    , talkSpurtStartSample(0)
+    , talkSpurtStartSequence(0)
+    , lastSequence(0) {
 }
 
 VoiceRecorder::RecordInfo::~RecordInfo() {
@@ -39,6 +65,14 @@ VoiceRecorder::RecordInfo::~RecordInfo() {
 		// Close libsndfile's handle if we have one.
 		sf_close(soundFile);
 	}
+
+	if (packetWriter) {
+		// Write the end-of-stream page before closing the file.
+		packetWriter->finish();
+		delete packetWriter;
+	}
+	delete packetFile;
+	delete indexFile;
 }
 
 VoiceRecorder::VoiceRecorder(QObject *p, const Config& config)
@@ -228,12 +262,7 @@ SF_INFO VoiceRecorder::createSoundFileInfo() const {
 	return sfinfo;
 }
 
-bool VoiceRecorder::ensureFileIsOpenedFor(SF_INFO& soundFileInfo, boost::shared_ptr<RecordInfo>& ri) {
-	if (ri->soundFile != NULL) {
-		// Nothing to do
-		return true;
-	}
-	
+bool VoiceRecorder::createTargetFileName(boost::shared_ptr<RecordInfo>& ri, QString &fileName) {
 	QString filename = expandTemplateVariables(m_config.fileName, ri->userName);
 
 	// Try to find a unique filename.
@@ -264,6 +293,21 @@ bool VoiceRecorder::ensureFileIsOpenedFor(SF_INFO& soundFileInfo, boost::shared_
 		return false;
 	}
 
+	fileName = filename;
+	return true;
+}
+
+bool VoiceRecorder::ensureFileIsOpenedFor(SF_INFO& soundFileInfo, boost::shared_ptr<RecordInfo>& ri) {
+	if (ri->soundFile != NULL) {
+		// Nothing to do
+		return true;
+	}
+
+	QString filename;
+	if (!createTargetFileName(ri, filename)) {
+		return false;
+	}
+
 #ifdef Q_OS_WIN
 	// This is needed for unicode filenames on Windows.
 	ri->soundFile = sf_wchar_open(filename.toStdWString().c_str(), SFM_WRITE, &soundFileInfo);
@@ -291,13 +335,88 @@ bool VoiceRecorder::ensureFileIsOpenedFor(SF_INFO& soundFileInfo, boost::shared_
 	return true;
 }
 
+bool VoiceRecorder::ensurePacketFileIsOpenedFor(boost::shared_ptr<RecordInfo>& ri) {
+	if (ri->packetWriter != NULL) {
+		// Nothing to do
+		return true;
+	}
+
+	QString filename;
+	if (!createTargetFileName(ri, filename)) {
+		return false;
+	}
+
+	ri->packetFile = new QFile(filename);
+	ri->indexFile = new QFile(filename + QLatin1String(".index"));
+	if (!ri->packetFile->open(QIODevice::WriteOnly) || !ri->indexFile->open(QIODevice::WriteOnly | QIODevice::Text)) {
+		qWarning() << "Failed to open file for recorder: " << ri->packetFile->errorString() << ri->indexFile->errorString();
+		m_recording = false;
+		emit error(CreateFileFailed, tr("Recorder failed to open file '%1'").arg(filename));
+		emit recording_stopped();
+		return false;
+	}
+
+	ri->packetWriter = new OggOpusWriter(ri->packetFile, static_cast<quint32>(qrand()));
+
+	QStringList comments;
+	comments << QString::fromLatin1("TITLE=%1").arg(ri->userName);
+	comments << QString::fromLatin1("DATE=%1").arg(m_recordingStartTime.toString(Qt::ISODate));
+	ri->packetWriter->writeHeaders(comments);
+
+	ri->indexFile->write("# sequence arrival_usec granule_position\n");
+
+	return true;
+}
+
+void VoiceRecorder::writePacket(boost::shared_ptr<RecordInfo>& ri, const RecordPacket &rp) {
+	const int samples = OggOpusWriter::packetSamples(rp.payload);
+	if (samples < 0)
+		return;
+
+	const quint64 written = ri->packetWriter->granulePosition();
+	const quint64 arrivalSample = (rp.arrivalTime * 48ULL) / 1000ULL;
+
+	// Sequence numbers count 10ms frames of the sender. Inside a talk spurt
+	// they place the packet relative to the first packet of the spurt, which
+	// keeps lost packets from shifting the rest of the spurt. A new spurt is
+	// anchored at its arrival time to compensate for clock drift.
+	quint64 target;
+	if (!ri->inTalkSpurt || rp.sequence <= ri->lastSequence) {
+		target = qMax(written, arrivalSample);
+		ri->talkSpurtStartSample = target;
+		ri->talkSpurtStartSequence = rp.sequence;
+	} else {
+		target = ri->talkSpurtStartSample + static_cast<quint64>(rp.sequence - ri->talkSpurtStartSequence) * 480ULL;
+	}
+
+	if (target < written) {
+		// Duplicate or reordered packet; the slot has already been filled.
+		return;
+	}
+
+	const quint64 gap = target - written;
+	if (gap >= 960) {
+		ri->packetWriter->writeSilence(static_cast<int>(gap - (gap % 960)));
+	}
+
+	const quint64 granule = ri->packetWriter->granulePosition();
+	ri->packetWriter->writePacket(rp.payload, samples);
+
+	ri->indexFile->write(QString::fromLatin1("%1 %2 %3\n").arg(rp.sequence).arg(rp.arrivalTime).arg(granule).toLatin1());
+
+	ri->inTalkSpurt = !rp.terminator;
+	ri->lastSequence = rp.sequence;
+}
+
 void VoiceRecorder::run() {
 	Q_ASSERT(!m_recording);
 	
 	if (g.sh && g.sh->uiVersion < 0x010203)
 		return;
 
-	SF_INFO soundFileInfo = createSoundFileInfo();
+	SF_INFO soundFileInfo = {};
+	if (!isInPacketMode())
+		soundFileInfo = createSoundFileInfo();
 	
 	m_recording = true;
 	emit recording_started();
@@ -314,16 +433,17 @@ void VoiceRecorder::run() {
 
 		while (!m_abort && !m_recordBuffer.isEmpty()) {
 			boost::shared_ptr<RecordBuffer> rb;
+			boost::shared_ptr<RecordInfo> ri;
 			{
 				QMutexLocker l(&m_bufferLock);
 				rb = m_recordBuffer.takeFirst();
+
+				Q_ASSERT(m_recordInfo.contains(rb->recordInfoIndex));
+				ri = m_recordInfo.value(rb->recordInfoIndex);
 			}
 			
 			// Create the file for this RecordInfo instance if it's not yet open.
 			
-			Q_ASSERT(m_recordInfo.contains(rb->recordInfoIndex));
-			boost::shared_ptr<RecordInfo> ri = m_recordInfo.value(rb->recordInfoIndex);
-			
 			if (!ensureFileIsOpenedFor(soundFileInfo, ri)) {
 				return;
 			}
@@ -363,6 +483,24 @@ void VoiceRecorder::run() {
 			ri->lastWrittenAbsoluteSample += rb->samples;
 		}
 
+		while (!m_abort && !m_recordPacket.isEmpty()) {
+			boost::shared_ptr<RecordPacket> rp;
+			boost::shared_ptr<RecordInfo> ri;
+			{
+				QMutexLocker l(&m_bufferLock);
+				rp = m_recordPacket.takeFirst();
+
+				Q_ASSERT(m_recordInfo.contains(rp->recordInfoIndex));
+				ri = m_recordInfo.value(rp->recordInfoIndex);
+			}
+
+			if (!ensurePacketFileIsOpenedFor(ri)) {
+				return;
+			}
+
+			writePacket(ri, *rp);
+		}
+
 		m_sleepLock.unlock();
 	}
 	
@@ -371,6 +509,7 @@ void VoiceRecorder::run() {
 		QMutexLocker l(&m_bufferLock);
 		m_recordInfo.clear();
 		m_recordBuffer.clear();
+		m_recordPacket.clear();
 	}
 	
 	emit recording_stopped();
@@ -397,23 +536,13 @@ void VoiceRecorder::addBuffer(const ClientUser *clientUser,
 	
 	Q_ASSERT(!m_config.mixDownMode || clientUser == NULL);
 
-	if (!m_recording)
+	if (!m_recording || isInPacketMode())
 		return;
 	
-	// Create a new RecordInfo object if this is a new user.
-	const int index = indexForUser(clientUser);
-	
-	if (!m_recordInfo.contains(index)) {
-		boost::shared_ptr<RecordInfo> ri = boost::make_shared<RecordInfo>(
-		            m_config.mixDownMode ? QLatin1String("Mixdown")
-		                                 : clientUser->qsName);
-		
-		m_recordInfo.insert(index, ri);
-	}
-
 	{
 		// Save the buffer in |qlRecordBuffer|.
 		QMutexLocker l(&m_bufferLock);
+		const int index = ensureRecordInfoFor(clientUser);
 		boost::shared_ptr<RecordBuffer> rb = boost::make_shared<RecordBuffer>(
 		            index, buffer, samples, m_absoluteSampleEstimation);
 		
@@ -424,6 +553,58 @@ void VoiceRecorder::addBuffer(const ClientUser *clientUser,
 	m_sleepCondition.wakeAll();
 }
 
+void VoiceRecorder::addPacket(const ClientUser *clientUser,
+                              unsigned int sequence,
+                              const QByteArray &packet) {
+
+	Q_ASSERT(clientUser != NULL);
+
+	if (!m_recording || !isInPacketMode() || packet.isEmpty())
+		return;
+
+	const unsigned int msgFlags = static_cast<unsigned char>(packet.at(0));
+	if (((msgFlags >> 5) & 0x7) != MessageHandler::UDPVoiceOpus)
+		return;
+
+	PacketDataStream pds(packet.constData() + 1, packet.size() - 1);
+
+	int size;
+	pds >> size;
+
+	const bool terminator = (size & 0x2000) != 0;
+	const QByteArray payload = pds.dataBlock(size & 0x1fff);
+
+	if (!pds.isValid() || payload.isEmpty())
+		return;
+
+	{
+		QMutexLocker l(&m_bufferLock);
+		const int index = ensureRecordInfoFor(clientUser);
+		boost::shared_ptr<RecordPacket> rp = boost::make_shared<RecordPacket>(
+		            index, sequence, m_timestamp->elapsed(), payload, terminator);
+
+		m_recordPacket << rp;
+	}
+
+	// Tell the main loop that we have new audio data.
+	m_sleepCondition.wakeAll();
+}
+
+int VoiceRecorder::ensureRecordInfoFor(const ClientUser *clientUser) {
+	// Create a new RecordInfo object if this is a new user.
+	const int index = indexForUser(clientUser);
+
+	if (!m_recordInfo.contains(index)) {
+		boost::shared_ptr<RecordInfo> ri = boost::make_shared<RecordInfo>(
+		            m_config.mixDownMode ? QLatin1String("Mixdown")
+		                                 : clientUser->qsName);
+
+		m_recordInfo.insert(index, ri);
+	}
+
+	return index;
+}
+
 quint64 VoiceRecorder::getElapsedTime() const {
 	return m_timestamp->elapsed();
 }
@@ -436,6 +617,10 @@ bool VoiceRecorder::isInMixDownMode() const {
 	return m_config.mixDownMode;
 }
 
+bool VoiceRecorder::isInPacketMode() const {
+	return m_config.recordingFormat == VoiceRecorderFormat::OPUS;
+}
+
 QString VoiceRecorderFormat::getFormatDescription(VoiceRecorderFormat::Format fm) {
 	switch (fm) {
 		case VoiceRecorderFormat::WAV:
@@ -448,6 +633,8 @@ QString VoiceRecorderFormat::getFormatDescription(VoiceRecorderFormat::Format fm
 			return VoiceRecorder::tr(".au - Uncompressed");
 		case VoiceRecorderFormat::FLAC:
 			return VoiceRecorder::tr(".flac - Lossless compressed");
+		case VoiceRecorderFormat::OPUS:
+			return VoiceRecorder::tr(".opus - Received packets, not re-encoded");
 		default:
 			return QString();
 	}
@@ -465,6 +652,8 @@ QString VoiceRecorderFormat::getFormatDefaultExtension(VoiceRecorderFormat::Form
 			return QLatin1String("au");
 		case VoiceRecorderFormat::FLAC:
 			return QLatin1String("flac");
+		case VoiceRecorderFormat::OPUS:
+			return QLatin1String("opus");
 		default:
 			return QString();
 	}
@@ -20,6 +20,8 @@
 #include <QtCore/QWaitCondition>
 
 class ClientUser;
+class OggOpusWriter;
+class QFile;
 class RecordUser;
 class Timer;
 
@@ -40,6 +42,8 @@ namespace VoiceRecorderFormat {
 		AU,
 		/// FLAC Format
 		FLAC,
+		/// Ogg Opus Format containing the received packets as-is
+		OPUS,
 		kEnd
 	};
 
@@ -57,6 +61,12 @@ namespace VoiceRecorderFormat {
 /// which is then encoded using one of the formats of VoiceRecordingFormat::Format
 /// and written to disk.
 ///
+/// When recording in the OPUS format the recorder runs in packet mode instead.
+/// It then accepts the encoded voice packets through the addPacket method and
+/// stores them without decoding or re-encoding into one Ogg Opus file per user.
+/// Each file is accompanied by an index file listing the sequence number and
+/// arrival time of every stored packet.
+///
 class VoiceRecorder : public QThread {
 		Q_OBJECT
 	public:
@@ -98,6 +108,12 @@ class VoiceRecorder : public QThread {
 		/// @param clientUser User for which to add the audio data. NULL in mixdown mode.
 		void addBuffer(const ClientUser *clientUser, boost::shared_array<float> buffer, int samples);
 		
+		/// Adds an encoded voice packet for |clientUser| to the recorder.
+		/// |packet| starts with the voice packet header byte, followed by the
+		/// voice data as received from the server (after the sequence number).
+		/// Only used in packet mode, packets of codecs other than Opus are ignored.
+		void addPacket(const ClientUser *clientUser, unsigned int sequence, const QByteArray &packet);
+
 		/// Returns the elapsed time since the recording started.
 		quint64 getElapsedTime() const;
 
@@ -106,6 +122,9 @@ class VoiceRecorder : public QThread {
 
 		/// Returns true if the recorder is recording mixed down data instead of multichannel
 		bool isInMixDownMode() const;
+
+		/// Returns true if the recorder stores encoded packets instead of decoded audio
+		bool isInPacketMode() const;
 signals:
 		/// Emitted if an error is encountered
 		void error(int err, QString strerr);
@@ -138,6 +157,31 @@ signals:
 			quint64 absoluteStartSample;
 		};
 
+		/// Stores information about a received voice packet in packet mode.
+		struct RecordPacket {
+			/// Constructs a new RecordPacket object.
+			RecordPacket(int recordInfoIndex_,
+			             unsigned int sequence_,
+			             quint64 arrivalTime_,
+			             const QByteArray &payload_,
+			             bool terminator_);
+
+			/// Hashmap index for the user
+			const int recordInfoIndex;
+
+			/// Sequence number of the packet (in 10ms frames).
+			const unsigned int sequence;
+
+			/// Arrival time of the packet in microseconds since the recording started.
+			const quint64 arrivalTime;
+
+			/// The Opus packet.
+			const QByteArray payload;
+
+			/// True if this is the last packet of a talk spurt.
+			const bool terminator;
+		};
+
 		/// Stores the recording state for one user.
 		struct RecordInfo {
 			RecordInfo(const QString& userName_);
@@ -151,6 +195,25 @@ signals:
 
 			/// The last absolute sample we wrote for this users
 			quint64 lastWrittenAbsoluteSample;
+
+			/// Ogg Opus output file in packet mode.
+			QFile *packetFile;
+
+			/// Writer for |packetFile|.
+			OggOpusWriter *packetWriter;
+
+			/// Packet index file in packet mode.
+			QFile *indexFile;
+
+			/// True while the user's current talk spurt has not been terminated.
+			bool inTalkSpurt;
+
+			/// Output position and sequence number of the first packet of the current talk spurt.
+			quint64 talkSpurtStartSample;
+			unsigned int talkSpurtStartSequence;
+
+			/// Sequence number of the last written packet.
+			unsigned int lastSequence;
 		};
 
 		typedef QHash< int, boost::shared_ptr<RecordInfo> > RecordInfoMap;
@@ -167,9 +230,25 @@ signals:
 		/// Create a sndfile SF_INFO structure describing the currently configured recording format
 		SF_INFO createSoundFileInfo() const;
 		
+		/// Finds an unused file name for the given recording information and creates its directory.
+		/// Helper function for the ensure*IsOpenedFor methods. Will abort recording on failure.
+		bool createTargetFileName(boost::shared_ptr<RecordInfo> &ri, QString &fileName);
+
 		/// Opens the file for the given recording information
 		/// Helper function for run method. Will abort recording on failure.
 		bool ensureFileIsOpenedFor(SF_INFO &soundFileInfo, boost::shared_ptr<RecordInfo> &ri);
+
+		/// Opens the Ogg Opus and index files for the given recording information in packet mode.
+		/// Helper function for run method. Will abort recording on failure.
+		bool ensurePacketFileIsOpenedFor(boost::shared_ptr<RecordInfo> &ri);
+
+		/// Writes a packet to its user's Ogg Opus file, inserting silence for gaps so
+		/// that all files of a recording stay aligned to the start of the recording.
+		void writePacket(boost::shared_ptr<RecordInfo> &ri, const RecordPacket &rp);
+
+		/// Returns the RecordInfo hashmap index for the given user, creating the RecordInfo if needed.
+		/// Must be called with |m_bufferLock| held.
+		int ensureRecordInfoFor(const ClientUser *clientUser);
 		
 		/// Hash which maps the |uiSession| of all users for which we have to keep a recording state to the corresponding RecordInfo object.
 		RecordInfoMap m_recordInfo;
@@ -177,13 +256,17 @@ signals:
 		/// List containing all unprocessed RecordBuffer objects.
 		QList< boost::shared_ptr<RecordBuffer> > m_recordBuffer;
 
+		/// List containing all unprocessed RecordPacket objects.
+		QList< boost::shared_ptr<RecordPacket> > m_recordPacket;
+
 		/// The user which is used to record local audio.
 		boost::scoped_ptr<RecordUser> m_recordUser;
 
 		/// High precision timer for buffer timestamps.
 		boost::scoped_ptr<Timer> m_timestamp;
 
-		/// Protects the buffer list |qlRecordBuffer|.
+		/// Protects |m_recordInfo| and the buffer lists |m_recordBuffer| and |m_recordPacket|.
+		/// Buffers are added from the audio thread, packets from the server handler thread.
 		QMutex m_bufferLock;
 
 		/// Wait condition and mutex to block until there is new data.
@@ -137,6 +137,14 @@ void VoiceRecorderDialog::on_qpbStart_clicked() {
 		return;
 	}
 
+	if (static_cast<VoiceRecorderFormat::Format>(ifm) == VoiceRecorderFormat::OPUS && qrbDownmix->isChecked()) {
+		QMessageBox::critical(this,
+		                      tr("Recorder"),
+		                      tr("The .opus format stores the received voice packets of each user as they are and "
+		                         "can only be used in multichannel mode."));
+		return;
+	}
+
 	QString dstr = qleTargetDirectory->text();
 	if (dstr.isEmpty()) {
 		on_qpbTargetDirectoryBrowse_clicked();
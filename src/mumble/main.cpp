@@ -11,6 +11,7 @@
 #include "AudioInput.h"
 #include "AudioOutput.h"
 #include "AudioWizard.h"
+#include "AudioBenchmark.h"
 #include "Cert.h"
 #include "Database.h"
 #include "Log.h"
@@ -129,6 +130,8 @@ int main(int argc, char **argv) {
 	bool bAllowMultiple = false;
 	bool suppressIdentity = false;
 	bool bRpcMode = false;
+	unsigned int uiBenchmarkUsers = 0;
+	unsigned int uiBenchmarkSeconds = 10;
 	QString rpcCommand;
 	QUrl url;
 	if (a.arguments().count() > 1) {
@@ -161,6 +164,9 @@ int main(int argc, char **argv) {
 					"                Show the Mumble authors.\n"
 					"  --third-party-licenses\n"
 					"                Show licenses for third-party software used by Mumble.\n"
+					"  --audio-benchmark <users>[:<seconds>]\n"
+					"                Measure the audio pipeline with <users> simulated\n"
+					"                speakers and no sound hardware, then exit.\n"
 					"\n"
 				);
 				QString rpcHelpBanner = MainWindow::tr(
@@ -214,6 +220,13 @@ int main(int argc, char **argv) {
 			} else if (args.at(i) == QLatin1String("-third-party-licenses") || args.at(i) == QLatin1String("--third-party-licenses")) {
 				printf("%s", qPrintable(License::printableThirdPartyLicenseInfo()));
 				return 0;
+			} else if (args.at(i) == QLatin1String("--audio-benchmark")) {
+				if (i + 1 >= args.count() || ! AudioBenchmark::parseArgument(args.at(i + 1), uiBenchmarkUsers, uiBenchmarkSeconds)) {
+					printf("%s\n", qPrintable(MainWindow::tr("Error: --audio-benchmark requires <users>[:<seconds>]")));
+					return 1;
+				}
+				++i;
+				bAllowMultiple = true;
 			} else if (args.at(i) == QLatin1String("rpc")) {
 				bRpcMode = true;
 				if (args.count() - 1 > i) {
@@ -337,6 +350,9 @@ int main(int argc, char **argv) {
 	// Load preferences
 	g.s.load();
 
+	if (uiBenchmarkUsers > 0)
+		AudioBenchmark::configure(g.s);
+
 	// Check whether we need to enable accessibility features
 #ifdef Q_OS_WIN
 	// Only windows for now. Could not find any information on how to query this for osx or linux
@@ -455,7 +471,10 @@ int main(int argc, char **argv) {
 	g.p = new Plugins(NULL);
 	g.p->rescanPlugins();
 
-	Audio::start();
+	if (uiBenchmarkUsers > 0)
+		Audio::start(QLatin1String("Null"), QLatin1String("Null"));
+	else
+		Audio::start();
 
 	a.setQuitOnLastWindowClosed(false);
 
@@ -476,7 +495,7 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	if (runaudiowizard) {
+	if (runaudiowizard && uiBenchmarkUsers == 0) {
 		AudioWizard *aw = new AudioWizard(g.mw);
 		aw->exec();
 		delete aw;
@@ -484,7 +503,7 @@ int main(int argc, char **argv) {
 
 	g.s.uiUpdateCounter = 2;
 
-	if (! CertWizard::validateCert(g.s.kpCertificate)) {
+	if (uiBenchmarkUsers == 0 && ! CertWizard::validateCert(g.s.kpCertificate)) {
 #if QT_VERSION >= 0x050000
 		QDir qd(QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation));
 #else
@@ -513,7 +532,7 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	if (QDateTime::currentDateTime().daysTo(g.s.kpCertificate.first.first().expiryDate()) < 14)
+	if (uiBenchmarkUsers == 0 && QDateTime::currentDateTime().daysTo(g.s.kpCertificate.first.first().expiryDate()) < 14)
 		g.l->log(Log::Warning, CertWizard::tr("<b>Certificate Expiry:</b> Your certificate is about to expire. You need to renew it, or you will no longer be able to connect to servers you are registered on."));
 
 #ifdef QT_NO_DEBUG
@@ -531,7 +550,11 @@ int main(int argc, char **argv) {
 		g.p->checkUpdates();
 	}
 
-	if (url.isValid()) {
+	AudioBenchmark *ab = NULL;
+	if (uiBenchmarkUsers > 0) {
+		ab = new AudioBenchmark(uiBenchmarkUsers, uiBenchmarkSeconds);
+		ab->start();
+	} else if (url.isValid()) {
 		OpenURLEvent *oue = new OpenURLEvent(url);
 		qApp->postEvent(g.mw, oue);
 #ifdef Q_OS_MAC
@@ -546,7 +569,11 @@ int main(int argc, char **argv) {
 	if (! g.bQuit)
 		res=a.exec();
 
-	g.s.save();
+	// The benchmark replaced the audio backends and transmit mode, don't persist that.
+	if (ab)
+		delete ab;
+	else
+		g.s.save();
 
 	url.clear();
 	
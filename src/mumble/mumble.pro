@@ -85,6 +85,8 @@ HEADERS *= BanEditor.h \
     AudioOutputSample.h \
     AudioOutputSpeech.h \
     AudioOutputUser.h \
+    AudioBenchmark.h \
+    NullAudio.h \
     CELTCodec.h \
     CustomElements.h \
     MainWindow.h \
@@ -124,6 +126,7 @@ HEADERS *= BanEditor.h \
     SocketRPC.h \
     VoiceRecorder.h \
     VoiceRecorderDialog.h \
+    OggOpusWriter.h \
     WebFetch.h \
     ../SignalCurry.h \
     OverlayClient.h \
@@ -153,6 +156,8 @@ SOURCES *= BanEditor.cpp \
     AudioOutputSample.cpp \
     AudioOutputSpeech.cpp \
     AudioOutputUser.cpp \
+    AudioBenchmark.cpp \
+    NullAudio.cpp \
     main.cpp \
     CELTCodec.cpp \
     CustomElements.cpp \
@@ -199,6 +204,7 @@ SOURCES *= BanEditor.cpp \
     SocketRPC.cpp \
     VoiceRecorder.cpp \
     VoiceRecorderDialog.cpp \
+    OggOpusWriter.cpp \
     WebFetch.cpp \
     MumbleApplication.cpp \
     ../../3rdparty/smallft-src/smallft.cpp \
@@ -0,0 +1,195 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "BlobStore.h"
+
+#include "Message.h"
+
+BlobStore::BlobStore() : uiUseCounter(0), iMemory(0), iCacheSize(0), iCacheUsed(0) {
+}
+
+void BlobStore::setLimits(qint64 cacheSize, const QString &spillPath) {
+	QString path = spillPath;
+	if (! path.isEmpty() && ! QDir().mkpath(path)) {
+		qWarning("BlobStore: Failed to create spill directory %s", qPrintable(path));
+		path = QString();
+	}
+
+	QMutexLocker l(&qmLock);
+
+	iCacheSize = cacheSize;
+	qsSpillPath = path;
+
+	const Evicted evicted = trim();
+	l.unlock();
+
+	writeSpilled(path, evicted);
+}
+
+QByteArray BlobStore::acquire(const QByteArray &hash, const QByteArray &data) {
+	QMutexLocker l(&qmLock);
+
+	QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+	if (i == qhEntries.end()) {
+		Entry e;
+		e.qbaData = data;
+		e.iRefs = 1;
+		e.uiUsed = 0;
+		qhEntries.insert(hash, e);
+		iMemory += data.size();
+		return data;
+	}
+
+	Entry &e = i.value();
+	if (e.iRefs++ == 0) {
+		qmUnused.remove(e.uiUsed);
+		e.uiUsed = 0;
+		iCacheUsed -= e.qbaData.size();
+	}
+	return e.qbaData;
+}
+
+void BlobStore::release(const QByteArray &hash) {
+	QMutexLocker l(&qmLock);
+
+	QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+	if (i == qhEntries.end() || (i.value().iRefs <= 0)) {
+		qWarning("BlobStore: Released unknown blob %s", hash.toHex().constData());
+		return;
+	}
+
+	Entry &e = i.value();
+	if (--e.iRefs == 0) {
+		iCacheUsed += e.qbaData.size();
+		touch(hash, e);
+
+		const QString path = qsSpillPath;
+		const Evicted evicted = trim();
+		l.unlock();
+
+		writeSpilled(path, evicted);
+	}
+}
+
+void BlobStore::insert(const QByteArray &hash, const QByteArray &data) {
+	QMutexLocker l(&qmLock);
+
+	QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+	if (i != qhEntries.end()) {
+		if (i.value().iRefs == 0)
+			touch(hash, i.value());
+		return;
+	}
+
+	Entry e;
+	e.qbaData = data;
+	e.iRefs = 0;
+	e.uiUsed = 0;
+	touch(hash, *qhEntries.insert(hash, e));
+	iMemory += data.size();
+	iCacheUsed += data.size();
+
+	const QString path = qsSpillPath;
+	const Evicted evicted = trim();
+	l.unlock();
+
+	writeSpilled(path, evicted);
+}
+
+QByteArray BlobStore::value(const QByteArray &hash) {
+	QString path;
+	{
+		QMutexLocker l(&qmLock);
+
+		QHash<QByteArray, Entry>::iterator i = qhEntries.find(hash);
+		if (i != qhEntries.end()) {
+			if (i.value().iRefs == 0)
+				touch(hash, i.value());
+			return i.value().qbaData;
+		}
+
+		if (qsSpillPath.isEmpty())
+			return QByteArray();
+		path = qsSpillPath;
+	}
+
+	QByteArray data = readSpilled(path, hash);
+	if (! data.isNull())
+		insert(hash, data);
+	return data;
+}
+
+qint64 BlobStore::memoryUsage() const {
+	QMutexLocker l(&qmLock);
+	return iMemory;
+}
+
+void BlobStore::touch(const QByteArray &hash, Entry &e) {
+	if (e.uiUsed)
+		qmUnused.remove(e.uiUsed);
+	e.uiUsed = ++uiUseCounter;
+	qmUnused.insert(e.uiUsed, hash);
+}
+
+BlobStore::Evicted BlobStore::trim() {
+	Evicted evicted;
+
+	while ((iCacheUsed > iCacheSize) && ! qmUnused.isEmpty()) {
+		QMap<quint64, QByteArray>::iterator i = qmUnused.begin();
+		const QByteArray hash = i.value();
+		qmUnused.erase(i);
+
+		const Entry e = qhEntries.take(hash);
+		iMemory -= e.qbaData.size();
+		iCacheUsed -= e.qbaData.size();
+
+		if (! qsSpillPath.isEmpty())
+			evicted << qMakePair(hash, e.qbaData);
+	}
+
+	return evicted;
+}
+
+QString BlobStore::spillFile(const QString &path, const QByteArray &hash) {
+	return path + QLatin1Char('/') + QString::fromLatin1(hash.toHex());
+}
+
+QByteArray BlobStore::readSpilled(const QString &path, const QByteArray &hash) {
+	QFile f(spillFile(path, hash));
+	if (! f.open(QIODevice::ReadOnly))
+		return QByteArray();
+
+	QByteArray data = f.readAll();
+	f.close();
+
+	// Never hand out a damaged or foreign file as the blob.
+	if (sha1(data) != hash) {
+		f.remove();
+		return QByteArray();
+	}
+	return data;
+}
+
+void BlobStore::writeSpilled(const QString &path, const Evicted &evicted) {
+	typedef QPair<QByteArray, QByteArray> Blob;
+	foreach(const Blob &b, evicted) {
+		const QString name = spillFile(path, b.first);
+		if (QFile::exists(name))
+			continue;
+
+		// Write to a temporary name first, so a crash never leaves a truncated blob behind.
+		// Other threads may be spilling the same blob, so the name is per thread.
+		QFile f(name + QString::fromLatin1(".%1.tmp").arg(reinterpret_cast<quintptr>(QThread::currentThreadId())));
+		if (! f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+			continue;
+		bool ok = (f.write(b.second) == b.second.size());
+		f.close();
+
+		if (! ok || ! f.rename(name))
+			f.remove();
+	}
+}
@@ -0,0 +1,85 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_BLOBSTORE_H_
+#define MUMBLE_MURMUR_BLOBSTORE_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+
+/// Content-addressed store for user textures, shared by all virtual servers.
+///
+/// Blobs are keyed by their SHA1 hash. Every holder of a blob takes a
+/// reference with acquire() and gets back the stored QByteArray, so users
+/// with the same avatar on any server share a single buffer.
+///
+/// Blobs that are no longer referenced are kept as a cache, so a user who
+/// logs in again doesn't have to be read from the database or from an
+/// authenticator. The cache is bounded in size and evicts the least
+/// recently used blobs first. If a spill directory is set, evicted blobs
+/// are written there and read back on demand. The spill directory is only
+/// accessed without holding the lock, so a slow disk doesn't hold up the
+/// servers.
+class BlobStore {
+	private:
+		Q_DISABLE_COPY(BlobStore)
+	public:
+		BlobStore();
+
+		/// Sets the size of the cache of unreferenced blobs, and the
+		/// directory evicted blobs are spilled to. An empty path disables
+		/// spilling.
+		void setLimits(qint64 cacheSize, const QString &spillPath);
+
+		/// Adds a reference to the blob |data| with SHA1 |hash|, and
+		/// returns the stored copy of it.
+		QByteArray acquire(const QByteArray &hash, const QByteArray &data);
+		/// Drops a reference taken with acquire().
+		void release(const QByteArray &hash);
+
+		/// Adds |data| to the cache without referencing it.
+		void insert(const QByteArray &hash, const QByteArray &data);
+		/// Returns the blob with SHA1 |hash|, or a null QByteArray if it
+		/// is neither in memory nor in the spill directory.
+		QByteArray value(const QByteArray &hash);
+
+		/// Number of bytes held in memory, referenced or not.
+		qint64 memoryUsage() const;
+	protected:
+		struct Entry {
+			QByteArray qbaData;
+			int iRefs;
+			/// Position in qmUnused while iRefs is 0.
+			quint64 uiUsed;
+		};
+
+		mutable QMutex qmLock;
+		QHash<QByteArray, Entry> qhEntries;
+		/// Unreferenced blobs, least recently used first.
+		QMap<quint64, QByteArray> qmUnused;
+		quint64 uiUseCounter;
+		qint64 iMemory;
+		qint64 iCacheSize;
+		qint64 iCacheUsed;
+		QString qsSpillPath;
+
+		/// Blobs evicted by trim(), by hash, to be spilled once the lock
+		/// has been released.
+		typedef QList<QPair<QByteArray, QByteArray> > Evicted;
+
+		void touch(const QByteArray &hash, Entry &e);
+		/// Evicts unreferenced blobs until the cache fits its size. Returns
+		/// what has to be spilled.
+		Evicted trim();
+		static QString spillFile(const QString &path, const QByteArray &hash);
+		static QByteArray readSpilled(const QString &path, const QByteArray &hash);
+		static void writeSpilled(const QString &path, const Evicted &evicted);
+};
+
+#endif
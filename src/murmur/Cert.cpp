@@ -175,6 +175,44 @@ void Server::initializeCert() {
 		}
 	}
 
+	// Assemble the configuration used for all incoming connections.
+	qscSslConfig = QSslConfiguration::defaultConfiguration();
+	qscSslConfig.setPrivateKey(qskKey);
+	qscSslConfig.setLocalCertificate(qscCert);
+
+	QList<QSslCertificate> ca = qscSslConfig.caCertificates();
+	// Treat the leaf certificate as a root.
+	// This shouldn't strictly be necessary,
+	// and is a left-over from early on.
+	// Perhaps it is necessary for self-signed
+	// certs?
+	ca << qscCert;
+	// Add CA certificates specified via
+	// murmur.ini's sslCA option.
+	ca << Meta::mp.qlCA;
+	// Add intermediate CAs found in the PEM
+	// bundle used for this server's certificate.
+	ca << qlIntermediates;
+	qscSslConfig.setCaCertificates(ca);
+
+	qscSslConfig.setCiphers(Meta::mp.qlCiphers);
+
+#if defined(USE_QSSLDIFFIEHELLMANPARAMETERS)
+	qscSslConfig.setDiffieHellmanParameters(qsdhpDHParams);
+#endif
+
+#if QT_VERSION >= 0x050500
+	qscSslConfig.setProtocol(QSsl::TlsV1_0OrLater);
+#elif QT_VERSION >= 0x050400
+	// In Qt 5.4, QSsl::SecureProtocols is equivalent
+	// to "TLSv1.0 or later", which we require.
+	qscSslConfig.setProtocol(QSsl::SecureProtocols);
+#elif QT_VERSION >= 0x050000
+	qscSslConfig.setProtocol(QSsl::TlsV1_0);
+#else
+	qscSslConfig.setProtocol(QSsl::TlsV1);
+#endif
+
 	// Drain OpenSSL's per-thread error queue
 	// to ensure that errors from the operations
 	// we've done in here do not leak out into
@@ -0,0 +1,383 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "Handoff.h"
+
+#include "Meta.h"
+#include "ServerUser.h"
+
+#include <sys/un.h>
+
+QMutex Handoff::qmReceived;
+QHash<QString, int> Handoff::qhReceived;
+QHash<int, QHash<QString, Server::ResumeState> > Handoff::qhSessions;
+
+Handoff::Handoff(const QString &path, QObject *p) : QObject(p), qsPath(path), iListen(-1), qsnListen(NULL), iConn(-1) {
+}
+
+Handoff::~Handoff() {
+	// The path isn't removed, as it may already belong to the process we
+	// handed off to. listen() replaces stale ones.
+	if (iListen >= 0)
+		close(iListen);
+	// The new process starts once this is closed, which happens at the
+	// latest when this process exits.
+	if (iConn >= 0)
+		close(iConn);
+}
+
+QString Handoff::key(int server, int index, Type type) {
+	return QString::fromLatin1("%1/%2/%3").arg(server).arg(index).arg(static_cast<int>(type));
+}
+
+static bool socketAddress(const QString &path, struct sockaddr_un &addr) {
+	const QByteArray name = QFile::encodeName(path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (static_cast<size_t>(name.size()) >= sizeof(addr.sun_path)) {
+		qWarning("Handoff: Socket path %s is too long", name.constData());
+		return false;
+	}
+	memcpy(addr.sun_path, name.constData(), static_cast<size_t>(name.size()));
+	return true;
+}
+
+bool Handoff::listen() {
+	struct sockaddr_un addr;
+	if (! socketAddress(qsPath, addr))
+		return false;
+
+	iListen = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (iListen < 0) {
+		qWarning("Handoff: Failed to create socket: %s", strerror(errno));
+		return false;
+	}
+
+	::unlink(addr.sun_path);
+	if ((::bind(iListen, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) || (::chmod(addr.sun_path, 0600) != 0) || (::listen(iListen, 1) != 0)) {
+		qWarning("Handoff: Failed to listen on %s: %s", addr.sun_path, strerror(errno));
+		close(iListen);
+		iListen = -1;
+		return false;
+	}
+
+	qsnListen = new QSocketNotifier(iListen, QSocketNotifier::Read, this);
+	connect(qsnListen, SIGNAL(activated(int)), this, SLOT(newRequest()));
+	return true;
+}
+
+bool Handoff::sendSocket(int conn, const Record &r, int sock) {
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		size_t align;
+		char data[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	iov.iov_base = const_cast<Record *>(&r);
+	iov.iov_len = sizeof(r);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (sock >= 0) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof(control.data);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &sock, sizeof(int));
+	}
+
+	ssize_t len;
+	do {
+		len = ::sendmsg(conn, &msg, 0);
+	} while ((len < 0) && (errno == EINTR));
+	return (len == static_cast<ssize_t>(sizeof(r)));
+}
+
+bool Handoff::sendAll(int conn, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t sent = ::send(conn, data, len, 0);
+		if ((sent < 0) && (errno == EINTR))
+			continue;
+		if (sent <= 0)
+			return false;
+		data += sent;
+		len -= static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+bool Handoff::receiveAll(int conn, char *data, size_t len) {
+	while (len > 0) {
+		ssize_t got = ::recv(conn, data, len, MSG_WAITALL);
+		if ((got < 0) && (errno == EINTR))
+			continue;
+		if (got <= 0)
+			return false;
+		data += got;
+		len -= static_cast<size_t>(got);
+	}
+	return true;
+}
+
+void Handoff::newRequest() {
+	int conn = ::accept(iListen, NULL, NULL);
+	if (conn < 0)
+		return;
+
+	int sent = 0;
+	bool ok = true;
+	foreach(Server *s, meta->qhServers) {
+		for (int i = 0; ok && (i < s->qlServer.count()); ++i) {
+			Record r = { s->iServerNum, i, Tcp };
+			ok = sendSocket(conn, r, static_cast<int>(s->qlServer.at(i)->socketDescriptor()));
+			++sent;
+		}
+		for (int i = 0; ok && (i < s->qlUdpSocket.count()); ++i) {
+			Record r = { s->iServerNum, i, Udp };
+			ok = sendSocket(conn, r, s->qlUdpSocket.at(i));
+			++sent;
+		}
+	}
+
+	if (! ok) {
+		qWarning("Handoff: Failed to hand over sockets: %s", strerror(errno));
+		close(conn);
+		return;
+	}
+
+	qWarning("Handoff: Handed over %d sockets", sent);
+	iConn = conn;
+	qsnListen->setEnabled(false);
+	emit handedOff();
+}
+
+void Handoff::sendSessions(Server *s) {
+	if (iConn < 0)
+		return;
+
+	QByteArray qba;
+	{
+		QDataStream ds(&qba, QIODevice::WriteOnly);
+		foreach(ServerUser *u, s->qhUsers) {
+			// Users without a certificate have nothing to prove who they are with.
+			if ((u->sState != ServerUser::Authenticated) || u->qsHash.isEmpty())
+				continue;
+			ds << u->qsHash << u->qsName << static_cast<qint32>(u->iId) << static_cast<qint32>(u->cChannel->iId);
+			ds << u->bMute << u->bDeaf << u->bPrioritySpeaker;
+		}
+	}
+
+	Record r = { s->iServerNum, qba.size(), Sessions };
+	if (! sendSocket(iConn, r, -1) || ! sendAll(iConn, qba.constData(), static_cast<size_t>(qba.size()))) {
+		qWarning("Handoff: Failed to hand over sessions: %s", strerror(errno));
+		close(iConn);
+		iConn = -1;
+	}
+}
+
+void Handoff::finish() {
+	if (iConn < 0)
+		return;
+
+	Record end = { 0, 0, End };
+	if (! sendSocket(iConn, end, -1))
+		qWarning("Handoff: Failed to finish handover: %s", strerror(errno));
+}
+
+int Handoff::receive(const QString &path) {
+	struct sockaddr_un addr;
+	if (! socketAddress(path, addr))
+		return -1;
+
+	int conn = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (conn < 0)
+		return -1;
+	if (::connect(conn, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+		close(conn);
+		return -1;
+	}
+
+	// Don't hang on a murmur that doesn't answer.
+	struct timeval tv;
+	tv.tv_sec = 10;
+	tv.tv_usec = 0;
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	QMutexLocker l(&qmReceived);
+
+	int received = 0;
+	bool finished = false;
+	forever {
+		Record r;
+		struct msghdr msg;
+		struct iovec iov;
+		union {
+			size_t align;
+			char data[CMSG_SPACE(sizeof(int))];
+		} control;
+
+		iov.iov_base = &r;
+		iov.iov_len = sizeof(r);
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof(control.data);
+
+		memset(&r, 0, sizeof(r));
+		ssize_t len = ::recvmsg(conn, &msg, MSG_WAITALL);
+		if ((len < 0) && (errno == EINTR))
+			continue;
+
+		QList<int> socks;
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+				continue;
+			const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (size_t i = 0; i < count; ++i) {
+				int sock;
+				memcpy(&sock, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				socks << sock;
+			}
+		}
+
+		// Every record carries at most one socket, and only Tcp and Udp
+		// records carry one at all. Anything else is closed, as is
+		// everything of a record whose control data was truncated.
+		int sock = -1;
+		const bool wantSocket = (r.iType == Tcp) || (r.iType == Udp);
+		if ((len == static_cast<ssize_t>(sizeof(r))) && wantSocket && (socks.count() == 1) && ! (msg.msg_flags & MSG_CTRUNC))
+			sock = socks.takeFirst();
+		if (! socks.isEmpty() || (msg.msg_flags & MSG_CTRUNC)) {
+			qWarning("Handoff: Discarding unexpected or truncated sockets");
+			foreach(int s, socks)
+				close(s);
+		}
+
+		if (len != static_cast<ssize_t>(sizeof(r))) {
+			if (sock >= 0)
+				close(sock);
+			qWarning("Handoff: Connection lost while receiving sockets");
+			break;
+		}
+		if (r.iType == End) {
+			finished = true;
+			break;
+		}
+		if (r.iType == Sessions) {
+			if ((r.iIndex < 0) || (r.iIndex > 64 * 1024 * 1024)) {
+				qWarning("Handoff: Invalid session record");
+				break;
+			}
+			QByteArray qba(r.iIndex, 0);
+			if (! receiveAll(conn, qba.data(), static_cast<size_t>(qba.size()))) {
+				qWarning("Handoff: Connection lost while receiving sessions");
+				break;
+			}
+
+			QHash<QString, Server::ResumeState> &sessions = qhSessions[r.iServer];
+			QDataStream ds(qba);
+			while (! ds.atEnd() && (ds.status() == QDataStream::Ok)) {
+				QString hash;
+				qint32 id, channel;
+				Server::ResumeState rs;
+				ds >> hash >> rs.qsName >> id >> channel;
+				ds >> rs.bMute >> rs.bDeaf >> rs.bPrioritySpeaker;
+				rs.iId = id;
+				rs.iChannel = channel;
+				if (ds.status() == QDataStream::Ok)
+					sessions.insert(hash, rs);
+			}
+			continue;
+		}
+		if (sock < 0)
+			continue;
+
+		::fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+		const QString k = key(r.iServer, r.iIndex, static_cast<Type>(r.iType));
+		if (qhReceived.contains(k))
+			close(qhReceived.value(k));
+		qhReceived.insert(k, sock);
+		++received;
+	}
+
+	// The old process releases everything else it listens on, like the
+	// RPC interfaces, on its way out. Wait for that before starting them.
+	if (finished) {
+		char c;
+		ssize_t len;
+		do {
+			len = ::recv(conn, &c, 1, 0);
+		} while ((len < 0) && (errno == EINTR));
+		if (len != 0)
+			qWarning("Handoff: The running murmur didn't exit in time");
+	}
+
+	close(conn);
+	return received;
+}
+
+int Handoff::take(int server, int index, Type type, const QHostAddress &address, unsigned short port) {
+	QMutexLocker l(&qmReceived);
+
+	const QString k = key(server, index, type);
+	if (! qhReceived.contains(k))
+		return -1;
+	int sock = qhReceived.take(k);
+
+	// The bind addresses may have changed with the configuration.
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	unsigned short boundPort = 0;
+	QHostAddress bound;
+	memset(&addr, 0, sizeof(addr));
+	if (getsockname(sock, reinterpret_cast<struct sockaddr *>(&addr), &len) == 0) {
+		bound = QHostAddress(reinterpret_cast<struct sockaddr *>(&addr));
+		if (addr.ss_family == AF_INET6)
+			boundPort = ntohs(reinterpret_cast<struct sockaddr_in6 *>(&addr)->sin6_port);
+		else if (addr.ss_family == AF_INET)
+			boundPort = ntohs(reinterpret_cast<struct sockaddr_in *>(&addr)->sin_port);
+	}
+
+	bool same = (bound == address);
+#if QT_VERSION >= 0x050000
+	// Qt listens on the IPv6 wildcard address for the dual stack Any.
+	if ((address.protocol() == QAbstractSocket::AnyIPProtocol) && (bound == QHostAddress(QHostAddress::AnyIPv6)))
+		same = true;
+#endif
+
+	if (! same || (boundPort != port)) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+QHash<QString, Server::ResumeState> Handoff::takeSessions(int server) {
+	QMutexLocker l(&qmReceived);
+
+	return qhSessions.take(server);
+}
+
+void Handoff::closeUnclaimed() {
+	QMutexLocker l(&qmReceived);
+
+	foreach(int sock, qhReceived)
+		close(sock);
+	qhReceived.clear();
+	qhSessions.clear();
+}
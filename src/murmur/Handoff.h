@@ -0,0 +1,105 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_HANDOFF_H_
+#define MUMBLE_MURMUR_HANDOFF_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtNetwork/QHostAddress>
+
+#include "Server.h"
+
+class QSocketNotifier;
+
+/// Passes the listening TCP sockets and the UDP sockets of the running
+/// virtual servers from one murmur to the one replacing it, over a Unix
+/// domain socket (SCM_RIGHTS). The new process starts serving on the same
+/// sockets, so a restart neither refuses connections nor loses queued
+/// datagrams. See MetaParams::qsHandoffSocket.
+///
+/// Connected sessions can't be handed over, as their TLS state can't be
+/// taken out of QSslSocket. Instead, the old process sends a resume record
+/// for each authenticated user as it shuts its servers down. A user
+/// reconnecting with the same certificate resumes that session without
+/// being authenticated again, see Server::ResumeState.
+///
+/// The new process only returns from receive() once the old one has
+/// exited, so it can open the RPC and metrics listeners after it.
+class Handoff : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(Handoff)
+	public:
+		enum Type { End = 0, Tcp = 1, Udp = 2, Sessions = 3 };
+
+		/// One record as sent over the handoff connection. For Tcp and
+		/// Udp, the socket is the ancillary data of the record. For
+		/// Sessions, iIndex bytes of resume records of server iServer
+		/// follow.
+		struct Record {
+			qint32 iServer;
+			qint32 iIndex;
+			qint32 iType;
+		};
+	protected:
+		QString qsPath;
+		int iListen;
+		QSocketNotifier *qsnListen;
+		/// Connection to the process the sockets were handed over to. It
+		/// is kept open until this process exits.
+		int iConn;
+
+		/// Protects qhReceived and qhSessions, as servers are booted on
+		/// boot threads.
+		static QMutex qmReceived;
+		/// Sockets received from the previous process that no server has
+		/// taken yet, by server number, bind address index and type.
+		static QHash<QString, int> qhReceived;
+		/// Resume records received from the previous process that no
+		/// server has taken yet, by server number.
+		static QHash<int, QHash<QString, Server::ResumeState> > qhSessions;
+
+		static QString key(int server, int index, Type type);
+		static bool sendSocket(int conn, const Record &r, int sock);
+		static bool sendAll(int conn, const char *data, size_t len);
+		static bool receiveAll(int conn, char *data, size_t len);
+	public:
+		Handoff(const QString &path, QObject *p = NULL);
+		~Handoff();
+
+		/// Starts accepting handoff requests at the path.
+		bool listen();
+		/// Sends the resume records of the users of |s|, which must be on
+		/// the main thread, once the sockets have been handed over.
+		void sendSessions(Server *s);
+		/// Tells the new process that everything has been sent. It starts
+		/// once this process has exited.
+		void finish();
+
+		/// Asks the murmur listening at |path| for its sockets and
+		/// sessions, and waits for it to exit. Returns the number of
+		/// sockets received, or -1 if no murmur answered.
+		static int receive(const QString &path);
+		/// Takes over the socket received for bind address |index| of
+		/// server |server|, if it is bound to |address| and |port|.
+		/// Returns -1 if there isn't one.
+		static int take(int server, int index, Type type, const QHostAddress &address, unsigned short port);
+		/// Takes the resume records received for server |server|, by
+		/// certificate hash.
+		static QHash<QString, Server::ResumeState> takeSessions(int server);
+		/// Closes all received sockets that no server took over.
+		static void closeUnclaimed();
+	protected slots:
+		void newRequest();
+	signals:
+		/// Emitted once the sockets have been handed over to another
+		/// process, which is now serving them.
+		void handedOff();
+};
+
+#endif
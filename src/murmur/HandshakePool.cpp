@@ -0,0 +1,176 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "HandshakePool.h"
+
+#include "Server.h"
+
+HandshakeEvent::HandshakeEvent(QSslSocket *sock) : QEvent(static_cast<QEvent::Type>(HANDSHAKE_QEVENT)), qtsSocket(sock), usPeerPort(0), bVerified(true), uiElapsed(0) {
+}
+
+HandshakeEvent::~HandshakeEvent() {
+	// Events still queued for a server that is destroyed are deleted on
+	// the server's thread, which is also the thread of the socket.
+	delete qtsSocket;
+}
+
+QSslSocket *HandshakeEvent::takeSocket() {
+	QSslSocket *sock = qtsSocket;
+	qtsSocket = NULL;
+	return sock;
+}
+
+SslHandshake::SslHandshake(HandshakePool *pool, Server *server, QSslSocket *sock, int timeout) : QObject(), hpPool(pool), sServer(server), qtsSocket(sock), bVerified(true), bDone(false) {
+	qtsSocket->setParent(this);
+
+	qtTimeout = new QTimer(this);
+	qtTimeout->setSingleShot(true);
+	qtTimeout->setInterval(timeout * 1000);
+
+	connect(qtTimeout, SIGNAL(timeout()), this, SLOT(timeout()));
+	connect(qtsSocket, SIGNAL(encrypted()), this, SLOT(encrypted()));
+	connect(qtsSocket, SIGNAL(sslErrors(const QList<QSslError> &)), this, SLOT(sslErrors(const QList<QSslError> &)));
+	connect(qtsSocket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketError()));
+	connect(qtsSocket, SIGNAL(disconnected()), this, SLOT(socketError()));
+}
+
+void SslHandshake::start() {
+	tStart.restart();
+	qtTimeout->start();
+	qtsSocket->startServerEncryption();
+}
+
+void SslHandshake::sslErrors(const QList<QSslError> &errors) {
+	QStringList fatal;
+	if (Server::checkSslErrors(errors, bVerified, fatal)) {
+		qtsSocket->ignoreSslErrors();
+		return;
+	}
+
+	// Disconnect the same way Server::sslError() does, as aborting
+	// in the middle of the handshake is not safe with Qt 5.
+	fail(QString::fromLatin1("SSL Error: %1").arg(fatal.join(QLatin1String(", "))));
+#if QT_VERSION >= 0x050000
+	qtsSocket->disconnectFromHost();
+#else
+	qtsSocket->abort();
+#endif
+}
+
+void SslHandshake::socketError() {
+	fail(qtsSocket->errorString());
+}
+
+void SslHandshake::timeout() {
+	fail(QLatin1String("TLS handshake timed out"));
+	qtsSocket->abort();
+}
+
+void SslHandshake::encrypted() {
+	if (bDone)
+		return;
+	bDone = true;
+	qtTimeout->stop();
+
+	// The socket is still inside the handshake code here, so it is only
+	// moved once control has returned to the event loop.
+	QMetaObject::invokeMethod(this, "handOver", Qt::QueuedConnection);
+}
+
+void SslHandshake::handOver() {
+	disconnect(qtsSocket, NULL, this, NULL);
+
+	HandshakeEvent *he = new HandshakeEvent(qtsSocket);
+	he->qhaPeer = qtsSocket->peerAddress();
+	he->usPeerPort = qtsSocket->peerPort();
+	he->bVerified = bVerified;
+	he->uiElapsed = tStart.elapsed();
+
+	if (hpPool->deliver(sServer, he, qtsSocket)) {
+		qtsSocket = NULL;
+	} else {
+		he->takeSocket();
+		delete he;
+	}
+
+	deleteLater();
+}
+
+void SslHandshake::fail(const QString &reason) {
+	if (bDone)
+		return;
+	bDone = true;
+	qtTimeout->stop();
+
+	HandshakeEvent *he = new HandshakeEvent(NULL);
+	he->qhaPeer = qtsSocket->peerAddress();
+	he->usPeerPort = qtsSocket->peerPort();
+	he->uiElapsed = tStart.elapsed();
+	he->qsError = reason.isEmpty() ? QString::fromLatin1("TLS handshake failed") : reason;
+
+	if (! hpPool->deliver(sServer, he, NULL))
+		delete he;
+
+	// We may be called from within the socket's signals, so it is
+	// deleted later, together with this object.
+	deleteLater();
+}
+
+HandshakePool::HandshakePool() : aiNext(0) {
+}
+
+HandshakePool::~HandshakePool() {
+	foreach(QThread *t, qlThreads) {
+		t->quit();
+		t->wait();
+		delete t;
+	}
+}
+
+void HandshakePool::setThreads(int count) {
+	for (int i = 0; i < count; ++i) {
+		QThread *t = new QThread();
+		t->setObjectName(QString::fromLatin1("Handshake %1").arg(i));
+		t->start();
+		qlThreads << t;
+	}
+}
+
+bool HandshakePool::isEnabled() const {
+	return ! qlThreads.isEmpty();
+}
+
+void HandshakePool::start(Server *server, QSslSocket *sock, int timeout) {
+	{
+		QMutexLocker l(&qmServers);
+		qsServers.insert(server);
+	}
+
+	const int idx = static_cast<int>(static_cast<unsigned int>(aiNext.fetchAndAddRelaxed(1)) % static_cast<unsigned int>(qlThreads.count()));
+
+	SslHandshake *hs = new SslHandshake(this, server, sock, timeout);
+	hs->moveToThread(qlThreads.at(idx));
+	QMetaObject::invokeMethod(hs, "start", Qt::QueuedConnection);
+}
+
+void HandshakePool::cancel(const Server *server) {
+	QMutexLocker l(&qmServers);
+	qsServers.remove(server);
+}
+
+bool HandshakePool::deliver(Server *server, HandshakeEvent *he, QSslSocket *sock) {
+	QMutexLocker l(&qmServers);
+	if (! qsServers.contains(server))
+		return false;
+
+	if (sock) {
+		sock->setParent(NULL);
+		sock->moveToThread(server->thread());
+	}
+	QCoreApplication::postEvent(server, he);
+	return true;
+}
@@ -0,0 +1,120 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_HANDSHAKEPOOL_H_
+#define MUMBLE_MURMUR_HANDSHAKEPOOL_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QEvent>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QSslError>
+
+#include "Timer.h"
+
+class HandshakePool;
+class QSslSocket;
+class QThread;
+class QTimer;
+class Server;
+
+#define HANDSHAKE_QEVENT (QEvent::User + 960)
+
+/// Result of a TLS handshake run by a HandshakePool, posted to the server
+/// that accepted the connection.
+class HandshakeEvent : public QEvent {
+		Q_DISABLE_COPY(HandshakeEvent);
+	protected:
+		QSslSocket *qtsSocket;
+	public:
+		QHostAddress qhaPeer;
+		quint16 usPeerPort;
+		/// Whether the client certificate passed verification.
+		bool bVerified;
+		/// Duration of the handshake in microseconds.
+		quint64 uiElapsed;
+		/// Why the handshake failed. Empty if it succeeded.
+		QString qsError;
+
+		HandshakeEvent(QSslSocket *sock);
+		/// Deletes the socket unless it was taken.
+		~HandshakeEvent() Q_DECL_OVERRIDE;
+
+		/// Returns the encrypted socket, or NULL if the handshake failed.
+		/// The caller takes ownership.
+		QSslSocket *takeSocket();
+};
+
+/// Drives the handshake of a single socket on a HandshakePool thread.
+class SslHandshake : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(SslHandshake)
+	protected:
+		HandshakePool *hpPool;
+		Server *sServer;
+		QSslSocket *qtsSocket;
+		QTimer *qtTimeout;
+		Timer tStart;
+		bool bVerified;
+		bool bDone;
+		QString qsError;
+
+		void fail(const QString &reason);
+	protected slots:
+		void encrypted();
+		void handOver();
+		void sslErrors(const QList<QSslError> &errors);
+		void socketError();
+		void timeout();
+	public slots:
+		void start();
+	public:
+		SslHandshake(HandshakePool *pool, Server *server, QSslSocket *sock, int timeout);
+};
+
+/// Runs the TLS handshakes of incoming connections on worker threads, so
+/// full handshakes don't stall the event loop running the server.
+///
+/// start() moves a socket to one of the workers, whose event loop drives
+/// the handshake. Once it finished, the socket is moved back to the
+/// thread of its server, and a HandshakeEvent is posted to the server.
+class HandshakePool {
+	private:
+		Q_DISABLE_COPY(HandshakePool)
+	protected:
+		QList<QThread *> qlThreads;
+		QAtomicInt aiNext;
+
+		/// qmServers protects qsServers, the servers results may be posted to.
+		QMutex qmServers;
+		QSet<const Server *> qsServers;
+	public:
+		HandshakePool();
+		~HandshakePool();
+
+		/// Starts |count| worker threads. May only be called once.
+		void setThreads(int count);
+		/// Whether there are worker threads to run handshakes on.
+		bool isEnabled() const;
+
+		/// Starts the server side handshake of |sock|, which must already be
+		/// configured. The pool takes ownership of the socket. The handshake is
+		/// abandoned after |timeout| seconds.
+		void start(Server *server, QSslSocket *sock, int timeout);
+		/// Stops posting results to |server|. Must be called before it is destroyed.
+		void cancel(const Server *server);
+
+		/// Moves the socket of a finished handshake to the thread of |server|
+		/// and posts |he| to it. Returns false, without taking ownership of
+		/// |he|, if the server is gone. Must be called on the socket's thread.
+		bool deliver(Server *server, HandshakeEvent *he, QSslSocket *sock);
+};
+
+#endif
@@ -84,20 +84,75 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	}
 	MSG_SETUP(ServerUser::Connected);
 
-	Channel *root = qhChannels.value(0);
-	Channel *c;
+	// The login is already waiting for an authenticator reply.
+	if (uSource->uiAuthRequest)
+		return;
 
 	uSource->qsName = u8(msg.username());
 
-	bool ok = false;
-	bool nameok = validateUserName(uSource->qsName);
 	QString pw = u8(msg.password());
 
+	// A user of the murmur we took over from picks up its session again,
+	// without going through the password check or an authenticator.
+	ResumeState rs;
+	if (takeResume(uSource, rs)) {
+		uSource->qsName = rs.qsName;
+		finishAuthenticate(uSource, msg, (rs.iId >= 0) ? rs.iId : -2, &rs);
+		return;
+	}
+
+	// Reuse a recent authenticator reply for the same credentials.
+	const QString cacheKey = authCacheKey(uSource->qsName, pw, uSource->qsHash);
+	QHash<QString, CachedAuthentication>::iterator cached = qhAuthCache.find(cacheKey);
+	if (cached != qhAuthCache.end()) {
+		if (isAuthCacheValid(cached.value())) {
+			const CachedAuthentication ca = cached.value();
+			if (ca.iResult >= 0) {
+				if (! ca.qsName.isEmpty())
+					uSource->qsName = ca.qsName;
+				if (! ca.qslGroups.isEmpty())
+					setTempGroups(ca.iResult, uSource->uiSession, NULL, ca.qslGroups);
+			}
+			finishAuthenticate(uSource, msg, ca.iResult);
+			return;
+		}
+		qhAuthCache.erase(cached);
+	}
+
+	// Let an asynchronous authenticator handle the login without blocking
+	// the main thread. The login continues in authenticateAsyncResult().
+	bool pending = false;
+	const quint64 request = nextAuthRequest();
+	emit authenticateAsyncSig(pending, request, uSource->qsName, uSource->peerCertificateChain(), uSource->qsHash, uSource->bVerified, pw);
+	if (pending) {
+		PendingAuthentication pa;
+		pa.uiSession = uSource->uiSession;
+		pa.mpaMessage = msg;
+		pa.qsCacheKey = cacheKey;
+		qhPendingAuth.insert(request, pa);
+		uSource->uiAuthRequest = request;
+
+		if (! qtAuthTimeout->isActive())
+			qtAuthTimeout->start(250);
+		return;
+	}
+
 	// Fetch ID and stored username.
 	// Since this may call DBus, which may recall our dbus messages, this function needs
 	// to support re-entrancy, and also to support the fact that sessions may go away.
 	int id = authenticate(uSource->qsName, pw, uSource->uiSession, uSource->qslEmail, uSource->qsHash, uSource->bVerified, uSource->peerCertificateChain());
 
+	finishAuthenticate(uSource, msg, id);
+}
+
+void Server::finishAuthenticate(ServerUser *uSource, const MumbleProto::Authenticate &msg, int id, const ResumeState *resume) {
+	Channel *root = qhChannels.value(0);
+	Channel *c;
+
+	bool ok = false;
+	bool nameok = validateUserName(uSource->qsName);
+	QString pw = u8(msg.password());
+
 	uSource->iId = id >= 0 ? id : -1;
 
 	QString reason;
@@ -119,16 +174,12 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		ok = true;
 	}
 
+	// Only authenticated users can be ghosts; of two connections racing to
+	// authenticate, the later one finds the earlier.
 	ServerUser *uOld = NULL;
-	foreach(ServerUser *u, qhUsers) {
-		if (u == uSource)
-			continue;
-		if (((u->iId>=0) && (u->iId == uSource->iId)) ||
-		        (u->qsName.toLower() == uSource->qsName.toLower())) {
-			uOld = u;
-			break;
-		}
-	}
+	unsigned int oldSession;
+	if (srUsers.find(uSource->qsName, uSource->iId, uSource->uiSession, oldSession))
+		uOld = qhUsers.value(oldSession);
 
 	// Allow reuse of name from same IP
 	if (ok && uOld && (uSource->iId == -1)) {
@@ -152,7 +203,9 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	}
 
 	Channel *lc;
-	if (bRememberChan) {
+	if (resume) {
+		lc = qhChannels.value(resume->iChannel);
+	} else if (bRememberChan) {
 		lc = qhChannels.value(readLastChannel(uSource->iId));
 	} else {
 		lc = qhChannels.value(iDefaultChan);
@@ -216,6 +269,7 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 		fake_celt_support = true;
 	}
 	uSource->bOpus = msg.opus();
+	ccCodecs.add(uSource->qlCodecs, uSource->bOpus);
 	recheckCodecVersions(uSource);
 
 	MumbleProto::CodecVersion mpcv;
@@ -278,19 +332,38 @@ void Server::msgAuthenticate(ServerUser *uSource, MumbleProto::Authenticate &msg
 	// Transmit user profile
 	MumbleProto::UserState mpus;
 
+	if (resume) {
+		{
+			QWriteLocker wl(&qrwlVoiceThread);
+			uSource->bMute = resume->bMute;
+			uSource->bDeaf = resume->bDeaf;
+		}
+		uSource->bPrioritySpeaker = resume->bPrioritySpeaker;
+
+		if (uSource->bDeaf)
+			mpus.set_deaf(true);
+		else if (uSource->bMute)
+			mpus.set_mute(true);
+		if (uSource->bPrioritySpeaker)
+			mpus.set_priority_speaker(true);
+	}
+
 	userEnterChannel(uSource, lc, mpus);
 
 	{
 		QWriteLocker wl(&qrwlVoiceThread);
 		uSource->sState = ServerUser::Authenticated;
 	}
+	reindexUser(uSource);
 
 	mpus.set_session(uSource->uiSession);
 	mpus.set_name(u8(uSource->qsName));
 	if (uSource->iId >= 0) {
 		mpus.set_user_id(uSource->iId);
 
-		hashAssign(uSource->qbaTexture, uSource->qbaTextureHash, getUserTexture(uSource->iId));
+		QByteArray hash;
+		QByteArray texture = getUserTexture(uSource->iId, &hash);
+		assignTexture(uSource, texture, hash);
 
 		if (! uSource->qbaTextureHash.isEmpty())
 			mpus.set_texture_hash(blob(uSource->qbaTextureHash));
@@ -616,7 +689,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 			}
 		} else {
 			// For unregistered users or SuperUser only get the hash
-			hashAssign(pDstServerUser->qbaTexture, pDstServerUser->qbaTextureHash, qba);
+			assignTexture(pDstServerUser, qba);
 		}
 
 		// The texture will be sent out later in this function
@@ -738,6 +811,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 		int id = registerUser(info);
 		if (id > 0) {
 			pDstServerUser->iId = id;
+			reindexUser(pDstServerUser);
 			setLastChannel(pDstServerUser);
 			msg.set_user_id(id);
 			bDstAclChanged = true;
@@ -754,12 +828,12 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 		if (msg.has_texture() && (pDstServerUser->qbaTexture.length() >= 4) && (qFromBigEndian<unsigned int>(reinterpret_cast<const unsigned char *>(pDstServerUser->qbaTexture.constData())) != 600 * 60 * 4)) {
 			// This is a new style texture, don't send it because the client doesn't handle it correctly / crashes.
 			msg.clear_texture();
-			sendAll(msg, ~ 0x010202);
+			broadcastUserState(msg, ~ 0x010202);
 			msg.set_texture(blob(pDstServerUser->qbaTexture));
 		} else {
 			// This is an old style texture, empty texture or there was no texture in this packet,
 			// send the message unchanged.
-			sendAll(msg, ~ 0x010202);
+			broadcastUserState(msg, ~ 0x010202);
 		}
 
 		// Texture / comment handling for clients >= 1.2.2.
@@ -773,7 +847,7 @@ void Server::msgUserState(ServerUser *uSource, MumbleProto::UserState &msg) {
 			msg.set_comment_hash(blob(pDstServerUser->qbaCommentHash));
 		}
 
-		sendAll(msg, 0x010202);
+		broadcastUserState(msg, 0x010202);
 
 		if (bDstAclChanged)
 			clearACLCache(pDstServerUser);
@@ -1109,14 +1183,42 @@ void Server::msgChannelRemove(ServerUser *uSource, MumbleProto::ChannelRemove &m
 	removeChannel(c);
 }
 
-void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg) {
-	MSG_SETUP(ServerUser::Authenticated);
-	QMutexLocker qml(&qmCache);
+// Text messages longer than this (typically ones with inline images) are
+// validated on Server::qtpText instead of the main thread.
+#define TEXT_VALIDATE_ASYNC_LENGTH 8192
+// Text messages of a user that may wait for validation at once. Any more
+// are dropped, so a client can't queue up unbounded work and memory.
+#define TEXT_VALIDATE_MAX_PENDING 4
+
+class TextMessageValidator : public QRunnable {
+	private:
+		Q_DISABLE_COPY(TextMessageValidator)
+	protected:
+		Server *s;
+		unsigned int uiSession;
+		quint64 uiConnection;
+		MumbleProto::TextMessage mptm;
+		bool bAllowHTML;
+		int iMaxTextMessageLength, iMaxImageMessageLength;
+	public:
+		TextMessageValidator(Server *server, unsigned int session, quint64 connection, const MumbleProto::TextMessage &msg) : s(server), uiSession(session), uiConnection(connection), mptm(msg) {
+			bAllowHTML = server->bAllowHTML;
+			iMaxTextMessageLength = server->iMaxTextMessageLength;
+			iMaxImageMessageLength = server->iMaxImageMessageLength;
+		}
 
-	TextMessage tm; // for signal userTextMessage
+		void run() {
+			QString text = u8(mptm.message());
+			bool changed = false;
+			bool allowed = Server::isTextAllowed(text, changed, bAllowHTML, iMaxTextMessageLength, iMaxImageMessageLength);
 
-	QSet<ServerUser *> users;
-	QQueue<Channel *> q;
+			ExecEvent *ee = new ExecEvent(boost::bind(&Server::textMessageValidated, s, uiSession, uiConnection, mptm, text, allowed, changed));
+			QCoreApplication::postEvent(s, ee);
+		}
+};
+
+void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg) {
+	MSG_SETUP(ServerUser::Authenticated);
 
 	int res = 0;
 	emit textMessageFilterSig(res, uSource, msg);
@@ -1134,10 +1236,44 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 			return;
 	}
 
+	// Once one message of a user went to the pool, the following ones have to
+	// take the same way, or they could overtake it.
+	if ((uSource->iPendingTextMessages > 0) || (msg.message().size() > TEXT_VALIDATE_ASYNC_LENGTH)) {
+		if (uSource->iPendingTextMessages >= TEXT_VALIDATE_MAX_PENDING)
+			return;
+		++uSource->iPendingTextMessages;
+		qtpText->start(new TextMessageValidator(this, uSource->uiSession, uSource->uiConnection, msg));
+		return;
+	}
+
 	QString text = u8(msg.message());
 	bool changed = false;
+	bool allowed = isTextAllowed(text, changed);
+
+	sendTextMessage(uSource, msg, text, allowed, changed);
+}
+
+void Server::textMessageValidated(unsigned int session, quint64 connection, MumbleProto::TextMessage msg, QString text, bool allowed, bool changed) {
+	ServerUser *uSource = qhUsers.value(session);
+
+	// The session id might have been reused by someone who never sent this message.
+	if (! uSource || (uSource->uiConnection != connection) || (uSource->iPendingTextMessages <= 0))
+		return;
+
+	--uSource->iPendingTextMessages;
+
+	MSG_SETUP_NO_UNIDLE(ServerUser::Authenticated);
 
-	if (! isTextAllowed(text, changed)) {
+	sendTextMessage(uSource, msg, text, allowed, changed);
+}
+
+void Server::sendTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg, const QString &text, bool allowed, bool changed) {
+	TextMessage tm; // for signal userTextMessage
+
+	QSet<ServerUser *> users;
+	QQueue<Channel *> q;
+
+	if (! allowed) {
 		PERM_DENIED_TYPE(TextTooLong);
 		return;
 	}
@@ -1157,69 +1293,88 @@ void Server::msgTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg)
 	}
 
 	msg.set_actor(uSource->uiSession);
-	for (int i=0;i<msg.channel_id_size(); ++i) {
-		unsigned int id = msg.channel_id(i);
-
-		Channel *c = qhChannels.value(id);
-		if (! c)
-			return;
 
-		if (! ChanACL::hasPermission(uSource, c, ChanACL::TextMessage, &acCache)) {
-			PERM_DENIED(uSource, c, ChanACL::TextMessage);
-			return;
-		}
+	// Only the permission checks need the ACL cache. The denial and the
+	// fan-out below happen after it has been released again.
+	Channel *denied = NULL;
+	{
+		QMutexLocker qml(&qmCache);
 
-		foreach(User *p, c->qlUsers)
-			users.insert(static_cast<ServerUser *>(p));
+		for (int i=0;i<msg.channel_id_size(); ++i) {
+			unsigned int id = msg.channel_id(i);
 
-		tm.qlChannels.append(id);
-	}
+			Channel *c = qhChannels.value(id);
+			if (! c)
+				return;
 
-	for (int i=0;i<msg.tree_id_size(); ++i) {
-		unsigned int id = msg.tree_id(i);
+			if (! ChanACL::hasPermission(uSource, c, ChanACL::TextMessage, &acCache)) {
+				denied = c;
+				break;
+			}
 
-		Channel *c = qhChannels.value(id);
-		if (! c)
-			return;
+			foreach(User *p, c->qlUsers)
+				users.insert(static_cast<ServerUser *>(p));
 
-		if (! ChanACL::hasPermission(uSource, c, ChanACL::TextMessage, &acCache)) {
-			PERM_DENIED(uSource, c, ChanACL::TextMessage);
-			return;
+			tm.qlChannels.append(id);
 		}
 
-		q.enqueue(c);
+		for (int i=0; !denied && i<msg.tree_id_size(); ++i) {
+			unsigned int id = msg.tree_id(i);
 
-		tm.qlTrees.append(id);
-	}
+			Channel *c = qhChannels.value(id);
+			if (! c)
+				return;
 
-	while (! q.isEmpty()) {
-		Channel *c = q.dequeue();
-		if (ChanACL::hasPermission(uSource, c, ChanACL::TextMessage, &acCache)) {
-			foreach(Channel *sub, c->qlChannels)
-				q.enqueue(sub);
-			foreach(User *p, c->qlUsers)
-				users.insert(static_cast<ServerUser *>(p));
+			if (! ChanACL::hasPermission(uSource, c, ChanACL::TextMessage, &acCache)) {
+				denied = c;
+				break;
+			}
+
+			q.enqueue(c);
+
+			tm.qlTrees.append(id);
 		}
-	}
 
-	for (int i=0;i < msg.session_size(); ++i) {
-		unsigned int session = msg.session(i);
-		ServerUser *u = qhUsers.value(session);
-		if (u) {
-			if (! ChanACL::hasPermission(uSource, u->cChannel, ChanACL::TextMessage, &acCache)) {
-				PERM_DENIED(uSource, u->cChannel, ChanACL::TextMessage);
-				return;
+		while (! denied && ! q.isEmpty()) {
+			Channel *c = q.dequeue();
+			if (ChanACL::hasPermission(uSource, c, ChanACL::TextMessage, &acCache)) {
+				foreach(Channel *sub, c->qlChannels)
+					q.enqueue(sub);
+				foreach(User *p, c->qlUsers)
+					users.insert(static_cast<ServerUser *>(p));
 			}
-			users.insert(u);
 		}
 
-		tm.qlSessions.append(session);
+		for (int i=0; !denied && i < msg.session_size(); ++i) {
+			unsigned int session = msg.session(i);
+			ServerUser *u = qhUsers.value(session);
+			if (u) {
+				if (! ChanACL::hasPermission(uSource, u->cChannel, ChanACL::TextMessage, &acCache)) {
+					denied = u->cChannel;
+					break;
+				}
+				users.insert(u);
+			}
+
+			tm.qlSessions.append(session);
+		}
+	}
+
+	if (denied) {
+		PERM_DENIED(uSource, denied, ChanACL::TextMessage);
+		return;
 	}
 
 	users.remove(uSource);
 
+	// The message has to arrive after any state change held back so far.
+	if (! qlPendingUserStates.isEmpty())
+		flushUserStates();
+
+	// Serialize once and hand the same buffer to every recipient.
+	QByteArray cache;
 	foreach(ServerUser *u, users)
-		sendMessage(u, msg);
+		u->sendMessage(msg, MessageHandler::TextMessage, cache);
 
 	emit userTextMessage(uSource, tm);
 }
@@ -1557,6 +1712,7 @@ void Server::msgUserList(ServerUser *uSource, MumbleProto::UserList &msg) {
 					foreach(ServerUser *serverUser, qhUsers) {
 						if (serverUser->iId == id) {
 							serverUser->qsName = name;
+							reindexUser(serverUser);
 							mpus.set_session(serverUser->uiSession);
 							break;
 						}
@@ -17,6 +17,10 @@
 #include "EnvUtils.h"
 #include "FFDHE.h"
 
+#ifdef Q_OS_UNIX
+#include "Handoff.h"
+#endif
+
 #if defined(USE_QSSLDIFFIEHELLMANPARAMETERS)
 # include <QSslDiffieHellmanParameters>
 #endif
@@ -51,6 +55,13 @@ MetaParams::MetaParams() {
 
 	iLogDays = 31;
 
+	bVoiceTrace = false;
+	iVoiceTraceSample = 0;
+	iVoiceTraceRing = 65536;
+	qsVoiceTraceFile = "murmur-voicetrace";
+
+	iBlobCacheSize = 16384;
+
 	iObfuscate = 0;
 	bSendVersion = true;
 	bBonjour = true;
@@ -58,10 +69,23 @@ MetaParams::MetaParams() {
 	bCertRequired = false;
 	bForceExternalAuth = false;
 
+	iAuthTimeout = 10;
+	iAuthCachePositive = 0;
+	iAuthCacheNegative = 0;
+
 	iBanTries = 10;
 	iBanTimeframe = 120;
 	iBanTime = 300;
 
+	iControlThreads = 0;
+	iHandshakeThreads = 0;
+	iVoiceThreads = 0;
+	bUdpBatch = false;
+	iBootThreads = 0;
+	bLazyBoot = false;
+	qsHandoffSocket = QString();
+	bOverloadControl = false;
+
 #ifdef Q_OS_UNIX
 	uiUid = uiGid = 0;
 #endif
@@ -70,6 +94,11 @@ MetaParams::MetaParams() {
 
 	iChannelNestingLimit = 10;
 
+	iUserStateDelay = 0;
+	iUnknownPeerAttempts = 16;
+	dAudibleRadius = 0.0;
+	iMaxTalkers = 0;
+
 	qrUserName = QRegExp(QLatin1String("[-=\\w\\[\\]\\{\\}\\(\\)\\@\\|\\.]+"));
 	qrChannelName = QRegExp(QLatin1String("[ \\-=\\w\\#\\[\\]\\{\\}\\(\\)\\@\\|]+"));
 
@@ -287,6 +316,9 @@ void MetaParams::read(QString fname) {
 	qsWelcomeText = typeCheckedFromSettings("welcometext", qsWelcomeText);
 	bCertRequired = typeCheckedFromSettings("certrequired", bCertRequired);
 	bForceExternalAuth = typeCheckedFromSettings("forceExternalAuth", bForceExternalAuth);
+	iAuthTimeout = typeCheckedFromSettings("authenticatortimeout", iAuthTimeout);
+	iAuthCachePositive = typeCheckedFromSettings("authenticatorcache", iAuthCachePositive);
+	iAuthCacheNegative = typeCheckedFromSettings("authenticatornegativecache", iAuthCacheNegative);
 
 	qsDatabase = typeCheckedFromSettings("database", qsDatabase);
 	iSQLiteWAL = typeCheckedFromSettings("sqlite_wal", iSQLiteWAL);
@@ -308,6 +340,16 @@ void MetaParams::read(QString fname) {
 	qsGRPCCert = typeCheckedFromSettings("grpccert", qsGRPCCert);
 	qsGRPCKey = typeCheckedFromSettings("grpckey", qsGRPCKey);
 
+	qsMetricsAddress = typeCheckedFromSettings("metrics", qsMetricsAddress);
+
+	iBlobCacheSize = typeCheckedFromSettings("texturecache", iBlobCacheSize);
+	qsBlobSpillPath = typeCheckedFromSettings("texturecachepath", qsBlobSpillPath);
+
+	bVoiceTrace = typeCheckedFromSettings("voicetrace", bVoiceTrace);
+	iVoiceTraceSample = typeCheckedFromSettings("voicetracesample", iVoiceTraceSample);
+	iVoiceTraceRing = typeCheckedFromSettings("voicetracering", iVoiceTraceRing);
+	qsVoiceTraceFile = typeCheckedFromSettings("voicetracefile", qsVoiceTraceFile);
+
 	iLogDays = typeCheckedFromSettings("logdays", iLogDays);
 
 	qsDBus = typeCheckedFromSettings("dbus", qsDBus);
@@ -326,6 +368,15 @@ void MetaParams::read(QString fname) {
 	iBanTimeframe = typeCheckedFromSettings("autobanTimeframe", iBanTimeframe);
 	iBanTime = typeCheckedFromSettings("autobanTime", iBanTime);
 
+	iControlThreads = typeCheckedFromSettings("controlthreads", iControlThreads);
+	iHandshakeThreads = typeCheckedFromSettings("sslhandshakethreads", iHandshakeThreads);
+	iVoiceThreads = typeCheckedFromSettings("voicethreads", iVoiceThreads);
+	bUdpBatch = typeCheckedFromSettings("udpbatch", bUdpBatch);
+	iBootThreads = typeCheckedFromSettings("bootthreads", iBootThreads);
+	bLazyBoot = typeCheckedFromSettings("lazyboot", bLazyBoot);
+	qsHandoffSocket = typeCheckedFromSettings("handoffsocket", qsHandoffSocket);
+	bOverloadControl = typeCheckedFromSettings("overloadcontrol", bOverloadControl);
+
 	qvSuggestVersion = MumbleVersion::getRaw(qsSettings->value("suggestVersion").toString());
 	if (qvSuggestVersion.toUInt() == 0)
 		qvSuggestVersion = QVariant();
@@ -341,6 +392,10 @@ void MetaParams::read(QString fname) {
 	iOpusThreshold = typeCheckedFromSettings("opusthreshold", iOpusThreshold);
 
 	iChannelNestingLimit = typeCheckedFromSettings("channelnestinglimit", iChannelNestingLimit);
+	iUserStateDelay = typeCheckedFromSettings("userstatedelay", iUserStateDelay);
+	iUnknownPeerAttempts = typeCheckedFromSettings("unknownpeerattempts", iUnknownPeerAttempts);
+	dAudibleRadius = typeCheckedFromSettings("audibleradius", dAudibleRadius);
+	iMaxTalkers = typeCheckedFromSettings("maxtalkers", iMaxTalkers);
 
 #ifdef Q_OS_UNIX
 	qsName = qsSettings->value("uname").toString();
@@ -414,6 +469,9 @@ void MetaParams::read(QString fname) {
 	qmConfig.insert(QLatin1String("suggestpushtotalk"), qvSuggestPushToTalk.isNull() ? QString() : qvSuggestPushToTalk.toString());
 	qmConfig.insert(QLatin1String("opusthreshold"), QString::number(iOpusThreshold));
 	qmConfig.insert(QLatin1String("channelnestinglimit"), QString::number(iChannelNestingLimit));
+	qmConfig.insert(QLatin1String("userstatedelay"), QString::number(iUserStateDelay));
+	qmConfig.insert(QLatin1String("audibleradius"), QString::number(dAudibleRadius));
+	qmConfig.insert(QLatin1String("maxtalkers"), QString::number(iMaxTalkers));
 	qmConfig.insert(QLatin1String("sslCiphers"), qsCiphers);
 	qmConfig.insert(QLatin1String("sslDHParams"), QString::fromLatin1(qbaDHParams.constData()));
 }
@@ -616,7 +674,90 @@ bool MetaParams::loadSSLSettings() {
 	return true;
 }
 
+ControlThread::ControlThread(QObject *p) : QThread(p) {
+}
+
+void ControlThread::run() {
+	exec();
+	ServerDB::closeThreadDatabase();
+}
+
+BootThread::BootThread(QObject *p) : QThread(p) {
+}
+
+void BootThread::run() {
+	QThread *main = QCoreApplication::instance()->thread();
+
+	forever {
+		int srvnum;
+		{
+			QMutexLocker l(&meta->qmBoot);
+			if (meta->qlBootPending.isEmpty())
+				break;
+			srvnum = meta->qlBootPending.takeFirst();
+		}
+
+		Server *s = new Server(srvnum, NULL);
+		if (! s->bValid) {
+			delete s;
+			s = NULL;
+		} else {
+			// moveToThread() has to be called on the thread the server is on.
+			s->moveToThread(main);
+		}
+
+		{
+			QMutexLocker l(&meta->qmBoot);
+			meta->qhBootLoaded.insert(srvnum, s);
+		}
+		emit loaded();
+	}
+
+	ServerDB::closeThreadDatabase();
+}
+
 Meta::Meta() {
+	bHandedOff = false;
+#ifdef Q_OS_UNIX
+	hoHandoff = NULL;
+#endif
+	bsBlobs.setLimits(static_cast<qint64>(mp.iBlobCacheSize) * 1024, mp.qsBlobSpillPath);
+	hpHandshakes.setThreads(mp.iHandshakeThreads);
+	veVoice.setThreads(mp.iVoiceThreads);
+
+	if (mp.iControlThreads > 0) {
+		// The RPC interfaces and Bonjour call into the servers from the
+		// main thread, so they can't be combined with control threads.
+		QStringList conflicts;
+#ifdef USE_DBUS
+		if (! mp.qsDBus.isEmpty())
+			conflicts << QLatin1String("dbus");
+#endif
+#ifdef USE_ICE
+		if (! mp.qsIceEndpoint.isEmpty())
+			conflicts << QLatin1String("ice");
+#endif
+#ifdef USE_GRPC
+		if (! mp.qsGRPCAddress.isEmpty())
+			conflicts << QLatin1String("grpc");
+#endif
+#ifdef USE_BONJOUR
+		if (mp.bBonjour)
+			conflicts << QLatin1String("bonjour");
+#endif
+		if (! conflicts.isEmpty()) {
+			qWarning("Meta: controlthreads can not be used together with %s, running all servers on the main thread", qPrintable(conflicts.join(QLatin1String(", "))));
+		} else {
+			for (int i = 0; i < mp.iControlThreads; ++i) {
+				ControlThread *ct = new ControlThread(this);
+				ct->setObjectName(QString::fromLatin1("Control %1").arg(i));
+				ct->start();
+				qlControlThreads << ct;
+			}
+			qWarning("Meta: Running servers on %d control threads", qlControlThreads.count());
+		}
+	}
+
 #ifdef Q_OS_WIN
 	QOS_VERSION qvVer;
 	qvVer.MajorVersion = 1;
@@ -638,6 +779,11 @@ Meta::Meta() {
 }
 
 Meta::~Meta() {
+	foreach(ControlThread *ct, qlControlThreads) {
+		ct->quit();
+		ct->wait();
+	}
+
 #ifdef Q_OS_WIN
 	if (hQoS) {
 		QOSCloseHandle(hQoS);
@@ -655,18 +801,22 @@ bool Meta::reloadSSLSettings() {
 	// Re-initialize certificates for all
 	// virtual servers using the Meta server's
 	// certificate and private key.
-	foreach (Server *s, qhServers) {
-		if (s->bUsingMetaCert) {
-			s->log("Reloading certificates...");
-			s->initializeCert();
-		} else {
-			s->log("Not reloading certificates; server does not use Meta certificate");
-		}
-	}
+	foreach (Server *s, qhServers)
+		QMetaObject::invokeMethod(s, "reloadMetaCertificate");
 
 	return true;
 }
 
+void Meta::dumpVoiceTraces() {
+	if (! mp.bVoiceTrace || mp.iVoiceTraceSample <= 0) {
+		qWarning("Voice trace sampling is not enabled");
+		return;
+	}
+
+	foreach(Server *s, qhServers)
+		s->dumpVoiceTrace();
+}
+
 void Meta::getOSInfo() {
 	qsOS = OSInfo::getOS();
 	qsOSVersion = OSInfo::getOSDisplayableVersion();
@@ -674,12 +824,100 @@ void Meta::getOSInfo() {
 
 void Meta::bootAll() {
 	QList<int> ql = ServerDB::getBootServers();
-	foreach(int snum, ql)
-		boot(snum);
+
+	bool parallel = (mp.iBootThreads > 0);
+#ifdef USE_BONJOUR
+	// The Bonjour registration has to be set up on the thread the server
+	// runs on.
+	if (parallel && mp.bBonjour) {
+		qWarning("Meta: bootthreads can not be used together with bonjour, loading servers one after another");
+		parallel = false;
+	}
+#endif
+	if (! parallel) {
+		foreach(int snum, ql)
+			boot(snum);
+		bootFinished();
+		return;
+	}
+
+	int pending;
+	{
+		QMutexLocker l(&qmBoot);
+		foreach(int snum, ql) {
+			if (qhServers.contains(snum) || qsBooting.contains(snum))
+				continue;
+			qlBootPending << snum;
+			qsBooting.insert(snum);
+		}
+		pending = qlBootPending.count();
+	}
+
+	const int threads = qMin(mp.iBootThreads, pending);
+	for (int i = 0; i < threads; ++i) {
+		BootThread *bt = new BootThread(this);
+		bt->setObjectName(QString::fromLatin1("Boot %1").arg(i));
+		connect(bt, SIGNAL(loaded()), this, SLOT(bootLoaded()), Qt::QueuedConnection);
+		bt->start();
+		qlBootThreads << bt;
+	}
+	qWarning("Meta: Loading %d servers on %d threads", pending, threads);
+
+	if (! mp.bLazyBoot)
+		waitBoot();
+}
+
+void Meta::bootLoaded() {
+	QHash<int, Server *> loaded;
+	{
+		QMutexLocker l(&qmBoot);
+		loaded = qhBootLoaded;
+		qhBootLoaded.clear();
+	}
+
+	QList<int> ql = loaded.keys();
+	qSort(ql);
+	foreach(int srvnum, ql) {
+		qsBooting.remove(srvnum);
+		Server *s = loaded.value(srvnum);
+		if (s)
+			start(s);
+	}
+
+	if (qsBooting.isEmpty())
+		bootFinished();
+}
+
+void Meta::waitBoot() {
+	foreach(BootThread *bt, qlBootThreads) {
+		bt->wait();
+		delete bt;
+	}
+	qlBootThreads.clear();
+
+	bootLoaded();
+}
+
+void Meta::bootFinished() {
+#ifdef Q_OS_UNIX
+	// Sockets no server was booted for.
+	Handoff::closeUnclaimed();
+
+	if (! mp.qsHandoffSocket.isEmpty() && ! hoHandoff) {
+		hoHandoff = new Handoff(mp.qsHandoffSocket, this);
+		if (hoHandoff->listen())
+			connect(hoHandoff, SIGNAL(handedOff()), this, SLOT(handedOff()));
+	}
+#endif
+}
+
+void Meta::handedOff() {
+	bHandedOff = true;
+	QCoreApplication::instance()->quit();
 }
 
 bool Meta::boot(int srvnum) {
-	if (qhServers.contains(srvnum))
+	if (qhServers.contains(srvnum) || qsBooting.contains(srvnum))
 		return false;
 	if (! ServerDB::serverExists(srvnum))
 		return false;
@@ -688,7 +926,22 @@ bool Meta::boot(int srvnum) {
 		delete s;
 		return false;
 	}
-	qhServers.insert(srvnum, s);
+
+	start(s);
+	return true;
+}
+
+void Meta::start(Server *s) {
+	// The server is set up on the main thread or a boot thread, and only
+	// then handed over to the control thread that runs its event loop.
+	if (! qlControlThreads.isEmpty()) {
+		s->setParent(NULL);
+		s->moveToThread(controlThread());
+	} else {
+		s->setParent(this);
+	}
+
+	qhServers.insert(s->iServerNum, s);
 	emit started(s);
 
 #ifdef Q_OS_UNIX
@@ -717,30 +970,68 @@ bool Meta::boot(int srvnum) {
 			qCritical("Current booted servers require minimum %d file descriptors when all slots are full, but only %lu file descriptors are allowed for this process. Your server will crash and burn; read the FAQ for details.", sockets, static_cast<unsigned long>(r.rlim_cur));
 	}
 #endif
-
-	return true;
 }
 
 void Meta::kill(int srvnum) {
 	Server *s = qhServers.take(srvnum);
 	if (!s)
 		return;
+	reclaim(s);
 	emit stopped(s);
 	delete s;
 }
 
 void Meta::killAll() {
+	waitBoot();
+
 	foreach(Server *s, qhServers) {
+		reclaim(s);
+#ifdef Q_OS_UNIX
+		// Let the users resume their sessions on the murmur we handed off to.
+		if (bHandedOff)
+			hoHandoff->sendSessions(s);
+#endif
 		emit stopped(s);
 		delete s;
 	}
 	qhServers.clear();
+
+#ifdef Q_OS_UNIX
+	if (bHandedOff)
+		hoHandoff->finish();
+#endif
+}
+
+QThread *Meta::controlThread() const {
+	QHash<QThread *, int> load;
+	foreach(ControlThread *ct, qlControlThreads)
+		load.insert(ct, 0);
+	foreach(Server *s, qhServers)
+		if (load.contains(s->thread()))
+			++load[s->thread()];
+
+	QThread *best = qlControlThreads.first();
+	foreach(ControlThread *ct, qlControlThreads)
+		if (load.value(ct) < load.value(best))
+			best = ct;
+	return best;
+}
+
+void Meta::reclaim(Server *s) {
+	if (s->thread() == thread())
+		return;
+
+	// moveToThread() has to be called on the thread the server is on.
+	QMetaObject::invokeMethod(s, "leaveControlThread", Qt::BlockingQueuedConnection);
+	s->setParent(this);
 }
 
 bool Meta::banCheck(const QHostAddress &addr) {
 	if ((mp.iBanTries == 0) || (mp.iBanTimeframe == 0))
 		return false;
 
+	QMutexLocker l(&qmBans);
+
 	if (qhBans.contains(addr)) {
 		Timer t = qhBans.value(addr);
 		if (t.elapsed() < (1000000ULL * mp.iBanTime))
@@ -8,6 +8,9 @@
 
 #include <QtCore/QDir>
 #include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
 #include <QtCore/QUrl>
 #include <QtCore/QVariant>
 #include <QtNetwork/QHostAddress>
@@ -19,8 +22,12 @@
 #endif
 
 #include "Timer.h"
+#include "BlobStore.h"
+#include "HandshakePool.h"
+#include "VoiceEngine.h"
 
 class Server;
+class Handoff;
 class QSettings;
 
 class MetaParams {
@@ -39,6 +46,19 @@ public:
 	int iMaxImageMessageLength;
 	int iOpusThreshold;
 	int iChannelNestingLimit;
+	/// Milliseconds UserState changes made by clients are held back, so
+	/// that several changes of a user can be broadcast as one message.
+	/// 0 broadcasts every change right away.
+	int iUserStateDelay;
+	/// Number of users behind the same address a datagram from an unknown
+	/// port is tried against, most likely first. 0 tries all of them.
+	int iUnknownPeerAttempts;
+	/// Distance beyond which positional voice isn't forwarded to listeners
+	/// in the same game context. 0 forwards it regardless of distance.
+	double dAudibleRadius;
+	/// Number of users whose voice is forwarded in a channel at the same
+	/// time; priority speakers don't count. 0 forwards everybody.
+	int iMaxTalkers;
 	/// If true the old SHA1 password hashing is used instead of PBKDF2
 	bool legacyPasswordHash;
 	/// Contains the default number of PBKDF2 iterations to use
@@ -52,10 +72,54 @@ public:
 	bool bCertRequired;
 	bool bForceExternalAuth;
 
+	/// Seconds to wait for an asynchronous authenticator reply before
+	/// rejecting the login as a temporary failure.
+	int iAuthTimeout;
+	/// Seconds to remember successful and failed authenticator replies.
+	/// 0 disables the cache.
+	int iAuthCachePositive;
+	int iAuthCacheNegative;
+
 	int iBanTries;
 	int iBanTimeframe;
 	int iBanTime;
 
+	/// Number of threads the control planes (TLS connections, message
+	/// handling and timers) of the virtual servers are spread over.
+	/// 0 runs all of them on the main thread.
+	int iControlThreads;
+
+	/// Number of threads TLS handshakes of incoming connections run on.
+	/// 0 runs them on the thread of the virtual server.
+	int iHandshakeThreads;
+
+	/// Number of threads receiving the voice of all virtual servers.
+	/// 0 starts a voice thread for each virtual server instead.
+	int iVoiceThreads;
+
+	/// If true, the datagrams a voice packet is forwarded as are sent
+	/// with one sendmmsg() call instead of one sendmsg() call each.
+	bool bUdpBatch;
+
+	/// Number of threads bootAll() loads the virtual servers on, so their
+	/// database reads and certificate generation overlap. 0 loads them one
+	/// after another on the main thread.
+	int iBootThreads;
+
+	/// If true, bootAll() returns without waiting for the boot threads, and
+	/// each virtual server starts as soon as it has been loaded.
+	bool bLazyBoot;
+
+	/// Path of the Unix domain socket a new murmur fetches the sockets and
+	/// sessions of the running one from, to take over serving them. Empty
+	/// disables it.
+	QString qsHandoffSocket;
+
+	/// If true, the voice thread sheds positional data, whispers and then
+	/// normal speech of everyone but priority speakers when it falls
+	/// behind. See OverloadControl.
+	bool bOverloadControl;
+
 	QString qsDatabase;
 	int iSQLiteWAL;
 	QString qsDBDriver;
@@ -83,6 +147,26 @@ public:
 	QString qsGRPCCert;
 	QString qsGRPCKey;
 
+	/// Address of the Prometheus metrics endpoint, either "host:port"
+	/// or "unix:/path/to/socket". Disabled if empty.
+	QString qsMetricsAddress;
+
+	/// If true, the voice threads timestamp every packet and export
+	/// per-stage latency histograms. See VoiceTrace.
+	bool bVoiceTrace;
+	/// Store one in every iVoiceTraceSample traced packets in a ring of
+	/// iVoiceTraceRing records. 0 disables sampling.
+	int iVoiceTraceSample;
+	int iVoiceTraceRing;
+	/// Path prefix the sampled packets are written to, suffixed with the server id.
+	QString qsVoiceTraceFile;
+
+	/// Size in KiB of the cache of textures that are no longer used by any
+	/// online user. See BlobStore.
+	int iBlobCacheSize;
+	/// Directory textures evicted from the cache are spilled to. Disabled if empty.
+	QString qsBlobSpillPath;
+
 	QString qsRegName;
 	QString qsRegPassword;
 	QString qsRegHost;
@@ -151,17 +235,84 @@ private:
 	T typeCheckedFromSettings(const QString &name, const T &variable, QSettings *settings = NULL);
 };
 
+/// Event loop thread that runs the control plane of one or more
+/// virtual servers. See MetaParams::iControlThreads.
+class ControlThread : public QThread {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(ControlThread)
+	protected:
+		void run();
+	public:
+		ControlThread(QObject *p = NULL);
+};
+
+/// Thread that loads virtual servers for Meta::bootAll(), and hands them
+/// over to the main thread to be started. See MetaParams::iBootThreads.
+class BootThread : public QThread {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(BootThread)
+	protected:
+		void run();
+	public:
+		BootThread(QObject *p = NULL);
+	signals:
+		/// Emitted from the thread whenever it has loaded a server.
+		void loaded();
+};
+
 class Meta : public QObject {
 	private:
 		Q_OBJECT;
 		Q_DISABLE_COPY(Meta);
+		friend class BootThread;
+	protected:
+		QList<ControlThread *> qlControlThreads;
+		QList<BootThread *> qlBootThreads;
+
+		/// Protects qlBootPending and qhBootLoaded.
+		QMutex qmBoot;
+		/// Servers the boot threads have yet to load.
+		QList<int> qlBootPending;
+		/// Servers the boot threads have loaded, or NULL if loading failed.
+		QHash<int, Server *> qhBootLoaded;
+		/// Servers being loaded by the boot threads. Only used on the main thread.
+		QSet<int> qsBooting;
+
+		/// Registers and announces a freshly loaded server.
+		void start(Server *s);
+		/// Waits for the boot threads, and starts what they loaded.
+		void waitBoot();
+		/// Called once all boot servers have been started.
+		void bootFinished();
+
+		/// Returns the control thread hosting the fewest servers.
+		QThread *controlThread() const;
+		/// Moves s back to the main thread, so it can be deleted.
+		void reclaim(Server *s);
 	public:
 		static MetaParams mp;
 		QHash<int, Server *> qhServers;
+		/// Protects qhAttempts and qhBans, which are checked by
+		/// every control thread.
+		QMutex qmBans;
 		QHash<QHostAddress, QList<Timer> > qhAttempts;
 		QHash<QHostAddress, Timer> qhBans;
 		QString qsOS, qsOSVersion;
 		Timer tUptime;
+		/// Textures of the users of all virtual servers.
+		BlobStore bsBlobs;
+		/// Runs TLS handshakes for all virtual servers.
+		HandshakePool hpHandshakes;
+		/// Receives voice for all virtual servers, if voicethreads is set.
+		VoiceEngine veVoice;
+#ifdef Q_OS_UNIX
+		/// Hands the sockets over to a new murmur, if handoffsocket is set.
+		Handoff *hoHandoff;
+#endif
+		/// Set once another murmur took over, which then owns the pid file.
+		bool bHandedOff;
 
 #ifdef Q_OS_WIN
 		static HANDLE hQoS;
@@ -176,6 +327,10 @@ class Meta : public QObject {
 		/// Meta server's certificate and private key.
 		bool reloadSSLSettings();
 
+		/// Writes the sampled voice trace of every running
+		/// virtual server to disk. See VoiceTrace.
+		void dumpVoiceTraces();
+
 		void bootAll();
 		bool boot(int);
 		bool banCheck(const QHostAddress &);
@@ -184,6 +339,10 @@ class Meta : public QObject {
 		void getOSInfo();
 		void connectListener(QObject *);
 		static void getVersion(int &major, int &minor, int &patch, QString &string);
+	protected slots:
+		void bootLoaded();
+		/// Quits once the sockets have been handed over to another murmur.
+		void handedOff();
 	signals:
 		void started(Server *);
 		void stopped(Server *);
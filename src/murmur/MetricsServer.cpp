@@ -0,0 +1,248 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "MetricsServer.h"
+
+#include "Meta.h"
+#include "Server.h"
+#include "ServerDB.h"
+#include "ServerMetrics.h"
+#include "ServerSnapshot.h"
+
+// Largest request header we are willing to buffer.
+#define METRICS_MAX_REQUEST 4096
+
+struct CounterFamily {
+	const char *name;
+	const char *help;
+	MetricCounter ServerMetricsShard::*member;
+};
+
+static const CounterFamily counterFamilies[] = {
+	{ "murmur_udp_packets_received_total", "UDP datagrams received.", &ServerMetricsShard::cUdpPacketsIn },
+	{ "murmur_udp_bytes_received_total", "UDP payload bytes received.", &ServerMetricsShard::cUdpBytesIn },
+	{ "murmur_udp_packets_sent_total", "UDP datagrams sent.", &ServerMetricsShard::cUdpPacketsOut },
+	{ "murmur_udp_bytes_sent_total", "UDP payload bytes sent.", &ServerMetricsShard::cUdpBytesOut },
+	{ "murmur_udp_send_batch_calls_total", "sendmmsg() calls made to send batched datagrams.", &ServerMetricsShard::cUdpSendCalls },
+	{ "murmur_tcp_voice_packets_sent_total", "Voice packets tunneled through the control channel.", &ServerMetricsShard::cTcpVoicePacketsOut },
+	{ "murmur_voice_packets_total", "Voice packets processed.", &ServerMetricsShard::cVoicePackets },
+	{ "murmur_voice_packets_dropped_total", "Voice packets dropped by the bandwidth limit.", &ServerMetricsShard::cVoiceDropped },
+	{ "murmur_udp_receive_queue_drops_total", "UDP datagrams dropped by the kernel because the receive queue was full.", &ServerMetricsShard::cKernelDrops },
+	{ "murmur_overload_escalations_total", "Times the voice thread started shedding more load.", &ServerMetricsShard::cOverloadEscalations },
+	{ "murmur_overload_shed_positional_total", "Voice packets forwarded without their positional data because of overload.", &ServerMetricsShard::cShedPositional },
+	{ "murmur_overload_shed_whisper_total", "Whispers and shouts dropped because of overload.", &ServerMetricsShard::cShedWhisper },
+	{ "murmur_overload_shed_speech_total", "Voice packets dropped because of overload.", &ServerMetricsShard::cShedSpeech },
+	{ "murmur_voice_positional_culled_total", "Positional voice packets not forwarded because the listener was out of earshot.", &ServerMetricsShard::cPositionalCulled },
+	{ "murmur_voice_talkers_limited_total", "Voice packets not forwarded because too many users were talking in the channel.", &ServerMetricsShard::cTalkersLimited },
+	{ "murmur_decrypt_failures_total", "UDP datagrams that failed to decrypt.", &ServerMetricsShard::cDecryptFailures },
+	{ "murmur_unknown_peer_packets_total", "UDP datagrams from an unknown address and port.", &ServerMetricsShard::cUnknownPeerAttempts },
+	{ "murmur_unknown_peer_dropped_total", "UDP datagrams from an unknown peer that matched no user.", &ServerMetricsShard::cUnknownPeerDropped },
+	{ "murmur_unknown_peer_decrypts_total", "Decryption attempts made to identify unknown peers.", &ServerMetricsShard::cUnknownPeerDecrypts },
+	{ "murmur_unknown_peer_scans_total", "Unknown peers for which all users of the address were tried.", &ServerMetricsShard::cUnknownPeerScans },
+	{ "murmur_pings_total", "UDP pings answered.", &ServerMetricsShard::cPings },
+	{ "murmur_rpc_events_dropped_total", "gRPC server events dropped because a listener did not keep up.", &ServerMetricsShard::cRpcEventsDropped },
+	{ "murmur_rpc_events_coalesced_total", "gRPC server events replaced by a later state update before being sent.", &ServerMetricsShard::cRpcEventsCoalesced },
+	{ "murmur_rpc_event_batches_total", "gRPC server event batches sent.", &ServerMetricsShard::cRpcEventBatches },
+	{ "murmur_tls_handshakes_total", "TLS handshakes completed.", &ServerMetricsShard::cTlsHandshakes },
+	{ "murmur_tls_handshake_failures_total", "Connections closed or refused before their TLS handshake completed.", &ServerMetricsShard::cTlsHandshakeFailures },
+	{ "murmur_user_states_coalesced_total", "User state changes merged into a change still waiting to be broadcast.", &ServerMetricsShard::cUserStatesCoalesced },
+};
+
+struct HistogramFamily {
+	const char *name;
+	const char *help;
+	MetricHistogram ServerMetricsShard::*member;
+	double scale;
+};
+
+static const HistogramFamily histogramFamilies[] = {
+	{ "murmur_voice_forward_seconds", "Time from receiving a voice datagram until it was forwarded.", &ServerMetricsShard::hVoiceForwardUsec, 1e-6 },
+	{ "murmur_voice_fanout", "Recipients per voice packet.", &ServerMetricsShard::hVoiceFanout, 1.0 },
+	{ "murmur_voice_lock_wait_seconds", "Time the voice thread waited for the server read lock.", &ServerMetricsShard::hVoiceLockWaitUsec, 1e-6 },
+	{ "murmur_acl_cache_lock_wait_seconds", "Time spent waiting for the ACL cache lock while routing voice.", &ServerMetricsShard::hCacheLockWaitUsec, 1e-6 },
+	{ "murmur_rpc_event_lag_seconds", "Time from a gRPC server event until its batch was delivered.", &ServerMetricsShard::hRpcEventLagUsec, 1e-6 },
+	{ "murmur_rpc_event_batch_size", "Events per gRPC server event batch.", &ServerMetricsShard::hRpcEventBatchSize, 1.0 },
+	{ "murmur_tls_handshake_seconds", "Duration of completed TLS handshakes.", &ServerMetricsShard::hTlsHandshakeUsec, 1e-6 },
+};
+
+MetricsServer::MetricsServer(const QString &address, QObject *p) : QObject(p), qtsServer(NULL), qlsServer(NULL) {
+	if (address.startsWith(QLatin1String("unix:"))) {
+		const QString path = address.mid(5);
+
+		qlsServer = new QLocalServer(this);
+		QLocalServer::removeServer(path);
+		if (! qlsServer->listen(path)) {
+			qWarning("MetricsServer: Failed to listen on %s: %s", qPrintable(path), qPrintable(qlsServer->errorString()));
+			return;
+		}
+		connect(qlsServer, SIGNAL(newConnection()), this, SLOT(newLocalConnection()));
+		qWarning("MetricsServer: Endpoint \"%s\" running", qPrintable(address));
+		return;
+	}
+
+	const int idx = address.lastIndexOf(QLatin1Char(':'));
+	QString host = (idx >= 0) ? address.left(idx) : QString();
+	bool ok = false;
+	const quint16 port = static_cast<quint16>(address.mid(idx + 1).toUInt(&ok));
+	if (! ok || port == 0) {
+		qWarning("MetricsServer: Invalid address \"%s\"", qPrintable(address));
+		return;
+	}
+
+	if (host.startsWith(QLatin1Char('[')) && host.endsWith(QLatin1Char(']')))
+		host = host.mid(1, host.length() - 2);
+
+	QHostAddress qha(QHostAddress::Any);
+	if (! host.isEmpty() && ! qha.setAddress(host)) {
+		qWarning("MetricsServer: Invalid address \"%s\"", qPrintable(address));
+		return;
+	}
+
+	qtsServer = new QTcpServer(this);
+	if (! qtsServer->listen(qha, port)) {
+		qWarning("MetricsServer: Failed to listen on %s: %s", qPrintable(address), qPrintable(qtsServer->errorString()));
+		return;
+	}
+	connect(qtsServer, SIGNAL(newConnection()), this, SLOT(newTcpConnection()));
+	qWarning("MetricsServer: Endpoint \"%s\" running", qPrintable(address));
+}
+
+MetricsServer::~MetricsServer() {
+	qWarning("MetricsServer: Shutdown complete");
+}
+
+bool MetricsServer::isListening() const {
+	return (qtsServer && qtsServer->isListening()) || (qlsServer && qlsServer->isListening());
+}
+
+void MetricsServer::newTcpConnection() {
+	while (QTcpSocket *sock = qtsServer->nextPendingConnection()) {
+		connect(sock, SIGNAL(readyRead()), this, SLOT(readyRead()));
+		connect(sock, SIGNAL(disconnected()), sock, SLOT(deleteLater()));
+	}
+}
+
+void MetricsServer::newLocalConnection() {
+	while (QLocalSocket *sock = qlsServer->nextPendingConnection()) {
+		connect(sock, SIGNAL(readyRead()), this, SLOT(readyRead()));
+		connect(sock, SIGNAL(disconnected()), sock, SLOT(deleteLater()));
+	}
+}
+
+void MetricsServer::readyRead() {
+	QIODevice *dev = qobject_cast<QIODevice *>(sender());
+	if (dev)
+		handleConnection(dev);
+}
+
+void MetricsServer::handleConnection(QIODevice *dev) {
+	// Leave the request in the device buffer until it is complete.
+	const QByteArray request = dev->peek(METRICS_MAX_REQUEST);
+	const int end = request.indexOf("\r\n\r\n");
+
+	QByteArray status;
+	QByteArray body;
+
+	if (end < 0) {
+		if (request.size() < METRICS_MAX_REQUEST)
+			return;
+		status = "431 Request Header Fields Too Large";
+	} else {
+		dev->read(end + 4);
+
+		const QList<QByteArray> line = request.left(request.indexOf("\r\n")).split(' ');
+		if (line.count() != 3 || ! line.at(2).startsWith("HTTP/")) {
+			status = "400 Bad Request";
+		} else if (line.at(0) != "GET") {
+			status = "405 Method Not Allowed";
+		} else if (line.at(1) != "/" && line.at(1) != "/metrics") {
+			status = "404 Not Found";
+		} else {
+			status = "200 OK";
+			body = collect();
+		}
+	}
+
+	QByteArray response = "HTTP/1.0 " + status + "\r\n";
+	response += "Content-Type: text/plain; version=0.0.4\r\n";
+	response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+	response += "Connection: close\r\n\r\n";
+	response += body;
+
+	disconnect(dev, SIGNAL(readyRead()), this, SLOT(readyRead()));
+	dev->write(response);
+
+	if (QTcpSocket *sock = qobject_cast<QTcpSocket *>(dev))
+		sock->disconnectFromHost();
+	else if (QLocalSocket *sock = qobject_cast<QLocalSocket *>(dev))
+		sock->disconnectFromServer();
+}
+
+QByteArray MetricsServer::collect() {
+	MetricsWriter mw;
+
+	QList<int> ids = meta->qhServers.keys();
+	qSort(ids);
+
+	QList<QByteArray> labels;
+	QList<Server *> servers;
+	foreach(int id, ids) {
+		labels << QByteArray("server=\"") + QByteArray::number(id) + '"';
+		servers << meta->qhServers.value(id);
+	}
+
+	// Users and channels may be owned by a control thread, so they are
+	// counted from the servers' snapshots.
+	QList<QSharedPointer<const ServerSnapshot> > snapshots;
+	foreach(int id, ids)
+		snapshots << ServerSnapshot::current(id);
+
+	mw.family("murmur_users", "gauge", "Connected users.");
+	for (int i = 0; i < servers.count(); ++i)
+		mw.sample("murmur_users", labels.at(i), snapshots.at(i) ? static_cast<quint64>(snapshots.at(i)->qhUsers.count()) : 0);
+
+	mw.family("murmur_channels", "gauge", "Channels.");
+	for (int i = 0; i < servers.count(); ++i)
+		mw.sample("murmur_channels", labels.at(i), snapshots.at(i) ? static_cast<quint64>(snapshots.at(i)->qmChannels.count()) : 0);
+
+	for (size_t f = 0; f < sizeof(counterFamilies) / sizeof(counterFamilies[0]); ++f) {
+		const CounterFamily &cf = counterFamilies[f];
+		mw.family(cf.name, "counter", cf.help);
+		for (int i = 0; i < servers.count(); ++i)
+			mw.sample(cf.name, labels.at(i), servers.at(i)->smMetrics.counter(cf.member));
+	}
+
+	for (size_t f = 0; f < sizeof(histogramFamilies) / sizeof(histogramFamilies[0]); ++f) {
+		const HistogramFamily &hf = histogramFamilies[f];
+		mw.family(hf.name, "histogram", hf.help);
+		for (int i = 0; i < servers.count(); ++i) {
+			MetricHistogram h;
+			servers.at(i)->smMetrics.histogram(hf.member, h);
+			mw.histogram(hf.name, labels.at(i), h, hf.scale);
+		}
+	}
+
+	if (Meta::mp.bVoiceTrace) {
+		mw.family("murmur_voice_trace_stage_seconds", "histogram", "Per-stage latency of traced voice packets.");
+		for (int i = 0; i < servers.count(); ++i) {
+			for (int stage = 0; stage < VoiceTrace::StageCount; ++stage) {
+				const QByteArray l = labels.at(i) + ",stage=\"" + VoiceTrace::stageName(stage) + '"';
+				mw.histogram("murmur_voice_trace_stage_seconds", l, servers.at(i)->vtTrace.hStages[stage], 1e-9);
+			}
+		}
+	}
+
+	const DatabaseMetrics &dbm = ServerDB::dbmMetrics;
+	mw.family("murmur_db_queries_total", "counter", "Database statements executed.");
+	mw.sample("murmur_db_queries_total", QByteArray(), dbm.cQueries.value());
+	mw.family("murmur_db_errors_total", "counter", "Database statements that failed.");
+	mw.sample("murmur_db_errors_total", QByteArray(), dbm.cErrors.value());
+	mw.family("murmur_db_query_seconds", "histogram", "Database statement execution time.");
+	mw.histogram("murmur_db_query_seconds", QByteArray(), dbm.hQueryUsec, 1e-6);
+
+	return mw.data();
+}
@@ -0,0 +1,48 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_METRICSSERVER_H_
+#define MUMBLE_MURMUR_METRICSSERVER_H_
+
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+
+/// Minimal HTTP/1.0 endpoint that serves Murmur's internal metrics
+/// in the Prometheus text format.
+///
+/// The exporter lives in the main thread. It only reads the lock-free
+/// metrics in ServerMetrics and data owned by the main thread, so
+/// scraping never contends with the voice threads.
+class MetricsServer : public QObject {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(MetricsServer)
+	protected:
+		QTcpServer *qtsServer;
+		QLocalServer *qlsServer;
+
+		void handleConnection(QIODevice *dev);
+	public:
+		/// Starts listening on |address|, which is either "host:port"
+		/// or "unix:/path/to/socket".
+		MetricsServer(const QString &address, QObject *parent = NULL);
+		~MetricsServer();
+
+		bool isListening() const;
+
+		/// Returns the current exposition for all running servers.
+		static QByteArray collect();
+	public slots:
+		void newTcpConnection();
+		void newLocalConnection();
+		void readyRead();
+};
+
+#endif
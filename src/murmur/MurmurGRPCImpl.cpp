@@ -15,6 +15,7 @@
 #include "../Group.h"
 #include "MurmurGRPCImpl.h"
 #include "ServerDB.h"
+#include "ServerSnapshot.h"
 #include "ServerUser.h"
 #include "Server.h"
 #include "Channel.h"
@@ -132,7 +133,7 @@ void GRPCStop() {
 	}
 }
 
-MurmurRPCImpl::MurmurRPCImpl(const QString &address, std::shared_ptr<::grpc::ServerCredentials> credentials) : m_cleanupTimer(this) {
+MurmurRPCImpl::MurmurRPCImpl(const QString &address, std::shared_ptr<::grpc::ServerCredentials> credentials) : m_cleanupTimer(this), m_eventBatchTimer(this), m_authenticatorRequestId(0) {
 	::grpc::ServerBuilder builder;
 	builder.AddListeningPort(u8(address), credentials);
 	builder.RegisterService(&m_V1Service);
@@ -142,6 +143,8 @@ MurmurRPCImpl::MurmurRPCImpl(const QString &address, std::shared_ptr<::grpc::Ser
 	connect(&m_cleanupTimer, SIGNAL(timeout()), this, SLOT(cleanup()));
 	m_cleanupTimer.setSingleShot(false);
 	m_cleanupTimer.start(1000 * 60);
+	connect(&m_eventBatchTimer, SIGNAL(timeout()), this, SLOT(flushEventBatches()));
+	m_eventBatchTimer.setSingleShot(false);
 	start();
 }
 
@@ -200,6 +203,16 @@ void MurmurRPCImpl::cleanup() {
 			++i;
 		}
 	}
+
+	QList<RPCEventBatchListener *> cancelled;
+	foreach(auto listener, m_serverBatchListeners) {
+		if (listener->call->context.IsCancelled()) {
+			cancelled << listener;
+		}
+	}
+	foreach(auto listener, cancelled) {
+		removeBatchListener(listener);
+	}
 }
 
 // ToRPC/FromRPC methods convert data to/from grpc protocol buffer messages.
@@ -259,6 +272,61 @@ void ToRPC(const ::Server *srv, const ::User *u, ::MurmurRPC::User *ru) {
 	ru->set_address(su->haAddress.toStdString());
 }
 
+void ToRPC(const ::ServerSnapshot &ss, const ::ServerSnapshot::ChannelState &cs, ::MurmurRPC::Channel *rc) {
+	rc->mutable_server()->set_id(ss.iServerNum);
+
+	rc->set_id(cs.iId);
+	rc->set_name(u8(cs.qsName));
+	if (cs.iParent >= 0) {
+		rc->mutable_parent()->mutable_server()->set_id(ss.iServerNum);
+		rc->mutable_parent()->set_id(cs.iParent);
+	}
+	rc->set_description(u8(cs.qsDesc));
+	rc->set_position(cs.iPosition);
+	foreach(int id, cs.qlLinks) {
+		::MurmurRPC::Channel *linked = rc->add_links();
+		linked->mutable_server()->set_id(ss.iServerNum);
+		linked->set_id(id);
+	}
+	rc->set_temporary(cs.bTemporary);
+}
+
+void ToRPC(const ::ServerSnapshot &ss, const ::ServerSnapshot::UserState &us, ::MurmurRPC::User *ru) {
+	ru->mutable_server()->set_id(ss.iServerNum);
+
+	ru->set_session(us.uiSession);
+	if (us.iId >= 0) {
+		ru->set_id(us.iId);
+	}
+	ru->set_name(u8(us.qsName));
+	ru->set_mute(us.bMute);
+	ru->set_deaf(us.bDeaf);
+	ru->set_suppress(us.bSuppress);
+	ru->set_recording(us.bRecording);
+	ru->set_priority_speaker(us.bPrioritySpeaker);
+	ru->set_self_mute(us.bSelfMute);
+	ru->set_self_deaf(us.bSelfDeaf);
+	ru->mutable_channel()->mutable_server()->set_id(ss.iServerNum);
+	ru->mutable_channel()->set_id(us.iChannel);
+	ru->set_comment(u8(us.qsComment));
+
+	ru->set_online_secs(ss.onlineSeconds(us));
+	ru->set_bytes_per_sec(us.iBandwidth);
+	ru->mutable_version()->set_version(us.uiVersion);
+	ru->mutable_version()->set_release(u8(us.qsRelease));
+	ru->mutable_version()->set_os(u8(us.qsOS));
+	ru->mutable_version()->set_os_version(u8(us.qsOSVersion));
+	ru->set_plugin_identity(u8(us.qsIdentity));
+	ru->set_plugin_context(us.ssContext);
+	ru->set_idle_secs(us.iIdleSecs);
+	ru->set_udp_ping_msecs(us.dUDPPingAvg);
+	ru->set_tcp_ping_msecs(us.dTCPPingAvg);
+
+	ru->set_tcp_only(us.bTcpOnly);
+
+	ru->set_address(us.haAddress.toStdString());
+}
+
 void ToRPC(const ::Server *srv, const QMap<int, QString> &info, const QByteArray &texture, ::MurmurRPC::DatabaseUser *du) {
 	du->mutable_server()->set_id(srv->iServerNum);
 
@@ -385,6 +453,49 @@ void ToRPC(const ::Server *srv, const ::User *user, const ::TextMessage &message
 	rtm->set_text(u8(message.qsText));
 }
 
+// Fills in an authentication request for a connecting user.
+void ToRPC(const QString &uname, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw, ::MurmurRPC::Authenticator_Request_Authenticate *rpcAuthenticate) {
+	rpcAuthenticate->set_name(u8(uname));
+	if (!pw.isEmpty()) {
+		rpcAuthenticate->set_password(u8(pw));
+	}
+	foreach(const auto &cert, certlist) {
+		auto data = cert.toDer();
+		rpcAuthenticate->add_certificates(data.constData(), data.size());
+	}
+	if (!certhash.isEmpty()) {
+		rpcAuthenticate->set_certificate_hash(u8(certhash));
+		rpcAuthenticate->set_strong_certificate(certstrong);
+	}
+}
+
+// Converts an authentication response to the result codes used by
+// Server::authenticate. Returns -2 if the request should fall through.
+int FromRPC(const ::MurmurRPC::Authenticator_Response_Authenticate &rpcAuthenticate, QString &uname, QStringList &groups) {
+	switch (rpcAuthenticate.status()) {
+	case ::MurmurRPC::Authenticator_Response_Status_Success:
+		if (!rpcAuthenticate.has_id()) {
+			return -3;
+		}
+		if (rpcAuthenticate.has_name()) {
+			uname = u8(rpcAuthenticate.name());
+		}
+		for (int i = 0; i < rpcAuthenticate.groups_size(); i++) {
+			auto &group = rpcAuthenticate.groups(i);
+			if (group.has_name()) {
+				groups << u8(group.name());
+			}
+		}
+		return rpcAuthenticate.id();
+	case ::MurmurRPC::Authenticator_Response_Status_TemporaryFailure:
+		return -3;
+	case ::MurmurRPC::Authenticator_Response_Status_Failure:
+		return -1;
+	default:
+		return -2;
+	}
+}
+
 // Sends a meta event to any subscribed listeners.
 void MurmurRPCImpl::sendMetaEvent(const ::MurmurRPC::Event &e) {
 	auto listeners = m_metaServiceListeners;
@@ -453,6 +564,139 @@ void MurmurRPCImpl::removeAuthenticator(const ::Server *s) {
 	authenticator->deref();
 }
 
+// Keeps a read outstanding on a pipelined authenticator stream and hands
+// every completed read to MurmurRPCImpl::authenticatorRead. The completion
+// runs in the grpc thread rather than being posted to the main thread, so
+// that it can wake a blocking MurmurRPCImpl::authenticatorCall. Each
+// outstanding read holds a reference to the stream.
+static void readAuthenticatorResponses(::MurmurRPC::Wrapper::V1_AuthenticatorStream *authenticator, int serverId) {
+	authenticator->ref();
+	auto fn = ::boost::bind(&MurmurRPCImpl::authenticatorRead, authenticator->rpc, serverId, authenticator, _1);
+	authenticator->stream.Read(&authenticator->readRequest, new ::boost::function<void(bool)>(fn));
+}
+
+// Sends the request in authenticator->response and waits for the matching
+// response, which is left in authenticator->request.
+//
+// Legacy authenticators answer strictly in order, so the stream is locked for
+// the whole round trip. On a pipelined stream only this call waits; other
+// requests and responses keep flowing in the meantime. The wait does not run
+// the event loop, so the calling server code is never re-entered, and a call
+// that is not answered within authenticatortimeout seconds fails.
+bool MurmurRPCImpl::authenticatorCall(::MurmurRPC::Wrapper::V1_AuthenticatorStream *authenticator) {
+	if (!m_pipelinedAuthenticators.contains(authenticator)) {
+		QMutexLocker l(&qmAuthenticatorsLock);
+		return authenticator->writeRead();
+	}
+
+	quint64 id = ++m_authenticatorRequestId;
+	authenticator->response.set_request_id(id);
+
+	QMutexLocker l(&qmAuthenticatorWaitLock);
+	m_authenticatorWaiters.insert(id, authenticator);
+	authenticator->queueWrite(authenticator->response);
+
+	const quint64 timeout = static_cast<quint64>(qMax(Meta::mp.iAuthTimeout, 1)) * 1000000ULL;
+	Timer t;
+	while (m_authenticatorWaiters.contains(id)) {
+		const quint64 elapsed = t.elapsed();
+		if (elapsed >= timeout) {
+			m_authenticatorWaiters.remove(id);
+			break;
+		}
+		qwcAuthenticatorWait.wait(&qmAuthenticatorWaitLock, static_cast<unsigned long>((timeout - elapsed + 999ULL) / 1000ULL));
+	}
+
+	if (!m_authenticatorResponses.contains(id)) {
+		return false;
+	}
+	authenticator->request = m_authenticatorResponses.take(id);
+	return true;
+}
+
+// Called in the grpc thread for every read completed on a pipelined
+// authenticator. Responses to blocking calls are handed to the waiting call
+// directly; everything else is passed on to authenticatorResponse in the main
+// thread. Takes over the reference held by the read.
+void MurmurRPCImpl::authenticatorRead(int serverId, ::MurmurRPC::Wrapper::V1_AuthenticatorStream *authenticator, bool ok) {
+	::boost::function<void()> fn;
+	if (ok) {
+		::MurmurRPC::Authenticator_Response response = authenticator->readRequest;
+		readAuthenticatorResponses(authenticator, serverId);
+		{
+			QMutexLocker l(&qmAuthenticatorWaitLock);
+			if (m_authenticatorWaiters.remove(response.request_id())) {
+				m_authenticatorResponses.insert(response.request_id(), response);
+				qwcAuthenticatorWait.wakeAll();
+				authenticator->deref();
+				return;
+			}
+		}
+		fn = [this, serverId, authenticator, response] () {
+			authenticatorResponse(serverId, authenticator, &response);
+			authenticator->deref();
+		};
+	} else {
+		{
+			QMutexLocker l(&qmAuthenticatorWaitLock);
+			for (auto i = m_authenticatorWaiters.begin(); i != m_authenticatorWaiters.end(); ) {
+				if (i.value() == authenticator) {
+					i = m_authenticatorWaiters.erase(i);
+				} else {
+					++i;
+				}
+			}
+			qwcAuthenticatorWait.wakeAll();
+		}
+		fn = [this, serverId, authenticator] () {
+			authenticatorResponse(serverId, authenticator, nullptr);
+			authenticator->deref();
+		};
+	}
+	QCoreApplication::instance()->postEvent(this, new RPCExecEvent(fn, authenticator));
+}
+
+// Called in the main thread for every response read from a pipelined
+// authenticator that no blocking call waits for, or with a null response once
+// the stream has failed.
+void MurmurRPCImpl::authenticatorResponse(int serverId, ::MurmurRPC::Wrapper::V1_AuthenticatorStream *authenticator, const ::MurmurRPC::Authenticator_Response *response) {
+	if (!response) {
+		m_pipelinedAuthenticators.remove(authenticator);
+		// Logins that were waiting on this stream are rejected by the
+		// server's authenticator timeout.
+		for (auto i = m_pendingAuthentications.begin(); i != m_pendingAuthentications.end(); ) {
+			if (i.value().stream == authenticator) {
+				i = m_pendingAuthentications.erase(i);
+			} else {
+				++i;
+			}
+		}
+		auto server = meta->qhServers.value(serverId);
+		QMutexLocker l(&qmAuthenticatorsLock);
+		if (server && m_authenticators.value(serverId) == authenticator) {
+			removeAuthenticator(server);
+		}
+		return;
+	}
+
+	auto i = m_pendingAuthentications.find(response->request_id());
+	if (i == m_pendingAuthentications.end() || i.value().stream != authenticator) {
+		return;
+	}
+	auto pending = i.value();
+	m_pendingAuthentications.erase(i);
+
+	auto server = meta->qhServers.value(pending.serverId);
+	if (!server) {
+		return;
+	}
+
+	QString name;
+	QStringList groups;
+	int res = FromRPC(response->authenticate(), name, groups);
+	server->authenticateAsyncResult(pending.request, res, name, groups);
+}
+
 // Called when a connecting user needs to be authenticated.
 void MurmurRPCImpl::authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
 	::Server *s = qobject_cast< ::Server *> (sender());
@@ -463,61 +707,50 @@ void MurmurRPCImpl::authenticateSlot(int &res, QString &uname, int sessionId, co
 
 	auto &request = authenticator->response;
 	request.Clear();
-	request.mutable_authenticate()->set_name(u8(uname));
-	if (!pw.isEmpty()) {
-		request.mutable_authenticate()->set_password(u8(pw));
+	ToRPC(uname, certlist, certhash, certstrong, pw, request.mutable_authenticate());
+
+	if (!authenticatorCall(authenticator.get())) {
+		QMutexLocker l(&qmAuthenticatorsLock);
+		removeAuthenticator(s);
+		res = -1;
+		return;
 	}
-	foreach(const auto &cert, certlist) {
-		auto data = cert.toDer();
-		request.mutable_authenticate()->add_certificates(data.constData(), data.size());
+
+	QStringList qsl;
+	int result = FromRPC(authenticator->request.authenticate(), uname, qsl);
+	if (result == -2) {
+		return;
 	}
-	if (!certhash.isEmpty()) {
-		request.mutable_authenticate()->set_certificate_hash(u8(certhash));
-		request.mutable_authenticate()->set_strong_certificate(certstrong);
+	res = result;
+	if (res >= 0 && !qsl.isEmpty()) {
+		s->setTempGroups(res, sessionId, NULL, qsl);
 	}
+}
 
-	{
-		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			res = -1;
-			return;
-		}
+// Called when a connecting user needs to be authenticated without blocking
+// the server. Only pipelined authenticators take part; for all others pending
+// is left unset and the server falls back to authenticateSlot.
+void MurmurRPCImpl::authenticateAsyncSlot(bool &pending, quint64 request, const QString &uname, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
+	::Server *s = qobject_cast< ::Server *> (sender());
+	auto authenticator = RPCCall::Ref<::MurmurRPC::Wrapper::V1_AuthenticatorStream>(m_authenticators.value(s->iServerNum));
+	if (!authenticator || !m_pipelinedAuthenticators.contains(authenticator.get())) {
+		return;
 	}
 
-	auto &response = authenticator->request;
-	switch (response.authenticate().status()) {
-	case ::MurmurRPC::Authenticator_Response_Status_Success:
-		if (!response.authenticate().has_id()) {
-			res = -3;
-			break;
-		}
-		res = response.authenticate().id();
-		if (response.authenticate().has_name()) {
-			uname = u8(response.authenticate().name());
-		}
-		{
-			QStringList qsl;
-			for (int i = 0; i < response.authenticate().groups_size(); i++) {
-				auto &group = response.authenticate().groups(i);
-				if (group.has_name()) {
-					qsl << u8(group.name());
-				}
-			}
-			if (!qsl.isEmpty()) {
-				s->setTempGroups(res, sessionId, NULL, qsl);
-			}
-		}
-		break;
-	case ::MurmurRPC::Authenticator_Response_Status_TemporaryFailure:
-		res = -3;
-		break;
-	case ::MurmurRPC::Authenticator_Response_Status_Failure:
-		res = -1;
-		break;
-	default:
-		break;
-	}
+	::MurmurRPC::Authenticator_Request rpcRequest;
+	ToRPC(uname, certlist, certhash, certstrong, pw, rpcRequest.mutable_authenticate());
+
+	quint64 id = ++m_authenticatorRequestId;
+	rpcRequest.set_request_id(id);
+
+	PendingAuthentication pa;
+	pa.stream = authenticator.get();
+	pa.serverId = s->iServerNum;
+	pa.request = request;
+	m_pendingAuthentications.insert(id, pa);
+
+	authenticator->queueWrite(rpcRequest);
+	pending = true;
 }
 
 // Called when a user is being registered on the server.
@@ -532,12 +765,10 @@ void MurmurRPCImpl::registerUserSlot(int &res, const QMap<int, QString> &info) {
 	request.Clear();
 	ToRPC(s, info, QByteArray(), request.mutable_register_()->mutable_user());
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -570,12 +801,10 @@ void MurmurRPCImpl::unregisterUserSlot(int &res, int id) {
 	request.mutable_deregister()->mutable_user()->mutable_server()->set_id(s->iServerNum);
 	request.mutable_deregister()->mutable_user()->set_id(id);
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -599,12 +828,10 @@ void MurmurRPCImpl::getRegisteredUsersSlot(const QString &filter, QMap<int, QStr
 		request.mutable_query()->set_filter(u8(filter));
 	}
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -632,12 +859,10 @@ void MurmurRPCImpl::getRegistrationSlot(int &res, int id, QMap<int, QString> &in
 
 	res = -1;
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -662,12 +887,10 @@ void MurmurRPCImpl::setInfoSlot(int &res, int id, const QMap<int, QString> &info
 
 	res = 0;
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -696,12 +919,10 @@ void MurmurRPCImpl::setTextureSlot(int &res, int id, const QByteArray &texture)
 	request.mutable_update()->mutable_user()->set_id(id);
 	request.mutable_update()->mutable_user()->set_texture(texture.constData(), texture.size());
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -722,12 +943,10 @@ void MurmurRPCImpl::nameToIdSlot(int &res, const QString &name) {
 	request.Clear();
 	request.mutable_find()->set_name(u8(name));
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -748,12 +967,10 @@ void MurmurRPCImpl::idToNameSlot(QString &res, int id) {
 	request.Clear();
 	request.mutable_find()->set_id(id);
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -774,12 +991,10 @@ void MurmurRPCImpl::idToTextureSlot(QByteArray &res, int id) {
 	request.Clear();
 	request.mutable_find()->set_id(id);
 
-	{
+	if (!authenticatorCall(authenticator.get())) {
 		QMutexLocker l(&qmAuthenticatorsLock);
-		if (!authenticator->writeRead()) {
-			removeAuthenticator(s);
-			return;
-		}
+		removeAuthenticator(s);
+		return;
 	}
 
 	auto &response = authenticator->request;
@@ -789,14 +1004,22 @@ void MurmurRPCImpl::idToTextureSlot(QByteArray &res, int id) {
 	}
 }
 
+// The number of events that may be waiting for a slow listener before further
+// events are dropped, unless the listener asked for a different limit.
+#define RPC_EVENT_QUEUE_LIMIT 1000
+
 // Sends a server event to subscribed listeners.
-void MurmurRPCImpl::sendServerEvent(const ::Server *s, const ::MurmurRPC::Server_Event &e) {
-	auto listeners = m_serverServiceListeners;
+void MurmurRPCImpl::sendServerEvent(::Server *s, const ::MurmurRPC::Server_Event &e) {
 	auto serverID = s->iServerNum;
-	auto i = listeners.find(serverID);
 
-	for ( ; i != listeners.end() && i.key() == serverID; ++i) {
+	// Write callbacks are only run from the event loop, so the listeners can
+	// be iterated in place.
+	for (auto i = m_serverServiceListeners.constFind(serverID); i != m_serverServiceListeners.constEnd() && i.key() == serverID; ++i) {
 		auto listener = i.value();
+		if (listener->pendingWrites() >= RPC_EVENT_QUEUE_LIMIT) {
+			s->smMetrics.msControl.cRpcEventsDropped.add();
+			continue;
+		}
 		listener->ref();
 		auto cb = [this, listener, serverID] (::MurmurRPC::Wrapper::V1_ServerEvents *, bool ok) {
 			if (!ok && m_serverServiceListeners.remove(serverID, listener) > 0) {
@@ -806,6 +1029,213 @@ void MurmurRPCImpl::sendServerEvent(const ::Server *s, const ::MurmurRPC::Server
 		};
 		listener->write(e, listener->callback(cb));
 	}
+
+	for (auto i = m_serverBatchListeners.constFind(serverID); i != m_serverBatchListeners.constEnd() && i.key() == serverID; ++i) {
+		queueBatchEvent(s, i.value(), e);
+	}
+}
+
+// Returns a key for the user or channel an event is about, or 0 if the event
+// can not be superseded by a later one.
+static quint64 EventKey(const ::MurmurRPC::Server_Event &e) {
+	switch (e.type()) {
+	case ::MurmurRPC::Server_Event_Type_UserConnected:
+	case ::MurmurRPC::Server_Event_Type_UserDisconnected:
+	case ::MurmurRPC::Server_Event_Type_UserStateChanged:
+		return e.has_user() ? ((Q_UINT64_C(1) << 32) | e.user().session()) : 0;
+	case ::MurmurRPC::Server_Event_Type_ChannelCreated:
+	case ::MurmurRPC::Server_Event_Type_ChannelRemoved:
+	case ::MurmurRPC::Server_Event_Type_ChannelStateChanged:
+		return e.has_channel() ? ((Q_UINT64_C(2) << 32) | e.channel().id()) : 0;
+	default:
+		return 0;
+	}
+}
+
+// Removes superseded events from a batch listener's queue.
+static void CompactEventBatch(RPCEventBatchListener *listener) {
+	QList<RPCEventBatchListener::QueuedEvent> events;
+	events.reserve(listener->queued);
+	listener->latest.clear();
+	foreach(const auto &qe, listener->events) {
+		if (qe.superseded) {
+			continue;
+		}
+		if (qe.key) {
+			listener->latest.insert(qe.key, events.size());
+		}
+		events << qe;
+	}
+	listener->events = events;
+}
+
+// Collapses a full queue to the latest event per user and channel, for
+// listeners using the Summary overflow policy.
+static void SummarizeEventBatch(RPCEventBatchListener *listener, ServerMetricsShard &metrics) {
+	for (int i = 0; i < listener->events.size(); ++i) {
+		auto &qe = listener->events[i];
+		if (qe.superseded) {
+			continue;
+		}
+		if (!qe.key) {
+			listener->dropped++;
+			metrics.cRpcEventsDropped.add();
+		} else if (listener->latest.value(qe.key) != i) {
+			metrics.cRpcEventsCoalesced.add();
+		} else {
+			continue;
+		}
+		qe.superseded = true;
+		listener->queued--;
+	}
+	listener->summary = true;
+	CompactEventBatch(listener);
+}
+
+// Queues an event for the next batch of a listener.
+void MurmurRPCImpl::queueBatchEvent(::Server *s, RPCEventBatchListener *listener, const ::MurmurRPC::Server_Event &e) {
+	auto &metrics = s->smMetrics.msControl;
+	auto key = EventKey(e);
+
+	if (listener->queued >= listener->maxQueue && listener->summaryOverflow && key && !listener->summary) {
+		SummarizeEventBatch(listener, metrics);
+	}
+
+	// A state update replaces a queued state update of the same user. Once a
+	// queue has been summarized, every event replaces the previous one of the
+	// same user or channel.
+	int supersedes = -1;
+	if (key && listener->latest.contains(key)) {
+		int idx = listener->latest.value(key);
+		if (listener->summary || (e.type() == ::MurmurRPC::Server_Event_Type_UserStateChanged && listener->events.at(idx).event.type() == e.type())) {
+			supersedes = idx;
+		}
+	}
+
+	if (supersedes < 0 && listener->queued >= listener->maxQueue) {
+		listener->dropped++;
+		metrics.cRpcEventsDropped.add();
+		return;
+	}
+
+	if (supersedes >= 0) {
+		listener->events[supersedes].superseded = true;
+		listener->queued--;
+		metrics.cRpcEventsCoalesced.add();
+	}
+
+	RPCEventBatchListener::QueuedEvent qe;
+	qe.event = e;
+	qe.key = key;
+	qe.superseded = false;
+	listener->events << qe;
+	listener->queued++;
+	if (key) {
+		listener->latest.insert(key, listener->events.size() - 1);
+	}
+
+	// Keep superseded events from piling up while the listener is busy.
+	if (listener->events.size() > 2 * listener->maxQueue) {
+		CompactEventBatch(listener);
+	}
+}
+
+void MurmurRPCImpl::addBatchListener(RPCEventBatchListener *listener) {
+	m_serverBatchListeners.insert(listener->serverId, listener);
+	if (!m_eventBatchTimer.isActive()) {
+		m_eventBatchTimer.start(100);
+	}
+}
+
+// Publishes the snapshots of all servers that changed since their last one.
+void MurmurRPCImpl::flushSnapshots() {
+	foreach(::Server *s, meta->qhServers) {
+		s->flushSnapshot();
+	}
+}
+
+void MurmurRPCImpl::removeBatchListener(RPCEventBatchListener *listener) {
+	if (m_serverBatchListeners.remove(listener->serverId, listener) == 0) {
+		return;
+	}
+	if (m_serverBatchListeners.isEmpty()) {
+		m_eventBatchTimer.stop();
+	}
+	listener->call->deref();
+	if (listener->writing) {
+		listener->removed = true;
+	} else {
+		delete listener;
+	}
+}
+
+// Sends the queued events of every batch listener that is not still busy
+// with its previous batch.
+void MurmurRPCImpl::flushEventBatches() {
+	foreach(auto listener, m_serverBatchListeners) {
+		if (listener->writing || (listener->queued == 0 && listener->dropped == 0)) {
+			continue;
+		}
+		if (listener->call->context.IsCancelled()) {
+			continue;
+		}
+
+		::MurmurRPC::Server_EventBatch batch;
+		batch.mutable_server()->set_id(listener->serverId);
+
+		quint64 lag = 0;
+		foreach(const auto &qe, listener->events) {
+			if (qe.superseded) {
+				continue;
+			}
+			if (batch.events_size() == 0) {
+				lag = qe.queued.elapsed();
+			}
+			*batch.add_events() = qe.event;
+		}
+		if (listener->dropped > 0) {
+			batch.set_dropped(listener->dropped);
+		}
+		if (listener->summary) {
+			batch.set_summary(true);
+		}
+		batch.set_lag_msecs(static_cast<quint32>(lag / 1000ULL));
+
+		listener->events.clear();
+		listener->latest.clear();
+		listener->queued = 0;
+		listener->dropped = 0;
+		listener->summary = false;
+
+		auto server = meta->qhServers.value(listener->serverId);
+		if (server) {
+			server->smMetrics.msControl.cRpcEventBatches.add();
+			server->smMetrics.msControl.hRpcEventBatchSize.add(batch.events_size());
+		}
+
+		listener->writing = true;
+		listener->writeLag = lag;
+		listener->writeStarted.restart();
+
+		auto call = listener->call;
+		call->ref();
+		auto cb = [this, listener, call] (::MurmurRPC::Wrapper::V1_ServerEventBatches *, bool ok) {
+			if (listener->removed) {
+				delete listener;
+			} else {
+				listener->writing = false;
+				auto server = meta->qhServers.value(listener->serverId);
+				if (server) {
+					server->smMetrics.msControl.hRpcEventLagUsec.add(listener->writeLag + listener->writeStarted.elapsed());
+				}
+				if (!ok) {
+					removeBatchListener(listener);
+				}
+			}
+			call->deref();
+		};
+		call->write(batch, call->callback(cb));
+	}
 }
 
 // Called when a user's state changes.
@@ -1150,6 +1580,16 @@ template <>
 	return MustChannel(server, msg.id());
 }
 
+// Returns the snapshot of the server the message refers to, or a null pointer
+// if the call has to be handled on the main thread instead.
+template <class T>
+QSharedPointer<const ::ServerSnapshot> CurrentSnapshot(const T &msg) {
+	if (!msg.has_server() || !msg.server().has_id()) {
+		return QSharedPointer<const ::ServerSnapshot>();
+	}
+	return ::ServerSnapshot::current(msg.server().id());
+}
+
 // Qt event listener for RPCExecEvents.
 void MurmurRPCImpl::customEvent(QEvent *evt) {
 	if (evt->type() == EXEC_QEVENT) {
@@ -1186,6 +1626,11 @@ void MurmurRPCImpl::run() {
 // The Wrapper implementation methods are below. Implementation methods are
 // executed in the main thread when its corresponding grpc method is invoked.
 //
+// Read-only methods additionally have a snapshot method, which is executed in
+// the grpc thread and answers the call from a ServerSnapshot. If it returns
+// false (e.g. the server is not running or the lookup failed), the call is
+// passed on to the implementation method, which also produces the error.
+//
 // Since the grpc asynchronous API is used, the implementation methods below
 // do not have to complete the call during the lifetime of the method (although
 // this is only used for streaming calls).
@@ -1265,6 +1710,20 @@ void V1_ServerEvents::impl(bool) {
 	rpc->m_serverServiceListeners.insert(server->iServerNum, this);
 }
 
+void V1_ServerEventBatches::impl(bool) {
+	auto server = MustServer(request);
+
+	auto listener = new RPCEventBatchListener();
+	listener->call = this;
+	listener->serverId = server->iServerNum;
+	listener->maxQueue = RPC_EVENT_QUEUE_LIMIT;
+	if (request.max_queue() > 0) {
+		listener->maxQueue = static_cast<int>(qMin(request.max_queue(), 100u * RPC_EVENT_QUEUE_LIMIT));
+	}
+	listener->summaryOverflow = (request.overflow() == ::MurmurRPC::Server_EventStream_Overflow_Summary);
+	rpc->addBatchListener(listener);
+}
+
 void V1_GetUptime::impl(bool) {
 	::MurmurRPC::Uptime uptime;
 	uptime.set_secs(meta->tUptime.elapsed()/1000000LL);
@@ -1500,6 +1959,36 @@ void V1_ChannelGet::impl(bool) {
 	end(rpcChannel);
 }
 
+bool V1_ChannelQuery::snapshot() {
+	auto ss = CurrentSnapshot(request);
+	if (!ss) {
+		return false;
+	}
+
+	::MurmurRPC::Channel_List list;
+	list.mutable_server()->set_id(ss->iServerNum);
+
+	foreach(const ::ServerSnapshot::ChannelState &cs, ss->qmChannels) {
+		auto rpcChannel = list.add_channels();
+		ToRPC(*ss, cs, rpcChannel);
+	}
+
+	end(list);
+	return true;
+}
+
+bool V1_ChannelGet::snapshot() {
+	auto ss = CurrentSnapshot(request);
+	if (!ss || !request.has_id() || !ss->qmChannels.contains(request.id())) {
+		return false;
+	}
+
+	::MurmurRPC::Channel rpcChannel;
+	ToRPC(*ss, ss->qmChannels.value(request.id()), &rpcChannel);
+	end(rpcChannel);
+	return true;
+}
+
 void V1_ChannelAdd::impl(bool) {
 	auto server = MustServer(request);
 
@@ -1635,6 +2124,53 @@ void V1_UserGet::impl(bool) {
 	throw ::grpc::Status(::grpc::INVALID_ARGUMENT, "session or name required");
 }
 
+bool V1_UserQuery::snapshot() {
+	auto ss = CurrentSnapshot(request);
+	if (!ss) {
+		return false;
+	}
+
+	::MurmurRPC::User_List list;
+	list.mutable_server()->set_id(ss->iServerNum);
+
+	foreach(const ::ServerSnapshot::UserState &us, ss->qhUsers) {
+		auto rpcUser = list.add_users();
+		ToRPC(*ss, us, rpcUser);
+	}
+
+	end(list);
+	return true;
+}
+
+bool V1_UserGet::snapshot() {
+	auto ss = CurrentSnapshot(request);
+	if (!ss) {
+		return false;
+	}
+
+	::MurmurRPC::User rpcUser;
+
+	if (request.has_session()) {
+		if (!ss->qhUsers.contains(request.session())) {
+			return false;
+		}
+		ToRPC(*ss, ss->qhUsers.value(request.session()), &rpcUser);
+		end(rpcUser);
+		return true;
+	} else if (request.has_name()) {
+		QString qsName = u8(request.name());
+		foreach(const ::ServerSnapshot::UserState &us, ss->qhUsers) {
+			if (us.qsName == qsName) {
+				ToRPC(*ss, us, &rpcUser);
+				end(rpcUser);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 void V1_UserUpdate::impl(bool) {
 	auto server = MustServer(request);
 	auto user = MustUser(server, request);
@@ -1731,6 +2267,39 @@ void V1_TreeQuery::impl(bool) {
 	end(root);
 }
 
+bool V1_TreeQuery::snapshot() {
+	auto ss = CurrentSnapshot(request);
+	if (!ss || !ss->qmChannels.contains(0)) {
+		return false;
+	}
+
+	::MurmurRPC::Tree root;
+
+	QQueue< QPair<int, ::MurmurRPC::Tree *> > qQueue;
+	qQueue.enqueue(qMakePair(0, &root));
+
+	while (!qQueue.isEmpty()) {
+		auto current = qQueue.dequeue();
+		const auto &cs = ss->qmChannels[current.first];
+		auto currentTree = current.second;
+
+		ToRPC(*ss, cs, currentTree->mutable_channel());
+
+		foreach(unsigned int session, cs.qlUsers) {
+			auto rpcUser = currentTree->add_users();
+			ToRPC(*ss, ss->qhUsers[session], rpcUser);
+		}
+
+		foreach(int id, cs.qlChannels) {
+			auto subTree = currentTree->add_children();
+			qQueue.enqueue(qMakePair(id, subTree));
+		}
+	}
+
+	end(root);
+	return true;
+}
+
 void V1_BansGet::impl(bool) {
 	auto server = MustServer(request);
 
@@ -1974,9 +2543,15 @@ void V1_AuthenticatorStream::impl(bool) {
 			throw ::grpc::Status(::grpc::INVALID_ARGUMENT, "missing initialize");
 		}
 		auto server = MustServer(request.initialize());
-		QMutexLocker l(&rpc->qmAuthenticatorsLock);
-		rpc->removeAuthenticator(server);
-		rpc->m_authenticators.insert(server->iServerNum, this);
+		{
+			QMutexLocker l(&rpc->qmAuthenticatorsLock);
+			rpc->removeAuthenticator(server);
+			rpc->m_authenticators.insert(server->iServerNum, this);
+		}
+		if (request.initialize().pipelined()) {
+			rpc->m_pipelinedAuthenticators.insert(this);
+			readAuthenticatorResponses(this, server->iServerNum);
+		}
 	};
 	stream.Read(&request, callback(onInitialize));
 }
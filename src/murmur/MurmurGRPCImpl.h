@@ -14,10 +14,12 @@
 
 #include "Server.h"
 #include "Meta.h"
+#include "Timer.h"
 
 #include <atomic>
 
 #include <QMultiHash>
+#include <QWaitCondition>
 
 #include <grpc++/grpc++.h>
 
@@ -28,15 +30,53 @@ namespace MurmurRPC {
 		class V1_ContextActionEvents;
 		class V1_Events;
 		class V1_ServerEvents;
+		class V1_ServerEventBatches;
 		class V1_AuthenticatorStream;
 		class V1_TextMessageFilter;
 	}
 }
 
+// State of a V1_ServerEventBatches stream. Only used on the main thread.
+struct RPCEventBatchListener {
+	struct QueuedEvent {
+		::MurmurRPC::Server_Event event;
+		// The user or channel the event is about, or 0.
+		quint64 key;
+		// Set when a later event made this one obsolete.
+		bool superseded;
+		Timer queued;
+	};
+
+	::MurmurRPC::Wrapper::V1_ServerEventBatches *call;
+	int serverId;
+	int maxQueue;
+	bool summaryOverflow;
+
+	QList<QueuedEvent> events;
+	// Maps key -> index of the latest queued event for it
+	QHash<quint64, int> latest;
+	// Number of events in |events| that are not superseded
+	int queued;
+	quint32 dropped;
+	bool summary;
+
+	// Set while a batch is being written
+	bool writing;
+	quint64 writeLag;
+	Timer writeStarted;
+	// Set if the stream went away while a batch was being written; the
+	// write callback then frees the listener.
+	bool removed;
+
+	RPCEventBatchListener() : call(nullptr), serverId(0), maxQueue(0), summaryOverflow(false), queued(0), dropped(0), summary(false), writing(false), writeLag(0), removed(false) {
+	}
+};
+
 class MurmurRPCImpl : public QThread {
 		Q_OBJECT;
 		std::unique_ptr<grpc::Server> m_server;
 		QTimer m_cleanupTimer;
+		QTimer m_eventBatchTimer;
 	protected:
 		void customEvent(QEvent *evt);
 	public:
@@ -54,10 +94,30 @@ class MurmurRPCImpl : public QThread {
 		QSet<::MurmurRPC::Wrapper::V1_Events *> m_metaServiceListeners;
 
 		QMultiHash<int, ::MurmurRPC::Wrapper::V1_ServerEvents *> m_serverServiceListeners;
+		QMultiHash<int, RPCEventBatchListener *> m_serverBatchListeners;
 
 		QMutex qmAuthenticatorsLock;
 		QHash<int, ::MurmurRPC::Wrapper::V1_AuthenticatorStream *> m_authenticators;
 
+		// Pipelined authenticators match responses to requests by request_id
+		// instead of answering them strictly in order.
+		struct PendingAuthentication {
+			::MurmurRPC::Wrapper::V1_AuthenticatorStream *stream;
+			int serverId;
+			quint64 request;
+		};
+		QSet<::MurmurRPC::Wrapper::V1_AuthenticatorStream *> m_pipelinedAuthenticators;
+		quint64 m_authenticatorRequestId;
+		// Maps request_id -> login waiting in Server::authenticateAsyncResult
+		QHash<quint64, PendingAuthentication> m_pendingAuthentications;
+		// Maps request_id -> stream, for blocking calls waiting on a pipelined
+		// stream. Responses to these are handed over by the grpc thread, so
+		// both hashes are guarded by qmAuthenticatorWaitLock.
+		QMutex qmAuthenticatorWaitLock;
+		QWaitCondition qwcAuthenticatorWait;
+		QHash<quint64, ::MurmurRPC::Wrapper::V1_AuthenticatorStream *> m_authenticatorWaiters;
+		QHash<quint64, ::MurmurRPC::Authenticator_Response> m_authenticatorResponses;
+
 		QMutex qmTextMessageFilterLock;
 		QHash<int, ::MurmurRPC::Wrapper::V1_TextMessageFilter *> m_textMessageFilters;
 
@@ -72,16 +132,25 @@ class MurmurRPCImpl : public QThread {
 
 		void removeTextMessageFilter(const ::Server *s);
 		void removeAuthenticator(const ::Server *s);
+		bool authenticatorCall(::MurmurRPC::Wrapper::V1_AuthenticatorStream *authenticator);
+		void authenticatorRead(int serverId, ::MurmurRPC::Wrapper::V1_AuthenticatorStream *authenticator, bool ok);
+		void authenticatorResponse(int serverId, ::MurmurRPC::Wrapper::V1_AuthenticatorStream *authenticator, const ::MurmurRPC::Authenticator_Response *response);
 		void sendMetaEvent(const ::MurmurRPC::Event &e);
-		void sendServerEvent(const ::Server *s, const ::MurmurRPC::Server_Event &e);
+		void sendServerEvent(::Server *s, const ::MurmurRPC::Server_Event &e);
+		void addBatchListener(RPCEventBatchListener *listener);
+		void queueBatchEvent(::Server *s, RPCEventBatchListener *listener, const ::MurmurRPC::Server_Event &e);
+		void removeBatchListener(RPCEventBatchListener *listener);
+		void flushSnapshots();
 
 	public slots:
 		void cleanup();
+		void flushEventBatches();
 
 		void started(Server *server);
 		void stopped(Server *server);
 
 		void authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw);
+		void authenticateAsyncSlot(bool &pending, quint64 request, const QString &uname, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw);
 		void registerUserSlot(int &res, const QMap<int, QString> &);
 		void unregisterUserSlot(int &res, int id);
 		void getRegisteredUsersSlot(const QString &filter, QMap<int, QString> &res);
@@ -165,6 +234,9 @@ public:
 		T *operator->() {
 			return m_object;
 		}
+		T *get() {
+			return m_object;
+		}
 	};
 };
 
@@ -182,6 +254,12 @@ public:
 	}
 
 	virtual void end(const OutType &msg = OutType()) {
+		// A call answered in the main thread may have changed a server.
+		// Its snapshot must be up to date before the client sees the
+		// reply and sends a query that is answered from it.
+		if (QThread::currentThread() == rpc->thread()) {
+			rpc->flushSnapshots();
+		}
 		stream.Finish(msg, ::grpc::Status::OK, done());
 	}
 };
@@ -215,6 +293,12 @@ public:
 		}
 	}
 
+	/// Returns the number of writes that have not completed yet.
+	int pendingWrites() {
+		QMutexLocker l(&m_writeLock);
+		return m_writeQueue.size();
+	}
+
 private:
 	void *writeCB() {
 		auto callback = ::boost::bind(&RPCSingleStreamCall<InType, OutType>::writeCallback, this, _1);
@@ -235,11 +319,20 @@ private:
 	}
 };
 
+/// Base for "stream-stream" RPC methods.
+///
+/// Besides the blocking helpers of the generated wrapper, the stream offers
+/// "queueWrite", which queues writes in the same way as RPCSingleStreamCall
+/// does. The two must not be mixed on the same stream.
 template <class InType, class OutType>
 class RPCStreamStreamCall : public RPCCall {
+	QMutex m_writeLock;
+	QQueue< QPair<OutType, void *> > m_writeQueue;
 public:
 	InType request;
 	OutType response;
+	// Target of reads that are issued while |request| may still be in use.
+	InType readRequest;
 	::grpc::ServerAsyncReaderWriter< OutType, InType > stream;
 
 	RPCStreamStreamCall(MurmurRPCImpl *rpcImpl) : RPCCall(rpcImpl), stream(&context) {
@@ -248,6 +341,35 @@ public:
 	virtual void error(const ::grpc::Status &err) {
 		stream.Finish(err, done());
 	}
+
+	void queueWrite(const OutType &msg, void *tag = nullptr) {
+		QMutexLocker l(&m_writeLock);
+		if (m_writeQueue.size() > 0) {
+			m_writeQueue.enqueue(qMakePair(msg, tag));
+		} else {
+			m_writeQueue.enqueue(qMakePair(OutType(), tag));
+			stream.Write(msg, writeCB());
+		}
+	}
+
+private:
+	void *writeCB() {
+		auto callback = ::boost::bind(&RPCStreamStreamCall<InType, OutType>::writeCallback, this, _1);
+		return new ::boost::function<void(bool)>(callback);
+	}
+
+	void writeCallback(bool ok) {
+		QMutexLocker l(&m_writeLock);
+		auto processed = m_writeQueue.dequeue();
+		if (processed.second) {
+			auto cb = static_cast< ::boost::function<void(bool)> *>(processed.second);
+			(*cb)(ok);
+			delete cb;
+		}
+		if (m_writeQueue.size() > 0) {
+			stream.Write(m_writeQueue.head().first, writeCB());
+		}
+	}
 };
 
 
@@ -20,6 +20,7 @@
 #include "Server.h"
 #include "ServerUser.h"
 #include "ServerDB.h"
+#include "ServerSnapshot.h"
 #include "User.h"
 #include "Ban.h"
 
@@ -138,6 +139,54 @@ static void channelToChannel(const ::Channel *c, Murmur::Channel &mc) {
 	mc.temporary = c->bTemporary;
 }
 
+static void userToUser(const ServerSnapshot &ss, const ServerSnapshot::UserState &us, Murmur::User &mp) {
+	mp.session = us.uiSession;
+	mp.userid = us.iId;
+	mp.name = iceString(us.qsName);
+	mp.mute = us.bMute;
+	mp.deaf = us.bDeaf;
+	mp.suppress = us.bSuppress;
+	mp.recording = us.bRecording;
+	mp.prioritySpeaker = us.bPrioritySpeaker;
+	mp.selfMute = us.bSelfMute;
+	mp.selfDeaf = us.bSelfDeaf;
+	mp.channel = us.iChannel;
+	mp.comment = iceString(us.qsComment);
+
+	mp.onlinesecs = ss.onlineSeconds(us);
+	mp.bytespersec = us.iBandwidth;
+	mp.version = us.uiVersion;
+	mp.release = iceString(us.qsRelease);
+	mp.os = iceString(us.qsOS);
+	mp.osversion = iceString(us.qsOSVersion);
+	mp.identity = iceString(us.qsIdentity);
+	mp.context = iceBase64(us.ssContext);
+	mp.idlesecs = us.iIdleSecs;
+	mp.udpPing = us.dUDPPingAvg;
+	mp.tcpPing = us.dTCPPingAvg;
+
+	mp.tcponly = us.bTcpOnly;
+
+	::Murmur::NetAddress addr(16, 0);
+	const Q_IPV6ADDR &a = us.haAddress.qip6;
+	for (int i=0;i<16;++i)
+		addr[i] = a[i];
+
+	mp.address = addr;
+}
+
+static void channelToChannel(const ServerSnapshot::ChannelState &cs, Murmur::Channel &mc) {
+	mc.id = cs.iId;
+	mc.name = iceString(cs.qsName);
+	mc.parent = cs.iParent;
+	mc.description = iceString(cs.qsDesc);
+	mc.position = cs.iPosition;
+	mc.links.clear();
+	foreach(int id, cs.qlLinks)
+		mc.links.push_back(id);
+	mc.temporary = cs.bTemporary;
+}
+
 static void ACLtoACL(const ::ChanACL *acl, Murmur::ACL &ma) {
 	ma.applyHere = acl->bApplyHere;
 	ma.applySubs = acl->bApplySubs;
@@ -662,14 +711,7 @@ void MurmurIce::nameToIdSlot(int &id, const QString &name) {
 	}
 }
 
-void MurmurIce::authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
-	::Server *server = qobject_cast< ::Server *> (sender());
-
-	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
-	::std::string newname;
-	::Murmur::GroupNameList groups;
-	::Murmur::CertificateList certs;
-
+static void certificatesToCertificates(const QList<QSslCertificate> &certlist, ::Murmur::CertificateList &certs) {
 	certs.resize(certlist.size());
 	for (int i=0;i<certlist.size();++i) {
 		::Murmur::CertificateDer der;
@@ -680,6 +722,84 @@ void MurmurIce::authenticateSlot(int &res, QString &uname, int sessionId, const
 			der[j] = ptr[j];
 		certs[i] = der;
 	}
+}
+
+/// Receives the reply to an asynchronous ServerAuthenticator::authenticate
+/// call. completed() runs on an Ice client thread, so the result is handed
+/// to the main thread before anything touches the server.
+class AuthenticateCallback : public IceUtil::Shared {
+	protected:
+		int iServerId;
+		quint64 uiRequest;
+	public:
+		AuthenticateCallback(int server_id, quint64 request) : iServerId(server_id), uiRequest(request) {}
+
+		void completed(const Ice::AsyncResultPtr &r) {
+			const ServerAuthenticatorPrx prx = ServerAuthenticatorPrx::uncheckedCast(r->getProxy());
+			::std::string newname;
+			::Murmur::GroupNameList groups;
+			int res = -2;
+			bool ok = true;
+
+			try {
+				res = prx->end_authenticate(newname, groups, r);
+			} catch (...) {
+				ok = false;
+				res = -2;
+			}
+
+			QStringList qsl;
+			foreach(const ::std::string &str, groups) {
+				qsl << u8(str);
+			}
+
+			ExecEvent *ie = new ExecEvent(boost::bind(&MurmurIce::authenticateAsyncResult, mi, iServerId, prx, uiRequest, ok, res, u8(newname), qsl));
+			QCoreApplication::instance()->postEvent(mi, ie);
+		}
+};
+
+typedef IceUtil::Handle<AuthenticateCallback> AuthenticateCallbackPtr;
+
+void MurmurIce::authenticateAsyncResult(int server_id, const ::Murmur::ServerAuthenticatorPrx &prx, quint64 request, bool ok, int res, const QString &name, const QStringList &groups) {
+	::Server *server = meta->qhServers.value(server_id);
+	if (! server)
+		return;
+
+	// Only drop the authenticator if it is still the one that failed.
+	if (! ok && getServerAuthenticator(server) == prx)
+		badAuthenticator(server);
+
+	server->authenticateAsyncResult(request, res, name, groups);
+}
+
+void MurmurIce::authenticateAsyncSlot(bool &pending, quint64 request, const QString &uname, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
+	::Server *server = qobject_cast< ::Server *> (sender());
+
+	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
+	if (! prx)
+		return;
+
+	::Murmur::CertificateList certs;
+	certificatesToCertificates(certlist, certs);
+
+	AuthenticateCallbackPtr cb = new AuthenticateCallback(server->iServerNum, request);
+	try {
+		prx->begin_authenticate(iceString(uname), iceString(pw), certs, iceString(certhash), certstrong, Ice::newCallback(cb, &AuthenticateCallback::completed));
+		pending = true;
+	} catch (...) {
+		badAuthenticator(server);
+	}
+}
+
+void MurmurIce::authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw) {
+	::Server *server = qobject_cast< ::Server *> (sender());
+
+	const ServerAuthenticatorPrx prx = getServerAuthenticator(server);
+	::std::string newname;
+	::Murmur::GroupNameList groups;
+	::Murmur::CertificateList certs;
+
+	certificatesToCertificates(certlist, certs);
 
 	try {
 		res = prx->authenticate(iceString(uname), iceString(pw), certs, iceString(certhash), certstrong, newname, groups);
@@ -1064,6 +1184,72 @@ static void impl_Server_getTree(const ::Murmur::AMD_Server_getTreePtr cb, int se
 	cb->ice_response(recurseTree(server->qhChannels.value(0)));
 }
 
+// The snapshot_ functions answer read-only queries directly on the Ice
+// thread from the server's ServerSnapshot. If the server has no snapshot
+// (e.g. it is not running), they return false and the call is handled by
+// impl_ on the main thread as usual.
+
+#define SNAPSHOT_Server_getUsers
+static bool snapshot_Server_getUsers(const ::Murmur::AMD_Server_getUsersPtr cb, int server_id) {
+	const QSharedPointer<const ServerSnapshot> ss = ServerSnapshot::current(server_id);
+	if (! ss)
+		return false;
+
+	::Murmur::UserMap pm;
+	foreach(const ServerSnapshot::UserState &us, ss->qhUsers) {
+		::Murmur::User mp;
+		if (us.bAuthenticated) {
+			userToUser(*ss, us, mp);
+			pm[us.uiSession] = mp;
+		}
+	}
+	cb->ice_response(pm);
+	return true;
+}
+
+#define SNAPSHOT_Server_getChannels
+static bool snapshot_Server_getChannels(const ::Murmur::AMD_Server_getChannelsPtr cb, int server_id) {
+	const QSharedPointer<const ServerSnapshot> ss = ServerSnapshot::current(server_id);
+	if (! ss)
+		return false;
+
+	::Murmur::ChannelMap cm;
+	foreach(const ServerSnapshot::ChannelState &cs, ss->qmChannels) {
+		::Murmur::Channel mc;
+		channelToChannel(cs, mc);
+		cm[cs.iId] = mc;
+	}
+	cb->ice_response(cm);
+	return true;
+}
+
+static TreePtr recurseTree(const ServerSnapshot &ss, const ServerSnapshot::ChannelState &cs) {
+	TreePtr t = new Tree();
+	channelToChannel(cs, t->c);
+
+	foreach(unsigned int session, cs.qlUsers) {
+		::Murmur::User mp;
+		userToUser(ss, ss.qhUsers.value(session), mp);
+		t->users.push_back(mp);
+	}
+
+	foreach(int id, cs.qlChannels) {
+		t->children.push_back(recurseTree(ss, ss.qmChannels.value(id)));
+	}
+
+	return t;
+}
+
+#define SNAPSHOT_Server_getTree
+static bool snapshot_Server_getTree(const ::Murmur::AMD_Server_getTreePtr cb, int server_id) {
+	const QSharedPointer<const ServerSnapshot> ss = ServerSnapshot::current(server_id);
+	if (! ss || ! ss->qmChannels.contains(0))
+		return false;
+
+	cb->ice_response(recurseTree(*ss, ss->qmChannels.value(0)));
+	return true;
+}
+
 #define ACCESS_Server_getCertificateList_READ
 static void impl_Server_getCertificateList(const ::Murmur::AMD_Server_getCertificateListPtr cb, int server_id, ::Ice::Int session) {
 	NEED_SERVER;
@@ -23,6 +23,7 @@ struct TextMessage;
 
 class MurmurIce : public QObject {
 		friend class MurmurLocker;
+		friend class AuthenticateCallback;
 		Q_OBJECT;
 	protected:
 		int count;
@@ -32,6 +33,7 @@ class MurmurIce : public QObject {
 		void badMetaProxy(const ::Murmur::MetaCallbackPrx &prx);
 		void badServerProxy(const ::Murmur::ServerCallbackPrx &prx, const ::Server* server);
 		void badAuthenticator(::Server *);
+		void authenticateAsyncResult(int server_id, const ::Murmur::ServerAuthenticatorPrx &prx, quint64 request, bool ok, int res, const QString &name, const QStringList &groups);
 		QList< ::Murmur::MetaCallbackPrx> qlMetaCallbacks;
 		QMap<int, QList< ::Murmur::ServerCallbackPrx> > qmServerCallbacks;
 		QMap<int, QMap<int, QMap<QString, ::Murmur::ServerContextCallbackPrx> > > qmServerContextCallbacks;
@@ -63,6 +65,7 @@ class MurmurIce : public QObject {
 		void stopped(Server *);
 
 		void authenticateSlot(int &res, QString &uname, int sessionId, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw);
+		void authenticateAsyncSlot(bool &pending, quint64 request, const QString &uname, const QList<QSslCertificate> &certlist, const QString &certhash, bool certstrong, const QString &pw);
 		void registerUserSlot(int &res, const QMap<int, QString> &);
 		void unregisterUserSlot(int &res, int id);
 		void getRegisteredUsersSlot(const QString &filter, QMap<int, QString> &res);
@@ -27,6 +27,10 @@ void ::Murmur::ServerI::isRunning_async(const ::Murmur::AMD_Server_isRunningPtr
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_isRunning
+	if (snapshot_Server_isRunning(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_isRunning, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -57,6 +61,10 @@ void ::Murmur::ServerI::start_async(const ::Murmur::AMD_Server_startPtr &cb, con
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_start
+	if (snapshot_Server_start(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_start, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -87,6 +95,10 @@ void ::Murmur::ServerI::stop_async(const ::Murmur::AMD_Server_stopPtr &cb, const
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_stop
+	if (snapshot_Server_stop(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_stop, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -117,6 +129,10 @@ void ::Murmur::ServerI::delete_async(const ::Murmur::AMD_Server_deletePtr &cb, c
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_delete
+	if (snapshot_Server_delete(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_delete, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -147,6 +163,10 @@ void ::Murmur::ServerI::id_async(const ::Murmur::AMD_Server_idPtr &cb, const ::I
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_id
+	if (snapshot_Server_id(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_id, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -177,6 +197,10 @@ void ::Murmur::ServerI::addCallback_async(const ::Murmur::AMD_Server_addCallback
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_addCallback
+	if (snapshot_Server_addCallback(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_addCallback, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -207,6 +231,10 @@ void ::Murmur::ServerI::removeCallback_async(const ::Murmur::AMD_Server_removeCa
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_removeCallback
+	if (snapshot_Server_removeCallback(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_removeCallback, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -237,6 +265,10 @@ void ::Murmur::ServerI::setAuthenticator_async(const ::Murmur::AMD_Server_setAut
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setAuthenticator
+	if (snapshot_Server_setAuthenticator(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setAuthenticator, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -267,6 +299,10 @@ void ::Murmur::ServerI::getConf_async(const ::Murmur::AMD_Server_getConfPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getConf
+	if (snapshot_Server_getConf(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getConf, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -297,6 +333,10 @@ void ::Murmur::ServerI::getAllConf_async(const ::Murmur::AMD_Server_getAllConfPt
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getAllConf
+	if (snapshot_Server_getAllConf(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getAllConf, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -327,6 +367,10 @@ void ::Murmur::ServerI::setConf_async(const ::Murmur::AMD_Server_setConfPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setConf
+	if (snapshot_Server_setConf(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setConf, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -357,6 +401,10 @@ void ::Murmur::ServerI::setSuperuserPassword_async(const ::Murmur::AMD_Server_se
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setSuperuserPassword
+	if (snapshot_Server_setSuperuserPassword(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setSuperuserPassword, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -387,6 +435,10 @@ void ::Murmur::ServerI::getLog_async(const ::Murmur::AMD_Server_getLogPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getLog
+	if (snapshot_Server_getLog(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getLog, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -417,6 +469,10 @@ void ::Murmur::ServerI::getLogLen_async(const ::Murmur::AMD_Server_getLogLenPtr
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getLogLen
+	if (snapshot_Server_getLogLen(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getLogLen, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -447,6 +503,10 @@ void ::Murmur::ServerI::getUsers_async(const ::Murmur::AMD_Server_getUsersPtr &c
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getUsers
+	if (snapshot_Server_getUsers(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getUsers, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -477,6 +537,10 @@ void ::Murmur::ServerI::getChannels_async(const ::Murmur::AMD_Server_getChannels
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getChannels
+	if (snapshot_Server_getChannels(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getChannels, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -507,6 +571,10 @@ void ::Murmur::ServerI::getCertificateList_async(const ::Murmur::AMD_Server_getC
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getCertificateList
+	if (snapshot_Server_getCertificateList(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getCertificateList, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -537,6 +605,10 @@ void ::Murmur::ServerI::getTree_async(const ::Murmur::AMD_Server_getTreePtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getTree
+	if (snapshot_Server_getTree(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getTree, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -567,6 +639,10 @@ void ::Murmur::ServerI::getBans_async(const ::Murmur::AMD_Server_getBansPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getBans
+	if (snapshot_Server_getBans(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getBans, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -597,6 +673,10 @@ void ::Murmur::ServerI::setBans_async(const ::Murmur::AMD_Server_setBansPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setBans
+	if (snapshot_Server_setBans(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setBans, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -627,6 +707,10 @@ void ::Murmur::ServerI::kickUser_async(const ::Murmur::AMD_Server_kickUserPtr &c
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_kickUser
+	if (snapshot_Server_kickUser(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_kickUser, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -657,6 +741,10 @@ void ::Murmur::ServerI::getState_async(const ::Murmur::AMD_Server_getStatePtr &c
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getState
+	if (snapshot_Server_getState(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getState, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -687,6 +775,10 @@ void ::Murmur::ServerI::setState_async(const ::Murmur::AMD_Server_setStatePtr &c
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setState
+	if (snapshot_Server_setState(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setState, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -717,6 +809,10 @@ void ::Murmur::ServerI::sendMessage_async(const ::Murmur::AMD_Server_sendMessage
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_sendMessage
+	if (snapshot_Server_sendMessage(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_sendMessage, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -747,6 +843,10 @@ void ::Murmur::ServerI::hasPermission_async(const ::Murmur::AMD_Server_hasPermis
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_hasPermission
+	if (snapshot_Server_hasPermission(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_hasPermission, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -777,6 +877,10 @@ void ::Murmur::ServerI::effectivePermissions_async(const ::Murmur::AMD_Server_ef
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_effectivePermissions
+	if (snapshot_Server_effectivePermissions(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_effectivePermissions, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -807,6 +911,10 @@ void ::Murmur::ServerI::addContextCallback_async(const ::Murmur::AMD_Server_addC
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_addContextCallback
+	if (snapshot_Server_addContextCallback(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3, p4, p5))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_addContextCallback, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3, p4, p5));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -837,6 +945,10 @@ void ::Murmur::ServerI::removeContextCallback_async(const ::Murmur::AMD_Server_r
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_removeContextCallback
+	if (snapshot_Server_removeContextCallback(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_removeContextCallback, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -867,6 +979,10 @@ void ::Murmur::ServerI::getChannelState_async(const ::Murmur::AMD_Server_getChan
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getChannelState
+	if (snapshot_Server_getChannelState(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getChannelState, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -897,6 +1013,10 @@ void ::Murmur::ServerI::setChannelState_async(const ::Murmur::AMD_Server_setChan
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setChannelState
+	if (snapshot_Server_setChannelState(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setChannelState, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -927,6 +1047,10 @@ void ::Murmur::ServerI::removeChannel_async(const ::Murmur::AMD_Server_removeCha
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_removeChannel
+	if (snapshot_Server_removeChannel(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_removeChannel, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -957,6 +1081,10 @@ void ::Murmur::ServerI::addChannel_async(const ::Murmur::AMD_Server_addChannelPt
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_addChannel
+	if (snapshot_Server_addChannel(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_addChannel, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -987,6 +1115,10 @@ void ::Murmur::ServerI::sendMessageChannel_async(const ::Murmur::AMD_Server_send
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_sendMessageChannel
+	if (snapshot_Server_sendMessageChannel(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_sendMessageChannel, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1017,6 +1149,10 @@ void ::Murmur::ServerI::getACL_async(const ::Murmur::AMD_Server_getACLPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getACL
+	if (snapshot_Server_getACL(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getACL, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1047,6 +1183,10 @@ void ::Murmur::ServerI::setACL_async(const ::Murmur::AMD_Server_setACLPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setACL
+	if (snapshot_Server_setACL(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3, p4))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setACL, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3, p4));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1077,6 +1217,10 @@ void ::Murmur::ServerI::addUserToGroup_async(const ::Murmur::AMD_Server_addUserT
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_addUserToGroup
+	if (snapshot_Server_addUserToGroup(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_addUserToGroup, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1107,6 +1251,10 @@ void ::Murmur::ServerI::removeUserFromGroup_async(const ::Murmur::AMD_Server_rem
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_removeUserFromGroup
+	if (snapshot_Server_removeUserFromGroup(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_removeUserFromGroup, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1137,6 +1285,10 @@ void ::Murmur::ServerI::redirectWhisperGroup_async(const ::Murmur::AMD_Server_re
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_redirectWhisperGroup
+	if (snapshot_Server_redirectWhisperGroup(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_redirectWhisperGroup, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1167,6 +1319,10 @@ void ::Murmur::ServerI::getUserNames_async(const ::Murmur::AMD_Server_getUserNam
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getUserNames
+	if (snapshot_Server_getUserNames(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getUserNames, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1197,6 +1353,10 @@ void ::Murmur::ServerI::getUserIds_async(const ::Murmur::AMD_Server_getUserIdsPt
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getUserIds
+	if (snapshot_Server_getUserIds(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getUserIds, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1227,6 +1387,10 @@ void ::Murmur::ServerI::registerUser_async(const ::Murmur::AMD_Server_registerUs
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_registerUser
+	if (snapshot_Server_registerUser(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_registerUser, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1257,6 +1421,10 @@ void ::Murmur::ServerI::unregisterUser_async(const ::Murmur::AMD_Server_unregist
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_unregisterUser
+	if (snapshot_Server_unregisterUser(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_unregisterUser, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1287,6 +1455,10 @@ void ::Murmur::ServerI::updateRegistration_async(const ::Murmur::AMD_Server_upda
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_updateRegistration
+	if (snapshot_Server_updateRegistration(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_updateRegistration, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1317,6 +1489,10 @@ void ::Murmur::ServerI::getRegistration_async(const ::Murmur::AMD_Server_getRegi
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getRegistration
+	if (snapshot_Server_getRegistration(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getRegistration, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1347,6 +1523,10 @@ void ::Murmur::ServerI::getRegisteredUsers_async(const ::Murmur::AMD_Server_getR
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getRegisteredUsers
+	if (snapshot_Server_getRegisteredUsers(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getRegisteredUsers, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1377,6 +1557,10 @@ void ::Murmur::ServerI::verifyPassword_async(const ::Murmur::AMD_Server_verifyPa
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_verifyPassword
+	if (snapshot_Server_verifyPassword(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_verifyPassword, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1407,6 +1591,10 @@ void ::Murmur::ServerI::getTexture_async(const ::Murmur::AMD_Server_getTexturePt
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getTexture
+	if (snapshot_Server_getTexture(cb, QString::fromStdString(current.id.name).toInt(), p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getTexture, cb, QString::fromStdString(current.id.name).toInt(), p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1437,6 +1625,10 @@ void ::Murmur::ServerI::setTexture_async(const ::Murmur::AMD_Server_setTexturePt
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_setTexture
+	if (snapshot_Server_setTexture(cb, QString::fromStdString(current.id.name).toInt(), p1, p2))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_setTexture, cb, QString::fromStdString(current.id.name).toInt(), p1, p2));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1467,6 +1659,10 @@ void ::Murmur::ServerI::getUptime_async(const ::Murmur::AMD_Server_getUptimePtr
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_getUptime
+	if (snapshot_Server_getUptime(cb, QString::fromStdString(current.id.name).toInt()))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_getUptime, cb, QString::fromStdString(current.id.name).toInt()));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1497,6 +1693,10 @@ void ::Murmur::ServerI::updateCertificate_async(const ::Murmur::AMD_Server_updat
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Server_updateCertificate
+	if (snapshot_Server_updateCertificate(cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Server_updateCertificate, cb, QString::fromStdString(current.id.name).toInt(), p1, p2, p3));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1527,6 +1727,10 @@ void ::Murmur::MetaI::getServer_async(const ::Murmur::AMD_Meta_getServerPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_getServer
+	if (snapshot_Meta_getServer(cb, current.adapter, p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_getServer, cb, current.adapter, p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1557,6 +1761,10 @@ void ::Murmur::MetaI::newServer_async(const ::Murmur::AMD_Meta_newServerPtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_newServer
+	if (snapshot_Meta_newServer(cb, current.adapter))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_newServer, cb, current.adapter));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1587,6 +1795,10 @@ void ::Murmur::MetaI::getBootedServers_async(const ::Murmur::AMD_Meta_getBootedS
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_getBootedServers
+	if (snapshot_Meta_getBootedServers(cb, current.adapter))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_getBootedServers, cb, current.adapter));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1617,6 +1829,10 @@ void ::Murmur::MetaI::getAllServers_async(const ::Murmur::AMD_Meta_getAllServers
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_getAllServers
+	if (snapshot_Meta_getAllServers(cb, current.adapter))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_getAllServers, cb, current.adapter));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1647,6 +1863,10 @@ void ::Murmur::MetaI::getDefaultConf_async(const ::Murmur::AMD_Meta_getDefaultCo
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_getDefaultConf
+	if (snapshot_Meta_getDefaultConf(cb, current.adapter))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_getDefaultConf, cb, current.adapter));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1677,6 +1897,10 @@ void ::Murmur::MetaI::getVersion_async(const ::Murmur::AMD_Meta_getVersionPtr &c
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_getVersion
+	if (snapshot_Meta_getVersion(cb, current.adapter))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_getVersion, cb, current.adapter));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1707,6 +1931,10 @@ void ::Murmur::MetaI::addCallback_async(const ::Murmur::AMD_Meta_addCallbackPtr
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_addCallback
+	if (snapshot_Meta_addCallback(cb, current.adapter, p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_addCallback, cb, current.adapter, p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1737,6 +1965,10 @@ void ::Murmur::MetaI::removeCallback_async(const ::Murmur::AMD_Meta_removeCallba
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_removeCallback
+	if (snapshot_Meta_removeCallback(cb, current.adapter, p1))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_removeCallback, cb, current.adapter, p1));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1767,6 +1999,10 @@ void ::Murmur::MetaI::getUptime_async(const ::Murmur::AMD_Meta_getUptimePtr &cb,
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_getUptime
+	if (snapshot_Meta_getUptime(cb, current.adapter))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_getUptime, cb, current.adapter));
 	QCoreApplication::instance()->postEvent(mi, ie);
@@ -1797,6 +2033,10 @@ void ::Murmur::MetaI::getSliceChecksums_async(const ::Murmur::AMD_Meta_getSliceC
 			return;
 		}
 	}
+#endif
+#ifdef SNAPSHOT_Meta_getSliceChecksums
+	if (snapshot_Meta_getSliceChecksums(cb, current.adapter))
+		return;
 #endif
 	ExecEvent *ie = new ExecEvent(boost::bind(&impl_Meta_getSliceChecksums, cb, current.adapter));
 	QCoreApplication::instance()->postEvent(mi, ie);
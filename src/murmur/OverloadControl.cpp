@@ -0,0 +1,115 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "OverloadControl.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+OverloadControl::OverloadControl() : bEnabled(false), iLevel(Normal), uiWindowStart(0), uiBusy(0), uiDrops(0), iCalm(0) {
+}
+
+bool OverloadControl::isEnabled() const {
+	return bEnabled;
+}
+
+void OverloadControl::setEnabled(bool enabled) {
+	bEnabled = enabled;
+	iLevel = Normal;
+	tClock.restart();
+	uiWindowStart = 0;
+	uiBusy = 0;
+	uiDrops = 0;
+	iCalm = 0;
+}
+
+bool OverloadControl::update(quint64 busy) {
+	return update(busy, tClock.elapsed());
+}
+
+bool OverloadControl::update(quint64 busy, quint64 now) {
+	if (! bEnabled)
+		return false;
+
+	uiBusy += busy;
+
+	const quint64 elapsed = now - uiWindowStart;
+	if (elapsed < Window)
+		return false;
+
+	const bool overloaded = (uiDrops > 0) || (uiBusy * 100 >= elapsed * HighLoad);
+	const bool calm = (uiDrops == 0) && (uiBusy * 100 < elapsed * LowLoad);
+
+	uiWindowStart = now;
+	uiBusy = 0;
+	uiDrops = 0;
+
+	if (overloaded) {
+		iCalm = 0;
+		if (iLevel < ShedSpeech) {
+			iLevel = iLevel + 1;
+			return true;
+		}
+	} else if (calm) {
+		if (++iCalm >= CalmWindows) {
+			iCalm = 0;
+			if (iLevel > Normal)
+				iLevel = iLevel - 1;
+		}
+	} else {
+		iCalm = 0;
+	}
+	return false;
+}
+
+quint32 OverloadControl::addDrops(int sock, quint32 total) {
+	// The first counter seen for a socket is only the baseline. A socket
+	// handed over by a previous murmur process carries the drops of its
+	// whole lifetime, which say nothing about the current load.
+	QHash<int, quint32>::iterator i = qhDrops.find(sock);
+	if (i == qhDrops.end()) {
+		qhDrops.insert(sock, total);
+		return 0;
+	}
+	const quint32 dropped = total - i.value();
+	i.value() = total;
+	uiDrops += dropped;
+	return dropped;
+}
+
+#ifdef Q_OS_LINUX
+bool OverloadControl::enableDropCounter(int sock) {
+	int val = 1;
+	return setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &val, sizeof(val)) == 0;
+}
+
+bool OverloadControl::takeDropCounter(struct msghdr *msg, quint32 &total) {
+	bool found = false;
+	char *out = reinterpret_cast<char *>(msg->msg_control);
+	socklen_t outlen = 0;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+	while (cmsg != NULL) {
+		struct cmsghdr *next = CMSG_NXTHDR(msg, cmsg);
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&total, CMSG_DATA(cmsg), sizeof(total));
+			found = true;
+		} else {
+			// Compact the remaining control messages towards the front.
+			const socklen_t space = static_cast<socklen_t>(CMSG_SPACE(cmsg->cmsg_len - CMSG_LEN(0)));
+			if (reinterpret_cast<char *>(cmsg) != out + outlen)
+				memmove(out + outlen, cmsg, cmsg->cmsg_len);
+			outlen += space;
+		}
+		cmsg = next;
+	}
+
+	msg->msg_controllen = outlen;
+	return found;
+}
+#endif
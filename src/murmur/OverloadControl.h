@@ -0,0 +1,88 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_OVERLOADCONTROL_H_
+#define MUMBLE_MURMUR_OVERLOADCONTROL_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QtGlobal>
+
+#include "Timer.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#endif
+
+/// Decides how much forwarding work the voice thread of a virtual server
+/// sheds when it can't keep up, so the kernel doesn't drop datagrams of
+/// everyone at random instead.
+///
+/// The load is measured in windows of Window microseconds: the share of
+/// the window spent processing datagrams, and whether the kernel dropped
+/// datagrams because the receive queue was full (SO_RXQ_OVFL). An
+/// overloaded window raises the level by one; after CalmWindows quiet
+/// windows in a row, it is lowered by one again.
+///
+/// Only the voice thread may call update() and addDrops(). level() may be
+/// read from any thread.
+class OverloadControl {
+	private:
+		Q_DISABLE_COPY(OverloadControl)
+	public:
+		enum Level {
+			/// Everything is forwarded.
+			Normal = 0,
+			/// Positional audio data is stripped from forwarded packets.
+			ShedPositional = 1,
+			/// Additionally, whispers and shouts are dropped.
+			ShedWhisper = 2,
+			/// Additionally, all normal speech is dropped.
+			ShedSpeech = 3
+		};
+
+		enum { Window = 100000, HighLoad = 80, LowLoad = 50, CalmWindows = 10 };
+	protected:
+		bool bEnabled;
+		volatile int iLevel;
+		Timer tClock;
+		quint64 uiWindowStart;
+		quint64 uiBusy;
+		quint64 uiDrops;
+		int iCalm;
+		/// Last drop counter reported for each socket.
+		QHash<int, quint32> qhDrops;
+	public:
+		OverloadControl();
+
+		bool isEnabled() const;
+		void setEnabled(bool enabled);
+
+		/// Current level. Priority speakers are never shed.
+		inline Level level() const {
+			return static_cast<Level>(iLevel);
+		}
+
+		/// Accounts |busy| microseconds spent on one datagram. Returns true
+		/// if this ended a window that raised the level.
+		bool update(quint64 busy);
+		/// As above, at time |now| in microseconds.
+		bool update(quint64 busy, quint64 now);
+
+		/// Records the kernel drop counter |total| of |sock|. Returns the
+		/// number of datagrams dropped since the last call for |sock|, or 0
+		/// for the first call, which only sets the baseline.
+		quint32 addDrops(int sock, quint32 total);
+
+#ifdef Q_OS_LINUX
+		/// Makes the kernel report its drop counter with every datagram
+		/// received on |sock|.
+		static bool enableDropCounter(int sock);
+		/// Removes the drop counter from the control data of |msg|, so it
+		/// can be reused for sending. Returns false if there was none.
+		static bool takeDropCounter(struct msghdr *msg, quint32 &total);
+#endif
+};
+
+#endif
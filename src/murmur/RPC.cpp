@@ -62,6 +62,7 @@ void Server::setUserState(User *pUser, Channel *cChannel, bool mute, bool deaf,
 
 	pUser->bPrioritySpeaker = prioritySpeaker;
 	pUser->qsName = name;
+	reindexUser(static_cast<ServerUser *>(pUser));
 	hashAssign(pUser->qsComment, pUser->qbaCommentHash, comment);
 
 	if (cChannel != pUser->cChannel) {
@@ -433,6 +434,89 @@ void Server::setTempGroups(int userid, int sessionId, Channel *cChannel, const Q
 		clearACLCache(p);
 }
 
+QAtomicInt Server::aiNextAuthRequest;
+
+quint64 Server::nextAuthRequest() {
+	quint64 request;
+	// 0 marks a user without a pending request.
+	do {
+		request = static_cast<quint32>(aiNextAuthRequest.fetchAndAddOrdered(1) + 1);
+	} while (request == 0);
+	return request;
+}
+
+QString Server::authCacheKey(const QString &name, const QString &pw, const QString &certhash) {
+	// Don't keep the plain password around.
+	const QByteArray pwhash = QCryptographicHash::hash(pw.toUtf8(), QCryptographicHash::Sha1).toHex();
+	return certhash + QLatin1Char('/') + name.toLower() + QLatin1Char('/') + QString::fromLatin1(pwhash.constData());
+}
+
+bool Server::isAuthCacheValid(const CachedAuthentication &ca) {
+	const int ttl = (ca.iResult >= 0) ? Meta::mp.iAuthCachePositive : Meta::mp.iAuthCacheNegative;
+	return ttl > 0 && ca.tCreated.elapsed() < static_cast<quint64>(ttl) * 1000000ULL;
+}
+
+void Server::authenticateAsyncResult(quint64 request, int res, const QString &name, const QStringList &groups) {
+	if (! qhPendingAuth.contains(request))
+		return;
+
+	const PendingAuthentication pa = qhPendingAuth.take(request);
+	if (qhPendingAuth.isEmpty())
+		qtAuthTimeout->stop();
+
+	if (res == -2 && bForceExternalAuth)
+		res = -3;
+
+	// Only cache definite answers. Temporary failures and fallthroughs are retried.
+	if ((res >= 0 && Meta::mp.iAuthCachePositive > 0) || (res == -1 && Meta::mp.iAuthCacheNegative > 0)) {
+		CachedAuthentication ca;
+		ca.iResult = res;
+		ca.qsName = name;
+		ca.qslGroups = groups;
+		qhAuthCache.insert(pa.qsCacheKey, ca);
+	}
+
+	ServerUser *u = qhUsers.value(pa.uiSession);
+	if (! u || u->uiAuthRequest != request)
+		return;
+	u->uiAuthRequest = 0;
+
+	if (res == -2) {
+		res = authenticate(u->qsName, u8(pa.mpaMessage.password()), u->uiSession, u->qslEmail, u->qsHash, u->bVerified, u->peerCertificateChain(), false);
+	} else {
+		if (res >= 0 && ! name.isEmpty())
+			u->qsName = name;
+		if (res >= 0) {
+			storeExternalAuthentication(res, u->qsName);
+			if (! groups.isEmpty())
+				setTempGroups(res, u->uiSession, NULL, groups);
+		}
+	}
+
+	finishAuthenticate(u, pa.mpaMessage, res);
+}
+
+void Server::checkPendingAuthentications() {
+	const quint64 timeout = static_cast<quint64>(qMax(Meta::mp.iAuthTimeout, 1)) * 1000000ULL;
+
+	QList<quint64> expired;
+	QHash<quint64, PendingAuthentication>::const_iterator i;
+	for (i = qhPendingAuth.constBegin(); i != qhPendingAuth.constEnd(); ++i) {
+		if (i.value().tStarted.elapsed() > timeout)
+			expired << i.key();
+	}
+
+	foreach(quint64 request, expired) {
+		ServerUser *u = qhUsers.value(qhPendingAuth.value(request).uiSession);
+		if (u)
+			log(u, "Authenticator did not reply in time");
+		authenticateAsyncResult(request, -3, QString(), QStringList());
+	}
+
+	if (qhPendingAuth.isEmpty())
+		qtAuthTimeout->stop();
+}
+
 /**
  * Clears temporary group memberships for the given User. If no channel is given root will be targeted.
  * If recursion is activated all temporary memberships in related channels will also be cleared.
@@ -469,6 +553,7 @@ void Server::connectAuthenticator(QObject *obj) {
 	connect(this, SIGNAL(getRegisteredUsersSig(const QString &, QMap<int, QString> &)), obj, SLOT(getRegisteredUsersSlot(const QString &, QMap<int, QString> &)));
 	connect(this, SIGNAL(getRegistrationSig(int &, int, QMap<int, QString> &)), obj, SLOT(getRegistrationSlot(int &, int, QMap<int, QString> &)));
 	connect(this, SIGNAL(authenticateSig(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, SLOT(authenticateSlot(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)));
+	connect(this, SIGNAL(authenticateAsyncSig(bool &, quint64, const QString &, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, SLOT(authenticateAsyncSlot(bool &, quint64, const QString &, const QList<QSslCertificate> &, const QString &, bool, const QString &)));
 	connect(this, SIGNAL(setInfoSig(int &, int, const QMap<int, QString> &)), obj, SLOT(setInfoSlot(int &, int, const QMap<int, QString> &)));
 	connect(this, SIGNAL(setTextureSig(int &, int, const QByteArray &)), obj, SLOT(setTextureSlot(int &, int, const QByteArray &)));
 	connect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)));
@@ -482,6 +567,7 @@ void Server::disconnectAuthenticator(QObject *obj) {
 	disconnect(this, SIGNAL(getRegisteredUsersSig(const QString &, QMap<int, QString> &)), obj, SLOT(getRegisteredUsersSlot(const QString &, QMap<int, QString> &)));
 	disconnect(this, SIGNAL(getRegistrationSig(int &, int, QMap<int, QString> &)), obj, SLOT(getRegistrationSlot(int &, int, QMap<int, QString> &)));
 	disconnect(this, SIGNAL(authenticateSig(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, SLOT(authenticateSlot(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &)));
+	disconnect(this, SIGNAL(authenticateAsyncSig(bool &, quint64, const QString &, const QList<QSslCertificate> &, const QString &, bool, const QString &)), obj, SLOT(authenticateAsyncSlot(bool &, quint64, const QString &, const QList<QSslCertificate> &, const QString &, bool, const QString &)));
 	disconnect(this, SIGNAL(setInfoSig(int &, int, const QMap<int, QString> &)), obj, SLOT(setInfoSlot(int &, int, const QMap<int, QString> &)));
 	disconnect(this, SIGNAL(setTextureSig(int &, int, const QByteArray &)), obj, SLOT(setTextureSlot(int &, int, const QByteArray &)));
 	disconnect(this, SIGNAL(idToNameSig(QString &, int)), obj, SLOT(idToNameSlot(QString &, int)));
@@ -16,6 +16,8 @@
 #include "Meta.h"
 #include "PacketDataStream.h"
 #include "ServerDB.h"
+#include "ServerSnapshot.h"
+#include "HandshakePool.h"
 #include "ServerUser.h"
 #include "Version.h"
 #include "HTMLFilter.h"
@@ -26,6 +28,10 @@
 #include "BonjourServiceRegister.h"
 #endif
 
+#ifdef Q_OS_UNIX
+#include "Handoff.h"
+#endif
+
 #ifndef MAX
 #define MAX(a,b) ((a)>(b) ? (a):(b))
 #endif
@@ -98,6 +104,7 @@ QSslSocket *SslServer::nextPendingSSLConnection() {
 Server::Server(int snum, QObject *p) : QThread(p) {
 	bValid = true;
 	iServerNum = snum;
+	qtVoice = NULL;
 #ifdef USE_BONJOUR
 	bsRegistration = NULL;
 #endif
@@ -109,13 +116,41 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 	hNotify = NULL;
 #endif
 	qtTimeout = new QTimer(this);
+	qtAuthTimeout = new QTimer(this);
+	uiNextConnection = 0;
+	qtSnapshot = new QTimer(this);
+	qtSnapshot->setSingleShot(true);
+	uiSnapshotVersion = 0;
+	qtUserStates = new QTimer(this);
+	qtUserStates->setSingleShot(true);
+
+	qtpText = new QThreadPool(this);
+	qtpText->setMaxThreadCount(1);
+
+	// Servers are moved to a control thread once started, and servers
+	// loaded on a boot thread to the main thread before that. Only children
+	// move along, and a QTimer can't be started from another thread, so
+	// the registration timer has to be one.
+	qtTick.setParent(this);
 
 	iCodecAlpha = iCodecBeta = 0;
 	bPreferAlpha = false;
 	bOpus = true;
 
+	uiLinkGeneration = 1;
+
 	qnamNetwork = NULL;
 
+	vtpCurrent = NULL;
+	// The batch holds about 110 KB of buffers, so it only exists if used.
+	ubVoice = NULL;
+	if (Meta::mp.bUdpBatch) {
+		ubVoice = new UdpBatch();
+		ubVoice->setEnabled(true);
+	}
+	ocVoice.setEnabled(Meta::mp.bOverloadControl);
+	vtTrace.configure(Meta::mp.bVoiceTrace, static_cast<unsigned int>(qMax(Meta::mp.iVoiceTraceSample, 0)), Meta::mp.iVoiceTraceRing);
+
 	readParams();
 	initialize();
 
@@ -124,6 +159,19 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 
 		connect(ss, SIGNAL(newConnection()), this, SLOT(newClient()), Qt::QueuedConnection);
 
+#ifdef Q_OS_UNIX
+		// Keep listening on the socket of the murmur we replaced, if any.
+		int handed = Handoff::take(iServerNum, qlServer.count(), Handoff::Tcp, qha, usPort);
+		if (handed >= 0) {
+			if (ss->setSocketDescriptor(handed)) {
+				log(QString("Server took over listening on %1").arg(addressToString(qha,usPort)));
+				qlServer << ss;
+				continue;
+			}
+			close(handed);
+		}
+#endif
+
 		if (! ss->listen(qha, usPort)) {
 			log(QString("Server: TCP Listen on %1 failed: %2").arg(addressToString(qha,usPort), ss->errorString()));
 			bValid = false;
@@ -147,8 +195,13 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 #endif
 		memset(&addr, 0, sizeof(addr));
 		getsockname(tcpsock, reinterpret_cast<struct sockaddr *>(&addr), &len);
+		bool handed = false;
 #ifdef Q_OS_UNIX
-		int sock = ::socket(addr.ss_family, SOCK_DGRAM, 0);
+		int sock = Handoff::take(iServerNum, qlUdpSocket.count(), Handoff::Udp, QHostAddress(reinterpret_cast<struct sockaddr *>(&addr)), usPort);
+		if (sock >= 0)
+			handed = true;
+		else
+			sock = ::socket(addr.ss_family, SOCK_DGRAM, 0);
 #ifdef Q_OS_LINUX
 		int sockopt = 1;
 		if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &sockopt, sizeof(sockopt)))
@@ -156,6 +209,10 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 		sockopt = 1;
 		if (setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &sockopt, sizeof(sockopt)))
 			log(QString("Failed to set IPV6_RECVPKTINFO for %1").arg(addressToString(ss->serverAddress(), usPort)));
+		if (vtTrace.isEnabled() && ! VoiceTrace::enableTimestamps(sock))
+			log(QString("Failed to set SO_TIMESTAMPNS for %1").arg(addressToString(ss->serverAddress(), usPort)));
+		if (ocVoice.isEnabled() && ! OverloadControl::enableDropCounter(sock))
+			log(QString("Failed to set SO_RXQ_OVFL for %1").arg(addressToString(ss->serverAddress(), usPort)));
 #endif
 #else
 #ifndef SIO_UDP_CONNRESET
@@ -173,7 +230,7 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 			bValid = false;
 			return;
 		} else {
-			if (addr.ss_family == AF_INET6) {
+			if ((addr.ss_family == AF_INET6) && ! handed) {
 				// Copy IPV6_V6ONLY attribute from tcp socket, it defaults to nonzero on Windows
 				// See https://msdn.microsoft.com/en-us/library/windows/desktop/ms738574%28v=vs.85%29.aspx
 				// This will fail for WindowsXP which is ok. Our TCP code will have split that up
@@ -187,7 +244,9 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 				}
 			}
 
-			if (::bind(sock, reinterpret_cast<sockaddr *>(&addr), len) == SOCKET_ERROR) {
+			if (handed) {
+				// Bound and set up by the murmur we replaced.
+			} else if (::bind(sock, reinterpret_cast<sockaddr *>(&addr), len) == SOCKET_ERROR) {
 				log(QString("Failed to bind UDP Socket to %1").arg(addressToString(ss->serverAddress(), usPort)));
 			} else {
 #ifdef Q_OS_UNIX
@@ -220,6 +279,10 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 		return;
 
 #ifdef Q_OS_UNIX
+	qhResume = Handoff::takeSessions(iServerNum);
+	if (! qhResume.isEmpty())
+		log(QString("Server took over %1 sessions to be resumed").arg(qhResume.count()));
+
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, aiNotify) != 0) {
 		log("Failed to create notify socket");
 		bValid = false;
@@ -236,6 +299,16 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 		qqIds.enqueue(i);
 
 	connect(qtTimeout, SIGNAL(timeout()), this, SLOT(checkTimeout()));
+	connect(qtAuthTimeout, SIGNAL(timeout()), this, SLOT(checkPendingAuthentications()));
+	connect(qtSnapshot, SIGNAL(timeout()), this, SLOT(publishSnapshot()));
+	connect(qtUserStates, SIGNAL(timeout()), this, SLOT(flushUserStates()));
+
+	connect(this, SIGNAL(userStateChanged(const User *)), this, SLOT(invalidateSnapshot()));
+	connect(this, SIGNAL(userConnected(const User *)), this, SLOT(invalidateSnapshot()));
+	connect(this, SIGNAL(userDisconnected(const User *)), this, SLOT(invalidateSnapshot()));
+	connect(this, SIGNAL(channelStateChanged(const Channel *)), this, SLOT(invalidateSnapshot()));
+	connect(this, SIGNAL(channelCreated(const Channel *)), this, SLOT(invalidateSnapshot()));
+	connect(this, SIGNAL(channelRemoved(const Channel *)), this, SLOT(invalidateSnapshot()));
 
 	getBans();
 	readChannels();
@@ -255,16 +328,29 @@ Server::Server(int snum, QObject *p) : QThread(p) {
 #endif
 		initRegister();
 
+		publishSnapshot();
 	}
 }
 
 void Server::startThread() {
+#ifdef Q_OS_LINUX
+	if (meta->veVoice.isEnabled()) {
+		if (! qtVoice) {
+			bRunning = true;
+
+			foreach(QSocketNotifier *qsn, qlUdpNotifier)
+				qsn->setEnabled(false);
+			qtVoice = meta->veVoice.attach(this, qlUdpSocket);
+		}
+	} else
+#endif
 	if (! isRunning()) {
 		log("Starting voice thread");
 		bRunning = true;
 
 		foreach(QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(false);
+		qtVoice = this;
 		start(QThread::HighestPriority);
 #ifdef Q_OS_LINUX
 		// QThread::HighestPriority == Same as everything else...
@@ -285,6 +371,18 @@ void Server::startThread() {
 
 void Server::stopThread() {
 	bRunning = false;
+#ifdef Q_OS_LINUX
+	if (qtVoice && (qtVoice != this)) {
+		meta->veVoice.detach(this);
+		qtVoice = NULL;
+
+		foreach(QSocketNotifier *qsn, qlUdpNotifier)
+			qsn->setEnabled(true);
+
+		if (Meta::mp.bVoiceTrace && Meta::mp.iVoiceTraceSample > 0)
+			dumpVoiceTrace();
+	} else
+#endif
 	if (isRunning()) {
 		log("Ending voice thread");
 
@@ -296,20 +394,46 @@ void Server::stopThread() {
 		SetEvent(hNotify);
 #endif
 		wait();
+		qtVoice = NULL;
 
 		foreach(QSocketNotifier *qsn, qlUdpNotifier)
 			qsn->setEnabled(true);
+
+		if (Meta::mp.bVoiceTrace && Meta::mp.iVoiceTraceSample > 0)
+			dumpVoiceTrace();
 	}
 	qtTimeout->stop();
 }
 
+bool Server::dumpVoiceTrace() {
+	if (Meta::mp.qsVoiceTraceFile.isEmpty())
+		return false;
+
+	const QString path = QString::fromLatin1("%1.%2").arg(Meta::mp.qsVoiceTraceFile, QString::number(iServerNum));
+	if (! vtTrace.dump(path)) {
+		log(QString("Failed to write voice trace to %1").arg(path));
+		return false;
+	}
+	log(QString("Voice trace written to %1").arg(path));
+	return true;
+}
+
 Server::~Server() {
+	meta->hpHandshakes.cancel(this);
+
 #ifdef USE_BONJOUR
 	removeBonjour();
 #endif
 
 	stopThread();
 
+	// Results are posted back to us, so no validation may outlive the server.
+	qtpText->waitForDone();
+
+	ServerSnapshot::withdraw(iServerNum);
+
+	delete ubVoice;
+
 	foreach(QSocketNotifier *qsn, qlUdpNotifier)
 		delete qsn;
 
@@ -397,6 +521,9 @@ void Server::readParams() {
 	qvSuggestPushToTalk = Meta::mp.qvSuggestPushToTalk;
 	iOpusThreshold = Meta::mp.iOpusThreshold;
 	iChannelNestingLimit = Meta::mp.iChannelNestingLimit;
+	iUserStateDelay = Meta::mp.iUserStateDelay;
+	fAudibleRadius = static_cast<float>(Meta::mp.dAudibleRadius);
+	iMaxTalkers = Meta::mp.iMaxTalkers;
 
 	QString qsHost = getConf("host", QString()).toString();
 	if (! qsHost.isEmpty()) {
@@ -463,6 +590,9 @@ void Server::readParams() {
 	iOpusThreshold = getConf("opusthreshold", iOpusThreshold).toInt();
 
 	iChannelNestingLimit = getConf("channelnestinglimit", iChannelNestingLimit).toInt();
+	iUserStateDelay = getConf("userstatedelay", iUserStateDelay).toInt();
+	fAudibleRadius = getConf("audibleradius", fAudibleRadius).toFloat();
+	iMaxTalkers = getConf("maxtalkers", iMaxTalkers).toInt();
 
 	qrUserName=QRegExp(getConf("username", qrUserName.pattern()).toString());
 	qrChannelName=QRegExp(getConf("channelname", qrChannelName.pattern()).toString());
@@ -582,6 +712,17 @@ void Server::setLiveConf(const QString &key, const QString &value) {
 		iOpusThreshold = (i >= 0 && !v.isNull()) ? qBound(0, i, 100) : Meta::mp.iOpusThreshold;
 	else if (key == "channelnestinglimit")
 		iChannelNestingLimit = (i >= 0 && !v.isNull()) ? i : Meta::mp.iChannelNestingLimit;
+	else if (key == "userstatedelay") {
+		iUserStateDelay = (i >= 0 && !v.isNull()) ? i : Meta::mp.iUserStateDelay;
+		if (iUserStateDelay == 0)
+			flushUserStates();
+	} else if (key == "audibleradius") {
+		float f = v.toFloat();
+		fAudibleRadius = (f >= 0.0f && !v.isNull()) ? f : static_cast<float>(Meta::mp.dAudibleRadius);
+	} else if (key == "maxtalkers") {
+		iMaxTalkers = (i >= 0 && !v.isNull()) ? i : Meta::mp.iMaxTalkers;
+		tlTalkers.clear();
+	}
 }
 
 #ifdef USE_BONJOUR
@@ -603,9 +744,24 @@ void Server::removeBonjour() {
 }
 #endif
 
+void Server::reloadMetaCertificate() {
+	if (bUsingMetaCert) {
+		log("Reloading certificates...");
+		initializeCert();
+	} else {
+		log("Not reloading certificates; server does not use Meta certificate");
+	}
+}
+
+void Server::leaveControlThread() {
+	moveToThread(QCoreApplication::instance()->thread());
+}
+
 void Server::customEvent(QEvent *evt) {
 	if (evt->type() == EXEC_QEVENT)
 		static_cast<ExecEvent *>(evt)->execute();
+	else if (evt->type() == HANDSHAKE_QEVENT)
+		handshakeFinished(static_cast<HandshakeEvent *>(evt));
 }
 
 void Server::udpActivated(int socket) {
@@ -663,20 +819,9 @@ void Server::udpActivated(int socket) {
 }
 
 void Server::run() {
-	qint32 len;
-#if defined(__LP64__)
-	char encbuff[UDP_PACKET_SIZE+8];
-	char *encrypt = encbuff + 4;
-#else
-	char encrypt[UDP_PACKET_SIZE];
-#endif
-	char buffer[UDP_PACKET_SIZE];
-
-	sockaddr_storage from;
 	int nfds = qlUdpSocket.count();
 
 #ifdef Q_OS_UNIX
-	socklen_t fromlen;
 	STACKVAR(struct pollfd, fds, nfds+1);
 
 	for (int i=0;i<nfds;++i) {
@@ -689,7 +834,6 @@ void Server::run() {
 	fds[nfds].events = POLLIN;
 	fds[nfds].revents = 0;
 #else
-	int fromlen;
 	STACKVAR(SOCKET, fds, nfds);
 	STACKVAR(HANDLE, events, nfds+1);
 	for (int i=0;i<nfds;++i) {
@@ -744,134 +888,226 @@ void Server::run() {
 				SOCKET sock = fds[ret - WAIT_OBJECT_0];
 #endif
 
-				fromlen = sizeof(from);
+				if (! receiveDatagram(sock, 0))
+					break;
+#ifdef Q_OS_UNIX
+				fds[i].revents = 0;
+#endif
+			}
+		}
+	}
 #ifdef Q_OS_WIN
-				len=::recvfrom(sock, encrypt, UDP_PACKET_SIZE, 0, reinterpret_cast<struct sockaddr *>(&from), &fromlen);
+	for (int i=0;i<nfds-1;++i) {
+		::WSAEventSelect(fds[i], NULL, 0);
+		CloseHandle(events[i]);
+	}
+#endif
+}
+
+/// Accounts the time the voice thread spent on a datagram with its
+/// OverloadControl when it goes out of scope, whichever way
+/// receiveDatagram() returns.
+class OverloadBusyGuard {
+	private:
+		Q_DISABLE_COPY(OverloadBusyGuard)
+		OverloadControl &oc;
+		ServerMetricsShard &ms;
+		const Timer &t;
+	public:
+		OverloadBusyGuard(OverloadControl &control, ServerMetricsShard &shard, const Timer &timer) : oc(control), ms(shard), t(timer) {
+		}
+		~OverloadBusyGuard() {
+			if (oc.update(t.elapsed()))
+				ms.cOverloadEscalations.add();
+		}
+};
+
+#ifdef Q_OS_UNIX
+bool Server::receiveDatagram(int sock, int flags) {
+#else
+bool Server::receiveDatagram(SOCKET sock, int flags) {
+#endif
+	qint32 len;
+#if defined(__LP64__)
+	char encbuff[UDP_PACKET_SIZE+8];
+	char *encrypt = encbuff + 4;
+#else
+	char encrypt[UDP_PACKET_SIZE];
+#endif
+	char buffer[UDP_PACKET_SIZE];
+
+	sockaddr_storage from;
+#ifdef Q_OS_UNIX
+	socklen_t fromlen;
+#else
+	int fromlen;
+#endif
+
+	VoiceTracePacket tp;
+	const bool trace = vtTrace.isEnabled();
+
+	fromlen = sizeof(from);
+#ifdef Q_OS_WIN
+	len=::recvfrom(sock, encrypt, UDP_PACKET_SIZE, flags, reinterpret_cast<struct sockaddr *>(&from), &fromlen);
 #else
 #ifdef Q_OS_LINUX
-				struct msghdr msg;
-				struct iovec iov[1];
+	struct msghdr msg;
+	struct iovec iov[1];
 
-				iov[0].iov_base = encrypt;
-				iov[0].iov_len = UDP_PACKET_SIZE;
+	iov[0].iov_base = encrypt;
+	iov[0].iov_len = UDP_PACKET_SIZE;
 
-				u_char controldata[CMSG_SPACE(MAX(sizeof(struct in6_pktinfo),sizeof(struct in_pktinfo)))];
+	u_char controldata[CMSG_SPACE(MAX(sizeof(struct in6_pktinfo),sizeof(struct in_pktinfo))) + CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(quint32))];
 
-				memset(&msg, 0, sizeof(msg));
-				msg.msg_name = reinterpret_cast<struct sockaddr *>(&from);
-				msg.msg_namelen = sizeof(from);
-				msg.msg_iov = iov;
-				msg.msg_iovlen = 1;
-				msg.msg_control = controldata;
-				msg.msg_controllen = sizeof(controldata);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = reinterpret_cast<struct sockaddr *>(&from);
+	msg.msg_namelen = sizeof(from);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = controldata;
+	msg.msg_controllen = sizeof(controldata);
 
-				len=static_cast<quint32>(::recvmsg(sock, &msg, MSG_TRUNC));
-				Q_UNUSED(fromlen);
+	len=static_cast<quint32>(::recvmsg(sock, &msg, MSG_TRUNC | flags));
+	Q_UNUSED(fromlen);
 #else
-				len=static_cast<qint32>(::recvfrom(sock, encrypt, UDP_PACKET_SIZE, MSG_TRUNC, reinterpret_cast<struct sockaddr *>(&from), &fromlen));
+	len=static_cast<qint32>(::recvfrom(sock, encrypt, UDP_PACKET_SIZE, MSG_TRUNC | flags, reinterpret_cast<struct sockaddr *>(&from), &fromlen));
 #endif
 #endif
-				if (len == 0) {
-					break;
-				} else if (len == SOCKET_ERROR) {
-					break;
-				} else if (len < 5) {
-					// 4 bytes crypt header + type + session
-					continue;
-				} else if (len > UDP_PACKET_SIZE) {
-					continue;
-				}
+	if (len == 0) {
+		return false;
+	} else if (len == SOCKET_ERROR) {
+		return false;
+	} else if (len < 5) {
+		// 4 bytes crypt header + type + session
+		return true;
+	} else if (len > UDP_PACKET_SIZE) {
+		return true;
+	}
+
+	ServerMetricsShard &ms = smMetrics.msVoice;
+	ms.cUdpPacketsIn.add();
+	ms.cUdpBytesIn.add(len);
+
+#ifdef Q_OS_LINUX
+	if (ocVoice.isEnabled()) {
+		// Also strips the counter so the control data can be reused by the ping reply.
+		quint32 dropped;
+		if (OverloadControl::takeDropCounter(&msg, dropped))
+			ms.cKernelDrops.add(ocVoice.addDrops(sock, dropped));
+	}
+#endif
+
+	if (trace) {
+		tp.reset();
+		tp.uiRecv = VoiceTrace::now();
+		tp.iLength = len;
+#ifdef Q_OS_LINUX
+		// Also strips the timestamp so the control data can be reused by the ping reply.
+		tp.uiKernel = VoiceTrace::takeTimestamp(&msg);
+#endif
+		vtpCurrent = &tp;
+	}
 
-				QReadLocker rl(&qrwlVoiceThread);
+	Timer tForward;
+	OverloadBusyGuard obg(ocVoice, ms, tForward);
+	QReadLocker rl(&qrwlVoiceThread);
+	ms.hVoiceLockWaitUsec.add(tForward.elapsed());
 
-				quint32 *ping = reinterpret_cast<quint32 *>(encrypt);
+	quint32 *ping = reinterpret_cast<quint32 *>(encrypt);
 
-				if ((len == 12) && (*ping == 0) && bAllowPing) {
-					ping[0] = uiVersionBlob;
-					// 1 and 2 will be the timestamp, which we return unmodified.
-					ping[3] = qToBigEndian(static_cast<quint32>(qhUsers.count()));
-					ping[4] = qToBigEndian(static_cast<quint32>(iMaxUsers));
-					ping[5] = qToBigEndian(static_cast<quint32>(iMaxBandwidth));
+	if ((len == 12) && (*ping == 0) && bAllowPing) {
+		ms.cPings.add();
+		ping[0] = uiVersionBlob;
+		// 1 and 2 will be the timestamp, which we return unmodified.
+		ping[3] = qToBigEndian(static_cast<quint32>(qhUsers.count()));
+		ping[4] = qToBigEndian(static_cast<quint32>(iMaxUsers));
+		ping[5] = qToBigEndian(static_cast<quint32>(iMaxBandwidth));
 
 #ifdef Q_OS_LINUX
-					iov[0].iov_len = 6 * sizeof(quint32);
-					::sendmsg(sock, &msg, 0);
+		iov[0].iov_len = 6 * sizeof(quint32);
+		::sendmsg(sock, &msg, 0);
 #else
-					::sendto(sock, encrypt, 6 * sizeof(quint32), 0, reinterpret_cast<struct sockaddr *>(&from), fromlen);
+		::sendto(sock, encrypt, 6 * sizeof(quint32), 0, reinterpret_cast<struct sockaddr *>(&from), fromlen);
 #endif
-					continue;
-				}
+		vtpCurrent = NULL;
+		return true;
+	}
 
 
-				quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast<sockaddr_in6 *>(&from)->sin6_port) : (reinterpret_cast<sockaddr_in *>(&from)->sin_port);
-				const HostAddress &ha = HostAddress(from);
+	quint16 port = (from.ss_family == AF_INET6) ? (reinterpret_cast<sockaddr_in6 *>(&from)->sin6_port) : (reinterpret_cast<sockaddr_in *>(&from)->sin_port);
+	const HostAddress &ha = HostAddress(from);
 
-				const QPair<HostAddress, quint16> &key = QPair<HostAddress, quint16>(ha, port);
+	const QPair<HostAddress, quint16> &key = QPair<HostAddress, quint16>(ha, port);
 
-				ServerUser *u = qhPeerUsers.value(key);
-				if (u) {
-					if (! checkDecrypt(u, encrypt, buffer, len)) {
-						continue;
-					}
-				} else {
-					// Unknown peer
-					foreach(ServerUser *usr, qhHostUsers.value(ha)) {
-						if (checkDecrypt(usr, encrypt, buffer, len)) { // checkDecrypt takes the User's qrwlCrypt lock.
-							// Every time we relock, reverify users' existance.
-							// The main thread might delete the user while the lock isn't held.
-							unsigned int uiSession = usr->uiSession;
-							rl.unlock();
-							qrwlVoiceThread.lockForWrite();
-							if (qhUsers.contains(uiSession)) {
-								u = usr;
-								u->sUdpSocket = sock;
-								memcpy(& u->saiUdpAddress, &from, sizeof(from));
-								qhHostUsers[from].remove(u);
-								qhPeerUsers.insert(key, u);
-							}
-							qrwlVoiceThread.unlock();
-							rl.relock();
-							if (u != NULL && !qhUsers.contains(uiSession))
-								u = NULL;
-							break;
-						}
-					}
-					if (! u) {
-						continue;
-					}
-				}
-				len -= 4;
-
-				MessageHandler::UDPMessageType msgType = static_cast<MessageHandler::UDPMessageType>((buffer[0] >> 5) & 0x7);
-
-				switch (msgType) {
-					case MessageHandler::UDPVoiceSpeex:
-					case MessageHandler::UDPVoiceCELTAlpha:
-					case MessageHandler::UDPVoiceCELTBeta:
-						if (bOpus)
-							break;
-					case MessageHandler::UDPVoiceOpus: {
-							u->aiUdpFlag = 1;
-							processMsg(u, buffer, len);
-							break;
-						}
-					case MessageHandler::UDPPing: {
-							QByteArray qba;
-							sendMessage(u, buffer, len, qba, true);
-						}
-				}
-#ifdef Q_OS_UNIX
-				fds[i].revents = 0;
-#endif
+	ServerUser *u = qhPeerUsers.value(key);
+	if (u) {
+		if (! checkDecrypt(u, encrypt, buffer, len)) {
+			vtpCurrent = NULL;
+			return true;
+		}
+	} else {
+		// Unknown peer
+		ms.cUnknownPeerAttempts.add();
+		ServerUser *usr = identifyPeer(ha, encrypt, buffer, len);
+		if (usr) {
+			// Every time we relock, reverify users' existance.
+			// The main thread might delete the user while the lock isn't held.
+			unsigned int uiSession = usr->uiSession;
+			rl.unlock();
+			qrwlVoiceThread.lockForWrite();
+			if (qhUsers.contains(uiSession)) {
+				u = usr;
+				u->sUdpSocket = sock;
+				memcpy(& u->saiUdpAddress, &from, sizeof(from));
+				qhHostUsers[from].remove(u);
+				qhPeerUsers.insert(key, u);
 			}
+			qrwlVoiceThread.unlock();
+			rl.relock();
+			if (u != NULL && !qhUsers.contains(uiSession))
+				u = NULL;
+		}
+		if (! u) {
+			ms.cUnknownPeerDropped.add();
+			vtpCurrent = NULL;
+			return true;
 		}
 	}
-#ifdef Q_OS_WIN
-	for (int i=0;i<nfds-1;++i) {
-		::WSAEventSelect(fds[i], NULL, 0);
-		CloseHandle(events[i]);
+	len -= 4;
+
+	if (vtpCurrent)
+		vtpCurrent->uiDecrypt = VoiceTrace::now();
+
+	MessageHandler::UDPMessageType msgType = static_cast<MessageHandler::UDPMessageType>((buffer[0] >> 5) & 0x7);
+
+	switch (msgType) {
+		case MessageHandler::UDPVoiceSpeex:
+		case MessageHandler::UDPVoiceCELTAlpha:
+		case MessageHandler::UDPVoiceCELTBeta:
+			if (bOpus)
+				break;
+		case MessageHandler::UDPVoiceOpus: {
+				u->aiUdpFlag = 1;
+				processMsg(u, buffer, len);
+				ms.hVoiceForwardUsec.add(tForward.elapsed());
+				if (vtpCurrent) {
+					vtTrace.record(tp, u->uiSession);
+					vtpCurrent = NULL;
+				}
+				break;
+			}
+		case MessageHandler::UDPPing: {
+				ms.cPings.add();
+				QByteArray qba;
+				sendMessage(u, buffer, len, qba, true);
+			}
 	}
-#endif
+	if (ubVoice && ubVoice->count() > 0) {
+		ubVoice->flush();
+		ms.cUdpSendCalls.add(ubVoice->takeCalls());
+	}
+	vtpCurrent = NULL;
+	return true;
 }
 
 bool Server::checkDecrypt(ServerUser *u, const char *encrypt, char *plain, unsigned int len) {
@@ -880,6 +1116,9 @@ bool Server::checkDecrypt(ServerUser *u, const char *encrypt, char *plain, unsig
 	if (u->csCrypt.isValid() && u->csCrypt.decrypt(reinterpret_cast<const unsigned char *>(encrypt), reinterpret_cast<unsigned char *>(plain), len))
 		return true;
 
+	// Only ever called from the voice thread.
+	smMetrics.msVoice.cDecryptFailures.add();
+
 	if (u->csCrypt.tLastGood.elapsed() > 5000000ULL) {
 		if (u->csCrypt.tLastRequest.elapsed() > 5000000ULL) {
 			u->csCrypt.tLastRequest.restart();
@@ -889,7 +1128,74 @@ bool Server::checkDecrypt(ServerUser *u, const char *encrypt, char *plain, unsig
 	return false;
 }
 
+/// Returns how far a packet whose nonce starts with |ivbyte| is from the
+/// next one |cs| expects, mirroring the checks CryptState::decrypt() makes
+/// before decrypting. Packets ahead of the expected one rank before late
+/// ones. Returns -1 if decrypt() would reject the packet outright.
+static int peerRank(const CryptState &cs, unsigned char ivbyte) {
+	int diff = ivbyte - cs.decrypt_iv[0];
+	if (diff > 128)
+		diff = diff - 256;
+	else if (diff < -128)
+		diff = diff + 256;
+
+	if (diff > 0)
+		return diff - 1;
+	if (diff > -30 && diff < 0)
+		return 128 - diff;
+	return -1;
+}
+
+/// Finds the user a datagram from an unknown port of |ha| was sent by, and
+/// decrypts it into |plain|. The voice lock must be held for reading.
+///
+/// Each attempt is a full decryption, and many users may share an address,
+/// so users are tried in order of how well the packet's nonce fits theirs,
+/// and only Meta::mp.iUnknownPeerAttempts of them. The remaining ones are
+/// tried at most once a second, so a user whose nonce fits badly is still
+/// found eventually.
+ServerUser *Server::identifyPeer(const HostAddress &ha, const char *encrypt, char *plain, unsigned int len) {
+	ServerMetricsShard &ms = smMetrics.msVoice;
+
+	if (len < 4)
+		return NULL;
+	const unsigned char ivbyte = static_cast<unsigned char>(encrypt[0]);
+
+	QList<QPair<int, ServerUser *> > candidates;
+	foreach(ServerUser *usr, qhHostUsers.value(ha)) {
+		QMutexLocker l(&usr->qmCrypt);
+		if (! usr->csCrypt.isValid())
+			continue;
+		const int rank = peerRank(usr->csCrypt, ivbyte);
+		if (rank >= 0)
+			candidates << qMakePair(rank, usr);
+	}
+	qSort(candidates);
+
+	int attempts = candidates.count();
+	if ((Meta::mp.iUnknownPeerAttempts > 0) && (attempts > Meta::mp.iUnknownPeerAttempts)) {
+		if (tPeerScan.elapsed() > 1000000ULL) {
+			tPeerScan.restart();
+			ms.cUnknownPeerScans.add();
+		} else {
+			attempts = Meta::mp.iUnknownPeerAttempts;
+		}
+	}
+
+	for (int i = 0; i < attempts; ++i) {
+		ServerUser *usr = candidates.at(i).second;
+		ms.cUnknownPeerDecrypts.add();
+		if (checkDecrypt(usr, encrypt, plain, len)) // checkDecrypt takes the User's qrwlCrypt lock.
+			return usr;
+	}
+	return NULL;
+}
+
 void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force) {
+	VoiceTracePacket *tp = traceContext();
+	if (tp && ! tp->uiRoute)
+		tp->uiRoute = VoiceTrace::now();
+
 	if ((QAtomicIntLoad(u->aiUdpFlag) == 1 || force) && (u->sUdpSocket != INVALID_SOCKET)) {
 #if defined(__LP64__)
 		STACKVAR(char, ebuffer, len+4+16);
@@ -907,6 +1213,8 @@ void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &c
 			u->csCrypt.encrypt(reinterpret_cast<const unsigned char *>(data), reinterpret_cast<unsigned char *>(buffer),
 							   len);
 		}
+		if (tp && ! tp->uiEncrypt)
+			tp->uiEncrypt = VoiceTrace::now();
 #ifdef Q_OS_WIN
 		DWORD dwFlow = 0;
 		if (Meta::hQoS)
@@ -951,10 +1259,19 @@ void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &c
 		}
 
 
-		::sendmsg(u->sUdpSocket, &msg, 0);
+		if ((QThread::currentThread() != qtVoice) || ! ubVoice || ! ubVoice->add(u->sUdpSocket, &msg))
+			::sendmsg(u->sUdpSocket, &msg, 0);
 #else
 		::sendto(u->sUdpSocket, buffer, len+4, 0, reinterpret_cast<struct sockaddr *>(& u->saiUdpAddress), (u->saiUdpAddress.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
 #endif
+		if (tp) {
+			tp->uiSend = VoiceTrace::now();
+			++tp->uiFanout;
+		}
+
+		ServerMetricsShard &ms = metricsShard();
+		ms.cUdpPacketsOut.add();
+		ms.cUdpBytesOut.add(len + 4);
 #ifdef Q_OS_WIN
 		if (Meta::hQoS && dwFlow)
 			QOSRemoveSocketFromFlow(Meta::hQoS, 0, dwFlow, 0);
@@ -963,16 +1280,46 @@ void Server::sendMessage(ServerUser *u, const char *data, int len, QByteArray &c
 	} else {
 		if (cache.isEmpty())
 			cache = QByteArray(data, len);
+		metricsShard().cTcpVoicePacketsOut.add();
 		emit tcpTransmit(cache,u->uiSession);
 	}
 }
 
+/// Whether pDst is within earshot of u. Listeners who haven't sent their
+/// position recently are, since they may have moved since. Listeners who
+/// already hear u keep doing so up to a tenth beyond the radius, so they
+/// don't flicker in and out at its edge.
+static inline bool isAudible(ServerUser *u, const ServerUser *pDst, float radius) {
+	if (! pDst->bPosition || pDst->tPosition.elapsed() > ServerUser::PositionTimeout * 1000000ULL)
+		return true;
+
+	const float dx = u->fPosition[0] - pDst->fPosition[0];
+	const float dy = u->fPosition[1] - pDst->fPosition[1];
+	const float dz = u->fPosition[2] - pDst->fPosition[2];
+	const bool hearing = u->qsAudible.contains(pDst->uiSession);
+	const float r = hearing ? radius * 1.1f : radius;
+	const bool audible = (dx * dx + dy * dy + dz * dz) <= (r * r);
+
+	if (audible && ! hearing)
+		u->qsAudible.insert(pDst->uiSession);
+	else if (! audible && hearing)
+		u->qsAudible.remove(pDst->uiSession);
+	return audible;
+}
+
 #define SENDTO \
 		if ((!pDst->bDeaf) && (!pDst->bSelfDeaf) && (pDst != u)) { \
-			if ((poslen > 0) && (pDst->ssContext == u->ssContext)) \
-				sendMessage(pDst, buffer, len, qba); \
-			else \
+			if ((poslen > 0) && (pDst->ssContext == u->ssContext)) { \
+				if (! cull || isAudible(u, pDst, fAudibleRadius)) { \
+					++fanout; \
+					sendMessage(pDst, buffer, len, qba); \
+				} else { \
+					++culled; \
+				} \
+			} else { \
+				++fanout; \
 				sendMessage(pDst, buffer, len - poslen, qba_npos); \
+			} \
 		}
 
 void Server::processMsg(ServerUser *u, const char *data, int len) {
@@ -987,6 +1334,23 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 	unsigned int type = data[0] & 0xe0;
 	unsigned int target = data[0] & 0x1f;
 	unsigned int poslen;
+	unsigned int fanout = 0;
+	unsigned int culled = 0;
+	bool terminator = false;
+
+	ServerMetricsShard &ms = metricsShard();
+	ms.cVoicePackets.add();
+
+	// Shed load if the voice thread can't keep up. Priority speakers are
+	// always forwarded in full.
+	const OverloadControl::Level shed = u->bPrioritySpeaker ? OverloadControl::Normal : ocVoice.level();
+	if (shed >= OverloadControl::ShedSpeech) {
+		ms.cShedSpeech.add();
+		return;
+	} else if ((shed >= OverloadControl::ShedWhisper) && (target != 0) && (target != 0x1f)) {
+		ms.cShedWhisper.add();
+		return;
+	}
 
 	// Check the voice data rate limit.
 	{
@@ -997,7 +1361,8 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 
 		if (! bw->addFrame(packetsize, iMaxBandwidth / 8)) {
 			// Suppress packet.
-			 return;
+			ms.cVoiceDropped.add();
+			return;
 		}
 	}
 
@@ -1014,11 +1379,28 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 		int size;
 		pdi >> size;
 		pdi.skip(size & 0x1fff);
+		terminator = (size & 0x2000) != 0;
 	}
 
 	// Save location of the positional audio data.
 	poslen = pdi.left();
 
+	// Positions are only tracked by the voice thread, so voice tunneled
+	// through TCP is never culled by distance.
+	bool cull = (fAudibleRadius > 0.0f) && (QThread::currentThread() == qtVoice);
+	if (cull) {
+		if (poslen >= 3 * sizeof(float)) {
+			pdi >> u->fPosition[0];
+			pdi >> u->fPosition[1];
+			pdi >> u->fPosition[2];
+			u->bPosition = pdi.isValid();
+			u->tPosition.restart();
+		} else {
+			u->bPosition = false;
+		}
+		cull = u->bPosition;
+	}
+
 	// Append session id to the new output stream.
 	pds << u->uiSession;
 	// Copy all voice and positional audio data to the output stream.
@@ -1026,27 +1408,63 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 
 	len = pds.size() + 1;
 
+	if ((poslen > 0) && (shed >= OverloadControl::ShedPositional)) {
+		ms.cShedPositional.add();
+		len -= poslen;
+		poslen = 0;
+	}
+
 	if (target == 0x1f) { // Server loopback
 		buffer[0] = static_cast<char>(type | 0);
 		sendMessage(u, buffer, len, qba);
+		ms.hVoiceFanout.add(1);
 		return;
 	} else if (target == 0) { // Normal speech
 		Channel *c = u->cChannel;
 
+		if ((iMaxTalkers > 0) && ! tlTalkers.admit(c->iId, u->uiSession, u->bPrioritySpeaker, terminator, iMaxTalkers)) {
+			ms.cTalkersLimited.add();
+			return;
+		}
+
 		buffer[0] = static_cast<char>(type | 0);
 		foreach(User *p, c->qlUsers) {
 			ServerUser *pDst = static_cast<ServerUser *>(p);
 			SENDTO;
 		}
 
-		if (! c->qhLinks.isEmpty()) {
-			QSet<Channel *> chans = c->allLinks();
-			chans.remove(c);
+		if (! c->qlLinkComponent.isEmpty()) {
+			if (u->uiLinkCacheGeneration != uiLinkGeneration) {
+				const unsigned int generation = uiLinkGeneration;
+				QList<Channel *> chans;
+				{
+					Timer tCache;
+					QMutexLocker qml(&qmCache);
+					ms.hCacheLockWaitUsec.add(tCache.elapsed());
+
+					foreach(Channel *l, c->qlLinkComponent)
+						if ((l != c) && ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache))
+							chans << l;
+				}
+
+				int uiSession = u->uiSession;
+				qrwlVoiceThread.unlock();
+				qrwlVoiceThread.lockForWrite();
 
-			QMutexLocker qml(&qmCache);
+				// Anything may have changed while the lock was released, in
+				// which case the result is dropped and rebuilt on the next packet.
+				if (qhUsers.contains(uiSession) && (generation == uiLinkGeneration)) {
+					u->qlLinkCache = chans;
+					u->uiLinkCacheGeneration = generation;
+				}
+				qrwlVoiceThread.unlock();
+				qrwlVoiceThread.lockForRead();
+				if (! qhUsers.contains(uiSession))
+					return;
+			}
 
-			foreach(Channel *l, chans) {
-				if (ChanACL::hasPermission(u, l, ChanACL::Speak, &acCache)) {
+			if (u->uiLinkCacheGeneration == uiLinkGeneration) {
+				foreach(Channel *l, u->qlLinkCache) {
 					foreach(User *p, l->qlUsers) {
 						ServerUser *pDst = static_cast<ServerUser *>(p);
 						SENDTO;
@@ -1065,7 +1483,9 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 		} else {
 			const WhisperTarget &wt = u->qmTargets.value(target);
 			if (! wt.qlChannels.isEmpty()) {
+				Timer tCache;
 				QMutexLocker qml(&qmCache);
+				ms.hCacheLockWaitUsec.add(tCache.elapsed());
 
 				foreach(const WhisperTarget::Channel &wtc, wt.qlChannels) {
 					Channel *wc = qhChannels.value(wtc.iId);
@@ -1083,7 +1503,7 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 						} else {
 							QSet<Channel *> channels;
 							if (link)
-								channels = wc->allLinks();
+								channels = wc->linkComponent();
 							else
 								channels.insert(wc);
 							if (dochildren)
@@ -1106,7 +1526,9 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 			}
 
 			{
+				Timer tCache;
 				QMutexLocker qml(&qmCache);
+				ms.hCacheLockWaitUsec.add(tCache.elapsed());
 
 				foreach(unsigned int id, wt.qlSessions) {
 					ServerUser *pDst = qhUsers.value(id);
@@ -1143,6 +1565,10 @@ void Server::processMsg(ServerUser *u, const char *data, int len) {
 			}
 		}
 	}
+
+	ms.hVoiceFanout.add(fanout);
+	if (culled > 0)
+		ms.cPositionalCulled.add(culled);
 }
 
 void Server::log(ServerUser *u, const QString &str) const {
@@ -1197,76 +1623,103 @@ void Server::newClient() {
 			}
 		}
 
-		sock->setPrivateKey(qskKey);
-		sock->setLocalCertificate(qscCert);
+		sock->setSslConfiguration(qscSslConfig);
+
+		// Without a free session, addClient() refuses the
+		// connection right away instead of after the handshake.
+		if (meta->hpHandshakes.isEnabled() && ! qqIds.isEmpty()) {
+			meta->hpHandshakes.start(this, sock, Meta::mp.iTimeout);
+			continue;
+		}
+
+		if (! addClient(sock))
+			return;
+
+		sock->startServerEncryption();
+	}
+}
 
-		// Treat the leaf certificate as a root.
-		// This shouldn't strictly be necessary,
-		// and is a left-over from early on.
-		// Perhaps it is necessary for self-signed
-		// certs?
-		sock->addCaCertificate(qscCert);
+ServerUser *Server::addClient(QSslSocket *sock) {
+	if (qqIds.isEmpty()) {
+		log(QString("Session ID pool (%1) empty, rejecting connection").arg(iMaxUsers));
+		sock->disconnectFromHost();
+		sock->deleteLater();
+		return NULL;
+	}
 
-		// Add CA certificates specified via
-		// murmur.ini's sslCA option.
-		sock->addCaCertificates(Meta::mp.qlCA);
+	HostAddress ha(sock->peerAddress());
 
-		// Add intermediate CAs found in the PEM
-		// bundle used for this server's certificate.
-		sock->addCaCertificates(qlIntermediates);
+	ServerUser *u = new ServerUser(this, sock);
+	u->uiSession = qqIds.dequeue();
+	u->uiConnection = ++uiNextConnection;
+	u->haAddress = ha;
+	HostAddress(sock->localAddress()).toSockaddr(& u->saiTcpLocalAddress);
 
-		sock->setCiphers(Meta::mp.qlCiphers);
+	{
+		QWriteLocker wl(&qrwlVoiceThread);
+		qhUsers.insert(u->uiSession, u);
+		qhHostUsers[ha].insert(u);
+	}
 
-#if defined(USE_QSSLDIFFIEHELLMANPARAMETERS)
-		QSslConfiguration cfg = sock->sslConfiguration();
-		cfg.setDiffieHellmanParameters(qsdhpDHParams);
-		sock->setSslConfiguration(cfg);
-#endif
+	connect(u, SIGNAL(connectionClosed(QAbstractSocket::SocketError, const QString &)), this, SLOT(connectionClosed(QAbstractSocket::SocketError, const QString &)));
+	connect(u, SIGNAL(message(unsigned int, const QByteArray &)), this, SLOT(message(unsigned int, const QByteArray &)));
+	connect(u, SIGNAL(handleSslErrors(const QList<QSslError> &)), this, SLOT(sslError(const QList<QSslError> &)));
+	connect(u, SIGNAL(encrypted()), this, SLOT(encrypted()));
 
-		if (qqIds.isEmpty()) {
-			log(QString("Session ID pool (%1) empty, rejecting connection").arg(iMaxUsers));
-			sock->disconnectFromHost();
-			sock->deleteLater();
-			return;
-		}
+	log(u, QString("New connection: %1").arg(addressToString(sock->peerAddress(), sock->peerPort())));
 
-		ServerUser *u = new ServerUser(this, sock);
-		u->uiSession = qqIds.dequeue();
-		u->haAddress = ha;
-		HostAddress(sock->localAddress()).toSockaddr(& u->saiTcpLocalAddress);
+	u->setToS();
 
-		{
-			QWriteLocker wl(&qrwlVoiceThread);
-			qhUsers.insert(u->uiSession, u);
-			qhHostUsers[ha].insert(u);
-		}
+	twTimeouts.schedule(u->uiSession, tUptime.elapsed() / 1000000ULL + static_cast<quint64>(iTimeout));
 
-		connect(u, SIGNAL(connectionClosed(QAbstractSocket::SocketError, const QString &)), this, SLOT(connectionClosed(QAbstractSocket::SocketError, const QString &)));
-		connect(u, SIGNAL(message(unsigned int, const QByteArray &)), this, SLOT(message(unsigned int, const QByteArray &)));
-		connect(u, SIGNAL(handleSslErrors(const QList<QSslError> &)), this, SLOT(sslError(const QList<QSslError> &)));
-		connect(u, SIGNAL(encrypted()), this, SLOT(encrypted()));
+	return u;
+}
 
-		log(u, QString("New connection: %1").arg(addressToString(sock->peerAddress(), sock->peerPort())));
+void Server::handshakeFinished(HandshakeEvent *he) {
+	QSslSocket *sock = he->takeSocket();
 
-		u->setToS();
+	if (sock && ((sock->thread() != thread()) || (sock->state() != QAbstractSocket::ConnectedState))) {
+		he->qsError = QLatin1String("Connection closed during TLS handshake");
+		sock->deleteLater();
+		sock = NULL;
+	}
 
-#if QT_VERSION >= 0x050500
-		sock->setProtocol(QSsl::TlsV1_0OrLater);
-#elif QT_VERSION >= 0x050400
-		// In Qt 5.4, QSsl::SecureProtocols is equivalent
-		// to "TLSv1.0 or later", which we require.
-		sock->setProtocol(QSsl::SecureProtocols);
-#elif QT_VERSION >= 0x050000
-		sock->setProtocol(QSsl::TlsV1_0);
-#else
-		sock->setProtocol(QSsl::TlsV1);
-#endif
-		sock->startServerEncryption();
+	if (! sock) {
+		smMetrics.msControl.cTlsHandshakeFailures.add();
+		log(QString("Ignoring connection: %1 (%2)").arg(addressToString(he->qhaPeer, he->usPeerPort), he->qsError));
+		return;
 	}
+
+	smMetrics.msControl.cTlsHandshakes.add();
+	smMetrics.msControl.hTlsHandshakeUsec.add(he->uiElapsed);
+
+	ServerUser *u = addClient(sock);
+	if (! u)
+		return;
+
+	u->bVerified = he->bVerified;
+	clientEncrypted(u);
+
+	// Data that arrived with the end of the handshake was buffered
+	// before anybody was listening for readyRead().
+	if (sock->bytesAvailable() > 0)
+		QMetaObject::invokeMethod(u, "socketRead", Qt::QueuedConnection);
 }
 
 void Server::encrypted() {
 	ServerUser *uSource = qobject_cast<ServerUser *>(sender());
+
+	// The connection was set up when the handshake started, and
+	// nothing has been received on it since.
+	smMetrics.msControl.cTlsHandshakes.add();
+	smMetrics.msControl.hTlsHandshakeUsec.add(static_cast<quint64>(uSource->activityTime()) * 1000ULL);
+
+	clientEncrypted(uSource);
+}
+
+void Server::clientEncrypted(ServerUser *uSource) {
+	uSource->bEncrypted = true;
+
 	int major, minor, patch;
 	QString release;
 
@@ -1320,12 +1773,7 @@ void Server::encrypted() {
 	}
 }
 
-void Server::sslError(const QList<QSslError> &errors) {
-	ServerUser *u = qobject_cast<ServerUser *>(sender());
-	if (!u)
-		return;
-
-	bool ok = true;
+bool Server::checkSslErrors(const QList<QSslError> &errors, bool &verified, QStringList &fatal) {
 	foreach(QSslError e, errors) {
 		switch (e.error()) {
 			case QSslError::InvalidPurpose:
@@ -1338,13 +1786,24 @@ void Server::sslError(const QList<QSslError> &errors) {
 			case QSslError::HostNameMismatch:
 			case QSslError::CertificateNotYetValid:
 			case QSslError::CertificateExpired:
-				u->bVerified = false;
+				verified = false;
 				break;
 			default:
-				log(u, QString("SSL Error: %1").arg(e.errorString()));
-				ok = false;
+				fatal << e.errorString();
 		}
 	}
+	return fatal.isEmpty();
+}
+
+void Server::sslError(const QList<QSslError> &errors) {
+	ServerUser *u = qobject_cast<ServerUser *>(sender());
+	if (!u)
+		return;
+
+	QStringList fatal;
+	const bool ok = checkSslErrors(errors, u->bVerified, fatal);
+	foreach(const QString &e, fatal)
+		log(u, QString("SSL Error: %1").arg(e));
 
 	if (ok) {
 		u->proceedAnyway();
@@ -1401,6 +1860,12 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 
 	log(u, QString("Connection closed: %1 [%2]").arg(reason).arg(err));
 
+	if (! u->bEncrypted)
+		smMetrics.msControl.cTlsHandshakeFailures.add();
+
+	if (u->uiAuthRequest)
+		qhPendingAuth.remove(u->uiAuthRequest);
+
 	if (u->sState == ServerUser::Authenticated) {
 		MumbleProto::UserRemove mpur;
 		mpur.set_session(u->uiSession);
@@ -1415,6 +1880,9 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 		QWriteLocker wl(&qrwlVoiceThread);
 
 		qhUsers.remove(u->uiSession);
+		twTimeouts.remove(u->uiSession);
+		srUsers.remove(u->uiSession);
+		ccCodecs.remove(u->qlCodecs, u->bOpus);
 		qhHostUsers[u->haAddress].remove(u);
 
 		quint16 port = (u->saiUdpAddress.ss_family == AF_INET6) ? (reinterpret_cast<sockaddr_in6 *>(&u->saiUdpAddress)->sin6_port) : (reinterpret_cast<sockaddr_in *>(&u->saiUdpAddress)->sin_port);
@@ -1423,6 +1891,11 @@ void Server::connectionClosed(QAbstractSocket::SocketError err, const QString &r
 
 		if (old)
 			old->removeUser(u);
+
+		// The session id may be handed to someone else, who mustn't
+		// inherit the hysteresis of this user. See isAudible().
+		foreach(ServerUser *other, qhUsers)
+			other->qsAudible.remove(u->uiSession);
 	}
 
 	if (old && old->bTemporary && old->qlUsers.isEmpty())
@@ -1512,16 +1985,58 @@ void Server::message(unsigned int uiType, const QByteArray &qbaMsg, ServerUser *
 void Server::checkTimeout() {
 	QList<ServerUser *> qlClose;
 
-	qrwlVoiceThread.lockForRead();
-	foreach(ServerUser *u, qhUsers) {
-		if (u->activityTime() > (iTimeout * 1000)) {
+	const quint64 now = tUptime.elapsed() / 1000000ULL;
+	const qint64 timeout = static_cast<qint64>(iTimeout) * 1000;
+
+	QList<unsigned int> expired;
+	twTimeouts.advance(now, expired);
+
+	// qhUsers is only changed on this thread, so it can be read
+	// without locking.
+	foreach(unsigned int session, expired) {
+		ServerUser *u = qhUsers.value(session);
+		if (! u)
+			continue;
+
+		const qint64 idle = u->activityTime();
+		if (idle > timeout) {
 			log(u, "Timeout");
 			qlClose.append(u);
+		} else {
+			// Check again once the user could have timed out.
+			twTimeouts.schedule(session, now + static_cast<quint64>((timeout - idle) / 1000) + 1);
 		}
 	}
-	qrwlVoiceThread.unlock();
 	foreach(ServerUser *u, qlClose)
 		u->disconnectSocket(true);
+
+	// Refresh pings, bandwidth and idle times of the RPC snapshot.
+	invalidateSnapshot();
+
+	QHash<QString, CachedAuthentication>::iterator i = qhAuthCache.begin();
+	while (i != qhAuthCache.end()) {
+		if (isAuthCacheValid(i.value()))
+			++i;
+		else
+			i = qhAuthCache.erase(i);
+	}
+}
+
+void Server::invalidateSnapshot() {
+	// Changes tend to come in bursts (a user joining causes several state
+	// updates), so wait a little and publish them together.
+	if (! qtSnapshot->isActive())
+		qtSnapshot->start(100);
+}
+
+void Server::publishSnapshot() {
+	qtSnapshot->stop();
+	ServerSnapshot::publish(QSharedPointer<const ServerSnapshot>(new ServerSnapshot(this, ++uiSnapshotVersion)));
+}
+
+void Server::flushSnapshot() {
+	if (qtSnapshot->isActive())
+		publishSnapshot();
 }
 
 void Server::tcpTransmitData(QByteArray a, unsigned int id) {
@@ -1551,6 +2066,22 @@ void Server::doSync(unsigned int id) {
 }
 
 void Server::sendProtoMessage(ServerUser *u, const ::google::protobuf::Message &msg, unsigned int msgType) {
+	// Anything sent after a state change, even to a single user, must
+	// arrive after it; the message may well refer to the new state.
+	// Transport messages don't, and a ping reply must not wait for, or
+	// trigger, a broadcast to the whole server.
+	if (! qlPendingUserStates.isEmpty()) {
+		switch (msgType) {
+			case MessageHandler::Ping:
+			case MessageHandler::CryptSetup:
+			case MessageHandler::CodecVersion:
+				break;
+			default:
+				flushUserStates();
+				break;
+		}
+	}
+
 	QByteArray cache;
 	u->sendMessage(msg, msgType, cache);
 }
@@ -1560,6 +2091,10 @@ void Server::sendProtoAll(const ::google::protobuf::Message &msg, unsigned int m
 }
 
 void Server::sendProtoExcept(ServerUser *u, const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int version) {
+	// Anything broadcast after a state change must arrive after it.
+	if (! qlPendingUserStates.isEmpty())
+		flushUserStates();
+
 	QByteArray cache;
 	foreach(ServerUser *usr, qhUsers)
 		if ((usr != u) && (usr->sState == ServerUser::Authenticated))
@@ -1567,6 +2102,78 @@ void Server::sendProtoExcept(ServerUser *u, const ::google::protobuf::Message &m
 				usr->sendMessage(msg, msgType, cache);
 }
 
+void Server::broadcastUserState(const MumbleProto::UserState &msg, unsigned int version) {
+	if (iUserStateDelay <= 0) {
+		sendAll(msg, version);
+		return;
+	}
+
+	QHash<unsigned int, PendingUserState>::iterator i = qhPendingUserStates.find(msg.session());
+	if ((i != qhPendingUserStates.end()) && (i.value().uiActor != msg.actor())) {
+		// Changes by different actors are kept apart, as clients show who made them.
+		flushUserStates();
+		i = qhPendingUserStates.end();
+	}
+
+	if (i == qhPendingUserStates.end()) {
+		i = qhPendingUserStates.insert(msg.session(), PendingUserState());
+		i.value().uiActor = msg.actor();
+		i.value().bLegacy = i.value().bCurrent = false;
+		qlPendingUserStates << msg.session();
+	}
+
+	PendingUserState &pus = i.value();
+	const bool legacy = ((version & 0x80000000) != 0);
+	MumbleProto::UserState &pending = legacy ? pus.mpusLegacy : pus.mpusCurrent;
+	bool &queued = legacy ? pus.bLegacy : pus.bCurrent;
+
+	if (queued) {
+		// A comment or texture replaces the previous one, whether that was sent in full or as a hash.
+		if (msg.has_comment() || msg.has_comment_hash()) {
+			pending.clear_comment();
+			pending.clear_comment_hash();
+		}
+		if (msg.has_texture() || msg.has_texture_hash()) {
+			pending.clear_texture();
+			pending.clear_texture_hash();
+		}
+		if (! legacy)
+			smMetrics.msControl.cUserStatesCoalesced.add();
+	}
+	pending.MergeFrom(msg);
+	queued = true;
+
+	if (! qtUserStates->isActive())
+		qtUserStates->start(iUserStateDelay);
+}
+
+void Server::flushUserStates() {
+	qtUserStates->stop();
+	if (qlPendingUserStates.isEmpty())
+		return;
+
+	// Every recipient gets all pending changes in a single write.
+	QByteArray legacy, current;
+	foreach(unsigned int session, qlPendingUserStates) {
+		const PendingUserState &pus = qhPendingUserStates[session];
+		QByteArray cache;
+		if (pus.bLegacy) {
+			Connection::messageToNetwork(pus.mpusLegacy, MessageHandler::UserState, cache);
+			legacy += cache;
+		}
+		if (pus.bCurrent) {
+			Connection::messageToNetwork(pus.mpusCurrent, MessageHandler::UserState, cache);
+			current += cache;
+		}
+	}
+	qhPendingUserStates.clear();
+	qlPendingUserStates.clear();
+
+	foreach(ServerUser *u, qhUsers)
+		if (u->sState == ServerUser::Authenticated)
+			u->sendMessage((u->uiVersion >= 0x010202) ? current : legacy);
+}
+
 void Server::removeChannel(int id) {
 	Channel *c = qhChannels.value(id);
 	if (c)
@@ -1583,6 +2190,7 @@ void Server::removeChannel(Channel *chan, Channel *dest) {
 	{
 		QWriteLocker wl(&qrwlVoiceThread);
 		chan->unlink(NULL);
+		++uiLinkGeneration;
 	}
 
 	foreach(c, chan->qlChannels) {
@@ -1658,6 +2266,7 @@ bool Server::unregisterUser(int id) {
 			sendAll(mpus);
 
 			u->iId = -1;
+			reindexUser(u);
 			break;
 		}
 	}
@@ -1805,6 +2414,7 @@ void Server::clearACLCache(User *p) {
 
 		foreach(ServerUser *u, qhUsers)
 			u->qmTargetCache.clear();
+		++uiLinkGeneration;
 	}
 }
 
@@ -1834,42 +2444,46 @@ bool Server::validateChannelName(const QString &name) {
 	return (qrChannelName.exactMatch(name) && (name.length() <= 512));
 }
 
-void Server::recheckCodecVersions(ServerUser *connectingUser) {
-	QMap<int, int> qmCodecUsercount;
-	QMap<int, int>::const_iterator i;
-	int users = 0;
-	int opus = 0;
-
-	// Count how many users use which codec
-	foreach(ServerUser *u, qhUsers) {
-		if (u->qlCodecs.isEmpty() && ! u->bOpus)
-			continue;
+void Server::reindexUser(ServerUser *u) {
+	if (u->sState == ServerUser::Authenticated)
+		srUsers.insert(u->uiSession, u->qsName, u->iId);
+}
 
-		++users;
-		if (u->bOpus)
-			++opus;
+bool Server::takeResume(ServerUser *u, ResumeState &rs) {
+	if (qhResume.isEmpty() || u->qsHash.isEmpty())
+		return false;
 
-		foreach(int version, u->qlCodecs)
-			++qmCodecUsercount[version];
+	if (tUptime.elapsed() > ResumeTimeout * 1000000ULL) {
+		qhResume.clear();
+		return false;
 	}
 
+	QHash<QString, ResumeState>::iterator i = qhResume.find(u->qsHash);
+	if (i == qhResume.end())
+		return false;
+
+	// The certificate proves who the user is; the name and account still
+	// have to match what it was authenticated as before the restart.
+	if (i.value().qsName.toLower() != u->qsName.toLower())
+		return false;
+	if ((i.value().iId >= 0) && (getUserName(i.value().iId).toLower() != i.value().qsName.toLower()))
+		return false;
+
+	rs = i.value();
+	qhResume.erase(i);
+	return true;
+}
+
+void Server::recheckCodecVersions(ServerUser *connectingUser) {
+	const int users = ccCodecs.users();
 	if (! users)
 		return;
 
 	// Enable Opus if the number of users with Opus is higher than the threshold
-	bool enableOpus = ((opus * 100 / users) >= iOpusThreshold);
+	bool enableOpus = ((ccCodecs.opus() * 100 / users) >= iOpusThreshold);
 
 	// Find the best possible codec most users support
-	int version = 0;
-	int maximum_users = 0;
-	i = qmCodecUsercount.constEnd();
-	do {
-		--i;
-		if (i.value() > maximum_users) {
-			version = i.key();
-			maximum_users = i.value();
-		}
-	} while (i != qmCodecUsercount.constBegin());
+	int version = ccCodecs.preferred();
 
 	int current_version = bPreferAlpha ? iCodecAlpha : iCodecBeta;
 
@@ -1919,6 +2533,11 @@ void Server::recheckCodecVersions(ServerUser *connectingUser) {
 }
 
 void Server::hashAssign(QString &dest, QByteArray &hash, const QString &src) {
+	// Reassigning the same text, e.g. an unchanged channel description,
+	// doesn't need to be hashed again.
+	if (! hash.isEmpty() && (dest == src))
+		return;
+
 	dest = src;
 	if (src.length() >= 128)
 		hash = sha1(src);
@@ -1926,72 +2545,64 @@ void Server::hashAssign(QString &dest, QByteArray &hash, const QString &src) {
 		hash = QByteArray();
 }
 
-void Server::hashAssign(QByteArray &dest, QByteArray &hash, const QByteArray &src) {
-	dest = src;
-	if (src.length() >= 128)
-		hash = sha1(src);
-	else
-		hash = QByteArray();
+void Server::assignTexture(ServerUser *u, const QByteArray &texture, QByteArray hash) {
+	if (! u->qbaTextureHash.isEmpty()) {
+		if (u->qbaTexture == texture)
+			return;
+		meta->bsBlobs.release(u->qbaTextureHash);
+	}
+
+	if (texture.length() >= 128) {
+		if (hash.isEmpty())
+			hash = sha1(texture);
+		u->qbaTexture = meta->bsBlobs.acquire(hash, texture);
+		u->qbaTextureHash = hash;
+	} else {
+		u->qbaTexture = texture;
+		u->qbaTextureHash = QByteArray();
+	}
 }
 
 bool Server::isTextAllowed(QString &text, bool &changed) {
+	return isTextAllowed(text, changed, bAllowHTML, iMaxTextMessageLength, iMaxImageMessageLength);
+}
+
+bool Server::isTextAllowed(QString &text, bool &changed, bool allowHTML, int maxTextLength, int maxImageLength) {
 	changed = false;
 
-	if (! bAllowHTML) {
+	if (! allowHTML) {
 		QString out;
 		if (HTMLFilter::filter(text, out)) {
 			changed = true;
 			text = out;
 		}
-		return ((iMaxTextMessageLength == 0) || (text.length() <= iMaxTextMessageLength));
+		return ((maxTextLength == 0) || (text.length() <= maxTextLength));
 	} else {
 		int length = text.length();
 
 		// No limits
-		if ((iMaxTextMessageLength == 0) && (iMaxImageMessageLength == 0))
+		if ((maxTextLength == 0) && (maxImageLength == 0))
 			return true;
 
 		// Over Image limit? (If so, always fail)
-		if ((iMaxImageMessageLength != 0) && (length > iMaxImageMessageLength))
+		if ((maxImageLength != 0) && (length > maxImageLength))
 			return false;
 
 		// Under textlength?
-		if ((iMaxTextMessageLength == 0) || (length <= iMaxTextMessageLength))
+		if ((maxTextLength == 0) || (length <= maxTextLength))
 			return true;
 
 		// Over textlength, under imagelength. If no XML, this is a fail.
 		if (! text.contains(QLatin1Char('<')))
 			return false;
 
-		// Strip value from <img>s src attributes to check text-length only -
+		// Don't count the value of <img>s src attributes towards the text-length -
 		// we already ensured the img-length requirement is met
-		QString qsOut;
-		QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(text));
-		QXmlStreamWriter qxsw(&qsOut);
-		while (! qxsr.atEnd()) {
-			switch (qxsr.readNext()) {
-				case QXmlStreamReader::Invalid:
-					return false;
-				case QXmlStreamReader::StartElement: {
-						if (qxsr.name() == QLatin1String("img")) {
-							qxsw.writeStartElement(qxsr.namespaceUri().toString(), qxsr.name().toString());
-							foreach(const QXmlStreamAttribute &a, qxsr.attributes())
-								if (a.name() != QLatin1String("src"))
-									qxsw.writeAttribute(a);
-						} else {
-							qxsw.writeCurrentToken(qxsr);
-						}
-					}
-					break;
-				default:
-					qxsw.writeCurrentToken(qxsr);
-					break;
-			}
-		}
-
-		length = qsOut.length();
+		length = HTMLFilter::textLength(text);
+		if (length < 0)
+			return false;
 
-		return (length <= iMaxTextMessageLength);
+		return (length <= maxTextLength);
 	}
 }
 
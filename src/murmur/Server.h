@@ -18,8 +18,10 @@
 #include <QtCore/QStringList>
 #include <QtCore/QSocketNotifier>
 #include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <QtCore/QUrl>
 #include <QtNetwork/QSslCertificate>
+#include <QtNetwork/QSslConfiguration>
 #include <QtNetwork/QSslKey>
 #include <QtNetwork/QSslSocket>
 #include <QtNetwork/QTcpServer>
@@ -37,9 +39,17 @@
 #include "Timer.h"
 #include "HostAddress.h"
 #include "Ban.h"
+#include "ServerMetrics.h"
+#include "SessionRegistry.h"
+#include "TalkerLimit.h"
+#include "TimerWheel.h"
+#include "OverloadControl.h"
+#include "UdpBatch.h"
+#include "VoiceTrace.h"
 
 class BonjourServer;
 class Channel;
+class HandshakeEvent;
 class PacketDataStream;
 class ServerUser;
 class User;
@@ -88,6 +98,9 @@ class Server : public QThread {
 		Q_DISABLE_COPY(Server);
 	protected:
 		bool bRunning;
+		/// The thread receiving the server's datagrams: the server itself,
+		/// a VoiceEngine worker, or NULL if neither has been started.
+		QThread *qtVoice;
 
 		QNetworkAccessManager *qnamNetwork;
 
@@ -111,6 +124,11 @@ class Server : public QThread {
 		int iMaxTextMessageLength;
 		int iMaxImageMessageLength;
 		int iOpusThreshold;
+		int iUserStateDelay;
+		/// See MetaParams::dAudibleRadius.
+		float fAudibleRadius;
+		/// See MetaParams::iMaxTalkers.
+		int iMaxTalkers;
 		bool bAllowHTML;
 		QString qsPassword;
 		QString qsWelcomeText;
@@ -148,6 +166,9 @@ class Server : public QThread {
 #if defined(USE_QSSLDIFFIEHELLMANPARAMETERS)
 		QSslDiffieHellmanParameters qsdhpDHParams;
 #endif
+		/// TLS configuration of incoming connections, assembled
+		/// by initializeCert() instead of once per connection.
+		QSslConfiguration qscSslConfig;
 
 		Timer tUptime;
 
@@ -159,6 +180,8 @@ class Server : public QThread {
 		int iCodecBeta;
 		bool bPreferAlpha;
 		bool bOpus;
+		/// Codecs of the users that sent their capabilities in msgAuthenticate.
+		CodecCensus ccCodecs;
 		void recheckCodecVersions(ServerUser *connectingUser = 0);
 
 #ifdef USE_BONJOUR
@@ -187,8 +210,26 @@ class Server : public QThread {
 		static QSslKey privateKeyFromPEM(const QByteArray &buf, const QByteArray &pass = QByteArray());
 		void initializeCert();
 		const QString getDigest() const;
+		/// Classifies the errors of a client's certificate. Acceptable but
+		/// unverified certificates clear |verified|. Errors that refuse the
+		/// connection are appended to |fatal|, and false is returned.
+		static bool checkSslErrors(const QList<QSslError> &errors, bool &verified, QStringList &fatal);
+	protected:
+		/// Creates the ServerUser for a new connection, or refuses it
+		/// if there are no free sessions.
+		ServerUser *addClient(QSslSocket *sock);
+		/// Sends the server version to a freshly encrypted connection
+		/// and checks its certificate.
+		void clientEncrypted(ServerUser *uSource);
+		/// Takes over a connection whose handshake ran on Meta's HandshakePool.
+		void handshakeFinished(HandshakeEvent *he);
 
 	public slots:
+		/// Reloads the certificate if the server uses the one of Meta.
+		void reloadMetaCertificate();
+		/// Moves the server from its control thread back to the main thread.
+		/// Must be invoked on the control thread, see Meta::reclaim().
+		void leaveControlThread();
 		void newClient();
 		void connectionClosed(QAbstractSocket::SocketError, const QString &);
 		void sslError(const QList<QSslError> &);
@@ -198,14 +239,66 @@ class Server : public QThread {
 		void doSync(unsigned int);
 		void encrypted();
 		void udpActivated(int);
+		/// Schedules a new ServerSnapshot for read-only RPC queries.
+		void invalidateSnapshot();
+		void publishSnapshot();
+		/// Publishes the scheduled snapshot right away, if there is one.
+		void flushSnapshot();
+		/// Broadcasts all UserState changes held back by broadcastUserState().
+		void flushUserStates();
 	signals:
 		void reqSync(unsigned int);
 		void tcpTransmit(QByteArray, unsigned int id);
 	public:
 		int iServerNum;
 		QQueue<int> qqIds;
+		/// Last ServerUser::uiConnection handed out.
+		quint64 uiNextConnection;
 		QList<SslServer *> qlServer;
 		QTimer *qtTimeout;
+		/// Deadlines, in seconds of tUptime, at which checkTimeout() looks at a
+		/// session again. Activity doesn't touch the wheel; a session that was
+		/// active in the meantime is rescheduled when its deadline is reached.
+		TimerWheel twTimeouts;
+		/// Authenticated users by name and user id, for ghost detection.
+		/// Must be updated through reindexUser() whenever either changes.
+		SessionRegistry srUsers;
+		void reindexUser(ServerUser *u);
+		/// Coalesces state changes into one ServerSnapshot, see invalidateSnapshot().
+		QTimer *qtSnapshot;
+		quint64 uiSnapshotVersion;
+
+		/// Changes of one user waiting to be broadcast, see broadcastUserState().
+		struct PendingUserState {
+			unsigned int uiActor;
+			/// Merged changes for clients older than 1.2.2, and for all others.
+			MumbleProto::UserState mpusLegacy, mpusCurrent;
+			bool bLegacy, bCurrent;
+		};
+		QHash<unsigned int, PendingUserState> qhPendingUserStates;
+		/// Sessions in qhPendingUserStates, in the order of their first change.
+		QList<unsigned int> qlPendingUserStates;
+		QTimer *qtUserStates;
+
+		/// Session of a user of the murmur this one took over from, see
+		/// Handoff. The user resumes it by reconnecting with the same
+		/// certificate and name within ResumeTimeout seconds, without
+		/// being authenticated again.
+		struct ResumeState {
+			QString qsName;
+			int iId;
+			int iChannel;
+			bool bMute, bDeaf, bPrioritySpeaker;
+		};
+		enum { ResumeTimeout = 120 };
+		/// Sessions that can still be resumed, by certificate hash.
+		QHash<QString, ResumeState> qhResume;
+		/// Takes the session |u| resumes, if any.
+		bool takeResume(ServerUser *u, ResumeState &rs);
+
+		/// Validates large text messages off the main thread, see msgTextMessage().
+		/// It runs a single thread, so messages are handed back in the order they arrived.
+		QThreadPool *qtpText;
 
 #ifdef Q_OS_UNIX
 		int aiNotify[2];
@@ -270,20 +363,69 @@ class Server : public QThread {
 
 		QMutex qmCache;
 		ChanACL::ACLCache acCache;
+		/// Incremented whenever channel links or permissions change, which
+		/// invalidates ServerUser::qlLinkCache. Written under a write lock
+		/// on qrwlVoiceThread.
+		unsigned int uiLinkGeneration;
 
 		QHash<int, QString> qhUserNameCache;
 		QHash<QString, int> qhUserIDCache;
+		/// Maps user ids to the BlobStore hash of their texture.
+		QHash<int, QByteArray> qhUserTextureCache;
 
 		QList<Ban> qlBans;
 
+		/// Internal metrics, see ServerMetrics.h.
+		ServerMetrics smMetrics;
+
+		/// Returns the metrics shard owned by the calling thread.
+		inline ServerMetricsShard &metricsShard() {
+			return (QThread::currentThread() == qtVoice) ? smMetrics.msVoice : smMetrics.msControl;
+		}
+
+		/// Optional per-packet latency tracing, see VoiceTrace.h.
+		VoiceTrace vtTrace;
+		/// Datagrams sent while the voice thread handles a datagram, sent
+		/// together at the end of receiveDatagram(). Only used by the
+		/// voice thread. NULL unless udpbatch is set.
+		UdpBatch *ubVoice;
+		/// Decides what the voice thread sheds when it falls behind, if
+		/// overloadcontrol is set.
+		OverloadControl ocVoice;
+		/// Talk spurts forwarded per channel, if maxtalkers is set.
+		TalkerLimit tlTalkers;
+
+		/// The packet currently being traced by the voice thread, or NULL.
+		/// Only written by the voice thread.
+		VoiceTracePacket *vtpCurrent;
+
+		/// Returns the trace of the packet being processed, if the caller
+		/// is the voice thread and tracing is enabled.
+		inline VoiceTracePacket *traceContext() {
+			return (vtpCurrent && QThread::currentThread() == qtVoice) ? vtpCurrent : NULL;
+		}
+		bool dumpVoiceTrace();
+
 		void processMsg(ServerUser *u, const char *data, int len);
 		void sendMessage(ServerUser *u, const char *data, int len, QByteArray &cache, bool force = false);
 		void run();
+		/// Reads and handles one datagram from |sock|, passing |flags| to
+		/// the receive call. Returns false if nothing could be read. Only
+		/// called by the thread receiving the server's voice.
+#ifdef Q_OS_UNIX
+		bool receiveDatagram(int sock, int flags);
+#else
+		bool receiveDatagram(SOCKET sock, int flags);
+#endif
 
 		bool validateChannelName(const QString &name);
 		bool validateUserName(const QString &name);
 
 		bool checkDecrypt(ServerUser *u, const char *encrypted, char *plain, unsigned int cryptlen);
+		ServerUser *identifyPeer(const HostAddress &ha, const char *encrypted, char *plain, unsigned int cryptlen);
+		/// Last time identifyPeer() tried all users of an address. Only
+		/// used by the voice thread.
+		Timer tPeerScan;
 
 		bool hasPermission(ServerUser *p, Channel *c, QFlags<ChanACL::Perm> perm);
 		QFlags<ChanACL::Perm> effectivePermissions(ServerUser *p, Channel *c);
@@ -294,6 +436,14 @@ class Server : public QThread {
 		void sendProtoAll(const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
 		void sendProtoExcept(ServerUser *, const ::google::protobuf::Message &msg, unsigned int msgType, unsigned int minversion);
 		void sendProtoMessage(ServerUser *, const ::google::protobuf::Message &msg, unsigned int msgType);
+		/// Like sendAll(), but if userstatedelay is set, the change is merged with
+		/// other changes of the same user made during the delay, and broadcast with
+		/// them. Any other control message, broadcast or sent to a single user,
+		/// sends the held back changes first, so no client sees a message before
+		/// the state changes that preceded it. Only voice tunneled through TCP
+		/// and the transport messages Ping, CryptSetup and CodecVersion, which
+		/// never refer to a user's state, may overtake them.
+		void broadcastUserState(const MumbleProto::UserState &msg, unsigned int version);
 
 		// sendAll sends a protobuf message to all users on the server whose version is either bigger than v or
 		// lower than ~v. If v == 0 the message is sent to everyone.
@@ -306,8 +456,15 @@ class Server : public QThread {
 #undef MUMBLE_MH_MSG
 
 		static void hashAssign(QString &destination, QByteArray &hash, const QString &str);
-		static void hashAssign(QByteArray &destination, QByteArray &hash, const QByteArray &source);
+		/// Sets the texture of |u|, sharing it with all other holders of the
+		/// same texture through the BlobStore. |hash| may be passed if known.
+		void assignTexture(ServerUser *u, const QByteArray &texture, QByteArray hash = QByteArray());
 		bool isTextAllowed(QString &str, bool &changed);
+		static bool isTextAllowed(QString &str, bool &changed, bool allowHTML, int maxTextLength, int maxImageLength);
+		/// Called on the main thread once qtpText has validated a text message
+		/// of the user with |session| on connection |connection|.
+		void textMessageValidated(unsigned int session, quint64 connection, MumbleProto::TextMessage msg, QString text, bool allowed, bool changed);
+		void sendTextMessage(ServerUser *uSource, MumbleProto::TextMessage &msg, const QString &text, bool allowed, bool changed);
 
 		void setLiveConf(const QString &key, const QString &value);
 
@@ -333,12 +490,22 @@ class Server : public QThread {
 		void disconnectListener(QObject *p);
 		void setTempGroups(int userid, int sessionId, Channel *cChannel, const QStringList &groups);
 		void clearTempGroups(User *user, Channel *cChannel = NULL, bool recurse = true);
+
+		/// Delivers the reply to a request started through authenticateAsyncSig
+		/// and resumes the suspended login. |res| follows the same convention as
+		/// authenticateSig; -2 falls through to the local database. Replies for
+		/// requests that timed out or whose user is gone are ignored.
+		void authenticateAsyncResult(quint64 request, int res, const QString &name, const QStringList &groups);
 	signals:
 		void registerUserSig(int &, const QMap<int, QString> &);
 		void unregisterUserSig(int &, int);
 		void getRegisteredUsersSig(const QString &, QMap<int, QString > &);
 		void getRegistrationSig(int &, int, QMap<int, QString> &);
 		void authenticateSig(int &, QString &, int, const QList<QSslCertificate> &, const QString &, bool, const QString &);
+		/// Emitted for every login before authenticateSig. An authenticator
+		/// that can answer asynchronously sets the bool to true and later
+		/// calls authenticateAsyncResult() with the given request id.
+		void authenticateAsyncSig(bool &, quint64, const QString &, const QList<QSslCertificate> &, const QString &, bool, const QString &);
 		void setInfoSig(int &, int, const QMap<int, QString> &);
 		void setTextureSig(int &, int, const QByteArray &);
 		void idToNameSig(QString &, int);
@@ -390,7 +557,8 @@ class Server : public QThread {
 
 		// Database / DBus functions. Implementation in ServerDB.cpp
 		void initialize();
-		int authenticate(QString &name, const QString &pw, int sessionId = 0, const QStringList &emails = QStringList(), const QString &certhash = QString(), bool bStrongCert = false, const QList<QSslCertificate> & = QList<QSslCertificate>());
+		int authenticate(QString &name, const QString &pw, int sessionId = 0, const QStringList &emails = QStringList(), const QString &certhash = QString(), bool bStrongCert = false, const QList<QSslCertificate> & = QList<QSslCertificate>(), bool external = true);
+		int storeExternalAuthentication(int res, const QString &name);
 		Channel *addChannel(Channel *c, const QString &name, bool temporary = false, int position = 0, unsigned int maxUsers = 0);
 		void removeChannelDB(const Channel *c);
 		void readChannels(Channel *p = NULL);
@@ -402,7 +570,9 @@ class Server : public QThread {
 		void dumpChannel(const Channel *c);
 		int getUserID(const QString &name);
 		QString getUserName(int id);
-		QByteArray getUserTexture(int id);
+		/// Returns the texture of registered user |id|. If |hash| is given and the
+		/// texture's hash is already known, it is stored there.
+		QByteArray getUserTexture(int id, QByteArray *hash = NULL);
 		QMap<int, QString> getRegistration(int id);
 		int registerUser(const QMap<int, QString> &info);
 		bool unregisterUserDB(int id);
@@ -423,6 +593,39 @@ class Server : public QThread {
 #define MUMBLE_MH_MSG(x) void msg##x(ServerUser *, MumbleProto:: x &);
 		MUMBLE_MH_ALL
 #undef MUMBLE_MH_MSG
+
+		/// Second half of msgAuthenticate, run once the user's id is known.
+		void finishAuthenticate(ServerUser *uSource, const MumbleProto::Authenticate &msg, int id, const ResumeState *resume = NULL);
+
+		// Asynchronous authentication.
+
+		/// A login suspended until an authenticator replies.
+		struct PendingAuthentication {
+			unsigned int uiSession;
+			MumbleProto::Authenticate mpaMessage;
+			QString qsCacheKey;
+			Timer tStarted;
+		};
+		/// A recent authenticator reply, see Meta::mp.iAuthCachePositive.
+		struct CachedAuthentication {
+			int iResult;
+			QString qsName;
+			QStringList qslGroups;
+			Timer tCreated;
+		};
+
+		QHash<quint64, PendingAuthentication> qhPendingAuth;
+		QHash<QString, CachedAuthentication> qhAuthCache;
+		QTimer *qtAuthTimeout;
+
+		/// Request numbers are unique across all virtual servers and server
+		/// restarts, so a late authenticator reply never matches a later login.
+		static QAtomicInt aiNextAuthRequest;
+		static quint64 nextAuthRequest();
+		static QString authCacheKey(const QString &name, const QString &pw, const QString &certhash);
+		static bool isAuthCacheValid(const CachedAuthentication &ca);
+	public slots:
+		void checkPendingAuthentications();
 };
 
 #endif
@@ -32,24 +32,30 @@ class TransactionHolder {
 	public:
 		QSqlQuery *qsqQuery;
 		TransactionHolder() {
-			ServerDB::db->transaction();
-			qsqQuery = new QSqlQuery();
+			ServerDB::qmDatabase.lock();
+			QSqlDatabase db = ServerDB::database();
+			db.transaction();
+			qsqQuery = new QSqlQuery(db);
 		}
 
 		~TransactionHolder() {
 			qsqQuery->clear();
 			delete qsqQuery;
-			ServerDB::db->commit();
+			ServerDB::database().commit();
+			ServerDB::qmDatabase.unlock();
 		}
 		TransactionHolder(const TransactionHolder & other) {
-			ServerDB::db->transaction();
+			ServerDB::qmDatabase.lock();
+			ServerDB::database().transaction();
 			qsqQuery = other.qsqQuery ? new QSqlQuery(*other.qsqQuery) : 0;
 		}
 };
 
 QSqlDatabase *ServerDB::db = NULL;
+QMutex ServerDB::qmDatabase(QMutex::Recursive);
 Timer ServerDB::tLogClean;
 QString ServerDB::qsUpgradeSuffix;
+DatabaseMetrics ServerDB::dbmMetrics;
 
 void ServerDB::loadOrSetupMetaPKBDF2IterationsCount(QSqlQuery &query) {
 	if (!Meta::mp.legacyPasswordHash) {
@@ -628,8 +634,44 @@ ServerDB::~ServerDB() {
 	db = NULL;
 }
 
+static QString threadConnectionName() {
+	return QString::fromLatin1("murmur-%1").arg(reinterpret_cast<quintptr>(QThread::currentThread()));
+}
+
+QSqlDatabase ServerDB::database() {
+	if (QThread::currentThread() == QCoreApplication::instance()->thread())
+		return *db;
+
+	// QSqlDatabase connections can only be used on the thread that opened
+	// them, so every control thread gets its own clone of the main one.
+	const QString name = threadConnectionName();
+	if (QSqlDatabase::contains(name))
+		return QSqlDatabase::database(name, false);
+
+	QSqlDatabase tdb = QSqlDatabase::cloneDatabase(*db, name);
+	if (! tdb.open())
+		qFatal("ServerDB: Failed to open database connection for thread: %s", qPrintable(tdb.lastError().text()));
+
+	if ((Meta::mp.qsDBDriver == "QSQLITE") && (Meta::mp.iSQLiteWAL > 0)) {
+		QSqlQuery query(tdb);
+		SQLDO((Meta::mp.iSQLiteWAL == 1) ? "PRAGMA synchronous=NORMAL;" : "PRAGMA synchronous=FULL;");
+	}
+	return tdb;
+}
+
+void ServerDB::closeThreadDatabase() {
+	QMutexLocker l(&qmDatabase);
+
+	const QString name = threadConnectionName();
+	if (! QSqlDatabase::contains(name))
+		return;
+	QSqlDatabase::database(name, false).close();
+	QSqlDatabase::removeDatabase(name);
+}
+
 bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
-	if (! db->isValid()) {
+	QSqlDatabase db = database();
+	if (! db.isValid()) {
 		qWarning("SQL [%s] rejected: Database is gone", qPrintable(str));
 		return false;
 	}
@@ -650,11 +692,11 @@ bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool wa
 	if (query.prepare(q)) {
 		return true;
 	} else {
-		db->close();
-		if (! db->open()) {
-			qFatal("Lost connection to SQL Database: Reconnect: %s", qPrintable(db->lastError().text()));
+		db.close();
+		if (! db.open()) {
+			qFatal("Lost connection to SQL Database: Reconnect: %s", qPrintable(db.lastError().text()));
 		}
-		query = QSqlQuery();
+		query = QSqlQuery(db);
 		if (query.prepare(q)) {
 			qWarning("SQL Connection lost, reconnection OK");
 			return true;
@@ -670,9 +712,16 @@ bool ServerDB::prepare(QSqlQuery &query, const QString &str, bool fatal, bool wa
 	}
 }
 
+static void recordQuery(const Timer &t, bool ok) {
+	ServerDB::dbmMetrics.cQueries.add();
+	ServerDB::dbmMetrics.hQueryUsec.add(t.elapsed());
+	if (! ok)
+		ServerDB::dbmMetrics.cErrors.add();
+}
+
 bool ServerDB::query(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
 	if (! str.isEmpty()) {
-		if (! db->isValid()) {
+		if (! database().isValid()) {
 			qWarning("SQL [%s] rejected: Database is gone", qPrintable(str));
 			return false;
 		}
@@ -690,7 +739,11 @@ bool ServerDB::query(QSqlQuery &query, const QString &str, bool fatal, bool warn
 			q.replace("`", "\"");
 		}
 		
-		if (query.exec(q)) {
+		Timer t;
+		const bool ok = query.exec(q);
+		recordQuery(t, ok);
+
+		if (ok) {
 			return true;
 		} else {
 			if (fatal) {
@@ -709,7 +762,12 @@ bool ServerDB::query(QSqlQuery &query, const QString &str, bool fatal, bool warn
 bool ServerDB::exec(QSqlQuery &query, const QString &str, bool fatal, bool warn) {
 	if (! str.isEmpty())
 		prepare(query, str, fatal, warn);
-	if (query.exec()) {
+
+	Timer t;
+	const bool ok = query.exec();
+	recordQuery(t, ok);
+
+	if (ok) {
 		return true;
 	} else {
 
@@ -726,7 +784,12 @@ bool ServerDB::exec(QSqlQuery &query, const QString &str, bool fatal, bool warn)
 bool ServerDB::execBatch(QSqlQuery &query, const QString &str, bool fatal) {
 	if (! str.isEmpty())
 		prepare(query, str, fatal);
-	if (query.execBatch()) {
+
+	Timer t;
+	const bool ok = query.execBatch();
+	recordQuery(t, ok);
+
+	if (ok) {
 		return true;
 	} else {
 
@@ -891,6 +954,7 @@ int Server::registerUser(const QMap<int, QString> &info) {
 	}
 	
 	qhUserNameCache.remove(id);
+	qhUserTextureCache.remove(id);
 
 	setInfo(id, info);
 
@@ -908,6 +972,7 @@ bool Server::unregisterUserDB(int id) {
 
 	qhUserIDCache.remove(info.value(ServerDB::User_Name));
 	qhUserNameCache.remove(id);
+	qhUserTextureCache.remove(id);
 
 	int res = -2;
 	emit unregisterUserSig(res, id);
@@ -1043,46 +1108,53 @@ QMap<int, QString> Server::getRegistration(int id) {
 
 /// @return UserID of authenticated user, -1 for authentication failures, -2 for unknown user (fallthrough),
 ///         -3 for authentication failures where the data could (temporarily) not be verified.
-int Server::authenticate(QString &name, const QString &password, int sessionId, const QStringList &emails, const QString &certhash, bool bStrongCert, const QList<QSslCertificate> &certs) {
-	int res = bForceExternalAuth ? -3 : -2;
+int Server::storeExternalAuthentication(int res, const QString &name) {
+	if (res != -1) {
+		TransactionHolder th;
+		QSqlQuery &query = *th.qsqQuery;
 
-	emit authenticateSig(res, name, sessionId, certs, certhash, bStrongCert, password);
+		int lchan=readLastChannel(res);
+		if (lchan < 0)
+			lchan = 0;
 
-	if (res != -2) {
-		// External authentication handled it. Ignore certificate completely.
-		if (res != -1) {
-			TransactionHolder th;
-			QSqlQuery &query = *th.qsqQuery;
+		if (Meta::mp.qsDBDriver == "QPSQL") {
+			SQLPREP("INSERT INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (:server_id,:user_id,:name,:lastchannel) ON CONFLICT (`server_id`, `user_id`) DO UPDATE SET `name` = :u_name, `lastchannel` = :u_lastchannel WHERE `%1users`.`server_id` = :u_server_id AND `%1users`.`user_id` = :u_user_id");
+			query.bindValue(":server_id", iServerNum);
+			query.bindValue(":user_id", res);
+			query.bindValue(":name", name);
+			query.bindValue(":lastchannel", lchan);
+			query.bindValue(":u_server_id", iServerNum);
+			query.bindValue(":u_user_id", res);
+			query.bindValue(":u_name", name);
+			query.bindValue(":u_lastchannel", lchan);
+			SQLEXEC();
+		} else {
+			SQLPREP("REPLACE INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (?,?,?,?)");
+			query.addBindValue(iServerNum);
+			query.addBindValue(res);
+			query.addBindValue(name);
+			query.addBindValue(lchan);
+			SQLEXEC();
+		}
+	}
+	if (res >= 0) {
+		qhUserNameCache.remove(res);
+		qhUserIDCache.remove(name);
+	}
+	return res;
+}
 
-			int lchan=readLastChannel(res);
-			if (lchan < 0)
-				lchan = 0;
+int Server::authenticate(QString &name, const QString &password, int sessionId, const QStringList &emails, const QString &certhash, bool bStrongCert, const QList<QSslCertificate> &certs, bool external) {
+	int res = -2;
 
-			if (Meta::mp.qsDBDriver == "QPSQL") {
-				SQLPREP("INSERT INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (:server_id,:user_id,:name,:lastchannel) ON CONFLICT (`server_id`, `user_id`) DO UPDATE SET `name` = :u_name, `lastchannel` = :u_lastchannel WHERE `%1users`.`server_id` = :u_server_id AND `%1users`.`user_id` = :u_user_id");
-				query.bindValue(":server_id", iServerNum);
-				query.bindValue(":user_id", res);
-				query.bindValue(":name", name);
-				query.bindValue(":lastchannel", lchan);
-				query.bindValue(":u_server_id", iServerNum);
-				query.bindValue(":u_user_id", res);
-				query.bindValue(":u_name", name);
-				query.bindValue(":u_lastchannel", lchan);
-				SQLEXEC();
-			} else {
-				SQLPREP("REPLACE INTO `%1users` (`server_id`, `user_id`, `name`, `lastchannel`) VALUES (?,?,?,?)");
-				query.addBindValue(iServerNum);
-				query.addBindValue(res);
-				query.addBindValue(name);
-				query.addBindValue(lchan);
-				SQLEXEC();
-			}
-		}
-		if (res >= 0) {
-			qhUserNameCache.remove(res);
-			qhUserIDCache.remove(name);
-		}
-		return res;
+	if (external) {
+		res = bForceExternalAuth ? -3 : -2;
+		emit authenticateSig(res, name, sessionId, certs, certhash, bStrongCert, password);
+	}
+
+	if (res != -2) {
+		// External authentication handled it. Ignore certificate completely.
+		return storeExternalAuthentication(res, name);
 	}
 
 	TransactionHolder th;
@@ -1350,9 +1422,17 @@ bool Server::setTexture(int id, const QByteArray &texture) {
 	else
 		tex = texture;
 
+	const QByteArray hash = (tex.length() >= 128) ? sha1(tex) : QByteArray();
+	if (hash.isEmpty()) {
+		qhUserTextureCache.remove(id);
+	} else {
+		meta->bsBlobs.insert(hash, tex);
+		qhUserTextureCache.insert(id, hash);
+	}
+
 	foreach(ServerUser *u, qhUsers) {
 		if (u->iId == id)
-			hashAssign(u->qbaTexture, u->qbaTextureHash, tex);
+			assignTexture(u, tex, hash);
 	}
 
 	int res = -2;
@@ -1475,13 +1555,27 @@ int Server::getUserID(const QString &name) {
 	return id;
 }
 
-QByteArray Server::getUserTexture(int id) {
+QByteArray Server::getUserTexture(int id, QByteArray *hash) {
 	QByteArray qba;
+
 	emit idToTextureSig(qba, id);
 	if (! qba.isNull()) {
 		return qba;
 	}
 
+	// Textures of users who were online recently are still in the blob
+	// store, and don't have to be read from the database again.
+	const QByteArray cached = qhUserTextureCache.value(id);
+	if (! cached.isEmpty()) {
+		qba = meta->bsBlobs.value(cached);
+		if (! qba.isNull()) {
+			if (hash)
+				*hash = cached;
+			return qba;
+		}
+		qhUserTextureCache.remove(id);
+	}
+
 	TransactionHolder th;
 
 	QSqlQuery &query = *th.qsqQuery;
@@ -1495,6 +1589,14 @@ QByteArray Server::getUserTexture(int id) {
 			if (qba.size() == 600 * 60 * 4)
 				qba = qCompress(qba);
 	}
+
+	if (qba.length() >= 128) {
+		const QByteArray h = sha1(qba);
+		meta->bsBlobs.insert(h, qba);
+		qhUserTextureCache.insert(id, h);
+		if (hash)
+			*hash = h;
+	}
 	return qba;
 }
 
@@ -1502,6 +1604,7 @@ void Server::addLink(Channel *c, Channel *l) {
 	{
 		QWriteLocker wl(&qrwlVoiceThread);
 		c->link(l);
+		++uiLinkGeneration;
 	}
 
 	if (c->bTemporary || l->bTemporary)
@@ -1525,6 +1628,7 @@ void Server::removeLink(Channel *c, Channel *l) {
 	{
 		QWriteLocker wl(&qrwlVoiceThread);
 		c->unlink(l);
+		++uiLinkGeneration;
 	}
 
 	if (c->bTemporary || l->bTemporary)
@@ -1827,9 +1931,10 @@ void Server::readChannelPrivs(Channel *c) {
 }
 
 void Server::readChannels(Channel *p) {
+	QMutexLocker l(&ServerDB::qmDatabase);
 	QList<Channel *> kids;
 	Channel *c;
-	QSqlQuery query;
+	QSqlQuery query(ServerDB::database());
 	int parentid = -1;
 
 	if (p) {
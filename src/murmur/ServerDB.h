@@ -6,9 +6,11 @@
 #ifndef MUMBLE_MURMUR_DATABASE_H_
 #define MUMBLE_MURMUR_DATABASE_H_
 
+#include <QtCore/QMutex>
 #include <QtCore/QVariant>
 
 #include "Timer.h"
+#include "ServerMetrics.h"
 
 class Channel;
 class User;
@@ -24,8 +26,19 @@ class ServerDB {
 		~ServerDB();
 		typedef QPair<unsigned int, QString> LogRecord;
 		static Timer tLogClean;
+		/// The connection of the main thread.
 		static QSqlDatabase *db;
+		/// Serializes all database access. Held for the lifetime
+		/// of every TransactionHolder.
+		static QMutex qmDatabase;
 		static QString qsUpgradeSuffix;
+		/// Statement metrics. Only updated while holding qmDatabase.
+		static DatabaseMetrics dbmMetrics;
+		/// Returns the connection for the calling thread, opening one
+		/// for control threads on first use. Requires qmDatabase.
+		static QSqlDatabase database();
+		/// Closes the connection of the calling control thread.
+		static void closeThreadDatabase();
 		static void setSUPW(int iServNum, const QString &pw);
 		static void disableSU(int srvnum);
 		static QList<int> getBootServers();
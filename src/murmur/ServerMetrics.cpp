@@ -0,0 +1,111 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "ServerMetrics.h"
+
+MetricHistogram::MetricHistogram() : uiSum(0), uiCount(0) {
+	for (int i = 0; i <= Buckets; ++i)
+		uiBuckets[i] = 0;
+}
+
+void MetricHistogram::merge(const MetricHistogram &other) {
+	for (int i = 0; i <= Buckets; ++i)
+		uiBuckets[i] = uiBuckets[i] + other.uiBuckets[i];
+	uiSum = uiSum + other.uiSum;
+	uiCount = uiCount + other.uiCount;
+}
+
+quint64 MetricHistogram::bucket(int i) const {
+	return uiBuckets[i];
+}
+
+quint64 MetricHistogram::sum() const {
+	return uiSum;
+}
+
+quint64 MetricHistogram::count() const {
+	return uiCount;
+}
+
+quint64 MetricHistogram::bound(int i) {
+	return Q_UINT64_C(1) << i;
+}
+
+quint64 ServerMetrics::counter(MetricCounter ServerMetricsShard::*m) const {
+	return (msVoice.*m).value() + (msControl.*m).value();
+}
+
+void ServerMetrics::histogram(MetricHistogram ServerMetricsShard::*m, MetricHistogram &out) const {
+	out.merge(msVoice.*m);
+	out.merge(msControl.*m);
+}
+
+void MetricsWriter::family(const char *name, const char *type, const char *help) {
+	qbaOutput.append("# HELP ");
+	qbaOutput.append(name);
+	qbaOutput.append(' ');
+	qbaOutput.append(help);
+	qbaOutput.append("\n# TYPE ");
+	qbaOutput.append(name);
+	qbaOutput.append(' ');
+	qbaOutput.append(type);
+	qbaOutput.append('\n');
+}
+
+void MetricsWriter::sample(const char *name, const QByteArray &labels, quint64 value) {
+	qbaOutput.append(name);
+	if (! labels.isEmpty()) {
+		qbaOutput.append('{');
+		qbaOutput.append(labels);
+		qbaOutput.append('}');
+	}
+	qbaOutput.append(' ');
+	qbaOutput.append(QByteArray::number(value));
+	qbaOutput.append('\n');
+}
+
+void MetricsWriter::histogram(const char *name, const QByteArray &labels, const MetricHistogram &h, double scale) {
+	const QByteArray base(name);
+	const QByteArray prefix = labels.isEmpty() ? QByteArray() : labels + ',';
+
+	// Prometheus buckets are cumulative.
+	quint64 cumulative = 0;
+	for (int i = 0; i < MetricHistogram::Buckets; ++i) {
+		cumulative += h.bucket(i);
+		qbaOutput.append(base + "_bucket{" + prefix + "le=\"" + formatDouble(static_cast<double>(MetricHistogram::bound(i)) * scale) + "\"} ");
+		qbaOutput.append(QByteArray::number(cumulative));
+		qbaOutput.append('\n');
+	}
+	cumulative += h.bucket(MetricHistogram::Buckets);
+	qbaOutput.append(base + "_bucket{" + prefix + "le=\"+Inf\"} ");
+	qbaOutput.append(QByteArray::number(cumulative));
+	qbaOutput.append('\n');
+
+	qbaOutput.append(base + "_sum");
+	if (! labels.isEmpty())
+		qbaOutput.append('{' + labels + '}');
+	qbaOutput.append(' ');
+	qbaOutput.append(formatDouble(static_cast<double>(h.sum()) * scale));
+	qbaOutput.append('\n');
+
+	// Use the bucket total rather than count() so the exposition stays
+	// consistent even if the writer updated the histogram meanwhile.
+	qbaOutput.append(base + "_count");
+	if (! labels.isEmpty())
+		qbaOutput.append('{' + labels + '}');
+	qbaOutput.append(' ');
+	qbaOutput.append(QByteArray::number(cumulative));
+	qbaOutput.append('\n');
+}
+
+const QByteArray &MetricsWriter::data() const {
+	return qbaOutput;
+}
+
+QByteArray MetricsWriter::formatDouble(double v) {
+	return QByteArray::number(v, 'g', 12);
+}
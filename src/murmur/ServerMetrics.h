@@ -0,0 +1,168 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_SERVERMETRICS_H_
+#define MUMBLE_MURMUR_SERVERMETRICS_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QtGlobal>
+
+// Metrics are updated on the hot paths of the voice thread, so they
+// don't use locks or atomic read-modify-write operations. Instead, every
+// metric has exactly one writing thread, and readers (the exporter) just
+// read the current value. A reader may see a slightly stale value, which
+// is fine for monitoring.
+
+/// Monotonically increasing counter. Must only be updated from one thread.
+class MetricCounter {
+	private:
+		Q_DISABLE_COPY(MetricCounter)
+	protected:
+		volatile quint64 uiValue;
+	public:
+		MetricCounter() : uiValue(0) {}
+
+		inline void add(quint64 v = 1) {
+			uiValue = uiValue + v;
+		}
+
+		inline quint64 value() const {
+			return uiValue;
+		}
+};
+
+/// Histogram with power-of-two buckets, 1 to 2^(Buckets-1).
+/// Must only be updated from one thread.
+class MetricHistogram {
+	private:
+		Q_DISABLE_COPY(MetricHistogram)
+	public:
+		enum { Buckets = 24 };
+	protected:
+		/// Non-cumulative counts. The last slot counts values above the largest bound.
+		volatile quint64 uiBuckets[Buckets + 1];
+		volatile quint64 uiSum;
+		volatile quint64 uiCount;
+	public:
+		MetricHistogram();
+
+		inline void add(quint64 v) {
+			int i = 0;
+			while (i < Buckets && v > (Q_UINT64_C(1) << i))
+				++i;
+			uiBuckets[i] = uiBuckets[i] + 1;
+			uiSum = uiSum + v;
+			uiCount = uiCount + 1;
+		}
+
+		/// Adds the current contents of |other| to this histogram.
+		void merge(const MetricHistogram &other);
+
+		quint64 bucket(int i) const;
+		quint64 sum() const;
+		quint64 count() const;
+		static quint64 bound(int i);
+};
+
+/// The metrics of one virtual server that are written by one thread.
+struct ServerMetricsShard {
+	MetricCounter cUdpPacketsIn;
+	MetricCounter cUdpBytesIn;
+	MetricCounter cUdpPacketsOut;
+	MetricCounter cUdpBytesOut;
+	MetricCounter cUdpSendCalls;
+	MetricCounter cTcpVoicePacketsOut;
+	MetricCounter cVoicePackets;
+	MetricCounter cVoiceDropped;
+	MetricCounter cKernelDrops;
+	MetricCounter cOverloadEscalations;
+	MetricCounter cShedPositional;
+	MetricCounter cShedWhisper;
+	MetricCounter cShedSpeech;
+	MetricCounter cPositionalCulled;
+	MetricCounter cTalkersLimited;
+	MetricCounter cDecryptFailures;
+	MetricCounter cUnknownPeerAttempts;
+	MetricCounter cUnknownPeerDropped;
+	MetricCounter cUnknownPeerDecrypts;
+	MetricCounter cUnknownPeerScans;
+	MetricCounter cPings;
+	MetricCounter cRpcEventsDropped;
+	MetricCounter cRpcEventsCoalesced;
+	MetricCounter cRpcEventBatches;
+	MetricCounter cTlsHandshakes;
+	MetricCounter cTlsHandshakeFailures;
+	MetricCounter cUserStatesCoalesced;
+
+	/// Time from receiving a datagram until it has been forwarded to all recipients, in microseconds.
+	MetricHistogram hVoiceForwardUsec;
+	/// Number of recipients per voice packet.
+	MetricHistogram hVoiceFanout;
+	/// Time spent acquiring qrwlVoiceThread, in microseconds.
+	MetricHistogram hVoiceLockWaitUsec;
+	/// Time spent acquiring qmCache, in microseconds.
+	MetricHistogram hCacheLockWaitUsec;
+	/// Time from queueing a gRPC server event until its batch was written, in microseconds.
+	MetricHistogram hRpcEventLagUsec;
+	/// Events per gRPC event batch.
+	MetricHistogram hRpcEventBatchSize;
+	/// Duration of completed TLS handshakes, in microseconds.
+	MetricHistogram hTlsHandshakeUsec;
+
+	ServerMetricsShard() {}
+	private:
+		Q_DISABLE_COPY(ServerMetricsShard)
+};
+
+/// All metrics of one virtual server, split by writing thread.
+class ServerMetrics {
+	private:
+		Q_DISABLE_COPY(ServerMetrics)
+	public:
+		/// Written by the voice thread (Server::run()).
+		ServerMetricsShard msVoice;
+		/// Written by the thread running the server's control plane,
+		/// e.g. for voice tunneled through TCP.
+		ServerMetricsShard msControl;
+
+		ServerMetrics() {}
+
+		quint64 counter(MetricCounter ServerMetricsShard::*m) const;
+		void histogram(MetricHistogram ServerMetricsShard::*m, MetricHistogram &out) const;
+};
+
+/// Database statement metrics. Shared by all virtual servers.
+struct DatabaseMetrics {
+	MetricCounter cQueries;
+	MetricCounter cErrors;
+	MetricHistogram hQueryUsec;
+
+	DatabaseMetrics() {}
+	private:
+		Q_DISABLE_COPY(DatabaseMetrics)
+};
+
+/// Builds a Prometheus text format (version 0.0.4) exposition.
+class MetricsWriter {
+	private:
+		Q_DISABLE_COPY(MetricsWriter)
+	protected:
+		QByteArray qbaOutput;
+	public:
+		MetricsWriter() {}
+
+		/// Starts a metric family. Must be followed by its samples.
+		void family(const char *name, const char *type, const char *help);
+		void sample(const char *name, const QByteArray &labels, quint64 value);
+		/// Writes the _bucket, _sum and _count samples of a histogram.
+		/// Values are multiplied by |scale|, e.g. 1e-6 to turn microseconds into seconds.
+		void histogram(const char *name, const QByteArray &labels, const MetricHistogram &h, double scale);
+
+		const QByteArray &data() const;
+
+		static QByteArray formatDouble(double v);
+};
+
+#endif
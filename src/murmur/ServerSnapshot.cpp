@@ -0,0 +1,103 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "ServerSnapshot.h"
+
+#include "Channel.h"
+#include "Server.h"
+#include "ServerUser.h"
+
+QMutex ServerSnapshot::qmSnapshots;
+QHash<int, QSharedPointer<const ServerSnapshot> > ServerSnapshot::qhSnapshots;
+
+ServerSnapshot::ServerSnapshot(const Server *server, quint64 version) : iServerNum(server->iServerNum), uiVersion(version) {
+	foreach(const ServerUser *u, server->qhUsers) {
+		UserState us;
+		us.uiSession = u->uiSession;
+		us.iId = u->iId;
+		us.qsName = u->qsName;
+		us.bAuthenticated = (u->sState == ServerUser::Authenticated);
+		us.bMute = u->bMute;
+		us.bDeaf = u->bDeaf;
+		us.bSuppress = u->bSuppress;
+		us.bRecording = u->bRecording;
+		us.bPrioritySpeaker = u->bPrioritySpeaker;
+		us.bSelfMute = u->bSelfMute;
+		us.bSelfDeaf = u->bSelfDeaf;
+		us.iChannel = u->cChannel ? u->cChannel->iId : 0;
+		us.qsComment = u->qsComment;
+		us.iOnlineSecs = u->bwr.onlineSeconds();
+		us.iIdleSecs = u->bwr.idleSeconds();
+		us.iBandwidth = u->bwr.bandwidth();
+		us.uiVersion = u->uiVersion;
+		us.qsRelease = u->qsRelease;
+		us.qsOS = u->qsOS;
+		us.qsOSVersion = u->qsOSVersion;
+		us.qsIdentity = u->qsIdentity;
+		us.ssContext = u->ssContext;
+		us.dUDPPingAvg = u->dUDPPingAvg;
+		us.dTCPPingAvg = u->dTCPPingAvg;
+		us.bTcpOnly = QAtomicIntLoad(u->aiUdpFlag) == 0;
+		us.haAddress = u->haAddress;
+		qhUsers.insert(us.uiSession, us);
+	}
+
+	foreach(const Channel *c, server->qhChannels) {
+		ChannelState cs;
+		cs.iId = c->iId;
+		cs.iParent = c->cParent ? c->cParent->iId : -1;
+		cs.qsName = c->qsName;
+		cs.qsDesc = c->qsDesc;
+		cs.iPosition = c->iPosition;
+		cs.bTemporary = c->bTemporary;
+		foreach(const Channel *l, c->qsPermLinks)
+			cs.qlLinks << l->iId;
+
+		QList<Channel *> channels = c->qlChannels;
+		qSort(channels.begin(), channels.end(), Channel::lessThan);
+		foreach(const Channel *sub, channels)
+			cs.qlChannels << sub->iId;
+
+		QList<User *> users = c->qlUsers;
+		qSort(users.begin(), users.end(), User::lessThan);
+		foreach(const User *p, users)
+			cs.qlUsers << p->uiSession;
+
+		qmChannels.insert(cs.iId, cs);
+	}
+}
+
+int ServerSnapshot::onlineSeconds(const UserState &us) const {
+	return us.iOnlineSecs + static_cast<int>(tCreated.elapsed() / 1000000ULL);
+}
+
+// Both publish() and withdraw() drop the previous snapshot outside of the
+// lock, so readers never wait for it to be freed.
+
+void ServerSnapshot::publish(QSharedPointer<const ServerSnapshot> snapshot) {
+	QSharedPointer<const ServerSnapshot> previous;
+
+	{
+		QMutexLocker lock(&qmSnapshots);
+		previous = qhSnapshots.value(snapshot->iServerNum);
+		qhSnapshots.insert(snapshot->iServerNum, snapshot);
+	}
+}
+
+void ServerSnapshot::withdraw(int server_id) {
+	QSharedPointer<const ServerSnapshot> snapshot;
+
+	{
+		QMutexLocker lock(&qmSnapshots);
+		snapshot = qhSnapshots.take(server_id);
+	}
+}
+
+QSharedPointer<const ServerSnapshot> ServerSnapshot::current(int server_id) {
+	QMutexLocker lock(&qmSnapshots);
+	return qhSnapshots.value(server_id);
+}
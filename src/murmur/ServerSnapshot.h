@@ -0,0 +1,96 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_SERVERSNAPSHOT_H_
+#define MUMBLE_MURMUR_SERVERSNAPSHOT_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+
+#include <string>
+
+#include "HostAddress.h"
+#include "Timer.h"
+
+class Server;
+
+/// Immutable copy of the channels and users of a running virtual server.
+///
+/// The server's thread builds a new snapshot shortly after the server's state
+/// changed and publishes it with publish(). Read-only RPC queries are then
+/// answered on the RPC threads from current(), without waiting for that
+/// thread and without touching the live Server, User or Channel objects.
+///
+/// A snapshot may lag behind the live state by a few hundred milliseconds.
+/// Bandwidth, ping and idle times are only refreshed together with the rest
+/// of the state, or at the latest on the next Server::checkTimeout().
+class ServerSnapshot {
+	private:
+		Q_DISABLE_COPY(ServerSnapshot)
+	public:
+		struct UserState {
+			unsigned int uiSession;
+			int iId;
+			QString qsName;
+			bool bAuthenticated;
+			bool bMute, bDeaf, bSuppress, bRecording, bPrioritySpeaker, bSelfMute, bSelfDeaf;
+			int iChannel;
+			QString qsComment;
+			int iOnlineSecs;
+			int iIdleSecs;
+			int iBandwidth;
+			unsigned int uiVersion;
+			QString qsRelease, qsOS, qsOSVersion;
+			QString qsIdentity;
+			std::string ssContext;
+			float dUDPPingAvg, dTCPPingAvg;
+			bool bTcpOnly;
+			HostAddress haAddress;
+		};
+
+		struct ChannelState {
+			int iId;
+			int iParent;
+			QString qsName;
+			QString qsDesc;
+			int iPosition;
+			bool bTemporary;
+			QList<int> qlLinks;
+			/// Subchannel ids, sorted like Channel::lessThan.
+			QList<int> qlChannels;
+			/// Sessions of the users in the channel, sorted like User::lessThan.
+			QList<unsigned int> qlUsers;
+		};
+
+		const int iServerNum;
+		/// Increases with every snapshot published for the server.
+		const quint64 uiVersion;
+
+		QHash<unsigned int, UserState> qhUsers;
+		QMap<int, ChannelState> qmChannels;
+
+		/// Builds a snapshot of |server|. Must be called on the thread owning it.
+		ServerSnapshot(const Server *server, quint64 version);
+
+		/// Seconds the user has been online, counted up to now.
+		int onlineSeconds(const UserState &us) const;
+
+		static void publish(QSharedPointer<const ServerSnapshot> snapshot);
+		static void withdraw(int server_id);
+		/// Returns the current snapshot of a running server, or a null pointer.
+		/// Safe to call from any thread.
+		static QSharedPointer<const ServerSnapshot> current(int server_id);
+	protected:
+		Timer tCreated;
+
+		static QMutex qmSnapshots;
+		static QHash<int, QSharedPointer<const ServerSnapshot> > qhSnapshots;
+};
+
+#endif
@@ -23,11 +23,23 @@ ServerUser::ServerUser(Server *p, QSslSocket *socket) : Connection(p, socket), U
 	aiUdpFlag = 1;
 	uiVersion = 0;
 	bVerified = true;
+	bEncrypted = false;
+	uiAuthRequest = 0;
+	iPendingTextMessages = 0;
+	uiConnection = 0;
 	iLastPermissionCheck = -1;
+	uiLinkCacheGeneration = 0;
+	bPosition = false;
+	fPosition[0] = fPosition[1] = fPosition[2] = 0.0f;
 	
 	bOpus = false;
 }
 
+ServerUser::~ServerUser() {
+	if (! qbaTextureHash.isEmpty())
+		meta->bsBlobs.release(qbaTextureHash);
+}
+
 
 ServerUser::operator QString() const {
 	return QString::fromLatin1("%1:%2(%3)").arg(qsName).arg(uiSession).arg(iId);
@@ -6,6 +6,7 @@
 #ifndef MUMBLE_MURMUR_SERVERUSER_H_
 #define MUMBLE_MURMUR_SERVERUSER_H_
 
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
 
 #ifdef Q_OS_UNIX
@@ -79,8 +80,24 @@ class ServerUser : public Connection, public User {
 		QString qsIdentity;
 
 		bool bVerified;
+		/// Whether the TLS handshake has completed.
+		bool bEncrypted;
 		QStringList qslEmail;
 
+		/// Id of the asynchronous authentication request this
+		/// user is waiting for, or 0 if none.
+		quint64 uiAuthRequest;
+
+		/// Number of text messages from this user that are
+		/// still being validated on Server::qtpText.
+		int iPendingTextMessages;
+
+		/// Number of this connection, unique within the server.
+		/// Unlike the session id, it is never reused, so work
+		/// finished after a disconnect can't be attributed to
+		/// the next user given the same session id.
+		quint64 uiConnection;
+
 		HostAddress haAddress;
 
 		/// Holds whether the user is using TCP
@@ -101,6 +118,23 @@ class ServerUser : public Connection, public User {
 		QMap<int, WhisperTarget> qmTargets;
 		typedef QPair<QSet<ServerUser *>, QSet<ServerUser *> > TargetCache;
 		QMap<int, TargetCache> qmTargetCache;
+		/// Channels linked to the user's channel that the user may speak
+		/// to, valid while uiLinkCacheGeneration matches the server's.
+		QList<Channel *> qlLinkCache;
+		unsigned int uiLinkCacheGeneration;
+
+		/// Position of the user in the game, as sent with their last
+		/// voice packet, if bPosition is set. Only used by the voice thread.
+		float fPosition[3];
+		bool bPosition;
+		/// Time since fPosition was last written. A position older than
+		/// PositionTimeout seconds is treated as unknown.
+		Timer tPosition;
+		enum { PositionTimeout = 5 };
+		/// Sessions of the users currently in earshot of this one, see
+		/// Server::fAudibleRadius. Only used by the voice thread, and
+		/// by Server::connectionClosed() with the voice thread locked out.
+		QSet<unsigned int> qsAudible;
 		QMap<QString, QString> qmWhisperRedirect;
 
 		int iLastPermissionCheck;
@@ -114,6 +148,7 @@ class ServerUser : public Connection, public User {
 		struct sockaddr_storage saiUdpAddress;
 		struct sockaddr_storage saiTcpLocalAddress;
 		ServerUser(Server *parent, QSslSocket *socket);
+		~ServerUser();
 };
 
 #endif
@@ -0,0 +1,120 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "SessionRegistry.h"
+
+SessionRegistry::SessionRegistry() {
+}
+
+void SessionRegistry::insert(unsigned int session, const QString &name, int id) {
+	remove(session);
+
+	Keys k;
+	k.qsName = name.toLower();
+	k.iId = id;
+
+	qmhNames.insert(k.qsName, session);
+	if (k.iId >= 0)
+		qmhIds.insert(k.iId, session);
+	qhSessions.insert(session, k);
+}
+
+void SessionRegistry::remove(unsigned int session) {
+	QHash<unsigned int, Keys>::iterator i = qhSessions.find(session);
+	if (i == qhSessions.end())
+		return;
+
+	qmhNames.remove(i.value().qsName, session);
+	if (i.value().iId >= 0)
+		qmhIds.remove(i.value().iId, session);
+	qhSessions.erase(i);
+}
+
+bool SessionRegistry::contains(unsigned int session) const {
+	return qhSessions.contains(session);
+}
+
+int SessionRegistry::count() const {
+	return qhSessions.count();
+}
+
+bool SessionRegistry::find(const QString &name, int id, unsigned int exclude, unsigned int &session) const {
+	if (id >= 0) {
+		QMultiHash<int, unsigned int>::const_iterator i = qmhIds.constFind(id);
+		for (; (i != qmhIds.constEnd()) && (i.key() == id); ++i) {
+			if (i.value() != exclude) {
+				session = i.value();
+				return true;
+			}
+		}
+	}
+
+	const QString key = name.toLower();
+	QMultiHash<QString, unsigned int>::const_iterator i = qmhNames.constFind(key);
+	for (; (i != qmhNames.constEnd()) && (i.key() == key); ++i) {
+		if (i.value() != exclude) {
+			session = i.value();
+			return true;
+		}
+	}
+	return false;
+}
+
+CodecCensus::CodecCensus() : iUsers(0), iOpus(0) {
+}
+
+void CodecCensus::add(const QList<int> &codecs, bool opus) {
+	if (codecs.isEmpty() && ! opus)
+		return;
+
+	++iUsers;
+	if (opus)
+		++iOpus;
+
+	foreach(int version, codecs)
+		++qmCodecs[version];
+}
+
+void CodecCensus::remove(const QList<int> &codecs, bool opus) {
+	if (codecs.isEmpty() && ! opus)
+		return;
+
+	--iUsers;
+	if (opus)
+		--iOpus;
+
+	foreach(int version, codecs) {
+		QMap<int, int>::iterator i = qmCodecs.find(version);
+		if (i == qmCodecs.end())
+			continue;
+		if (--i.value() <= 0)
+			qmCodecs.erase(i);
+	}
+}
+
+int CodecCensus::users() const {
+	return iUsers;
+}
+
+int CodecCensus::opus() const {
+	return iOpus;
+}
+
+int CodecCensus::preferred() const {
+	int version = 0;
+	int maximum_users = 0;
+
+	QMap<int, int>::const_iterator i = qmCodecs.constEnd();
+	while (i != qmCodecs.constBegin()) {
+		--i;
+		if (i.value() > maximum_users) {
+			version = i.key();
+			maximum_users = i.value();
+		}
+	}
+	return version;
+}
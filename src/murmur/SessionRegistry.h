@@ -0,0 +1,74 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_SESSIONREGISTRY_H_
+#define MUMBLE_MURMUR_SESSIONREGISTRY_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMultiHash>
+#include <QtCore/QString>
+
+/// Index of the sessions of a server by user name, ignoring case, and by
+/// registered user id.
+///
+/// Each session remembers the keys it was indexed under, so it can always
+/// be removed, even if the user's name or id has changed since.
+class SessionRegistry {
+	private:
+		Q_DISABLE_COPY(SessionRegistry)
+	protected:
+		struct Keys {
+			QString qsName;
+			int iId;
+		};
+
+		QHash<unsigned int, Keys> qhSessions;
+		QMultiHash<QString, unsigned int> qmhNames;
+		QMultiHash<int, unsigned int> qmhIds;
+	public:
+		SessionRegistry();
+
+		/// Indexes |session| under |name| and, if it is not negative, |id|,
+		/// replacing any previous keys of the session.
+		void insert(unsigned int session, const QString &name, int id);
+		void remove(unsigned int session);
+		bool contains(unsigned int session) const;
+		int count() const;
+
+		/// Finds a session other than |exclude| that is registered as |id|
+		/// or, failing that, is named |name| in any case. Returns false if
+		/// there is none.
+		bool find(const QString &name, int id, unsigned int exclude, unsigned int &session) const;
+};
+
+/// Number of users supporting each codec, maintained as users come and go.
+class CodecCensus {
+	private:
+		Q_DISABLE_COPY(CodecCensus)
+	protected:
+		QMap<int, int> qmCodecs;
+		int iUsers;
+		int iOpus;
+	public:
+		CodecCensus();
+
+		/// Counts a user with CELT |codecs| that supports Opus if |opus| is
+		/// set. Users supporting neither are not counted.
+		void add(const QList<int> &codecs, bool opus);
+		/// Reverts add() for the same arguments.
+		void remove(const QList<int> &codecs, bool opus);
+
+		/// Number of users counted.
+		int users() const;
+		/// Number of users counted that support Opus.
+		int opus() const;
+		/// The CELT codec supported by most users, the highest version on
+		/// a tie. 0 if no user supports any.
+		int preferred() const;
+};
+
+#endif
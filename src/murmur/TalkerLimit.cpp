@@ -0,0 +1,68 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "TalkerLimit.h"
+
+TalkerLimit::TalkerLimit() {
+}
+
+bool TalkerLimit::admit(int channel, unsigned int session, bool priority, bool terminator, int limit) {
+	return admit(channel, session, priority, terminator, limit, tClock.elapsed());
+}
+
+bool TalkerLimit::admit(int channel, unsigned int session, bool priority, bool terminator, int limit, quint64 now) {
+	if (priority)
+		return true;
+
+	QMutexLocker l(&qmSpurts);
+
+	QList<Spurt> &spurts = qhSpurts[channel];
+
+	bool admitted = false;
+	for (int i = 0; i < spurts.count(); ) {
+		Spurt &s = spurts[i];
+		if (s.uiSession == session) {
+			admitted = true;
+			if (terminator) {
+				spurts.removeAt(i);
+				continue;
+			}
+			s.uiLast = now;
+		} else if (now - s.uiLast > Timeout) {
+			spurts.removeAt(i);
+			continue;
+		}
+		++i;
+	}
+
+	if (! admitted && (spurts.count() < limit)) {
+		admitted = true;
+		if (! terminator) {
+			Spurt s;
+			s.uiSession = session;
+			s.uiLast = now;
+			spurts << s;
+		}
+	}
+
+	if (spurts.isEmpty())
+		qhSpurts.remove(channel);
+
+	return admitted;
+}
+
+int TalkerLimit::count(int channel) {
+	QMutexLocker l(&qmSpurts);
+
+	return qhSpurts.value(channel).count();
+}
+
+void TalkerLimit::clear() {
+	QMutexLocker l(&qmSpurts);
+
+	qhSpurts.clear();
+}
@@ -0,0 +1,59 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_TALKERLIMIT_H_
+#define MUMBLE_MURMUR_TALKERLIMIT_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+
+#include "Timer.h"
+
+/// Bounds the number of users whose voice is forwarded in a channel at the
+/// same time. The first talk spurts started in a channel are admitted;
+/// everybody else starting to talk while all slots are taken is dropped
+/// until one of them ends. Priority speakers are always admitted and don't
+/// take a slot.
+///
+/// A talk spurt ends with its terminator packet, or after Timeout
+/// microseconds without a packet, in case the terminator was lost or the
+/// speaker moved to another channel.
+///
+/// Used by both the voice thread and the control thread (voice tunneled
+/// through TCP), so it has its own lock.
+class TalkerLimit {
+	private:
+		Q_DISABLE_COPY(TalkerLimit)
+	public:
+		enum { Timeout = 500000 };
+	protected:
+		struct Spurt {
+			unsigned int uiSession;
+			quint64 uiLast;
+		};
+
+		QMutex qmSpurts;
+		/// Admitted talk spurts by channel id.
+		QHash<int, QList<Spurt> > qhSpurts;
+		Timer tClock;
+	public:
+		TalkerLimit();
+
+		/// Returns whether a voice packet of |session| in |channel| is to
+		/// be forwarded, if at most |limit| users may talk in a channel at
+		/// once. |terminator| is set on the last packet of a talk spurt.
+		bool admit(int channel, unsigned int session, bool priority, bool terminator, int limit);
+		/// As above, at time |now| in microseconds.
+		bool admit(int channel, unsigned int session, bool priority, bool terminator, int limit, quint64 now);
+
+		/// Number of talk spurts admitted in |channel|, including expired
+		/// ones not yet cleaned up.
+		int count(int channel);
+		/// Forgets all talk spurts, e.g. when the limit is changed.
+		void clear();
+};
+
+#endif
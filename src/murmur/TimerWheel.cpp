@@ -0,0 +1,143 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "TimerWheel.h"
+
+// A key scheduled for tick t is stored at the highest level in which t
+// differs from the current tick, in the slot given by t's digit (Bits
+// wide) at that level. Once the current tick reaches the start of that
+// slot's range, all lower digits of the current tick are zero and the
+// slot is cascaded: its keys are inserted again, and end up in a lower
+// level. On level 0, the slot is only reached at t itself.
+
+TimerWheel::TimerWheel() : uiCurrent(0) {
+	for (int i = 0; i < Levels; ++i)
+		iLevelCount[i] = 0;
+}
+
+QSet<unsigned int> &TimerWheel::slot(const Entry &e) {
+	if (e.iLevel < 0)
+		return qsDue;
+	if (e.iLevel >= Levels)
+		return qsOverflow;
+	return qsSlots[e.iLevel][e.iSlot];
+}
+
+void TimerWheel::insert(unsigned int key, Entry &e) {
+	if (e.uiDeadline <= uiCurrent) {
+		e.iLevel = -1;
+		e.iSlot = 0;
+	} else {
+		const quint64 diff = e.uiDeadline ^ uiCurrent;
+		int level = 0;
+		while ((level < Levels) && ((diff >> (Bits * (level + 1))) != 0))
+			++level;
+		e.iLevel = level;
+		e.iSlot = (level < Levels) ? static_cast<int>((e.uiDeadline >> (Bits * level)) & (Slots - 1)) : 0;
+		if (level < Levels)
+			++iLevelCount[level];
+	}
+	slot(e).insert(key);
+}
+
+void TimerWheel::unlink(unsigned int key, const Entry &e) {
+	if (slot(e).remove(key) && (e.iLevel >= 0) && (e.iLevel < Levels))
+		--iLevelCount[e.iLevel];
+}
+
+void TimerWheel::cascade(int level) {
+	QSet<unsigned int> keys;
+	if (level >= Levels) {
+		keys.swap(qsOverflow);
+	} else {
+		keys.swap(qsSlots[level][(uiCurrent >> (Bits * level)) & (Slots - 1)]);
+		iLevelCount[level] -= keys.count();
+	}
+
+	foreach(unsigned int key, keys)
+		insert(key, qhEntries[key]);
+}
+
+void TimerWheel::expire(QSet<unsigned int> &keys, QList<unsigned int> &expired) {
+	foreach(unsigned int key, keys) {
+		qhEntries.remove(key);
+		expired << key;
+	}
+	keys.clear();
+}
+
+void TimerWheel::schedule(unsigned int key, quint64 deadline) {
+	QHash<unsigned int, Entry>::iterator i = qhEntries.find(key);
+	if (i != qhEntries.end())
+		unlink(key, i.value());
+	else
+		i = qhEntries.insert(key, Entry());
+
+	i.value().uiDeadline = deadline;
+	insert(key, i.value());
+}
+
+void TimerWheel::remove(unsigned int key) {
+	QHash<unsigned int, Entry>::iterator i = qhEntries.find(key);
+	if (i == qhEntries.end())
+		return;
+	unlink(key, i.value());
+	qhEntries.erase(i);
+}
+
+bool TimerWheel::contains(unsigned int key) const {
+	return qhEntries.contains(key);
+}
+
+int TimerWheel::count() const {
+	return qhEntries.count();
+}
+
+quint64 TimerWheel::current() const {
+	return uiCurrent;
+}
+
+void TimerWheel::advance(quint64 now, QList<unsigned int> &expired) {
+	expire(qsDue, expired);
+
+	while (uiCurrent < now) {
+		// Nothing to do until |now|, so skip ahead.
+		if (qhEntries.isEmpty()) {
+			uiCurrent = now;
+			break;
+		}
+
+		// Without keys on the lower levels, nothing happens before
+		// the next slot of the lowest level that has keys.
+		int lowest = 0;
+		while ((lowest < Levels) && (iLevelCount[lowest] == 0))
+			++lowest;
+		if (lowest > 0) {
+			const quint64 next = (uiCurrent | ((Q_UINT64_C(1) << (Bits * lowest)) - 1)) + 1;
+			if (next > now) {
+				uiCurrent = now;
+				break;
+			}
+			uiCurrent = next - 1;
+		}
+
+		++uiCurrent;
+
+		int top = 0;
+		while ((top < Levels) && ((uiCurrent & ((Q_UINT64_C(1) << (Bits * (top + 1))) - 1)) == 0))
+			++top;
+		// Higher levels first, as they may cascade into a slot of a lower
+		// level that is due now.
+		for (int level = top; level > 0; --level)
+			cascade(level);
+
+		QSet<unsigned int> &due = qsSlots[0][uiCurrent & (Slots - 1)];
+		iLevelCount[0] -= due.count();
+		expire(due, expired);
+		expire(qsDue, expired);
+	}
+}
@@ -0,0 +1,69 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_TIMERWHEEL_H_
+#define MUMBLE_MURMUR_TIMERWHEEL_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QtGlobal>
+
+/// Hierarchical timer wheel of deadlines, keyed by session.
+///
+/// Scheduling, rescheduling and removing a key are O(1), and advance()
+/// only touches the keys that are due, plus the occasional cascade of a
+/// higher level slot into the levels below. Stretches of time without
+/// deadlines are skipped. Time is counted in ticks of arbitrary length,
+/// starting at 0.
+///
+/// Deadlines beyond the range of the wheel (64^Levels ticks) are kept in
+/// an overflow set that is redistributed whenever the top level wraps.
+class TimerWheel {
+	private:
+		Q_DISABLE_COPY(TimerWheel)
+	public:
+		enum { Bits = 6, Slots = 1 << Bits, Levels = 4 };
+	protected:
+		struct Entry {
+			quint64 uiDeadline;
+			/// -1 for qsDue, Levels for qsOverflow.
+			int iLevel;
+			int iSlot;
+		};
+
+		quint64 uiCurrent;
+		QHash<unsigned int, Entry> qhEntries;
+		QSet<unsigned int> qsSlots[Levels][Slots];
+		/// Number of keys in the slots of each level.
+		int iLevelCount[Levels];
+		/// Keys whose deadline passed by the time they were inserted.
+		QSet<unsigned int> qsDue;
+		QSet<unsigned int> qsOverflow;
+
+		QSet<unsigned int> &slot(const Entry &e);
+		void insert(unsigned int key, Entry &e);
+		void unlink(unsigned int key, const Entry &e);
+		void cascade(int level);
+		void expire(QSet<unsigned int> &keys, QList<unsigned int> &expired);
+	public:
+		TimerWheel();
+
+		/// Sets the deadline of |key|, replacing a previous one. A deadline
+		/// that already passed expires on the next call to advance().
+		void schedule(unsigned int key, quint64 deadline);
+		void remove(unsigned int key);
+		bool contains(unsigned int key) const;
+		int count() const;
+		/// The current tick, as last passed to advance().
+		quint64 current() const;
+
+		/// Moves the wheel forward to |now| and appends the keys whose
+		/// deadline is at or before |now| to |expired|. Expired keys are
+		/// removed from the wheel.
+		void advance(quint64 now, QList<unsigned int> &expired);
+};
+
+#endif
@@ -0,0 +1,104 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "UdpBatch.h"
+
+UdpBatch::UdpBatch() : iSocket(-1), iCount(0), bEnabled(false), uiCalls(0) {
+#ifdef Q_OS_LINUX
+	for (int i = 0; i < Capacity; ++i) {
+		iovEntries[i].iov_base = eEntries[i].cBuffer;
+		iovEntries[i].iov_len = 0;
+
+		memset(&mmsgEntries[i], 0, sizeof(mmsgEntries[i]));
+		mmsgEntries[i].msg_hdr.msg_name = &eEntries[i].ssTo;
+		mmsgEntries[i].msg_hdr.msg_iov = &iovEntries[i];
+		mmsgEntries[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+}
+
+bool UdpBatch::isEnabled() const {
+	return bEnabled;
+}
+
+void UdpBatch::setEnabled(bool enabled) {
+	if (! enabled)
+		flush();
+#ifdef Q_OS_LINUX
+	bEnabled = enabled;
+#endif
+}
+
+int UdpBatch::count() const {
+	return iCount;
+}
+
+#ifdef Q_OS_LINUX
+bool UdpBatch::add(int sock, const struct msghdr *msg) {
+	if (! bEnabled)
+		return false;
+	if ((msg->msg_iovlen != 1) || (msg->msg_iov[0].iov_len > MaxDatagram) || (msg->msg_namelen > sizeof(struct sockaddr_storage)) || (msg->msg_controllen > MaxControl))
+		return false;
+
+	if ((iCount == Capacity) || ((iCount > 0) && (sock != iSocket)))
+		flush();
+
+	iSocket = sock;
+
+	Entry &e = eEntries[iCount];
+	struct msghdr &hdr = mmsgEntries[iCount].msg_hdr;
+
+	memcpy(e.cBuffer, msg->msg_iov[0].iov_base, msg->msg_iov[0].iov_len);
+	iovEntries[iCount].iov_len = msg->msg_iov[0].iov_len;
+
+	memcpy(&e.ssTo, msg->msg_name, msg->msg_namelen);
+	hdr.msg_namelen = msg->msg_namelen;
+
+	if (msg->msg_controllen > 0) {
+		memcpy(e.uControl.data, msg->msg_control, msg->msg_controllen);
+		hdr.msg_control = e.uControl.data;
+	} else {
+		hdr.msg_control = NULL;
+	}
+	hdr.msg_controllen = msg->msg_controllen;
+	hdr.msg_flags = 0;
+
+	++iCount;
+	return true;
+}
+#endif
+
+void UdpBatch::flush() {
+#ifdef Q_OS_LINUX
+	int sent = 0;
+	while (sent < iCount) {
+		++uiCalls;
+		int ret = ::sendmmsg(iSocket, &mmsgEntries[sent], static_cast<unsigned int>(iCount - sent), 0);
+		if (ret > 0) {
+			sent += ret;
+		} else if ((ret < 0) && (errno == EINTR)) {
+			continue;
+		} else if ((ret < 0) && (errno == ENOSYS)) {
+			qWarning("UdpBatch: sendmmsg() is not supported, sending datagrams one by one");
+			bEnabled = false;
+			for (; sent < iCount; ++sent)
+				::sendmsg(iSocket, &mmsgEntries[sent].msg_hdr, 0);
+		} else {
+			// The first remaining datagram failed; drop it, as sendmsg()
+			// failing would have.
+			++sent;
+		}
+	}
+#endif
+	iCount = 0;
+}
+
+unsigned int UdpBatch::takeCalls() {
+	unsigned int calls = uiCalls;
+	uiCalls = 0;
+	return calls;
+}
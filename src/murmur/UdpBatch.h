@@ -0,0 +1,72 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_UDPBATCH_H_
+#define MUMBLE_MURMUR_UDPBATCH_H_
+
+#include <QtCore/QtGlobal>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <sys/types.h>
+#endif
+
+/// Queues outgoing datagrams and sends them with sendmmsg(), so the copies
+/// of a voice packet sent to its recipients cost one system call per
+/// socket rather than one per recipient.
+///
+/// Datagrams are sent when flush() is called, when the queue is full, or
+/// when a datagram for a different socket is added. Batching is only
+/// available on Linux; elsewhere add() never queues anything.
+class UdpBatch {
+	private:
+		Q_DISABLE_COPY(UdpBatch)
+	public:
+		enum { Capacity = 64, MaxDatagram = 1536, MaxControl = 64 };
+	protected:
+#ifdef Q_OS_LINUX
+		struct Entry {
+			struct sockaddr_storage ssTo;
+			/// Aligned like struct cmsghdr.
+			union {
+				size_t align;
+				char data[MaxControl];
+			} uControl;
+			char cBuffer[MaxDatagram];
+		};
+
+		Entry eEntries[Capacity];
+		struct iovec iovEntries[Capacity];
+		struct mmsghdr mmsgEntries[Capacity];
+#endif
+		int iSocket;
+		int iCount;
+		bool bEnabled;
+		/// System calls made by flush() since the last call to takeCalls().
+		unsigned int uiCalls;
+	public:
+		UdpBatch();
+
+		bool isEnabled() const;
+		void setEnabled(bool enabled);
+		/// Number of datagrams queued.
+		int count() const;
+
+#ifdef Q_OS_LINUX
+		/// Queues a copy of |msg|, which must have a single iovec, to be
+		/// sent on |sock|. Returns false, without queueing, if batching is
+		/// disabled or the datagram doesn't fit.
+		bool add(int sock, const struct msghdr *msg);
+#endif
+		/// Sends all queued datagrams. Errors of single datagrams are
+		/// ignored, as they would be by sendmsg(). If the kernel lacks
+		/// sendmmsg(), the datagrams are sent one by one and batching is
+		/// disabled.
+		void flush();
+		/// Returns and resets the number of system calls flush() made.
+		unsigned int takeCalls();
+};
+
+#endif
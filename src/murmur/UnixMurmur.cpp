@@ -87,6 +87,7 @@ extern QFile *qfLog;
 int UnixMurmur::iHupFd[2];
 int UnixMurmur::iTermFd[2];
 int UnixMurmur::iUsr1Fd[2];
+int UnixMurmur::iUsr2Fd[2];
 
 UnixMurmur::UnixMurmur() {
 	bRoot = true;
@@ -104,15 +105,20 @@ UnixMurmur::UnixMurmur() {
 	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, iUsr1Fd))
 		qFatal("Couldn't create USR1 socketpair");
 
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, iUsr2Fd))
+		qFatal("Couldn't create USR2 socketpair");
+
 	qsnHup = new QSocketNotifier(iHupFd[1], QSocketNotifier::Read, this);
 	qsnTerm = new QSocketNotifier(iTermFd[1], QSocketNotifier::Read, this);
 	qsnUsr1 = new QSocketNotifier(iUsr1Fd[1], QSocketNotifier::Read, this);
+	qsnUsr2 = new QSocketNotifier(iUsr2Fd[1], QSocketNotifier::Read, this);
 
 	connect(qsnHup, SIGNAL(activated(int)), this, SLOT(handleSigHup()));
 	connect(qsnTerm, SIGNAL(activated(int)), this, SLOT(handleSigTerm()));
 	connect(qsnUsr1, SIGNAL(activated(int)), this, SLOT(handleSigUsr1()));
+	connect(qsnUsr2, SIGNAL(activated(int)), this, SLOT(handleSigUsr2()));
 
-	struct sigaction hup, term, usr1;
+	struct sigaction hup, term, usr1, usr2;
 
 	hup.sa_handler = hupSignalHandler;
 	sigemptyset(&hup.sa_mask);
@@ -135,6 +141,13 @@ UnixMurmur::UnixMurmur() {
 	if (sigaction(SIGUSR1, &usr1, NULL))
 		qFatal("Failed to install SIGUSR1 handler");
 
+	usr2.sa_handler = usr2SignalHandler;
+	sigemptyset(&usr2.sa_mask);
+	usr2.sa_flags = SA_RESTART;
+
+	if (sigaction(SIGUSR2, &usr2, NULL))
+		qFatal("Failed to install SIGUSR2 handler");
+
 	umask(S_IRWXO);
 }
 
@@ -142,10 +155,12 @@ UnixMurmur::~UnixMurmur() {
 	delete qsnHup;
 	delete qsnTerm;
 	delete qsnUsr1;
+	delete qsnUsr2;
 
 	qsnHup = NULL;
 	qsnTerm = NULL;
 	qsnUsr1 = NULL;
+	qsnUsr2 = NULL;
 
 	close(iHupFd[0]);
 	close(iHupFd[1]);
@@ -153,6 +168,8 @@ UnixMurmur::~UnixMurmur() {
 	close(iTermFd[1]);
 	close(iUsr1Fd[0]);
 	close(iUsr1Fd[1]);
+	close(iUsr2Fd[0]);
+	close(iUsr2Fd[1]);
 }
 
 void UnixMurmur::hupSignalHandler(int) {
@@ -173,6 +190,12 @@ void UnixMurmur::usr1SignalHandler(int) {
 	Q_UNUSED(len);
 }
 
+void UnixMurmur::usr2SignalHandler(int) {
+	char a = 1;
+	ssize_t len = ::write(iUsr2Fd[0], &a, sizeof(a));
+	Q_UNUSED(len);
+}
+
 
 // Keep these two synchronized with matching actions in DBus.cpp
 
@@ -242,6 +265,20 @@ void UnixMurmur::handleSigUsr1() {
 	qsnUsr1->setEnabled(true);
 }
 
+void UnixMurmur::handleSigUsr2() {
+	qsnUsr2->setEnabled(false);
+	char tmp;
+	ssize_t len = ::read(iUsr2Fd[1], &tmp, sizeof(tmp));
+	Q_UNUSED(len);
+
+	if (meta) {
+		qWarning("UnixMurmur: Writing voice traces...");
+		meta->dumpVoiceTraces();
+	}
+
+	qsnUsr2->setEnabled(true);
+}
+
 void UnixMurmur::setuid() {
 	if (Meta::mp.uiUid != 0) {
 #ifdef Q_OS_DARWIN
@@ -32,16 +32,18 @@ class UnixMurmur : public QObject {
 		Q_DISABLE_COPY(UnixMurmur)
 	protected:
 		bool bRoot;
-		static int iHupFd[2], iTermFd[2], iUsr1Fd[2];
-		QSocketNotifier *qsnHup, *qsnTerm, *qsnUsr1;
+		static int iHupFd[2], iTermFd[2], iUsr1Fd[2], iUsr2Fd[2];
+		QSocketNotifier *qsnHup, *qsnTerm, *qsnUsr1, *qsnUsr2;
 
 		static void hupSignalHandler(int);
 		static void termSignalHandler(int);
 		static void usr1SignalHandler(int);
+		static void usr2SignalHandler(int);
 	public slots:
 		void handleSigHup();
 		void handleSigTerm();
 		void handleSigUsr1();
+		void handleSigUsr2();
 	public:
 		bool logToSyslog;
 
@@ -0,0 +1,233 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "VoiceEngine.h"
+
+#include "Server.h"
+
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+/// Datagrams read from one socket before moving on to the next one, so a
+/// busy server can't starve the others on the same worker.
+#define VOICE_ENGINE_BURST 16
+
+VoiceWorker::VoiceWorker(int cpu, QObject *p) : QThread(p), iEpoll(-1), iWake(-1), iCpu(cpu), bStop(false) {
+#ifdef Q_OS_LINUX
+	iEpoll = epoll_create1(EPOLL_CLOEXEC);
+	iWake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ((iEpoll >= 0) && (iWake >= 0)) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl(iEpoll, EPOLL_CTL_ADD, iWake, &ev) != 0) {
+			close(iWake);
+			iWake = -1;
+		}
+	}
+#endif
+}
+
+VoiceWorker::~VoiceWorker() {
+	stop();
+
+	foreach(const QList<Handler *> &handlers, qhHandlers)
+		qDeleteAll(handlers);
+	qDeleteAll(qlRetired);
+
+#ifdef Q_OS_LINUX
+	if (iWake >= 0)
+		close(iWake);
+	if (iEpoll >= 0)
+		close(iEpoll);
+#endif
+}
+
+bool VoiceWorker::isValid() const {
+	return (iEpoll >= 0) && (iWake >= 0);
+}
+
+void VoiceWorker::wake() {
+#ifdef Q_OS_LINUX
+	quint64 val = 1;
+	if (::write(iWake, &val, sizeof(val)) != sizeof(val))
+		qWarning("VoiceWorker: Failed to wake thread");
+#endif
+}
+
+void VoiceWorker::stop() {
+	{
+		QMutexLocker l(&qmHandlers);
+		bStop = true;
+	}
+	if (isRunning()) {
+		wake();
+		wait();
+	}
+}
+
+void VoiceWorker::attach(Server *server, const QList<int> &sockets) {
+#ifdef Q_OS_LINUX
+	QMutexLocker l(&qmHandlers);
+
+	QList<Handler *> &handlers = qhHandlers[server];
+	foreach(int sock, sockets) {
+		Handler *h = new Handler();
+		h->sServer = server;
+		h->iSocket = sock;
+
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = h;
+		if (epoll_ctl(iEpoll, EPOLL_CTL_ADD, sock, &ev) != 0) {
+			qWarning("VoiceWorker: Failed to add socket: %s", strerror(errno));
+			delete h;
+			continue;
+		}
+		handlers << h;
+	}
+#else
+	Q_UNUSED(server);
+	Q_UNUSED(sockets);
+#endif
+}
+
+void VoiceWorker::detach(const Server *server) {
+	QMutexLocker l(&qmHandlers);
+
+	foreach(Handler *h, qhHandlers.take(server)) {
+#ifdef Q_OS_LINUX
+		epoll_ctl(iEpoll, EPOLL_CTL_DEL, h->iSocket, NULL);
+#endif
+		h->sServer = NULL;
+		qlRetired << h;
+	}
+}
+
+int VoiceWorker::count() {
+	QMutexLocker l(&qmHandlers);
+	return qhHandlers.count();
+}
+
+void VoiceWorker::run() {
+#ifdef Q_OS_LINUX
+	if (iCpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(iCpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			qWarning("VoiceWorker: Failed to pin thread to CPU %d", iCpu);
+	}
+
+	struct epoll_event events[64];
+
+	forever {
+		int n = epoll_wait(iEpoll, events, 64, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			qCritical("VoiceWorker: epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		QMutexLocker l(&qmHandlers);
+		if (bStop)
+			break;
+
+		for (int i = 0; i < n; ++i) {
+			Handler *h = static_cast<Handler *>(events[i].data.ptr);
+			if (! h) {
+				quint64 val;
+				while (::read(iWake, &val, sizeof(val)) == sizeof(val)) {};
+				continue;
+			}
+			// Detached after the event was returned.
+			if (! h->sServer)
+				continue;
+
+			// Sockets are level triggered, so anything left is reported again.
+			for (int j = 0; j < VOICE_ENGINE_BURST; ++j)
+				if (! h->sServer->receiveDatagram(h->iSocket, MSG_DONTWAIT))
+					break;
+		}
+
+		// No event returned from here on refers to a retired handler.
+		qDeleteAll(qlRetired);
+		qlRetired.clear();
+	}
+#endif
+}
+
+VoiceEngine::VoiceEngine() {
+}
+
+VoiceEngine::~VoiceEngine() {
+	foreach(VoiceWorker *w, qlWorkers) {
+		w->stop();
+		delete w;
+	}
+}
+
+void VoiceEngine::setThreads(int count) {
+	if (count <= 0)
+		return;
+
+#ifdef Q_OS_LINUX
+	const int cpus = QThread::idealThreadCount();
+	for (int i = 0; i < count; ++i) {
+		VoiceWorker *w = new VoiceWorker((cpus > 0) ? (i % cpus) : -1);
+		if (! w->isValid()) {
+			qWarning("VoiceEngine: Failed to set up worker: %s", strerror(errno));
+			delete w;
+			break;
+		}
+		w->setObjectName(QString::fromLatin1("Voice %1").arg(i));
+		w->start(QThread::HighestPriority);
+		qlWorkers << w;
+	}
+	if (! qlWorkers.isEmpty())
+		qWarning("VoiceEngine: Receiving voice on %d threads", qlWorkers.count());
+#else
+	qWarning("VoiceEngine: voicethreads is only supported on Linux, starting a voice thread per server");
+#endif
+}
+
+bool VoiceEngine::isEnabled() const {
+	return ! qlWorkers.isEmpty();
+}
+
+QThread *VoiceEngine::attach(Server *server, const QList<int> &sockets) {
+	QMutexLocker l(&qmServers);
+
+	VoiceWorker *best = NULL;
+	int load = 0;
+	foreach(VoiceWorker *w, qlWorkers) {
+		const int c = w->count();
+		if (! best || (c < load)) {
+			best = w;
+			load = c;
+		}
+	}
+
+	best->attach(server, sockets);
+	qhServers.insert(server, best);
+	return best;
+}
+
+void VoiceEngine::detach(const Server *server) {
+	QMutexLocker l(&qmServers);
+
+	VoiceWorker *w = qhServers.take(server);
+	if (w)
+		w->detach(server);
+}
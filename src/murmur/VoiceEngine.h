@@ -0,0 +1,92 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICEENGINE_H_
+#define MUMBLE_MURMUR_VOICEENGINE_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+
+class Server;
+
+/// A thread of a VoiceEngine, waiting for datagrams on the UDP sockets
+/// of the servers attached to it.
+class VoiceWorker : public QThread {
+	private:
+		Q_OBJECT
+		Q_DISABLE_COPY(VoiceWorker)
+	protected:
+		/// One socket of an attached server. A handler is referenced by
+		/// its epoll registration, so after its server was detached it is
+		/// only deleted once no event returned earlier can refer to it.
+		struct Handler {
+			Server *sServer;
+			int iSocket;
+		};
+
+		int iEpoll;
+		int iWake;
+		int iCpu;
+
+		/// qmHandlers is held while events are processed, and protects
+		/// the members below.
+		QMutex qmHandlers;
+		QHash<const Server *, QList<Handler *> > qhHandlers;
+		QList<Handler *> qlRetired;
+		bool bStop;
+
+		void run() Q_DECL_OVERRIDE;
+		void wake();
+	public:
+		/// |cpu| is the processor the thread is pinned to, or -1.
+		VoiceWorker(int cpu, QObject *p = NULL);
+		~VoiceWorker() Q_DECL_OVERRIDE;
+
+		bool isValid() const;
+		void attach(Server *server, const QList<int> &sockets);
+		void detach(const Server *server);
+		/// Number of attached servers.
+		int count();
+		/// Stops the thread and waits for it.
+		void stop();
+};
+
+/// Receives the datagrams of all virtual servers on a fixed pool of
+/// threads, instead of starting a voice thread per server.
+///
+/// Each server is attached to a single worker, which calls
+/// Server::receiveDatagram() for its sockets. A server's datagrams are
+/// thus still handled by one thread at a time, and its state and locking
+/// are the same as with a voice thread of its own. Only available on
+/// Linux, as it is built on epoll.
+class VoiceEngine {
+	private:
+		Q_DISABLE_COPY(VoiceEngine)
+	protected:
+		QList<VoiceWorker *> qlWorkers;
+
+		/// qmServers protects qhServers, the worker each server is attached to.
+		QMutex qmServers;
+		QHash<const Server *, VoiceWorker *> qhServers;
+	public:
+		VoiceEngine();
+		~VoiceEngine();
+
+		/// Starts |count| worker threads. May only be called once.
+		void setThreads(int count);
+		/// Whether there are worker threads to attach servers to.
+		bool isEnabled() const;
+
+		/// Starts receiving the datagrams of |server| on the worker with the
+		/// fewest servers, and returns that worker.
+		QThread *attach(Server *server, const QList<int> &sockets);
+		/// Stops receiving the datagrams of |server|. Once this returns, no
+		/// worker calls into the server anymore.
+		void detach(const Server *server);
+};
+
+#endif
@@ -0,0 +1,194 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include "murmur_pch.h"
+
+#include "VoiceTrace.h"
+
+#ifdef Q_OS_UNIX
+# include <time.h>
+# include <sys/socket.h>
+#endif
+
+// Trace files start with this header, followed by the records in the
+// host's byte order.
+struct VoiceTraceFileHeader {
+	char magic[4];
+	quint32 uiVersion;
+	quint32 uiRecordSize;
+	quint32 uiCount;
+};
+
+VoiceTrace::VoiceTrace() : bEnabled(false), uiSampleEvery(0), uiSampleCounter(0), iRingNext(0), bRingWrapped(false) {
+}
+
+void VoiceTrace::configure(bool enabled, unsigned int sampleEvery, int ringSize) {
+	QMutexLocker l(&qmRing);
+
+	bEnabled = enabled;
+	uiSampleEvery = (ringSize > 0) ? sampleEvery : 0;
+	uiSampleCounter = 0;
+	qvRing.clear();
+	if (bEnabled && uiSampleEvery > 0)
+		qvRing.resize(ringSize);
+	iRingNext = 0;
+	bRingWrapped = false;
+}
+
+bool VoiceTrace::isEnabled() const {
+	return bEnabled;
+}
+
+quint32 VoiceTrace::offset(quint64 start, quint64 t) {
+	if (t == 0 || t < start)
+		return 0xffffffffU;
+	const quint64 d = t - start;
+	return (d >= 0xffffffffULL) ? 0xfffffffeU : static_cast<quint32>(d);
+}
+
+void VoiceTrace::record(const VoiceTracePacket &tp, unsigned int session) {
+	if (tp.uiKernel && tp.uiRecv >= tp.uiKernel)
+		hStages[KernelToRecv].add(tp.uiRecv - tp.uiKernel);
+	if (tp.uiDecrypt)
+		hStages[RecvToDecrypt].add(tp.uiDecrypt - tp.uiRecv);
+	if (tp.uiRoute && tp.uiDecrypt)
+		hStages[DecryptToRoute].add(tp.uiRoute - tp.uiDecrypt);
+	if (tp.uiEncrypt && tp.uiRoute)
+		hStages[RouteToEncrypt].add(tp.uiEncrypt - tp.uiRoute);
+	if (tp.uiSend && tp.uiEncrypt)
+		hStages[EncryptToSend].add(tp.uiSend - tp.uiEncrypt);
+	if (tp.uiSend) {
+		const quint64 start = (tp.uiKernel && tp.uiKernel <= tp.uiRecv) ? tp.uiKernel : tp.uiRecv;
+		hStages[Total].add(tp.uiSend - start);
+	}
+
+	if (uiSampleEvery == 0 || ++uiSampleCounter < uiSampleEvery)
+		return;
+	uiSampleCounter = 0;
+
+	VoiceTraceRecord r;
+	r.uiKernelNs = tp.uiKernel;
+	r.uiRecvNs = tp.uiRecv;
+	r.uiDecrypt = offset(tp.uiRecv, tp.uiDecrypt);
+	r.uiRoute = offset(tp.uiRecv, tp.uiRoute);
+	r.uiEncrypt = offset(tp.uiRecv, tp.uiEncrypt);
+	r.uiSend = offset(tp.uiRecv, tp.uiSend);
+	r.uiSession = session;
+	r.usFanout = static_cast<quint16>(qMin(tp.uiFanout, 0xffffU));
+	r.usLength = static_cast<quint16>(qBound(0, tp.iLength, 0xffff));
+
+	QMutexLocker l(&qmRing);
+	qvRing[iRingNext] = r;
+	if (++iRingNext >= qvRing.size()) {
+		iRingNext = 0;
+		bRingWrapped = true;
+	}
+}
+
+bool VoiceTrace::dump(const QString &path) {
+	QVector<VoiceTraceRecord> records;
+	{
+		QMutexLocker l(&qmRing);
+		if (bRingWrapped)
+			records = qvRing.mid(iRingNext) + qvRing.mid(0, iRingNext);
+		else
+			records = qvRing.mid(0, iRingNext);
+	}
+
+	QFile f(path);
+	if (! f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	VoiceTraceFileHeader h;
+	memcpy(h.magic, "MVTR", 4);
+	h.uiVersion = 1;
+	h.uiRecordSize = sizeof(VoiceTraceRecord);
+	h.uiCount = static_cast<quint32>(records.count());
+
+	const qint64 size = static_cast<qint64>(records.count()) * static_cast<qint64>(sizeof(VoiceTraceRecord));
+	if (f.write(reinterpret_cast<const char *>(&h), sizeof(h)) != sizeof(h))
+		return false;
+	if (size > 0 && f.write(reinterpret_cast<const char *>(records.constData()), size) != size)
+		return false;
+	return true;
+}
+
+const char *VoiceTrace::stageName(int stage) {
+	switch (stage) {
+		case KernelToRecv:
+			return "kernel_to_recv";
+		case RecvToDecrypt:
+			return "recv_to_decrypt";
+		case DecryptToRoute:
+			return "decrypt_to_route";
+		case RouteToEncrypt:
+			return "route_to_encrypt";
+		case EncryptToSend:
+			return "encrypt_to_send";
+		case Total:
+			return "total";
+		default:
+			return "unknown";
+	}
+}
+
+#ifdef Q_OS_WIN
+quint64 VoiceTrace::now() {
+	// FILETIME is in 100ns units since 1601-01-01.
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	ULARGE_INTEGER li;
+	li.LowPart = ft.dwLowDateTime;
+	li.HighPart = ft.dwHighDateTime;
+	return (li.QuadPart - 116444736000000000ULL) * 100ULL;
+}
+#else
+quint64 VoiceTrace::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<quint64>(ts.tv_sec) * 1000000000ULL + static_cast<quint64>(ts.tv_nsec);
+}
+#endif
+
+#ifdef Q_OS_LINUX
+bool VoiceTrace::enableTimestamps(int sock) {
+	int val = 1;
+	return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val)) == 0;
+}
+
+quint64 VoiceTrace::takeTimestamp(struct msghdr *msg) {
+	quint64 ts = 0;
+	char *out = reinterpret_cast<char *>(msg->msg_control);
+	socklen_t outlen = 0;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+	while (cmsg != NULL) {
+		struct cmsghdr *next = CMSG_NXTHDR(msg, cmsg);
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec tv;
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			ts = static_cast<quint64>(tv.tv_sec) * 1000000000ULL + static_cast<quint64>(tv.tv_nsec);
+		} else {
+			// Compact the remaining control messages towards the front.
+			const socklen_t space = static_cast<socklen_t>(CMSG_SPACE(cmsg->cmsg_len - CMSG_LEN(0)));
+			if (reinterpret_cast<char *>(cmsg) != out + outlen)
+				memmove(out + outlen, cmsg, cmsg->cmsg_len);
+			outlen += space;
+		}
+		cmsg = next;
+	}
+
+	msg->msg_controllen = outlen;
+	return ts;
+}
+#else
+bool VoiceTrace::enableTimestamps(int) {
+	return false;
+}
+
+quint64 VoiceTrace::takeTimestamp(struct msghdr *) {
+	return 0;
+}
+#endif
@@ -0,0 +1,111 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#ifndef MUMBLE_MURMUR_VOICETRACE_H_
+#define MUMBLE_MURMUR_VOICETRACE_H_
+
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "ServerMetrics.h"
+
+struct msghdr;
+
+/// Timestamps of a single voice datagram as it passes through the
+/// voice thread. All values are CLOCK_REALTIME nanoseconds, or 0 if the
+/// packet never reached that stage.
+struct VoiceTracePacket {
+	/// Kernel receive timestamp (SO_TIMESTAMPNS). 0 if unavailable.
+	quint64 uiKernel;
+	/// recvmsg() returned.
+	quint64 uiRecv;
+	/// The datagram was decrypted and matched to a user.
+	quint64 uiDecrypt;
+	/// Routing found the first recipient.
+	quint64 uiRoute;
+	/// The first outgoing copy was encrypted.
+	quint64 uiEncrypt;
+	/// The last sendmsg() returned.
+	quint64 uiSend;
+	unsigned int uiFanout;
+	int iLength;
+
+	inline void reset() {
+		uiKernel = uiRecv = uiDecrypt = uiRoute = uiEncrypt = uiSend = 0;
+		uiFanout = 0;
+		iLength = 0;
+	}
+};
+
+/// On-disk record of a sampled packet. Offsets are nanoseconds relative
+/// to uiRecvNs, 0xffffffff if the stage was not reached.
+struct VoiceTraceRecord {
+	quint64 uiKernelNs;
+	quint64 uiRecvNs;
+	quint32 uiDecrypt;
+	quint32 uiRoute;
+	quint32 uiEncrypt;
+	quint32 uiSend;
+	quint32 uiSession;
+	quint16 usFanout;
+	quint16 usLength;
+};
+
+/// Optional per-packet latency tracing for a server's voice thread.
+///
+/// When enabled, every datagram is timestamped at each stage and the
+/// stage durations are added to histograms that are exported through
+/// MetricsServer. Additionally, one in every |uiSampleEvery| packets
+/// is stored in a fixed size ring, which can be written to a file.
+///
+/// When disabled, the cost is a single pointer check per stage.
+class VoiceTrace {
+	private:
+		Q_DISABLE_COPY(VoiceTrace)
+	public:
+		enum Stage { KernelToRecv, RecvToDecrypt, DecryptToRoute, RouteToEncrypt, EncryptToSend, Total, StageCount };
+
+		/// Histograms of the stage durations in nanoseconds. Written by the voice thread only.
+		MetricHistogram hStages[StageCount];
+	protected:
+		bool bEnabled;
+		unsigned int uiSampleEvery;
+		unsigned int uiSampleCounter;
+
+		/// Guards qvRing and iRingNext. Only taken for sampled packets.
+		QMutex qmRing;
+		QVector<VoiceTraceRecord> qvRing;
+		int iRingNext;
+		bool bRingWrapped;
+
+		static quint32 offset(quint64 start, quint64 t);
+	public:
+		VoiceTrace();
+
+		/// Configures tracing. Must be called before the voice thread starts.
+		void configure(bool enabled, unsigned int sampleEvery, int ringSize);
+		bool isEnabled() const;
+
+		/// Adds a completed packet to the histograms and, if sampled, to the ring.
+		void record(const VoiceTracePacket &tp, unsigned int session);
+
+		/// Writes the ring, oldest record first, to |path|.
+		bool dump(const QString &path);
+
+		static const char *stageName(int stage);
+
+		/// Returns the current CLOCK_REALTIME in nanoseconds.
+		static quint64 now();
+
+		/// Enables kernel receive timestamps on |sock|.
+		static bool enableTimestamps(int sock);
+		/// Extracts the kernel receive timestamp from |msg| and removes
+		/// its control message, so that the remaining control data can be
+		/// reused for sendmsg(). Returns 0 if there was no timestamp.
+		static quint64 takeTimestamp(struct msghdr *msg);
+};
+
+#endif
@@ -19,8 +19,10 @@
 #include "License.h"
 #include "LogEmitter.h"
 #include "EnvUtils.h"
+#include "MetricsServer.h"
 
 #ifdef Q_OS_UNIX
+#include "Handoff.h"
 #include "UnixMurmur.h"
 #endif
 
@@ -43,6 +45,9 @@ static LogEmitter le;
 
 static QStringList qlErrors;
 
+// Virtual servers may log from their own control threads.
+static QMutex qmLog(QMutex::Recursive);
+
 static void murmurMessageOutputQString(QtMsgType type, const QString &msg) {
 #ifdef Q_OS_UNIX
 	if (unixMurmur->logToSyslog) {
@@ -70,6 +75,8 @@ static void murmurMessageOutputQString(QtMsgType type, const QString &msg) {
 	}
 #endif
 
+	QMutexLocker lock(&qmLog);
+
 	char c;
 	switch (type) {
 		case QtDebugMsg:
@@ -513,6 +520,14 @@ int main(int argc, char **argv) {
 		close(fd);
 	}
 	unixhandler.finalcap();
+
+	// Take over from the running murmur before anything else binds, as it
+	// only releases its RPC and metrics listeners as it exits.
+	if (! Meta::mp.qsHandoffSocket.isEmpty()) {
+		int received = Handoff::receive(Meta::mp.qsHandoffSocket);
+		if (received >= 0)
+			qWarning("Took over %d sockets from the running murmur", received);
+	}
 #endif
 
 #ifdef USE_DBUS
@@ -563,6 +578,10 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+	MetricsServer *metrics = NULL;
+	if (! Meta::mp.qsMetricsAddress.isEmpty())
+		metrics = new MetricsServer(Meta::mp.qsMetricsAddress);
+
 	meta->getOSInfo();
 
 	int major, minor, patch;
@@ -581,6 +600,9 @@ int main(int argc, char **argv) {
 
 	qWarning("Shutting down");
 
+	delete metrics;
+	metrics = NULL;
+
 #ifdef USE_DBUS
 	delete MurmurDBus::qdbc;
 	MurmurDBus::qdbc = NULL;
@@ -597,6 +619,9 @@ int main(int argc, char **argv) {
 	delete qfLog;
 	qfLog = NULL;
 
+#ifdef Q_OS_UNIX
+	const bool handedOff = meta->bHandedOff;
+#endif
 	delete meta;
 
 #if QT_VERSION >= 0x050000
@@ -606,7 +631,8 @@ int main(int argc, char **argv) {
 #endif
 
 #ifdef Q_OS_UNIX
-	if (! Meta::mp.qsPid.isEmpty()) {
+	// The murmur we handed off to has written its own pid by now.
+	if (! Meta::mp.qsPid.isEmpty() && ! handedOff) {
 		QFile pid(Meta::mp.qsPid);
 		pid.remove();
 	}
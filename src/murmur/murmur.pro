@@ -16,8 +16,8 @@ TARGET = murmur
 DBFILE = murmur.db
 LANGUAGE = C++
 FORMS =
-HEADERS *= Server.h ServerUser.h Meta.h PBKDF2.h
-SOURCES *= main.cpp Server.cpp ServerUser.cpp ServerDB.cpp Register.cpp Cert.cpp Messages.cpp Meta.cpp RPC.cpp PBKDF2.cpp
+HEADERS *= Server.h ServerUser.h Meta.h PBKDF2.h ServerMetrics.h MetricsServer.h VoiceTrace.h ServerSnapshot.h BlobStore.h HandshakePool.h TimerWheel.h SessionRegistry.h VoiceEngine.h UdpBatch.h OverloadControl.h TalkerLimit.h
+SOURCES *= main.cpp Server.cpp ServerUser.cpp ServerDB.cpp Register.cpp Cert.cpp Messages.cpp Meta.cpp RPC.cpp PBKDF2.cpp ServerMetrics.cpp MetricsServer.cpp VoiceTrace.cpp ServerSnapshot.cpp BlobStore.cpp HandshakePool.cpp TimerWheel.cpp SessionRegistry.cpp VoiceEngine.cpp UdpBatch.cpp OverloadControl.cpp TalkerLimit.cpp
 
 PRECOMPILED_HEADER = murmur_pch.h
 
@@ -62,8 +62,8 @@ unix {
     QMAKE_LFLAGS *= -Wl,-rpath,$$(MUMBLE_PREFIX)/lib:$$(MUMBLE_ICE_PREFIX)/lib
   }
 
-  HEADERS *= UnixMurmur.h
-  SOURCES *= UnixMurmur.cpp
+  HEADERS *= UnixMurmur.h Handoff.h
+  SOURCES *= UnixMurmur.cpp Handoff.cpp
   TARGET = murmurd
 }
 
@@ -45,6 +45,53 @@ public:
 };
 )";
 
+// Like CSingle_SSingle, but the call is first offered to snapshot(), which
+// runs on the completion queue thread and may answer it from the server's
+// ServerSnapshot. Only if it returns false is impl() run on the main thread.
+const char *CSingle_SSingle_Snapshot = R"(
+class $service$_$method$ : public RPCSingleSingleCall< ::$in$, ::$out$ > {
+public:
+	::$ns$::$service$::AsyncService *service;
+
+	$service$_$method$(MurmurRPCImpl *rpc_impl, ::$ns$::$service$::AsyncService *async_service) : RPCSingleSingleCall(rpc_impl), service(async_service) {
+	}
+
+	void impl(bool ok);
+	bool snapshot();
+
+	void handle(bool ok) {
+		$service$_$method$::create(this->rpc, this->service);
+		try {
+			if (ok && snapshot()) {
+				return;
+			}
+		} catch (::grpc::Status &ex) {
+			error(ex);
+			return;
+		}
+		auto ie = new RPCExecEvent(::boost::bind(&$service$_$method$::impl, this, ok), this);
+		QCoreApplication::instance()->postEvent(rpc, ie);
+	}
+
+	static void create(MurmurRPCImpl *rpc, ::$ns$::$service$::AsyncService *service) {
+		auto call = new $service$_$method$(rpc, service);
+		auto fn = ::boost::bind(&$service$_$method$::handle, call, _1);
+		auto fn_ptr = new ::boost::function<void(bool)>(fn);
+		service->Request$method$(&call->context, &call->request, &call->stream, rpc->m_completionQueue.get(), rpc->m_completionQueue.get(), fn_ptr);
+	}
+};
+)";
+
+// Read-only methods that use CSingle_SSingle_Snapshot.
+const char *SnapshotMethods[] = {
+	"ChannelQuery",
+	"ChannelGet",
+	"UserQuery",
+	"UserGet",
+	"TreeQuery",
+	nullptr
+};
+
 const char *CSingle_SStream = R"(
 class $service$_$method$ : public RPCSingleStreamCall< ::$in$, ::$out$ > {
 public:
@@ -227,6 +274,8 @@ class WrapperGenerator : public CodeGenerator {
 				} else {
 					if (method->server_streaming()) {
 						template_str = CSingle_SStream;
+					} else if (IsSnapshotMethod(method->name())) {
+						template_str = CSingle_SSingle_Snapshot;
 					} else {
 						template_str = CSingle_SSingle;
 					}
@@ -251,6 +300,15 @@ class WrapperGenerator : public CodeGenerator {
 		return true;
 	}
 
+	static bool IsSnapshotMethod(const string &name) {
+		for (const char **m = SnapshotMethods; *m; m++) {
+			if (name == *m) {
+				return true;
+			}
+		}
+		return false;
+	}
+
 	static string CompiledName(const string &ns, const Descriptor *type) {
 		string s = type->name();
 		for (type = type->containing_type(); type; type = type->containing_type()) {
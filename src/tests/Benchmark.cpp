@@ -1,395 +1,1217 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
 /**
- * Provided a target address spawns a specified number of senders/speakers,
- * UDP-listeners and TCP-listeners.
+ * Event driven load generator for murmur.
+ *
+ * Simulates a large number of clients from a single thread using epoll and
+ * non-blocking OpenSSL. Every simulated client does a full TLS handshake,
+ * authenticates, sets up the UDP crypt state and then behaves according to
+ * the configured traffic model:
+ *
+ *  - Speakers alternate between talk spurts and silence (exponentially
+ *    distributed, Brady style on/off model) and send Opus sized packets.
+ *  - A fraction of talk spurts are whispered to other simulated clients.
+ *  - Clients can hop between the channels that exist on the server.
+ *  - Periodic reconnect storms drop and immediately reconnect a fraction
+ *    of all clients.
+ *
+ * Every voice packet carries its send timestamp and the sending client in
+ * its payload. Since all clients share one clock, receivers can measure the
+ * forwarding latency through murmur directly, as well as the interarrival
+ * jitter (RFC 3550) per stream.
+ *
+ * The generator is single threaded, so measured latency includes its own
+ * scheduling delay. That delay is reported as "lag"; if it gets close to
+ * the voice latency, run fewer clients per process.
+ *
+ * Note that murmur limits concurrent users ("users") and bans hosts that
+ * reconnect too often ("autobanAttempts"). Adjust murmur.ini accordingly.
  */
 
-#include <QtCore>
-#include <QtNetwork>
+#include <QtCore/QtCore>
 
-#ifndef Q_OS_WIN
-#include <unistd.h>
-#endif
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/types.h>
-#ifndef Q_OS_WIN
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/types.h>
 #include <netinet/in.h>
-#include <netinet/ip.h>
-#include <sys/utsname.h>
-#endif
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
 
 #include "PacketDataStream.h"
-#include "Timer.h"
 #include "Message.h"
 #include "CryptState.h"
 #include "Mumble.pb.h"
 
-class Client : public QThread {
-		Q_OBJECT
+// Histogram resolution and range. Anything above the range is counted as overflow.
+#define HISTOGRAM_BUCKET_USEC 10ULL
+#define HISTOGRAM_RANGE_USEC 2000000ULL
+
+// Identifies voice payloads sent by this generator.
+#define PAYLOAD_MAGIC 0x4d42
+// TOC byte (1) + magic (2) + sender index (4) + timestamp (8)
+#define PAYLOAD_HEADER_SIZE 15
+
+#define PING_INTERVAL_USEC 5000000ULL
+#define RECONNECT_DELAY_USEC 1000000ULL
+
+static quint64 now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<quint64>(ts.tv_sec) * 1000000ULL + static_cast<quint64>(ts.tv_nsec) / 1000ULL;
+}
+
+/// xorshift64*, good enough for traffic models and cheap enough to call per packet.
+class Random {
+	protected:
+		quint64 uiState;
 	public:
-		bool udp;
-		bool sender;
-		struct sockaddr_in srv;
-		unsigned int uiSession;
-		CryptState crypt;
-		int rcvd;
-		int socket;
-		int seq;
-		void run();
-		void ping();
-		void sendVoice();
-		int numbytes;
-		int ptype;
-		QSslSocket *ssl;
-		Client(QObject *parent, QHostAddress srvaddr, unsigned short prt, bool send, bool tcponly);
-		void doUdp(const unsigned char *buffer, int size);
-		void sendMessage(const ::google::protobuf::Message &msg, unsigned int msgType);
-		~Client();
-	public slots:
-		void readyRead();
-		void disconnected();
+		Random(quint64 seed) : uiState(seed ? seed : 0x9e3779b97f4a7c15ULL) {
+		}
+
+		quint64 next() {
+			uiState ^= uiState >> 12;
+			uiState ^= uiState << 25;
+			uiState ^= uiState >> 27;
+			return uiState * 2685821657736338717ULL;
+		}
+
+		/// Uniform in [0, 1).
+		double uniform() {
+			return static_cast<double>(next() >> 11) / 9007199254740992.0;
+		}
+
+		unsigned int below(unsigned int n) {
+			return n ? static_cast<unsigned int>(next() % n) : 0;
+		}
+
+		quint64 exponential(quint64 mean) {
+			return static_cast<quint64>(-static_cast<double>(mean) * log(1.0 - uniform()));
+		}
 };
 
-Client::Client(QObject *p, QHostAddress qha, unsigned short prt, bool send, bool tcponly) : QThread(p) {
-	srv.sin_family = AF_INET;
-	srv.sin_addr.s_addr = htonl(qha.toIPv4Address());
-	srv.sin_port = htons(prt);
+class Histogram {
+	protected:
+		std::vector<quint64> qvBuckets;
+		quint64 uiOverflow;
+		quint64 uiCount;
+		quint64 uiMax;
+	public:
+		Histogram() : qvBuckets(HISTOGRAM_RANGE_USEC / HISTOGRAM_BUCKET_USEC, 0), uiOverflow(0), uiCount(0), uiMax(0) {
+		}
 
-	udp = ! tcponly;
-	sender = send;
+		void add(quint64 usec) {
+			const quint64 idx = usec / HISTOGRAM_BUCKET_USEC;
+			if (idx < qvBuckets.size())
+				++qvBuckets[idx];
+			else
+				++uiOverflow;
+			++uiCount;
+			uiMax = qMax(uiMax, usec);
+		}
 
-	ssl = new QSslSocket(this);
+		void reset() {
+			std::fill(qvBuckets.begin(), qvBuckets.end(), 0);
+			uiOverflow = uiCount = uiMax = 0;
+		}
 
-	connect(ssl, SIGNAL(readyRead()), this, SLOT(readyRead()));
-	connect(ssl, SIGNAL(disconnected()), this, SLOT(disconnected()));
+		quint64 count() const {
+			return uiCount;
+		}
 
-	ssl->setProtocol(QSsl::TlsV1);
-	ssl->connectToHostEncrypted(qha.toString(), prt);
-	ssl->ignoreSslErrors();
-	if (! ssl->waitForEncrypted())
-		qFatal("Connection failure");
+		quint64 max() const {
+			return uiMax;
+		}
 
-	static int ctr = 1;
+		/// Upper bound of the bucket containing the p-th percentile.
+		quint64 percentile(double p) const {
+			if (! uiCount)
+				return 0;
+			const quint64 want = static_cast<quint64>(ceil(static_cast<double>(uiCount) * p / 100.0));
+			quint64 seen = 0;
+			for (size_t i = 0; i < qvBuckets.size(); ++i) {
+				seen += qvBuckets[i];
+				if (seen >= want && seen > 0)
+					return (i + 1) * HISTOGRAM_BUCKET_USEC;
+			}
+			return uiMax;
+		}
 
-#ifdef Q_OS_WIN
-	DWORD pid = GetCurrentProcessId();
-	wchar_t buf[64];
-	DWORD bufsize = 64;
-	GetComputerName(buf, &bufsize);
+		QString summary() const {
+			if (! uiCount)
+				return QLatin1String("-");
+			return QString::fromLatin1("p50 %1 p90 %2 p99 %3 max %4")
+			       .arg(msec(percentile(50.0)))
+			       .arg(msec(percentile(90.0)))
+			       .arg(msec(percentile(99.0)))
+			       .arg(msec(uiMax));
+		}
 
-	QString name = QString("%1.%2").arg(QString::fromWCharArray(buf)).arg(pid * 1000 + ctr);
-#else
-	struct utsname uts;
-	uname(&uts);
+		static QString msec(quint64 usec) {
+			return QString::number(static_cast<double>(usec) / 1000.0, 'f', 2);
+		}
+};
 
-	QString name = QString("%1.%2").arg(uts.nodename).arg(getpid() * 1000 + ctr);
-#endif
+struct Options {
+	QByteArray qbaHost;
+	QByteArray qbaPort;
+	QByteArray qbaPassword;
+	unsigned int uiClients;
+	unsigned int uiSpeakers;
+	double dTcpOnly;
+	unsigned int uiConnectRate;
+	quint64 uiPacketUsec;
+	unsigned int uiBitrate;
+	quint64 uiTalkUsec;
+	quint64 uiSilenceUsec;
+	double dWhisper;
+	unsigned int uiWhisperTargets;
+	quint64 uiHopUsec;
+	quint64 uiStormUsec;
+	double dStormFraction;
+	quint64 uiDurationUsec;
+	quint64 uiReportUsec;
+	quint64 uiSeed;
+
+	Options()
+		: qbaPort("64738")
+		, uiClients(100)
+		, uiSpeakers(10)
+		, dTcpOnly(0.0)
+		, uiConnectRate(200)
+		, uiPacketUsec(20000)
+		, uiBitrate(40000)
+		, uiTalkUsec(1500000)
+		, uiSilenceUsec(3000000)
+		, dWhisper(0.0)
+		, uiWhisperTargets(5)
+		, uiHopUsec(0)
+		, uiStormUsec(0)
+		, dStormFraction(0.1)
+		, uiDurationUsec(0)
+		, uiReportUsec(5000000)
+		, uiSeed(0) {
+	}
+};
 
-	ctr++;
+struct Statistics {
+	Histogram hLatency;
+	Histogram hJitter;
+	Histogram hHandshake;
+	Histogram hLag;
+	quint64 uiSent;
+	quint64 uiReceived;
+	quint64 uiTunneled;
+	quint64 uiLost;
+	quint64 uiConnects;
+	quint64 uiFailures;
+	quint64 uiHops;
+	quint64 uiDenied;
+
+	Statistics() {
+		resetCounters();
+	}
 
-	MumbleProto::Version mpv;
-	mpv.set_release(u8(QLatin1String("1.2.1 Benchmark")));
-	mpv.set_version(0x010203);
+	void resetCounters() {
+		uiSent = uiReceived = uiTunneled = uiLost = 0;
+		uiConnects = uiFailures = uiHops = uiDenied = 0;
+	}
 
-	sendMessage(mpv, MessageHandler::Version);
+	void reset() {
+		hLatency.reset();
+		hJitter.reset();
+		hHandshake.reset();
+		hLag.reset();
+		resetCounters();
+	}
+};
 
-	MumbleProto::Authenticate mpa;
-	mpa.set_username(u8(name));
+/// Per sender state kept by each receiver.
+struct Stream {
+	quint64 uiLastTransit;
+	quint64 uiJitter;
+	unsigned int uiLastSeq;
+};
 
-	sendMessage(mpa, MessageHandler::Authenticate);
+class LoadClient {
+	private:
+		Q_DISABLE_COPY(LoadClient)
+	public:
+		enum State { Idle, Connecting, Handshaking, Authenticating, Synced };
+
+		unsigned int uiIndex;
+		/// Bumped on every disconnect, so timers of an old connection are ignored.
+		unsigned int uiGeneration;
+		State sState;
+		bool bSpeaker;
+		bool bTcpOnly;
+		int iTcp;
+		int iUdp;
+		SSL *ssl;
+		unsigned int uiEvents;
+		QByteArray qbaIn;
+		QByteArray qbaOut;
+		CryptState csCrypt;
+		unsigned int uiSession;
+		quint64 uiConnectStart;
+
+		unsigned int uiSeq;
+		bool bTalking;
+		bool bWhisper;
+		quint64 uiSpurtEnd;
+
+		QHash<unsigned int, Stream> qhStreams;
+
+		LoadClient(unsigned int index) : uiIndex(index), uiGeneration(0), sState(Idle), bSpeaker(false), bTcpOnly(false), iTcp(-1), iUdp(-1), ssl(NULL), uiEvents(0), uiSession(0), uiConnectStart(0), uiSeq(0), bTalking(false), bWhisper(false), uiSpurtEnd(0) {
+		}
+};
+
+struct TimerEvent {
+	enum Kind { Connect, Voice, Ping, Hop };
 
-	if (udp)
-		socket = ::socket(PF_INET, SOCK_DGRAM, 0);
+	quint64 uiWhen;
+	unsigned int uiClient;
+	unsigned int uiGeneration;
+	Kind kKind;
+
+	bool operator>(const TimerEvent &other) const {
+		return uiWhen > other.uiWhen;
+	}
+};
+
+class LoadGenerator {
+	private:
+		Q_DISABLE_COPY(LoadGenerator)
+	protected:
+		Options oOptions;
+		Random rRandom;
+		int iEpoll;
+		SSL_CTX *ctx;
+		struct sockaddr_storage ssServer;
+		socklen_t slServer;
+		std::vector<LoadClient *> qvClients;
+		std::priority_queue<TimerEvent, std::vector<TimerEvent>, std::greater<TimerEvent> > pqTimers;
+		QList<unsigned int> qlChannels;
+		unsigned int uiSynced;
+		int iRejectsLogged;
+
+		Statistics sInterval;
+		Statistics sTotal;
+		quint64 uiStart;
+
+		void schedule(LoadClient *c, TimerEvent::Kind kind, quint64 when);
+		void updateEvents(LoadClient *c);
+
+		void connectClient(LoadClient *c);
+		void disconnectClient(LoadClient *c, bool reconnect, quint64 delay = RECONNECT_DELAY_USEC);
+		void handleTcp(LoadClient *c, unsigned int events);
+		void handleUdp(LoadClient *c);
+		bool flush(LoadClient *c);
+		void sendMessage(LoadClient *c, const ::google::protobuf::Message &msg, unsigned int msgType);
+		void sendUdp(LoadClient *c, const unsigned char *data, unsigned int len);
+		bool processMessages(LoadClient *c);
+		void processMessage(LoadClient *c, unsigned int type, const char *data, int len);
+		void synced(LoadClient *c);
+
+		void sendVoice(LoadClient *c, quint64 when);
+		void sendPing(LoadClient *c);
+		void hop(LoadClient *c);
+		void storm();
+		void receiveVoice(LoadClient *c, const unsigned char *data, unsigned int len, bool tunneled);
+
+		void report(Statistics &s, quint64 elapsed, bool final);
+	public:
+		LoadGenerator(const Options &o);
+		~LoadGenerator();
+		bool init();
+		void run();
+};
 
-	seq = 0;
-	rcvd = 0;
-	numbytes = -1;
+static volatile sig_atomic_t bStop = 0;
+
+static void stopHandler(int) {
+	bStop = 1;
 }
 
-Client::~Client() {
-	terminate();
-	wait();
+LoadGenerator::LoadGenerator(const Options &o) : oOptions(o), rRandom(o.uiSeed ? o.uiSeed : static_cast<quint64>(getpid()) ^ now()), iEpoll(-1), ctx(NULL), slServer(0), uiSynced(0), iRejectsLogged(0), uiStart(0) {
+	memset(&ssServer, 0, sizeof(ssServer));
 }
 
-void Client::sendMessage(const ::google::protobuf::Message &msg, unsigned int msgType) {
-	unsigned char uc[4096];
-	int len = msg.ByteSize();
-	Q_ASSERT(len < 4090);
+LoadGenerator::~LoadGenerator() {
+	for (size_t i = 0; i < qvClients.size(); ++i) {
+		disconnectClient(qvClients[i], false);
+		delete qvClients[i];
+	}
+	if (ctx)
+		SSL_CTX_free(ctx);
+	if (iEpoll >= 0)
+		close(iEpoll);
+}
 
-	* reinterpret_cast<quint16 *>(& uc[0]) = qToBigEndian(static_cast<quint16>(msgType));
-	* reinterpret_cast<quint32 *>(& uc[2]) = qToBigEndian(static_cast<quint32>(len));
+bool LoadGenerator::init() {
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *res = NULL;
+	int err = getaddrinfo(oOptions.qbaHost.constData(), oOptions.qbaPort.constData(), &hints, &res);
+	if (err != 0 || ! res) {
+		qWarning("Failed to resolve %s: %s", oOptions.qbaHost.constData(), gai_strerror(err));
+		return false;
+	}
+	memcpy(&ssServer, res->ai_addr, res->ai_addrlen);
+	slServer = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	// Every client needs a TCP and a UDP socket.
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+		if (rl.rlim_cur < oOptions.uiClients * 2 + 16)
+			qWarning("File descriptor limit %lu is too low for %u clients", static_cast<unsigned long>(rl.rlim_cur), oOptions.uiClients);
+	}
 
-	msg.SerializeToArray(uc + 6, len);
+	SSL_library_init();
+	SSL_load_error_strings();
 
-	ssl->write(reinterpret_cast<const char *>(uc), len + 6);
-}
+	ctx = SSL_CTX_new(SSLv23_client_method());
+	if (! ctx) {
+		qWarning("Failed to create SSL context");
+		return false;
+	}
+	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	iEpoll = epoll_create1(EPOLL_CLOEXEC);
+	if (iEpoll < 0) {
+		qWarning("epoll_create1: %s", strerror(errno));
+		return false;
+	}
 
-void Client::ping() {
-	unsigned char buffer[256];
-	buffer[0] = MessageHandler::UDPPing << 5;
-	PacketDataStream pds(buffer + 1, 255);
-	pds << 123;
+	uiStart = now();
 
-	doUdp(buffer, pds.size() + 1);
+	const quint64 spacing = oOptions.uiConnectRate ? 1000000ULL / oOptions.uiConnectRate : 0;
+	for (unsigned int i = 0; i < oOptions.uiClients; ++i) {
+		LoadClient *c = new LoadClient(i);
+		c->bSpeaker = (i < oOptions.uiSpeakers);
+		c->bTcpOnly = (rRandom.uniform() < oOptions.dTcpOnly);
+		qvClients.push_back(c);
+		schedule(c, TimerEvent::Connect, uiStart + i * spacing);
+	}
 
-	MumbleProto::Ping mpp;
-	mpp.set_timestamp(123);
-	sendMessage(mpp, MessageHandler::Ping);
+	qWarning("Simulating %u clients (%u speakers) against %s:%s", oOptions.uiClients, qMin(oOptions.uiSpeakers, oOptions.uiClients), oOptions.qbaHost.constData(), oOptions.qbaPort.constData());
+	return true;
 }
 
-void Client::sendVoice() {
-	unsigned char buffer[1024];
-	int len = 32 + (qrand() & 0x3f);
+void LoadGenerator::schedule(LoadClient *c, TimerEvent::Kind kind, quint64 when) {
+	TimerEvent te;
+	te.uiWhen = when;
+	te.uiClient = c->uiIndex;
+	te.uiGeneration = c->uiGeneration;
+	te.kKind = kind;
+	pqTimers.push(te);
+}
 
-	// Regular voice, nothing special
-	buffer[0] = 0;
+void LoadGenerator::updateEvents(LoadClient *c) {
+	unsigned int events = EPOLLIN;
+	if (c->sState == LoadClient::Connecting || ! c->qbaOut.isEmpty())
+		events |= EPOLLOUT;
 
-	PacketDataStream ods(buffer + 1, 1024);
-	ods << 1;
-	ods.append(len);
-	ods.skip(len);
+	if (events == c->uiEvents)
+		return;
 
-	doUdp(buffer, ods.size() + 1);
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u64 = static_cast<quint64>(c->uiIndex) << 1;
+	epoll_ctl(iEpoll, EPOLL_CTL_MOD, c->iTcp, &ev);
+	c->uiEvents = events;
 }
 
-void Client::doUdp(const unsigned char *buffer, int size) {
-	if (! udp || ! crypt.isValid())
+void LoadGenerator::connectClient(LoadClient *c) {
+	c->iTcp = socket(ssServer.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (c->iTcp < 0) {
+		qWarning("socket: %s", strerror(errno));
+		disconnectClient(c, true);
 		return;
+	}
 
-	unsigned char crypted[2048];
+	int one = 1;
+	setsockopt(c->iTcp, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	c->uiConnectStart = now();
+	if (::connect(c->iTcp, reinterpret_cast<struct sockaddr *>(&ssServer), slServer) != 0 && errno != EINPROGRESS) {
+		disconnectClient(c, true);
+		return;
+	}
+
+	if (! c->bTcpOnly) {
+		c->iUdp = socket(ssServer.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (c->iUdp < 0 || ::connect(c->iUdp, reinterpret_cast<struct sockaddr *>(&ssServer), slServer) != 0) {
+			disconnectClient(c, true);
+			return;
+		}
+
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = (static_cast<quint64>(c->uiIndex) << 1) | 1;
+		epoll_ctl(iEpoll, EPOLL_CTL_ADD, c->iUdp, &ev);
+	}
+
+	c->sState = LoadClient::Connecting;
+	c->uiEvents = EPOLLIN | EPOLLOUT;
 
-	crypt.encrypt(reinterpret_cast<const unsigned char *>(buffer), crypted, size);
-	::sendto(socket, reinterpret_cast<const char *>(crypted), size+4, 0, reinterpret_cast<struct sockaddr *>(&srv), sizeof(srv));
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = c->uiEvents;
+	ev.data.u64 = static_cast<quint64>(c->uiIndex) << 1;
+	epoll_ctl(iEpoll, EPOLL_CTL_ADD, c->iTcp, &ev);
 }
 
+void LoadGenerator::disconnectClient(LoadClient *c, bool reconnect, quint64 delay) {
+	if (c->sState == LoadClient::Synced)
+		--uiSynced;
 
-void Client::run() {
-	unsigned char buffer[1024];
-	struct sockaddr_in addr;
-	socklen_t sz;
-	int len;
+	if (c->ssl) {
+		SSL_free(c->ssl);
+		c->ssl = NULL;
+	}
+	if (c->iTcp >= 0) {
+		close(c->iTcp);
+		c->iTcp = -1;
+	}
+	if (c->iUdp >= 0) {
+		close(c->iUdp);
+		c->iUdp = -1;
+	}
 
-	if (! udp)
-		return;
+	c->sState = LoadClient::Idle;
+	c->uiEvents = 0;
+	c->qbaIn.clear();
+	c->qbaOut.clear();
+	c->uiSession = 0;
+	c->bTalking = false;
+	c->qhStreams.clear();
+	c->csCrypt.bInit = false;
+	++c->uiGeneration;
+
+	if (reconnect && ! bStop)
+		schedule(c, TimerEvent::Connect, now() + delay);
+}
 
-	forever {
-		sz = sizeof(addr);
-		len = ::recvfrom(socket, reinterpret_cast<char *>(buffer), 1024, 0, reinterpret_cast<struct sockaddr *>(&addr), &sz);
-		if (len <= 0)
+void LoadGenerator::sendMessage(LoadClient *c, const ::google::protobuf::Message &msg, unsigned int msgType) {
+	const int len = msg.ByteSize();
+	const int offset = c->qbaOut.size();
+
+	c->qbaOut.resize(offset + len + 6);
+	unsigned char *uc = reinterpret_cast<unsigned char *>(c->qbaOut.data()) + offset;
+	* reinterpret_cast<quint16 *>(& uc[0]) = qToBigEndian(static_cast<quint16>(msgType));
+	* reinterpret_cast<quint32 *>(& uc[2]) = qToBigEndian(static_cast<quint32>(len));
+	msg.SerializeToArray(uc + 6, len);
+}
+
+bool LoadGenerator::flush(LoadClient *c) {
+	while (! c->qbaOut.isEmpty()) {
+		const int n = SSL_write(c->ssl, c->qbaOut.constData(), c->qbaOut.size());
+		if (n > 0) {
+			c->qbaOut.remove(0, n);
+			continue;
+		}
+		const int err = SSL_get_error(c->ssl, n);
+		if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
 			break;
-		if (len >= 32)
-			rcvd++;
+		return false;
 	}
+	return true;
 }
 
-void Client::readyRead() {
+void LoadGenerator::handleTcp(LoadClient *c, unsigned int events) {
+	if (c->sState == LoadClient::Connecting) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if ((events & (EPOLLERR | EPOLLHUP)) || getsockopt(c->iTcp, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+			++sInterval.uiFailures;
+			++sTotal.uiFailures;
+			disconnectClient(c, true);
+			return;
+		}
+		if (! (events & EPOLLOUT))
+			return;
+
+		c->ssl = SSL_new(ctx);
+		SSL_set_fd(c->ssl, c->iTcp);
+		SSL_set_connect_state(c->ssl);
+		c->sState = LoadClient::Handshaking;
+	}
+
+	if (c->sState == LoadClient::Handshaking) {
+		const int r = SSL_do_handshake(c->ssl);
+		if (r != 1) {
+			const int err = SSL_get_error(c->ssl, r);
+			if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+				// Only wait for writability if OpenSSL asks for it.
+				struct epoll_event ev;
+				memset(&ev, 0, sizeof(ev));
+				ev.events = (err == SSL_ERROR_WANT_WRITE) ? EPOLLOUT : EPOLLIN;
+				ev.data.u64 = static_cast<quint64>(c->uiIndex) << 1;
+				epoll_ctl(iEpoll, EPOLL_CTL_MOD, c->iTcp, &ev);
+				c->uiEvents = ev.events;
+				return;
+			}
+			++sInterval.uiFailures;
+			++sTotal.uiFailures;
+			disconnectClient(c, true);
+			return;
+		}
+
+		c->sState = LoadClient::Authenticating;
+
+		MumbleProto::Version mpv;
+		mpv.set_release(u8(QLatin1String("1.3.0 Benchmark")));
+		mpv.set_version(0x010300);
+		sendMessage(c, mpv, MessageHandler::Version);
+
+		MumbleProto::Authenticate mpa;
+		mpa.set_username(u8(QString::fromLatin1("bench-%1-%2").arg(getpid()).arg(c->uiIndex)));
+		if (! oOptions.qbaPassword.isEmpty())
+			mpa.set_password(oOptions.qbaPassword.constData());
+		mpa.set_opus(true);
+		sendMessage(c, mpa, MessageHandler::Authenticate);
+	}
+
+	// Read everything available. SSL buffers internally, so epoll alone
+	// doesn't tell us whether more data is pending.
+	char buffer[16384];
 	forever {
-		int avail = ssl->bytesAvailable();
-		if (numbytes == -1) {
-			if (avail < 6)
-				break;
-			unsigned char b[6];
-			ssl->read(reinterpret_cast<char *>(b), 6);
+		const int n = SSL_read(c->ssl, buffer, sizeof(buffer));
+		if (n > 0) {
+			c->qbaIn.append(buffer, n);
+			continue;
+		}
+		const int err = SSL_get_error(c->ssl, n);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+			break;
+		// Closed by the server or a hard error.
+		disconnectClient(c, true);
+		return;
+	}
 
-			ptype = qFromBigEndian(* reinterpret_cast<quint16 *>(& b[0]));
-			numbytes = qFromBigEndian(* reinterpret_cast<quint32 *>(& b[2]));
+	if (! processMessages(c))
+		return;
 
-			avail = ssl->bytesAvailable();
+	if (! flush(c)) {
+		disconnectClient(c, true);
+		return;
+	}
+
+	updateEvents(c);
+}
+
+bool LoadGenerator::processMessages(LoadClient *c) {
+	int offset = 0;
+	const unsigned int generation = c->uiGeneration;
+
+	while (c->qbaIn.size() - offset >= 6) {
+		const unsigned char *uc = reinterpret_cast<const unsigned char *>(c->qbaIn.constData()) + offset;
+		const unsigned int type = qFromBigEndian(* reinterpret_cast<const quint16 *>(& uc[0]));
+		const int len = static_cast<int>(qFromBigEndian(* reinterpret_cast<const quint32 *>(& uc[2])));
+
+		if (len < 0 || len > 0x7fffff) {
+			disconnectClient(c, true);
+			return false;
 		}
-		if ((numbytes >= 0) && (avail >= numbytes)) {
-			int want = numbytes;
-			numbytes = -1;
-			unsigned char buff[65536];
-			Q_ASSERT(want < 65536);
-			ssl->read(reinterpret_cast<char *>(buff), want);
-
-
-			avail = ssl->bytesAvailable();
-
-			switch (ptype) {
-				case MessageHandler::CryptSetup: {
-						MumbleProto::CryptSetup msg;
-						if (! msg.ParseFromArray(buff, want))
-							qFatal("Failed parse crypt");
-
-						if (msg.has_key() && msg.has_client_nonce() && msg.has_server_nonce()) {
-							const std::string &key = msg.key();
-							const std::string &client_nonce = msg.client_nonce();
-							const std::string &server_nonce = msg.server_nonce();
-							if (key.size() == AES_BLOCK_SIZE && client_nonce.size() == AES_BLOCK_SIZE && server_nonce.size() == AES_BLOCK_SIZE)
-								crypt.setKey(reinterpret_cast<const unsigned char *>(key.data()), reinterpret_cast<const unsigned char *>(client_nonce.data()), reinterpret_cast<const unsigned char *>(server_nonce.data()));
-						} else if (msg.has_server_nonce()) {
-							const std::string &server_nonce = msg.server_nonce();
-							if (server_nonce.size() == AES_BLOCK_SIZE) {
-								crypt.uiResync++;
-								memcpy(crypt.decrypt_iv, server_nonce.data(), AES_BLOCK_SIZE);
-							}
-						} else {
-							MumbleProto::CryptSetup mpcs;
-							mpcs.set_client_nonce(std::string(reinterpret_cast<const char *>(crypt.encrypt_iv), AES_BLOCK_SIZE));
-							sendMessage(mpcs, MessageHandler::CryptSetup);
-						}
-						break;
-					}
-				case MessageHandler::ServerSync: {
-						MumbleProto::ServerSync msg;
-						if (! msg.ParseFromArray(buff, want))
-							qFatal("Failed parse sync");
-						uiSession = msg.session();
-						break;
-					}
-				case MessageHandler::UDPTunnel: {
-						unsigned int msgUDPType = (buff[0] >> 5) & 0x7;
-						if (msgUDPType == MessageHandler::UDPVoiceCELTAlpha)
-							rcvd++;
-						break;
+		if (c->qbaIn.size() - offset - 6 < len)
+			break;
+
+		processMessage(c, type, reinterpret_cast<const char *>(uc + 6), len);
+		// The message may have caused a disconnect.
+		if (c->uiGeneration != generation)
+			return false;
+
+		offset += 6 + len;
+	}
+
+	c->qbaIn.remove(0, offset);
+	return true;
+}
+
+void LoadGenerator::processMessage(LoadClient *c, unsigned int type, const char *data, int len) {
+	switch (type) {
+		case MessageHandler::UDPTunnel:
+			receiveVoice(c, reinterpret_cast<const unsigned char *>(data), static_cast<unsigned int>(len), true);
+			break;
+		case MessageHandler::CryptSetup: {
+				MumbleProto::CryptSetup msg;
+				if (! msg.ParseFromArray(data, len))
+					break;
+				if (msg.has_key() && msg.has_client_nonce() && msg.has_server_nonce()) {
+					const std::string &key = msg.key();
+					const std::string &client_nonce = msg.client_nonce();
+					const std::string &server_nonce = msg.server_nonce();
+					if (key.size() == AES_BLOCK_SIZE && client_nonce.size() == AES_BLOCK_SIZE && server_nonce.size() == AES_BLOCK_SIZE)
+						c->csCrypt.setKey(reinterpret_cast<const unsigned char *>(key.data()), reinterpret_cast<const unsigned char *>(client_nonce.data()), reinterpret_cast<const unsigned char *>(server_nonce.data()));
+				} else if (msg.has_server_nonce()) {
+					const std::string &server_nonce = msg.server_nonce();
+					if (server_nonce.size() == AES_BLOCK_SIZE) {
+						c->csCrypt.uiResync++;
+						c->csCrypt.setDecryptIV(reinterpret_cast<const unsigned char *>(server_nonce.data()));
 					}
+				} else {
+					MumbleProto::CryptSetup mpcs;
+					mpcs.set_client_nonce(std::string(reinterpret_cast<const char *>(c->csCrypt.encrypt_iv), AES_BLOCK_SIZE));
+					sendMessage(c, mpcs, MessageHandler::CryptSetup);
+				}
+				break;
+			}
+		case MessageHandler::ChannelState: {
+				MumbleProto::ChannelState msg;
+				if (msg.ParseFromArray(data, len) && msg.has_channel_id() && ! qlChannels.contains(msg.channel_id()))
+					qlChannels << msg.channel_id();
+				break;
+			}
+		case MessageHandler::ChannelRemove: {
+				MumbleProto::ChannelRemove msg;
+				if (msg.ParseFromArray(data, len))
+					qlChannels.removeAll(msg.channel_id());
+				break;
+			}
+		case MessageHandler::ServerSync: {
+				MumbleProto::ServerSync msg;
+				if (! msg.ParseFromArray(data, len))
+					break;
+				c->uiSession = msg.session();
+				synced(c);
+				break;
+			}
+		case MessageHandler::UserRemove: {
+				MumbleProto::UserRemove msg;
+				if (msg.ParseFromArray(data, len) && c->uiSession && msg.session() == c->uiSession) {
+					++sInterval.uiFailures;
+					++sTotal.uiFailures;
+					disconnectClient(c, true);
+				}
+				break;
+			}
+		case MessageHandler::Reject: {
+				MumbleProto::Reject msg;
+				if (msg.ParseFromArray(data, len) && iRejectsLogged < 10) {
+					++iRejectsLogged;
+					qWarning("Client %u rejected: %s", c->uiIndex, msg.reason().c_str());
+				}
+				++sInterval.uiFailures;
+				++sTotal.uiFailures;
+				disconnectClient(c, true);
+				break;
 			}
-		} else {
+		case MessageHandler::PermissionDenied:
+			++sInterval.uiDenied;
+			++sTotal.uiDenied;
+			break;
+		default:
 			break;
-		}
 	}
 }
 
-void Client::disconnected() {
-	qWarning("SSL Socket disconnected");
-	QCoreApplication::instance()->quit();
+void LoadGenerator::synced(LoadClient *c) {
+	if (c->sState == LoadClient::Synced)
+		return;
+
+	c->sState = LoadClient::Synced;
+	++uiSynced;
+
+	const quint64 t = now();
+	sInterval.hHandshake.add(t - c->uiConnectStart);
+	sTotal.hHandshake.add(t - c->uiConnectStart);
+	++sInterval.uiConnects;
+	++sTotal.uiConnects;
+
+	// Let the server learn our UDP address right away.
+	sendPing(c);
+	schedule(c, TimerEvent::Ping, t + PING_INTERVAL_USEC);
+
+	if (c->bSpeaker)
+		schedule(c, TimerEvent::Voice, t + rRandom.exponential(oOptions.uiSilenceUsec));
+	if (oOptions.uiHopUsec)
+		schedule(c, TimerEvent::Hop, t + rRandom.exponential(oOptions.uiHopUsec));
 }
 
-class Container : public QObject {
-		Q_OBJECT
-	public:
-		int sent;
-		int numsender, numudplistener, numtcplistener;
-		int isender, iudplistener, itcplistener;
-		bool live, forceping;
-		QHostAddress qha;
-		unsigned short port;
-		QTimer qtTick;
-		Timer tickPing, tickVoice, tickGo, tickSpawn;
-		QList<Client *> speakers;
-		QList<Client *> clients;
-		Container(QHostAddress srvaddr, unsigned short port, int nsend, int nudp, int ntcp);
-	public slots:
-		void tick();
-		void go();
-};
+void LoadGenerator::sendUdp(LoadClient *c, const unsigned char *data, unsigned int len) {
+	if (c->bTcpOnly || c->iUdp < 0 || ! c->csCrypt.isValid()) {
+		// Tunnel through the control channel, like a client with UDP disabled.
+		const int offset = c->qbaOut.size();
+		c->qbaOut.resize(offset + static_cast<int>(len) + 6);
+		unsigned char *uc = reinterpret_cast<unsigned char *>(c->qbaOut.data()) + offset;
+		* reinterpret_cast<quint16 *>(& uc[0]) = qToBigEndian(static_cast<quint16>(MessageHandler::UDPTunnel));
+		* reinterpret_cast<quint32 *>(& uc[2]) = qToBigEndian(static_cast<quint32>(len));
+		memcpy(uc + 6, data, len);
+		if (! flush(c))
+			disconnectClient(c, true);
+		else
+			updateEvents(c);
+		return;
+	}
 
-Container::Container(QHostAddress qha, unsigned short port, int numsend, int numudp, int numtcp) {
-	isender = iudplistener = itcplistener = 0;
-	live = false;
-	forceping = false;
-	sent = 0;
+	unsigned char crypted[2048];
+	c->csCrypt.encrypt(data, crypted, len);
+	::send(c->iUdp, reinterpret_cast<const char *>(crypted), len + 4, 0);
+}
 
-	Timer t;
+void LoadGenerator::sendPing(LoadClient *c) {
+	const quint64 t = now();
 
-	qWarning("Spawning %d speakers and %d listeners (%d UDP, %d TCP)", numsend, numudp+numtcp, numudp, numtcp);
+	if (! c->bTcpOnly && c->csCrypt.isValid()) {
+		unsigned char buffer[64];
+		buffer[0] = static_cast<unsigned char>(MessageHandler::UDPPing << 5);
+		PacketDataStream pds(buffer + 1, sizeof(buffer) - 1);
+		pds << t;
+		sendUdp(c, buffer, pds.size() + 1);
+	}
 
-	this->qha = qha;
-	this->port = port;
+	MumbleProto::Ping mpp;
+	mpp.set_timestamp(t);
+	mpp.set_good(c->csCrypt.uiGood);
+	mpp.set_late(c->csCrypt.uiLate);
+	mpp.set_lost(c->csCrypt.uiLost);
+	mpp.set_resync(c->csCrypt.uiResync);
+	sendMessage(c, mpp, MessageHandler::Ping);
+	if (! flush(c))
+		disconnectClient(c, true);
+	else
+		updateEvents(c);
+}
+
+void LoadGenerator::sendVoice(LoadClient *c, quint64 when) {
+	if (! c->bTalking) {
+		c->bTalking = true;
+		c->uiSpurtEnd = when + qMax(oOptions.uiPacketUsec, rRandom.exponential(oOptions.uiTalkUsec));
+		c->bWhisper = (oOptions.dWhisper > 0.0) && (rRandom.uniform() < oOptions.dWhisper);
+
+		if (c->bWhisper) {
+			MumbleProto::VoiceTarget mpvt;
+			mpvt.set_id(1);
+			MumbleProto::VoiceTarget_Target *t = mpvt.add_targets();
+			for (unsigned int i = 0; i < oOptions.uiWhisperTargets; ++i) {
+				LoadClient *other = qvClients[rRandom.below(static_cast<unsigned int>(qvClients.size()))];
+				if (other != c && other->sState == LoadClient::Synced)
+					t->add_session(other->uiSession);
+			}
+			if (t->session_size() == 0) {
+				c->bWhisper = false;
+			} else {
+				sendMessage(c, mpvt, MessageHandler::VoiceTarget);
+				if (! flush(c)) {
+					disconnectClient(c, true);
+					return;
+				}
+				updateEvents(c);
+			}
+		}
+	}
 
-	numsender = numsend;
-	numudplistener = numudp;
-	numtcplistener = numtcp;
+	const bool terminator = (when + oOptions.uiPacketUsec >= c->uiSpurtEnd);
+	const int size = qMax(PAYLOAD_HEADER_SIZE, static_cast<int>((oOptions.uiBitrate * oOptions.uiPacketUsec) / 8000000ULL));
 
+	unsigned char buffer[1024];
+	buffer[0] = static_cast<unsigned char>((MessageHandler::UDPVoiceOpus << 5) | (c->bWhisper ? 1 : 0));
+	PacketDataStream pds(buffer + 1, sizeof(buffer) - 1);
+	pds << c->uiSeq;
+	pds << (static_cast<unsigned int>(size) | (terminator ? 0x2000U : 0U));
+
+	unsigned char payload[1024];
+	memset(payload, 0, sizeof(payload));
+	payload[0] = 0x78; // SILK/CELT hybrid 20ms mono TOC, for realism only.
+	qToBigEndian(static_cast<quint16>(PAYLOAD_MAGIC), payload + 1);
+	qToBigEndian(static_cast<quint32>(c->uiIndex), payload + 3);
+	qToBigEndian(static_cast<quint64>(now()), payload + 7);
+	pds.append(reinterpret_cast<const char *>(payload), static_cast<quint32>(qMin(size, static_cast<int>(sizeof(payload)))));
+
+	// Sequence numbers count 10ms frames.
+	c->uiSeq += static_cast<unsigned int>(oOptions.uiPacketUsec / 10000ULL);
+
+	sendUdp(c, buffer, pds.size() + 1);
+	// sendUdp() may have had to drop the connection.
+	if (c->sState != LoadClient::Synced)
+		return;
 
-	connect(&qtTick, SIGNAL(timeout()), this, SLOT(tick()));
-	qtTick.start(0);
+	++sInterval.uiSent;
+	++sTotal.uiSent;
 
-	tickSpawn.restart();
+	if (terminator) {
+		c->bTalking = false;
+		schedule(c, TimerEvent::Voice, c->uiSpurtEnd + rRandom.exponential(oOptions.uiSilenceUsec));
+	} else {
+		schedule(c, TimerEvent::Voice, when + oOptions.uiPacketUsec);
+	}
 }
 
-void Container::tick() {
-	if (forceping || tickPing.isElapsed(5000000ULL)) {
-		forceping = false;
+void LoadGenerator::receiveVoice(LoadClient *c, const unsigned char *data, unsigned int len, bool tunneled) {
+	if (len < 2)
+		return;
 
-		foreach(Client *c, clients)
-			c->ping();
+	const MessageHandler::UDPMessageType type = static_cast<MessageHandler::UDPMessageType>((data[0] >> 5) & 0x7);
+	if (type != MessageHandler::UDPVoiceOpus)
+		return;
 
-		if (live) {
+	PacketDataStream pds(reinterpret_cast<const char *>(data + 1), static_cast<int>(len - 1));
+	unsigned int session, seq;
+	int size;
+	pds >> session;
+	pds >> seq;
+	pds >> size;
+	size &= 0x1fff;
 
-			int lost = 0;
-			quint64 totrcv = 0;
-			int nrcv = 0;
-			foreach(Client *c, clients) {
-				if (! c->sender) {
-					totrcv += c->rcvd;
-					lost += sent - c->rcvd;
-					nrcv++;
-				}
-			}
-			qWarning("Sent: %8d  Rcvd: %8lld  Lost: %8d   BW: %6.1fMbit/s", sent, totrcv / nrcv, (lost + nrcv - 1) / nrcv, (totrcv * 8.0 * 123.0) / (tickGo.elapsed() * 1.0));
-		} else {
-			qWarning("Spawned %3d/%3d", isender + iudplistener + itcplistener, numsender + numudplistener + numtcplistener);
+	if (! pds.isValid() || size < PAYLOAD_HEADER_SIZE || pds.left() < static_cast<quint32>(size))
+		return;
+
+	const QByteArray qba = pds.dataBlock(static_cast<quint32>(size));
+	const unsigned char *payload = reinterpret_cast<const unsigned char *>(qba.constData());
+	if (qFromBigEndian<quint16>(payload + 1) != PAYLOAD_MAGIC)
+		return;
+
+	const quint64 sent = qFromBigEndian<quint64>(payload + 7);
+	const quint64 t = now();
+	const quint64 transit = (t > sent) ? t - sent : 0;
+
+	sInterval.hLatency.add(transit);
+	sTotal.hLatency.add(transit);
+	++sInterval.uiReceived;
+	++sTotal.uiReceived;
+	if (tunneled) {
+		++sInterval.uiTunneled;
+		++sTotal.uiTunneled;
+	}
+
+	QHash<unsigned int, Stream>::iterator i = c->qhStreams.find(session);
+	if (i == c->qhStreams.end()) {
+		Stream s;
+		s.uiLastTransit = transit;
+		s.uiJitter = 0;
+		s.uiLastSeq = seq;
+		c->qhStreams.insert(session, s);
+		return;
+	}
+
+	Stream &s = i.value();
+
+	// RFC 3550, section 6.4.1
+	const quint64 d = (transit > s.uiLastTransit) ? transit - s.uiLastTransit : s.uiLastTransit - transit;
+	s.uiJitter = (s.uiJitter * 15 + d) / 16;
+	s.uiLastTransit = transit;
+	sInterval.hJitter.add(s.uiJitter);
+	sTotal.hJitter.add(s.uiJitter);
+
+	// Gaps within a talk spurt are losses. Larger jumps are a new spurt.
+	const unsigned int step = static_cast<unsigned int>(oOptions.uiPacketUsec / 10000ULL);
+	if (seq > s.uiLastSeq + step && seq - s.uiLastSeq < 50 * step) {
+		const quint64 lost = (seq - s.uiLastSeq) / step - 1;
+		sInterval.uiLost += lost;
+		sTotal.uiLost += lost;
+	}
+	if (seq > s.uiLastSeq)
+		s.uiLastSeq = seq;
+}
+
+void LoadGenerator::handleUdp(LoadClient *c) {
+	unsigned char encrypted[2048];
+	unsigned char buffer[2048];
+
+	forever {
+		const ssize_t len = recv(c->iUdp, encrypted, sizeof(encrypted), 0);
+		if (len < 0)
+			break;
+		if (len < 5)
+			continue;
+		if (! c->csCrypt.isValid() || ! c->csCrypt.decrypt(encrypted, buffer, static_cast<unsigned int>(len)))
+			continue;
+		receiveVoice(c, buffer, static_cast<unsigned int>(len - 4), false);
+	}
+}
+
+void LoadGenerator::hop(LoadClient *c) {
+	if (qlChannels.count() > 1) {
+		MumbleProto::UserState mpus;
+		mpus.set_session(c->uiSession);
+		mpus.set_channel_id(qlChannels.at(static_cast<int>(rRandom.below(static_cast<unsigned int>(qlChannels.count())))));
+		sendMessage(c, mpus, MessageHandler::UserState);
+		if (! flush(c)) {
+			disconnectClient(c, true);
+			return;
 		}
+		updateEvents(c);
+		++sInterval.uiHops;
+		++sTotal.uiHops;
 	}
+	schedule(c, TimerEvent::Hop, now() + rRandom.exponential(oOptions.uiHopUsec));
+}
 
-	if (live && tickVoice.isElapsed(10000ULL)) {
-		foreach(Client *c, speakers) {
-			sent++;
-			c->sendVoice();
+void LoadGenerator::storm() {
+	unsigned int dropped = 0;
+	for (size_t i = 0; i < qvClients.size(); ++i) {
+		LoadClient *c = qvClients[i];
+		if (c->sState == LoadClient::Synced && rRandom.uniform() < oOptions.dStormFraction) {
+			disconnectClient(c, true, 0);
+			++dropped;
 		}
 	}
-	if (! live) {
-		if (isender < numsender) {
-			// Spawn a sender
-			Client *c = new Client(this, qha, port, true, false);
-			speakers << c;
-			c->start();
-			clients << c;
-			isender++;
-		} else if (iudplistener < numudplistener) {
-			// Spawn a listener which uses UDP
-			Client *c = new Client(this, qha, port, false, false);
-			c->start();
-			clients << c;
-			iudplistener++;
-		} else if (itcplistener < numtcplistener) {
-			// Spawn a listener which uses TCP-only
-			Client *c = new Client(this, qha, port, false, true);
-			c->start();
-			clients << c;
-			itcplistener++;
-		} else {
-			live = true;
-			quint64 elapsed = tickSpawn.elapsed();
-			qWarning("Spawning took %lld ms (%lld us per client)", elapsed / 1000ULL, elapsed / (numsender+numudplistener+numtcplistener));
-			foreach(Client *c, clients)
-				c->rcvd = 0;
-			sent = 0;
-			forceping = true;
-			qtTick.start(10);
+	qWarning("Reconnect storm: dropped %u clients", dropped);
+}
+
+void LoadGenerator::report(Statistics &s, quint64 elapsed, bool final) {
+	const double secs = static_cast<double>(elapsed) / 1000000.0;
+	const quint64 expected = s.uiReceived + s.uiLost;
+
+	qWarning("%s %7.1fs  synced %u/%u  tx %.0f/s  rx %.0f/s (%llu tunneled)  loss %.3f%%  connects %llu  failures %llu  hops %llu  denied %llu",
+	         final ? "TOTAL" : "     ",
+	         static_cast<double>(now() - uiStart) / 1000000.0,
+	         uiSynced, oOptions.uiClients,
+	         static_cast<double>(s.uiSent) / secs,
+	         static_cast<double>(s.uiReceived) / secs,
+	         static_cast<unsigned long long>(s.uiTunneled),
+	         expected ? 100.0 * static_cast<double>(s.uiLost) / static_cast<double>(expected) : 0.0,
+	         static_cast<unsigned long long>(s.uiConnects),
+	         static_cast<unsigned long long>(s.uiFailures),
+	         static_cast<unsigned long long>(s.uiHops),
+	         static_cast<unsigned long long>(s.uiDenied));
+	qWarning("      latency ms   %s", qPrintable(s.hLatency.summary()));
+	qWarning("      jitter ms    %s", qPrintable(s.hJitter.summary()));
+	qWarning("      handshake ms %s", qPrintable(s.hHandshake.summary()));
+	qWarning("      lag ms       %s", qPrintable(s.hLag.summary()));
+}
+
+void LoadGenerator::run() {
+	struct epoll_event events[1024];
+	quint64 nextReport = uiStart + oOptions.uiReportUsec;
+	quint64 nextStorm = oOptions.uiStormUsec ? uiStart + oOptions.uiStormUsec : 0;
+	quint64 lastReport = uiStart;
+
+	while (! bStop) {
+		quint64 t = now();
+
+		while (! pqTimers.empty() && pqTimers.top().uiWhen <= t) {
+			const TimerEvent te = pqTimers.top();
+			pqTimers.pop();
+
+			LoadClient *c = qvClients[te.uiClient];
+			if (te.uiGeneration != c->uiGeneration)
+				continue;
+
+			sInterval.hLag.add(t - te.uiWhen);
+			sTotal.hLag.add(t - te.uiWhen);
+
+			switch (te.kKind) {
+				case TimerEvent::Connect:
+					if (c->sState == LoadClient::Idle)
+						connectClient(c);
+					break;
+				case TimerEvent::Voice:
+					if (c->sState == LoadClient::Synced)
+						sendVoice(c, te.uiWhen);
+					break;
+				case TimerEvent::Ping:
+					if (c->sState == LoadClient::Synced) {
+						sendPing(c);
+						if (c->sState == LoadClient::Synced)
+							schedule(c, TimerEvent::Ping, te.uiWhen + PING_INTERVAL_USEC);
+					}
+					break;
+				case TimerEvent::Hop:
+					if (c->sState == LoadClient::Synced)
+						hop(c);
+					break;
+			}
+		}
+
+		t = now();
+		if (t >= nextReport) {
+			report(sInterval, t - lastReport, false);
+			sInterval.reset();
+			lastReport = t;
+			nextReport += oOptions.uiReportUsec;
+		}
+		if (nextStorm && t >= nextStorm) {
+			storm();
+			nextStorm += oOptions.uiStormUsec;
+		}
+		if (oOptions.uiDurationUsec && t - uiStart >= oOptions.uiDurationUsec)
+			break;
+
+		quint64 wake = nextReport;
+		if (! pqTimers.empty())
+			wake = qMin(wake, pqTimers.top().uiWhen);
+		if (nextStorm)
+			wake = qMin(wake, nextStorm);
+		const int timeout = (wake > t) ? static_cast<int>((wake - t + 999) / 1000) : 0;
+
+		const int n = epoll_wait(iEpoll, events, 1024, timeout);
+		if (n < 0 && errno != EINTR) {
+			qWarning("epoll_wait: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < n; ++i) {
+			LoadClient *c = qvClients[static_cast<size_t>(events[i].data.u64 >> 1)];
+			if (events[i].data.u64 & 1) {
+				if (c->iUdp >= 0)
+					handleUdp(c);
+			} else if (c->iTcp >= 0) {
+				handleTcp(c, events[i].events);
+			}
 		}
 	}
+
+	report(sTotal, now() - uiStart, true);
 }
 
-void Container::go() {
-	foreach(Client *c, clients)
-		c->start();
-	qtTick.start(10);
-	tickGo.restart();
+static void usage(const char *argv0) {
+	fprintf(stderr,
+	        "Usage: %s [options] <host> [port]\n"
+	        "\n"
+	        "  -n, --clients N        Number of simulated clients (default 100)\n"
+	        "  -s, --speakers N       Number of clients that talk (default 10)\n"
+	        "  -r, --rate N           New connections per second while ramping up (default 200)\n"
+	        "  -p, --password PW      Server password\n"
+	        "      --tcp F            Fraction of clients that tunnel voice over TCP (default 0)\n"
+	        "      --packet MS        Audio per packet in ms, multiple of 10 (default 20)\n"
+	        "      --bitrate BPS      Opus bitrate, determines packet size (default 40000)\n"
+	        "      --talk MS          Mean talk spurt length (default 1500)\n"
+	        "      --silence MS       Mean silence length (default 3000)\n"
+	        "      --whisper F        Fraction of talk spurts that are whispers (default 0)\n"
+	        "      --whisper-targets N  Users per whisper (default 5)\n"
+	        "      --hop S            Mean seconds between channel hops per client (default off)\n"
+	        "      --storm S[:F]      Every S seconds, reconnect fraction F of clients (default off, F 0.1)\n"
+	        "  -d, --duration S       Stop after S seconds (default: run until interrupted)\n"
+	        "      --report S         Report interval in seconds (default 5)\n"
+	        "      --seed N           Random seed\n",
+	        argv0);
 }
 
 int main(int argc, char **argv) {
-	QCoreApplication a(argc, argv);
+	Options o;
+
+	enum { OptTcp = 256, OptPacket, OptBitrate, OptTalk, OptSilence, OptWhisper, OptWhisperTargets, OptHop, OptStorm, OptReport, OptSeed };
+
+	static const struct option longopts[] = {
+		{ "clients", required_argument, NULL, 'n' },
+		{ "speakers", required_argument, NULL, 's' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "password", required_argument, NULL, 'p' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "tcp", required_argument, NULL, OptTcp },
+		{ "packet", required_argument, NULL, OptPacket },
+		{ "bitrate", required_argument, NULL, OptBitrate },
+		{ "talk", required_argument, NULL, OptTalk },
+		{ "silence", required_argument, NULL, OptSilence },
+		{ "whisper", required_argument, NULL, OptWhisper },
+		{ "whisper-targets", required_argument, NULL, OptWhisperTargets },
+		{ "hop", required_argument, NULL, OptHop },
+		{ "storm", required_argument, NULL, OptStorm },
+		{ "report", required_argument, NULL, OptReport },
+		{ "seed", required_argument, NULL, OptSeed },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "n:s:r:p:d:h", longopts, NULL)) != -1) {
+		switch (opt) {
+			case 'n':
+				o.uiClients = static_cast<unsigned int>(atoi(optarg));
+				break;
+			case 's':
+				o.uiSpeakers = static_cast<unsigned int>(atoi(optarg));
+				break;
+			case 'r':
+				o.uiConnectRate = static_cast<unsigned int>(atoi(optarg));
+				break;
+			case 'p':
+				o.qbaPassword = QByteArray(optarg);
+				break;
+			case 'd':
+				o.uiDurationUsec = static_cast<quint64>(atof(optarg) * 1000000.0);
+				break;
+			case OptTcp:
+				o.dTcpOnly = atof(optarg);
+				break;
+			case OptPacket:
+				o.uiPacketUsec = static_cast<quint64>(qBound(1, atoi(optarg) / 10, 6)) * 10000ULL;
+				break;
+			case OptBitrate:
+				o.uiBitrate = static_cast<unsigned int>(atoi(optarg));
+				break;
+			case OptTalk:
+				o.uiTalkUsec = static_cast<quint64>(atoi(optarg)) * 1000ULL;
+				break;
+			case OptSilence:
+				o.uiSilenceUsec = static_cast<quint64>(atoi(optarg)) * 1000ULL;
+				break;
+			case OptWhisper:
+				o.dWhisper = atof(optarg);
+				break;
+			case OptWhisperTargets:
+				o.uiWhisperTargets = static_cast<unsigned int>(atoi(optarg));
+				break;
+			case OptHop:
+				o.uiHopUsec = static_cast<quint64>(atof(optarg) * 1000000.0);
+				break;
+			case OptStorm: {
+					const QList<QByteArray> parts = QByteArray(optarg).split(':');
+					o.uiStormUsec = static_cast<quint64>(parts.at(0).toDouble() * 1000000.0);
+					if (parts.count() > 1)
+						o.dStormFraction = parts.at(1).toDouble();
+					break;
+				}
+			case OptReport:
+				o.uiReportUsec = qMax(static_cast<quint64>(atof(optarg) * 1000000.0), 100000ULL);
+				break;
+			case OptSeed:
+				o.uiSeed = static_cast<quint64>(strtoull(optarg, NULL, 0));
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
 
-	qWarning("Maximum # sockets is %d", FD_SETSIZE);
+	if (optind >= argc || argc - optind > 2) {
+		usage(argv[0]);
+		return 1;
+	}
 
-	if (argc != 6)
-		qFatal("Invalid number of arguments. These need to be passed: <host address> <port> <numsend> <numudp> <numtcp>");
+	o.qbaHost = QByteArray(argv[optind]);
+	if (argc - optind == 2)
+		o.qbaPort = QByteArray(argv[optind + 1]);
 
-	QHostAddress qha = QHostAddress(argv[1]);
-	int port = atoi(argv[2]);
-	int numsender = atoi(argv[3]);
-	int numudplistener = atoi(argv[4]);
-	int numtcplistener = atoi(argv[5]);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, stopHandler);
+	signal(SIGTERM, stopHandler);
 
-	Container c(qha, port, numsender, numudplistener, numtcplistener);
-	c.go();
-	a.exec();
+	LoadGenerator lg(o);
+	if (! lg.init())
+		return 1;
+	lg.run();
+	return 0;
 }
-
-#include "Benchmark.moc"
@@ -1,7 +1,7 @@
 include(../mumble.pri)
 
 TEMPLATE = app
-CONFIG *= qt thread warn_on network qtestlib debug
+CONFIG *= qt thread warn_on network debug
 CONFIG -= app_bundle
 QT *= network xml
 LANGUAGE = C++
@@ -10,6 +10,13 @@ SOURCES *= Benchmark.cpp Timer.cpp CryptState.cpp
 HEADERS *= Timer.h CryptState.h
 VPATH *= ..
 INCLUDEPATH *= .. ../murmur ../mumble
+
+# The load generator is built on epoll.
+!linux {
+  error(Benchmark is only supported on Linux)
+}
+
+# The load generator drives libssl directly.
 !win32 {
-  LIBS *= -lcrypto
+  LIBS *= -lssl -lcrypto
 }
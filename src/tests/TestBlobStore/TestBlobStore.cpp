@@ -0,0 +1,102 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "BlobStore.h"
+
+class TestBlobStore : public QObject {
+		Q_OBJECT
+	private slots:
+		void shared();
+		void cache();
+		void spill();
+	private:
+		static QByteArray blob(char c, int size);
+		static QByteArray hash(const QByteArray &data);
+};
+
+QByteArray TestBlobStore::blob(char c, int size) {
+	return QByteArray(size, c);
+}
+
+QByteArray TestBlobStore::hash(const QByteArray &data) {
+	return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+void TestBlobStore::shared() {
+	BlobStore bs;
+	const QByteArray a = blob('a', 1000);
+	const QByteArray h = hash(a);
+
+	const QByteArray first = bs.acquire(h, a);
+	const QByteArray second = bs.acquire(h, blob('a', 1000));
+	QVERIFY(first.constData() == second.constData());
+	QCOMPARE(bs.memoryUsage(), Q_INT64_C(1000));
+
+	// Without a cache, the blob is gone as soon as the last reference is.
+	bs.release(h);
+	QCOMPARE(bs.value(h), a);
+	bs.release(h);
+	QVERIFY(bs.value(h).isNull());
+	QCOMPARE(bs.memoryUsage(), Q_INT64_C(0));
+}
+
+void TestBlobStore::cache() {
+	BlobStore bs;
+	bs.setLimits(2500, QString());
+
+	const QByteArray a = blob('a', 1000), b = blob('b', 1000), c = blob('c', 1000);
+
+	bs.insert(hash(a), a);
+	bs.insert(hash(b), b);
+	// Using a makes b the least recently used blob.
+	QCOMPARE(bs.value(hash(a)), a);
+	bs.insert(hash(c), c);
+
+	QCOMPARE(bs.value(hash(a)), a);
+	QVERIFY(bs.value(hash(b)).isNull());
+	QCOMPARE(bs.value(hash(c)), c);
+
+	// Referenced blobs don't count towards the cache and are never evicted.
+	bs.acquire(hash(b), b);
+	bs.acquire(hash(a), a);
+	bs.setLimits(0, QString());
+	QCOMPARE(bs.value(hash(a)), a);
+	QCOMPARE(bs.value(hash(b)), b);
+	QVERIFY(bs.value(hash(c)).isNull());
+	QCOMPARE(bs.memoryUsage(), Q_INT64_C(2000));
+}
+
+void TestBlobStore::spill() {
+	const QString path = QDir::temp().filePath(QString::fromLatin1("TestBlobStore-%1").arg(QCoreApplication::applicationPid()));
+
+	{
+		BlobStore bs;
+		bs.setLimits(0, path);
+
+		const QByteArray a = blob('a', 1000);
+		bs.insert(hash(a), a);
+		QCOMPARE(bs.memoryUsage(), Q_INT64_C(0));
+		QCOMPARE(bs.value(hash(a)), a);
+
+		// A damaged file is not returned as the blob.
+		QFile f(QDir(path).filePath(QString::fromLatin1(hash(a).toHex())));
+		QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		f.write("damaged");
+		f.close();
+		QVERIFY(bs.value(hash(a)).isNull());
+		QVERIFY(! f.exists());
+	}
+
+	QDir dir(path);
+	foreach(const QString &name, dir.entryList(QDir::Files))
+		dir.remove(name);
+	QDir::temp().rmdir(path);
+}
+
+QTEST_MAIN(TestBlobStore)
+#include "TestBlobStore.moc"
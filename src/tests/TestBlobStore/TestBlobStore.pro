@@ -0,0 +1,10 @@
+# Copyright 2005-2017 The Mumble Developers. All rights reserved.
+# Use of this source code is governed by a BSD-style license
+# that can be found in the LICENSE file at the root of the
+# Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+include(../test.pri)
+
+TARGET = TestBlobStore
+HEADERS = BlobStore.h
+SOURCES = TestBlobStore.cpp BlobStore.cpp
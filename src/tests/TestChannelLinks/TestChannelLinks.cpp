@@ -0,0 +1,66 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "Channel.h"
+
+class TestChannelLinks : public QObject {
+		Q_OBJECT
+	private slots:
+		void unlinked();
+		void linked();
+		void split();
+};
+
+void TestChannelLinks::unlinked() {
+	Channel root(0, QLatin1String("Root"));
+	Channel *a = new Channel(1, QLatin1String("A"), &root);
+
+	// A whisper to an unlinked channel that asks for links still
+	// reaches the channel itself.
+	QVERIFY(a->qlLinkComponent.isEmpty());
+	QCOMPARE(a->linkComponent(), QSet<Channel *>() << a);
+	QCOMPARE(a->linkComponent(), a->allLinks());
+}
+
+void TestChannelLinks::linked() {
+	Channel root(0, QLatin1String("Root"));
+	Channel *a = new Channel(1, QLatin1String("A"), &root);
+	Channel *b = new Channel(2, QLatin1String("B"), &root);
+	Channel *c = new Channel(3, QLatin1String("C"), &root);
+
+	a->link(b);
+	b->link(c);
+
+	const QSet<Channel *> all = QSet<Channel *>() << a << b << c;
+	QCOMPARE(a->linkComponent(), all);
+	QCOMPARE(b->linkComponent(), all);
+	QCOMPARE(c->linkComponent(), all);
+	QCOMPARE(root.linkComponent(), QSet<Channel *>() << &root);
+}
+
+void TestChannelLinks::split() {
+	Channel root(0, QLatin1String("Root"));
+	Channel *a = new Channel(1, QLatin1String("A"), &root);
+	Channel *b = new Channel(2, QLatin1String("B"), &root);
+	Channel *c = new Channel(3, QLatin1String("C"), &root);
+
+	a->link(b);
+	b->link(c);
+	b->unlink(c);
+
+	QCOMPARE(a->linkComponent(), QSet<Channel *>() << a << b);
+	QCOMPARE(c->linkComponent(), QSet<Channel *>() << c);
+	QVERIFY(c->qlLinkComponent.isEmpty());
+
+	a->unlink();
+	QCOMPARE(a->linkComponent(), QSet<Channel *>() << a);
+	QCOMPARE(b->linkComponent(), QSet<Channel *>() << b);
+}
+
+QTEST_MAIN(TestChannelLinks)
+#include "TestChannelLinks.moc"
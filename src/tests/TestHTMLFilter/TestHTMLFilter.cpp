@@ -0,0 +1,236 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+#include <QXmlStreamReader>
+
+#include "HTMLFilter.h"
+
+class TestHTMLFilter : public QObject {
+		Q_OBJECT
+	private slots:
+		void initTestCase();
+		void plainText();
+		void markup();
+		void lineBreaks();
+		void entities();
+		void invalid_data();
+		void invalid();
+		void textLength();
+		void fuzzWellFormed();
+		void fuzzMutated();
+		void benchmarkFilter();
+		void benchmarkTextLength();
+		void benchmarkReference();
+	private:
+		QString randomDocument(int depth);
+		QString imageMessage() const;
+};
+
+// The QXmlStreamReader based filter that HTMLFilter::filter replaced.
+static bool referenceFilter(const QString &in, QString &out) {
+	if (! in.contains(QLatin1Char('<'))) {
+		out = in.simplified();
+		return true;
+	}
+
+	QXmlStreamReader qxsr(QString::fromLatin1("<document>%1</document>").arg(in));
+	QString qs;
+	while (! qxsr.atEnd()) {
+		switch (qxsr.readNext()) {
+			case QXmlStreamReader::Invalid:
+				return false;
+			case QXmlStreamReader::Characters:
+				qs += qxsr.text();
+				break;
+			case QXmlStreamReader::EndElement:
+				if ((qxsr.name() == QLatin1String("br")) || (qxsr.name() == QLatin1String("p")))
+					qs += QLatin1Char('\n');
+				break;
+			default:
+				break;
+		}
+	}
+	qs = qs.simplified();
+	qs.replace(QLatin1Char('<'), QLatin1String("&lt;"));
+	qs.replace(QLatin1Char('>'), QLatin1String("&gt;"));
+	out = qs;
+	return true;
+}
+
+void TestHTMLFilter::initTestCase() {
+	qsrand(1);
+}
+
+void TestHTMLFilter::plainText() {
+	QString out;
+	QVERIFY(HTMLFilter::filter(QLatin1String("  hello \n  world  "), out));
+	QCOMPARE(out, QString::fromLatin1("hello world"));
+}
+
+void TestHTMLFilter::markup() {
+	QString out;
+	QVERIFY(HTMLFilter::filter(QLatin1String("<b>Hello</b>  <i class=\"x\">world</i><!-- comment --><![CDATA[ <raw> ]]>"), out));
+	QCOMPARE(out, QString::fromLatin1("Hello world &lt;raw&gt;"));
+}
+
+void TestHTMLFilter::lineBreaks() {
+	QString out;
+	QVERIFY(HTMLFilter::filter(QLatin1String("a<br/>b<p>c</p>d"), out));
+	QCOMPARE(out, QString::fromLatin1("a bc d"));
+}
+
+void TestHTMLFilter::entities() {
+	QString out;
+	QVERIFY(HTMLFilter::filter(QLatin1String("<b>&lt;3 &amp; &#65;&#x42;&#x1F600;</b>"), out));
+	QString expected = QString::fromLatin1("&lt;3 & AB");
+	expected += QChar(QChar::highSurrogate(0x1f600));
+	expected += QChar(QChar::lowSurrogate(0x1f600));
+	QCOMPARE(out, expected);
+}
+
+void TestHTMLFilter::invalid_data() {
+	QTest::addColumn<QString>("in");
+
+	QTest::newRow("unclosed") << QString::fromLatin1("<b>unclosed");
+	QTest::newRow("unopened") << QString::fromLatin1("text</b>");
+	QTest::newRow("crossed") << QString::fromLatin1("<b><i>x</b></i>");
+	QTest::newRow("unquoted") << QString::fromLatin1("<b x=1>x</b>");
+	QTest::newRow("duplicate attribute") << QString::fromLatin1("<b x='1' x='2'>x</b>");
+	QTest::newRow("html entity") << QString::fromLatin1("<b>&nbsp;</b>");
+	QTest::newRow("bare ampersand") << QString::fromLatin1("<b>a & b</b>");
+	QTest::newRow("invalid reference") << QString::fromLatin1("<b>&#0;</b>");
+	QTest::newRow("lt in attribute") << QString::fromLatin1("<a href=\"<\">x</a>");
+	QTest::newRow("doctype") << QString::fromLatin1("<!DOCTYPE html><b>x</b>");
+	QTest::newRow("xml declaration") << QString::fromLatin1("<?xml version=\"1.0\"?><b>x</b>");
+	QTest::newRow("double dash") << QString::fromLatin1("<!-- a -- b -->");
+	QTest::newRow("unterminated cdata") << QString::fromLatin1("<![CDATA[ x");
+	QTest::newRow("control character") << QString::fromLatin1("<b>\x01</b>");
+	QTest::newRow("wrapper") << QString::fromLatin1("</document><document>");
+}
+
+void TestHTMLFilter::invalid() {
+	QFETCH(QString, in);
+
+	QString out = QLatin1String("unchanged");
+	QVERIFY(! HTMLFilter::filter(in, out));
+	QCOMPARE(out, QString::fromLatin1("unchanged"));
+	QCOMPARE(HTMLFilter::textLength(in), -1);
+}
+
+void TestHTMLFilter::textLength() {
+	const QString src = QLatin1String("data:image/png;base64,iVBORw0KGgo=");
+	const QString in = QString::fromLatin1("<p>hi <img alt=\"src\" src=\"%1\"/></p><a src=\"kept\">x</a>").arg(src);
+
+	QCOMPARE(HTMLFilter::textLength(in), in.size() - src.size());
+	QCOMPARE(HTMLFilter::textLength(QLatin1String("plain")), 5);
+	QCOMPARE(HTMLFilter::textLength(imageMessage()), imageMessage().size() - 128 * 1024);
+}
+
+QString TestHTMLFilter::randomDocument(int depth) {
+	static const char *words[] = { "hello", "world", "&amp;", "&lt;", "&gt;", "&quot;", "&#65;", "&#x263a;", " ", "\n", "\t", "<![CDATA[ <x> ]]>", "<!-- c -->", "<br/>", "<br />" };
+	static const char *tags[] = { "b", "i", "u", "p", "a", "span", "img" };
+
+	QString out;
+	const int parts = qrand() % 6;
+	for (int i = 0; i < parts; ++i) {
+		if ((depth > 0) && (qrand() % 3 == 0)) {
+			const QString tag = QLatin1String(tags[qrand() % (sizeof(tags) / sizeof(tags[0]))]);
+			QString attrs;
+			if (qrand() % 2)
+				attrs += QString::fromLatin1(" src=\"%1\"").arg(QString(qrand() % 64, QLatin1Char('A')));
+			if (qrand() % 2)
+				attrs += QLatin1String(" alt='a &amp; b'");
+			if (qrand() % 4 == 0)
+				out += QString::fromLatin1("<%1%2/>").arg(tag, attrs);
+			else
+				out += QString::fromLatin1("<%1%2>%3</%1 >").arg(tag, attrs, randomDocument(depth - 1));
+		} else {
+			out += QLatin1String(words[qrand() % (sizeof(words) / sizeof(words[0]))]);
+		}
+	}
+	return out;
+}
+
+QString TestHTMLFilter::imageMessage() const {
+	return QString::fromLatin1("<p>Look at this: <img src=\"%1\"/></p>").arg(QString(128 * 1024, QLatin1Char('A')));
+}
+
+void TestHTMLFilter::fuzzWellFormed() {
+	for (int i = 0; i < 2000; ++i) {
+		const QString in = QLatin1String("<p>") + randomDocument(4) + QLatin1String("</p>");
+
+		QString out, ref;
+		QVERIFY(referenceFilter(in, ref));
+		QVERIFY(HTMLFilter::filter(in, out));
+		QCOMPARE(out, ref);
+		QVERIFY(HTMLFilter::textLength(in) >= 0);
+	}
+}
+
+void TestHTMLFilter::fuzzMutated() {
+	static const char alphabet[] = "<>/!?-[]&#;=\"' \nabpimgsrcx0A";
+
+	for (int i = 0; i < 5000; ++i) {
+		QString in = QLatin1String("<p>") + randomDocument(3) + QLatin1String("</p>");
+		const int mutations = 1 + qrand() % 4;
+		for (int j = 0; j < mutations; ++j) {
+			const int pos = qrand() % in.size();
+			const QChar c = QLatin1Char(alphabet[qrand() % (sizeof(alphabet) - 1)]);
+			switch (qrand() % 3) {
+				case 0:
+					in[pos] = c;
+					break;
+				case 1:
+					in.insert(pos, c);
+					break;
+				default:
+					in.remove(pos, 1);
+					break;
+			}
+			if (in.isEmpty())
+				in = c;
+		}
+
+		QString out, ref;
+		const bool ok = HTMLFilter::filter(in, out);
+		const bool refOk = referenceFilter(in, ref);
+
+		if (ok && in.contains(QLatin1Char('<'))) {
+			QVERIFY(! out.contains(QLatin1Char('<')));
+			QVERIFY(! out.contains(QLatin1Char('>')));
+			QVERIFY(HTMLFilter::textLength(in) >= 0);
+		}
+		if (ok && refOk)
+			QCOMPARE(out, ref);
+	}
+}
+
+void TestHTMLFilter::benchmarkFilter() {
+	const QString in = imageMessage();
+	QString out;
+	QBENCHMARK {
+		HTMLFilter::filter(in, out);
+	}
+}
+
+void TestHTMLFilter::benchmarkTextLength() {
+	const QString in = imageMessage();
+	QBENCHMARK {
+		HTMLFilter::textLength(in);
+	}
+}
+
+void TestHTMLFilter::benchmarkReference() {
+	const QString in = imageMessage();
+	QString out;
+	QBENCHMARK {
+		referenceFilter(in, out);
+	}
+}
+
+QTEST_MAIN(TestHTMLFilter)
+#include "TestHTMLFilter.moc"
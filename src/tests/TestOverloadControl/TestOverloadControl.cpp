@@ -0,0 +1,109 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "OverloadControl.h"
+
+class TestOverloadControl : public QObject {
+		Q_OBJECT
+	protected:
+		/// Runs one window with the given busy share in percent.
+		static bool window(OverloadControl &oc, quint64 &now, int load);
+	private slots:
+		void disabled();
+		void escalate();
+		void recover();
+		void drops();
+};
+
+bool TestOverloadControl::window(OverloadControl &oc, quint64 &now, int load) {
+	now += OverloadControl::Window;
+	return oc.update(OverloadControl::Window * load / 100, now);
+}
+
+void TestOverloadControl::disabled() {
+	OverloadControl oc;
+	quint64 now = 0;
+
+	QVERIFY(! window(oc, now, 100));
+	QCOMPARE(oc.level(), OverloadControl::Normal);
+}
+
+void TestOverloadControl::escalate() {
+	OverloadControl oc;
+	oc.setEnabled(true);
+	quint64 now = 0;
+
+	// Work within a window doesn't change anything until it ends.
+	QVERIFY(! oc.update(OverloadControl::Window, now + 10));
+	QCOMPARE(oc.level(), OverloadControl::Normal);
+
+	now += OverloadControl::Window;
+	QVERIFY(oc.update(0, now));
+	QCOMPARE(oc.level(), OverloadControl::ShedPositional);
+
+	QVERIFY(window(oc, now, 90));
+	QCOMPARE(oc.level(), OverloadControl::ShedWhisper);
+	QVERIFY(window(oc, now, 90));
+	QCOMPARE(oc.level(), OverloadControl::ShedSpeech);
+
+	// There's nothing left to shed.
+	QVERIFY(! window(oc, now, 90));
+	QCOMPARE(oc.level(), OverloadControl::ShedSpeech);
+}
+
+void TestOverloadControl::recover() {
+	OverloadControl oc;
+	oc.setEnabled(true);
+	quint64 now = 0;
+
+	window(oc, now, 90);
+	window(oc, now, 90);
+	QCOMPARE(oc.level(), OverloadControl::ShedWhisper);
+
+	// A load between the thresholds keeps the level.
+	for (int i = 0; i < 2 * OverloadControl::CalmWindows; ++i)
+		QVERIFY(! window(oc, now, 60));
+	QCOMPARE(oc.level(), OverloadControl::ShedWhisper);
+
+	// Calm windows lower it one step at a time.
+	for (int i = 0; i < OverloadControl::CalmWindows - 1; ++i)
+		window(oc, now, 10);
+	QCOMPARE(oc.level(), OverloadControl::ShedWhisper);
+	window(oc, now, 10);
+	QCOMPARE(oc.level(), OverloadControl::ShedPositional);
+
+	// An overloaded window in between starts over.
+	for (int i = 0; i < OverloadControl::CalmWindows - 1; ++i)
+		window(oc, now, 10);
+	window(oc, now, 90);
+	QCOMPARE(oc.level(), OverloadControl::ShedWhisper);
+}
+
+void TestOverloadControl::drops() {
+	OverloadControl oc;
+	oc.setEnabled(true);
+	quint64 now = 0;
+
+	// The first report of each socket is only the baseline.
+	QCOMPARE(oc.addDrops(3, 5), 0U);
+	QCOMPARE(oc.addDrops(3, 5), 0U);
+	QCOMPARE(oc.addDrops(4, 2), 0U);
+	QCOMPARE(oc.addDrops(4, 4), 2U);
+	QCOMPARE(oc.addDrops(3, 7), 2U);
+
+	// Drops overload a window regardless of the load.
+	QVERIFY(window(oc, now, 0));
+	QCOMPARE(oc.level(), OverloadControl::ShedPositional);
+
+	// The counter wraps around.
+	QCOMPARE(oc.addDrops(5, 0xfffffffeU), 0U);
+	QCOMPARE(oc.addDrops(5, 1), 3U);
+}
+
+QTEST_MAIN(TestOverloadControl)
+#include "TestOverloadControl.moc"
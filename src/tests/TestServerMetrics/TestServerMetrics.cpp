@@ -0,0 +1,119 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "ServerMetrics.h"
+
+class TestServerMetrics : public QObject {
+		Q_OBJECT
+	private slots:
+		void counter();
+		void histogramBuckets();
+		void histogramMerge();
+		void shards();
+		void writer();
+};
+
+void TestServerMetrics::counter() {
+	MetricCounter c;
+	QCOMPARE(c.value(), Q_UINT64_C(0));
+	c.add();
+	c.add(41);
+	QCOMPARE(c.value(), Q_UINT64_C(42));
+}
+
+void TestServerMetrics::histogramBuckets() {
+	MetricHistogram h;
+
+	// Bucket i counts values in (2^(i-1), 2^i].
+	h.add(0);
+	h.add(1);
+	h.add(2);
+	h.add(3);
+	h.add(4);
+	h.add(5);
+	h.add(MetricHistogram::bound(MetricHistogram::Buckets - 1));
+	h.add(MetricHistogram::bound(MetricHistogram::Buckets - 1) + 1);
+
+	QCOMPARE(h.bucket(0), Q_UINT64_C(2));
+	QCOMPARE(h.bucket(1), Q_UINT64_C(1));
+	QCOMPARE(h.bucket(2), Q_UINT64_C(2));
+	QCOMPARE(h.bucket(3), Q_UINT64_C(1));
+	QCOMPARE(h.bucket(MetricHistogram::Buckets - 1), Q_UINT64_C(1));
+	QCOMPARE(h.bucket(MetricHistogram::Buckets), Q_UINT64_C(1));
+	QCOMPARE(h.count(), Q_UINT64_C(8));
+	QCOMPARE(h.sum(), Q_UINT64_C(15) + 2 * MetricHistogram::bound(MetricHistogram::Buckets - 1) + 1);
+}
+
+void TestServerMetrics::histogramMerge() {
+	MetricHistogram a, b, out;
+	a.add(1);
+	a.add(100);
+	b.add(100);
+
+	out.merge(a);
+	out.merge(b);
+
+	QCOMPARE(out.count(), Q_UINT64_C(3));
+	QCOMPARE(out.sum(), Q_UINT64_C(201));
+	QCOMPARE(out.bucket(0), Q_UINT64_C(1));
+	QCOMPARE(out.bucket(7), Q_UINT64_C(2));
+}
+
+void TestServerMetrics::shards() {
+	ServerMetrics sm;
+	sm.msVoice.cVoicePackets.add(3);
+	sm.msControl.cVoicePackets.add(2);
+	sm.msVoice.hVoiceFanout.add(4);
+	sm.msControl.hVoiceFanout.add(8);
+
+	QCOMPARE(sm.counter(&ServerMetricsShard::cVoicePackets), Q_UINT64_C(5));
+	QCOMPARE(sm.counter(&ServerMetricsShard::cPings), Q_UINT64_C(0));
+
+	MetricHistogram h;
+	sm.histogram(&ServerMetricsShard::hVoiceFanout, h);
+	QCOMPARE(h.count(), Q_UINT64_C(2));
+	QCOMPARE(h.sum(), Q_UINT64_C(12));
+}
+
+void TestServerMetrics::writer() {
+	MetricsWriter mw;
+
+	mw.family("test_total", "counter", "A counter.");
+	mw.sample("test_total", "server=\"1\"", 7);
+	mw.sample("test_total", QByteArray(), 8);
+
+	MetricHistogram h;
+	h.add(1);
+	h.add(3);
+	mw.family("test_seconds", "histogram", "A histogram.");
+	mw.histogram("test_seconds", "server=\"1\"", h, 0.5);
+
+	const QList<QByteArray> lines = mw.data().split('\n');
+
+	QCOMPARE(lines.at(0), QByteArray("# HELP test_total A counter."));
+	QCOMPARE(lines.at(1), QByteArray("# TYPE test_total counter"));
+	QCOMPARE(lines.at(2), QByteArray("test_total{server=\"1\"} 7"));
+	QCOMPARE(lines.at(3), QByteArray("test_total 8"));
+	QCOMPARE(lines.at(4), QByteArray("# HELP test_seconds A histogram."));
+	QCOMPARE(lines.at(5), QByteArray("# TYPE test_seconds histogram"));
+
+	// Buckets are cumulative and scaled.
+	QCOMPARE(lines.at(6), QByteArray("test_seconds_bucket{server=\"1\",le=\"0.5\"} 1"));
+	QCOMPARE(lines.at(7), QByteArray("test_seconds_bucket{server=\"1\",le=\"1\"} 1"));
+	QCOMPARE(lines.at(8), QByteArray("test_seconds_bucket{server=\"1\",le=\"2\"} 2"));
+
+	const int inf = 6 + MetricHistogram::Buckets;
+	QCOMPARE(lines.at(inf), QByteArray("test_seconds_bucket{server=\"1\",le=\"+Inf\"} 2"));
+	QCOMPARE(lines.at(inf + 1), QByteArray("test_seconds_sum{server=\"1\"} 2"));
+	QCOMPARE(lines.at(inf + 2), QByteArray("test_seconds_count{server=\"1\"} 2"));
+	QCOMPARE(lines.at(inf + 3), QByteArray());
+	QCOMPARE(lines.count(), inf + 4);
+}
+
+QTEST_MAIN(TestServerMetrics)
+#include "TestServerMetrics.moc"
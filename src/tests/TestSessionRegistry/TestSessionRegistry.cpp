@@ -0,0 +1,157 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "SessionRegistry.h"
+
+class TestSessionRegistry : public QObject {
+		Q_OBJECT
+	private slots:
+		void find();
+		void reindex();
+		void duplicates();
+		void census();
+		void benchmarkLogin_data();
+		void benchmarkLogin();
+};
+
+void TestSessionRegistry::find() {
+	SessionRegistry sr;
+	unsigned int session = 0;
+
+	sr.insert(1, QLatin1String("Alice"), -1);
+	sr.insert(2, QLatin1String("bob"), 7);
+	QCOMPARE(sr.count(), 2);
+
+	QVERIFY(sr.find(QLatin1String("ALICE"), -1, 0, session));
+	QCOMPARE(session, 1U);
+
+	// The user id matches regardless of the name.
+	QVERIFY(sr.find(QLatin1String("robert"), 7, 0, session));
+	QCOMPARE(session, 2U);
+
+	QVERIFY(! sr.find(QLatin1String("Alice"), -1, 1, session));
+	QVERIFY(! sr.find(QLatin1String("carol"), 8, 0, session));
+}
+
+void TestSessionRegistry::reindex() {
+	SessionRegistry sr;
+	unsigned int session = 0;
+
+	sr.insert(1, QLatin1String("alice"), -1);
+	sr.insert(1, QLatin1String("Alicia"), 3);
+	QCOMPARE(sr.count(), 1);
+
+	QVERIFY(! sr.find(QLatin1String("alice"), -1, 0, session));
+	QVERIFY(sr.find(QLatin1String("alicia"), -1, 0, session));
+	QVERIFY(sr.find(QString(), 3, 0, session));
+
+	sr.insert(1, QLatin1String("Alicia"), -1);
+	QVERIFY(! sr.find(QString(), 3, 0, session));
+
+	sr.remove(1);
+	QVERIFY(! sr.contains(1));
+	QVERIFY(! sr.find(QLatin1String("alicia"), -1, 0, session));
+	QCOMPARE(sr.count(), 0);
+}
+
+void TestSessionRegistry::duplicates() {
+	SessionRegistry sr;
+	unsigned int session = 0;
+
+	// A ghost and the user replacing it share their name until the ghost
+	// is gone.
+	sr.insert(1, QLatin1String("alice"), 5);
+	sr.insert(2, QLatin1String("Alice"), 5);
+
+	QVERIFY(sr.find(QLatin1String("alice"), 5, 2, session));
+	QCOMPARE(session, 1U);
+	QVERIFY(sr.find(QLatin1String("alice"), 5, 1, session));
+	QCOMPARE(session, 2U);
+
+	sr.remove(1);
+	QVERIFY(! sr.find(QLatin1String("alice"), 5, 2, session));
+	QVERIFY(sr.find(QLatin1String("alice"), -1, 0, session));
+	QCOMPARE(session, 2U);
+}
+
+void TestSessionRegistry::census() {
+	CodecCensus cc;
+	QCOMPARE(cc.preferred(), 0);
+
+	const int celt070 = static_cast<qint32>(0x8000000b);
+	const int celt011 = static_cast<qint32>(0x80000010);
+	const QList<int> old = QList<int>() << celt070;
+	const QList<int> both = QList<int>() << celt070 << celt011;
+
+	cc.add(QList<int>(), false);
+	QCOMPARE(cc.users(), 0);
+
+	cc.add(old, false);
+	cc.add(both, true);
+	cc.add(both, true);
+	QCOMPARE(cc.users(), 3);
+	QCOMPARE(cc.opus(), 2);
+	QCOMPARE(cc.preferred(), celt070);
+
+	cc.remove(old, false);
+	// On a tie, the highest version wins.
+	QCOMPARE(cc.preferred(), celt011);
+
+	cc.remove(both, true);
+	cc.remove(both, true);
+	QCOMPARE(cc.users(), 0);
+	QCOMPARE(cc.opus(), 0);
+	QCOMPARE(cc.preferred(), 0);
+}
+
+void TestSessionRegistry::benchmarkLogin_data() {
+	QTest::addColumn<int>("users");
+
+	QTest::newRow("100") << 100;
+	QTest::newRow("2000") << 2000;
+	QTest::newRow("20000") << 20000;
+}
+
+/// One user leaving and logging in again, at a constant population. The
+/// cost should not depend on the number of users.
+void TestSessionRegistry::benchmarkLogin() {
+	QFETCH(int, users);
+
+	SessionRegistry sr;
+	CodecCensus cc;
+	const QList<int> codecs = QList<int>() << static_cast<qint32>(0x8000000b) << static_cast<qint32>(0x80000010);
+
+	QStringList names;
+	for (int i = 0; i < users; ++i) {
+		names << QString::fromLatin1("User %1").arg(i);
+		sr.insert(static_cast<unsigned int>(i + 1), names.at(i), (i % 2) ? i : -1);
+		cc.add(codecs, true);
+	}
+
+	int i = 0;
+	QBENCHMARK {
+		const unsigned int session = static_cast<unsigned int>(i + 1);
+		const int id = (i % 2) ? i : -1;
+		unsigned int ghost;
+
+		sr.remove(session);
+		cc.remove(codecs, true);
+
+		sr.find(names.at(i), id, session, ghost);
+		cc.add(codecs, true);
+		cc.preferred();
+		sr.insert(session, names.at(i), id);
+
+		i = (i + 1) % users;
+	}
+	QCOMPARE(sr.count(), users);
+	QCOMPARE(cc.users(), users);
+}
+
+QTEST_MAIN(TestSessionRegistry)
+#include "TestSessionRegistry.moc"
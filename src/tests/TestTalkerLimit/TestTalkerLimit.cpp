@@ -0,0 +1,112 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "TalkerLimit.h"
+
+class TestTalkerLimit : public QObject {
+		Q_OBJECT
+	private slots:
+		void limit();
+		void terminator();
+		void timeout();
+		void priority();
+		void channels();
+		void benchmarkAdmit_data();
+		void benchmarkAdmit();
+};
+
+void TestTalkerLimit::limit() {
+	TalkerLimit tl;
+
+	QVERIFY(tl.admit(1, 10, false, false, 2, 0));
+	QVERIFY(tl.admit(1, 11, false, false, 2, 0));
+	QVERIFY(! tl.admit(1, 12, false, false, 2, 0));
+	QCOMPARE(tl.count(1), 2);
+
+	// Admitted talkers keep their slot, the others stay out.
+	QVERIFY(tl.admit(1, 10, false, false, 2, 20000));
+	QVERIFY(tl.admit(1, 11, false, false, 2, 20000));
+	QVERIFY(! tl.admit(1, 12, false, false, 2, 20000));
+}
+
+void TestTalkerLimit::terminator() {
+	TalkerLimit tl;
+
+	QVERIFY(tl.admit(1, 10, false, false, 1, 0));
+	QVERIFY(! tl.admit(1, 11, false, false, 1, 0));
+
+	// The terminator is forwarded, and frees the slot.
+	QVERIFY(tl.admit(1, 10, false, true, 1, 20000));
+	QCOMPARE(tl.count(1), 0);
+	QVERIFY(tl.admit(1, 11, false, false, 1, 40000));
+	QVERIFY(! tl.admit(1, 10, false, false, 1, 60000));
+
+	// A lone terminator doesn't take a slot.
+	QVERIFY(tl.admit(2, 12, false, true, 1, 0));
+	QCOMPARE(tl.count(2), 0);
+}
+
+void TestTalkerLimit::timeout() {
+	TalkerLimit tl;
+
+	QVERIFY(tl.admit(1, 10, false, false, 1, 0));
+	QVERIFY(! tl.admit(1, 11, false, false, 1, TalkerLimit::Timeout));
+
+	// Without packets, the spurt ends after the timeout.
+	QVERIFY(tl.admit(1, 11, false, false, 1, TalkerLimit::Timeout + 1));
+	QVERIFY(! tl.admit(1, 10, false, false, 1, TalkerLimit::Timeout + 2));
+}
+
+void TestTalkerLimit::priority() {
+	TalkerLimit tl;
+
+	QVERIFY(tl.admit(1, 10, false, false, 1, 0));
+	QVERIFY(tl.admit(1, 11, true, false, 1, 0));
+	QCOMPARE(tl.count(1), 1);
+	QVERIFY(! tl.admit(1, 12, false, false, 1, 0));
+}
+
+void TestTalkerLimit::channels() {
+	TalkerLimit tl;
+
+	QVERIFY(tl.admit(1, 10, false, false, 1, 0));
+	QVERIFY(tl.admit(2, 11, false, false, 1, 0));
+	QVERIFY(! tl.admit(1, 11, false, false, 1, 0));
+	QVERIFY(! tl.admit(2, 10, false, false, 1, 0));
+
+	tl.clear();
+	QCOMPARE(tl.count(1), 0);
+	QVERIFY(tl.admit(1, 11, false, false, 1, 0));
+}
+
+void TestTalkerLimit::benchmarkAdmit_data() {
+	QTest::addColumn<int>("talkers");
+	QTest::addColumn<int>("limit");
+
+	QTest::newRow("10 talkers, limit 3") << 10 << 3;
+	QTest::newRow("50 talkers, limit 3") << 50 << 3;
+	QTest::newRow("50 talkers, limit 10") << 50 << 10;
+}
+
+/// Cost of one 20ms frame of every talker in one channel.
+void TestTalkerLimit::benchmarkAdmit() {
+	QFETCH(int, talkers);
+	QFETCH(int, limit);
+
+	TalkerLimit tl;
+	quint64 now = 0;
+
+	QBENCHMARK {
+		for (int i = 0; i < talkers; ++i)
+			tl.admit(1, static_cast<unsigned int>(i), false, false, limit, now);
+		now += 20000;
+	}
+}
+
+QTEST_MAIN(TestTalkerLimit)
+#include "TestTalkerLimit.moc"
@@ -0,0 +1,140 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include "TimerWheel.h"
+
+class TestTimerWheel : public QObject {
+		Q_OBJECT
+	private slots:
+		void expire();
+		void reschedule();
+		void levels();
+		void overflow();
+		void random();
+};
+
+void TestTimerWheel::expire() {
+	TimerWheel tw;
+	QList<unsigned int> expired;
+
+	tw.schedule(1, 10);
+	tw.schedule(2, 10);
+	tw.schedule(3, 0);
+	QCOMPARE(tw.count(), 3);
+
+	// Deadlines that already passed expire right away.
+	tw.advance(0, expired);
+	QCOMPARE(expired, QList<unsigned int>() << 3);
+
+	expired.clear();
+	tw.advance(9, expired);
+	QVERIFY(expired.isEmpty());
+
+	tw.advance(10, expired);
+	qSort(expired);
+	QCOMPARE(expired, QList<unsigned int>() << 1 << 2);
+	QCOMPARE(tw.count(), 0);
+	QCOMPARE(tw.current(), Q_UINT64_C(10));
+}
+
+void TestTimerWheel::reschedule() {
+	TimerWheel tw;
+	QList<unsigned int> expired;
+
+	tw.schedule(1, 5);
+	tw.schedule(2, 5);
+	tw.schedule(1, 500);
+	tw.remove(2);
+	QVERIFY(! tw.contains(2));
+
+	tw.advance(499, expired);
+	QVERIFY(expired.isEmpty());
+	tw.advance(1000, expired);
+	QCOMPARE(expired, QList<unsigned int>() << 1);
+}
+
+void TestTimerWheel::levels() {
+	TimerWheel tw;
+	QList<unsigned int> expired;
+
+	// One deadline per level, each just past a slot boundary.
+	const quint64 deadlines[] = { 63, 64, 4097, 262145, 16777215 };
+	for (unsigned int i = 0; i < 5; ++i)
+		tw.schedule(i, deadlines[i]);
+
+	for (unsigned int i = 0; i < 5; ++i) {
+		tw.advance(deadlines[i] - 1, expired);
+		QVERIFY(expired.isEmpty());
+		tw.advance(deadlines[i], expired);
+		QCOMPARE(expired, QList<unsigned int>() << i);
+		expired.clear();
+	}
+}
+
+void TestTimerWheel::overflow() {
+	TimerWheel tw;
+	QList<unsigned int> expired;
+
+	const quint64 far = (Q_UINT64_C(1) << 30) + 12345;
+	tw.schedule(1, far);
+	tw.advance(1, expired);
+
+	tw.advance(far - 1, expired);
+	QVERIFY(expired.isEmpty());
+	tw.advance(far, expired);
+	QCOMPARE(expired, QList<unsigned int>() << 1);
+}
+
+void TestTimerWheel::random() {
+	TimerWheel tw;
+	QHash<unsigned int, quint64> model;
+	quint64 now = 0;
+
+	qsrand(1);
+	for (int round = 0; round < 20000; ++round) {
+		const unsigned int key = static_cast<unsigned int>(qrand() % 500);
+		switch (qrand() % 4) {
+			case 0:
+				tw.remove(key);
+				model.remove(key);
+				break;
+			default: {
+					const quint64 delta = (qrand() % 8 == 0) ? static_cast<quint64>(qrand()) * 97 : static_cast<quint64>(qrand() % 5000);
+					tw.schedule(key, now + delta);
+					model.insert(key, now + delta);
+				}
+				break;
+		}
+
+		if (qrand() % 10 == 0) {
+			now += static_cast<quint64>(qrand() % 3000);
+
+			QList<unsigned int> expired;
+			tw.advance(now, expired);
+			qSort(expired);
+
+			QList<unsigned int> expected;
+			QHash<unsigned int, quint64>::iterator i = model.begin();
+			while (i != model.end()) {
+				if (i.value() <= now) {
+					expected << i.key();
+					i = model.erase(i);
+				} else {
+					++i;
+				}
+			}
+			qSort(expected);
+
+			QCOMPARE(expired, expected);
+			QCOMPARE(tw.count(), model.count());
+		}
+	}
+}
+
+QTEST_MAIN(TestTimerWheel)
+#include "TestTimerWheel.moc"
@@ -0,0 +1,195 @@
+// Copyright 2005-2017 The Mumble Developers. All rights reserved.
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file at the root of the
+// Mumble source tree or at <https://www.mumble.info/LICENSE>.
+
+#include <QtCore>
+#include <QtTest>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "UdpBatch.h"
+
+class TestUdpBatch : public QObject {
+		Q_OBJECT
+	protected:
+		int iSender;
+		int iReceiver;
+		struct sockaddr_in siReceiver;
+
+		void prepare(struct msghdr &msg, struct iovec &iov, char *data, size_t len);
+		int receive(QList<QByteArray> &datagrams);
+	private slots:
+		void initTestCase();
+		void cleanupTestCase();
+		void send();
+		void sockets();
+		void disabled();
+		void benchmarkSend_data();
+		void benchmarkSend();
+};
+
+void TestUdpBatch::initTestCase() {
+	iSender = socket(AF_INET, SOCK_DGRAM, 0);
+	iReceiver = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	QVERIFY(iSender >= 0);
+	QVERIFY(iReceiver >= 0);
+
+	memset(&siReceiver, 0, sizeof(siReceiver));
+	siReceiver.sin_family = AF_INET;
+	siReceiver.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	QCOMPARE(bind(iReceiver, reinterpret_cast<struct sockaddr *>(&siReceiver), sizeof(siReceiver)), 0);
+
+	socklen_t len = sizeof(siReceiver);
+	QCOMPARE(getsockname(iReceiver, reinterpret_cast<struct sockaddr *>(&siReceiver), &len), 0);
+}
+
+void TestUdpBatch::cleanupTestCase() {
+	close(iSender);
+	close(iReceiver);
+}
+
+void TestUdpBatch::prepare(struct msghdr &msg, struct iovec &iov, char *data, size_t len) {
+	iov.iov_base = data;
+	iov.iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &siReceiver;
+	msg.msg_namelen = sizeof(siReceiver);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+}
+
+int TestUdpBatch::receive(QList<QByteArray> &datagrams) {
+	char buffer[UdpBatch::MaxDatagram];
+	ssize_t len;
+	while ((len = recv(iReceiver, buffer, sizeof(buffer), 0)) >= 0)
+		datagrams << QByteArray(buffer, static_cast<int>(len));
+	return datagrams.count();
+}
+
+void TestUdpBatch::send() {
+	UdpBatch ub;
+	ub.setEnabled(true);
+
+	struct msghdr msg;
+	struct iovec iov;
+	char data[64];
+
+	for (int i = 0; i < 3; ++i) {
+		memset(data, 'a' + i, sizeof(data));
+		prepare(msg, iov, data, 10 + i);
+		QVERIFY(ub.add(iSender, &msg));
+	}
+	QCOMPARE(ub.count(), 3);
+
+	// Nothing is sent before the batch is flushed.
+	QList<QByteArray> datagrams;
+	QCOMPARE(receive(datagrams), 0);
+
+	ub.flush();
+	QCOMPARE(ub.count(), 0);
+	QCOMPARE(ub.takeCalls(), 1U);
+
+	QCOMPARE(receive(datagrams), 3);
+	for (int i = 0; i < 3; ++i)
+		QCOMPARE(datagrams.at(i), QByteArray(10 + i, static_cast<char>('a' + i)));
+}
+
+void TestUdpBatch::sockets() {
+	UdpBatch ub;
+	ub.setEnabled(true);
+
+	int other = socket(AF_INET, SOCK_DGRAM, 0);
+	QVERIFY(other >= 0);
+
+	struct msghdr msg;
+	struct iovec iov;
+	char data[16] = { 0 };
+	prepare(msg, iov, data, sizeof(data));
+
+	// A datagram for another socket sends the ones queued before.
+	QVERIFY(ub.add(iSender, &msg));
+	QVERIFY(ub.add(iSender, &msg));
+	QVERIFY(ub.add(other, &msg));
+	QCOMPARE(ub.count(), 1);
+	ub.flush();
+	QCOMPARE(ub.takeCalls(), 2U);
+
+	// So does a full queue.
+	for (int i = 0; i < UdpBatch::Capacity + 1; ++i)
+		QVERIFY(ub.add(iSender, &msg));
+	QCOMPARE(ub.count(), 1);
+	ub.flush();
+	QCOMPARE(ub.takeCalls(), 2U);
+
+	QList<QByteArray> datagrams;
+	QCOMPARE(receive(datagrams), UdpBatch::Capacity + 4);
+
+	close(other);
+}
+
+void TestUdpBatch::disabled() {
+	UdpBatch ub;
+
+	struct msghdr msg;
+	struct iovec iov;
+	char data[UdpBatch::MaxDatagram + 1];
+	prepare(msg, iov, data, 16);
+
+	QVERIFY(! ub.add(iSender, &msg));
+
+	ub.setEnabled(true);
+	iov.iov_len = sizeof(data);
+	QVERIFY(! ub.add(iSender, &msg));
+	QCOMPARE(ub.count(), 0);
+}
+
+void TestUdpBatch::benchmarkSend_data() {
+	QTest::addColumn<int>("packets");
+	QTest::addColumn<bool>("batched");
+
+	QTest::newRow("10k sendmsg") << 10000 << false;
+	QTest::newRow("10k sendmmsg") << 10000 << true;
+	QTest::newRow("50k sendmsg") << 50000 << false;
+	QTest::newRow("50k sendmmsg") << 50000 << true;
+	QTest::newRow("100k sendmsg") << 100000 << false;
+	QTest::newRow("100k sendmmsg") << 100000 << true;
+}
+
+/// CPU time needed for one second of forwarded voice at the given packet
+/// rate, in fanouts of 20 recipients per received packet.
+void TestUdpBatch::benchmarkSend() {
+	QFETCH(int, packets);
+	QFETCH(bool, batched);
+
+	UdpBatch ub;
+	ub.setEnabled(batched);
+
+	struct msghdr msg;
+	struct iovec iov;
+	char data[80];
+	memset(data, 0, sizeof(data));
+	prepare(msg, iov, data, sizeof(data));
+
+	QList<QByteArray> datagrams;
+
+	QBENCHMARK {
+		for (int i = 0; i < packets; ++i) {
+			if (! ub.add(iSender, &msg))
+				sendmsg(iSender, &msg, 0);
+			if ((i % 20) == 19)
+				ub.flush();
+		}
+		ub.flush();
+
+		// Keep the receive buffer from filling up.
+		receive(datagrams);
+		datagrams.clear();
+	}
+}
+
+QTEST_MAIN(TestUdpBatch)
+#include "TestUdpBatch.moc"
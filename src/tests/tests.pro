@@ -13,9 +13,22 @@ SUBDIRS += \
   TestPasswordGenerator \
   TestTimer \
   TestXMLTools \
+  TestHTMLFilter \
   TestUnresolvedServerAddress \
   TestServerAddress \
   TestServerResolver \
   TestSelfSignedCertificate \
   TestSSLLocks \
+  TestServerMetrics \
+  TestBlobStore \
+  TestTimerWheel \
+  TestSessionRegistry \
+  TestOverloadControl \
+  TestTalkerLimit \
+  TestChannelLinks \
   TestFFDHE
+
+# UdpBatch is built on sendmmsg(), which only exists on Linux.
+linux {
+  SUBDIRS += TestUdpBatch
+}